@@ -0,0 +1,215 @@
+#include "addrbook.h"
+
+// Address book of this node
+AddressBook node_book;
+
+// Order entries best first for qsort
+static int compare_entries(const void* a, const void* b) {
+    const BookEntry* x = (const BookEntry*)a;
+    const BookEntry* y = (const BookEntry*)b;
+    if (x->failures != y->failures) {
+        return x->failures < y->failures ? -1 : 1;
+    }
+    if (x->last_seen != y->last_seen) {
+        return x->last_seen > y->last_seen ? -1 : 1;
+    }
+    
+    // Never dialed sorts after any measured time
+    unsigned int x_ms = (unsigned int)x->connect_ms;
+    unsigned int y_ms = (unsigned int)y->connect_ms;
+    return (x_ms > y_ms) - (x_ms < y_ms);
+}
+
+// Entry for ip:port (caller holds book mutex)
+static BookEntry* find_entry(AddressBook* book, const char* ip, int port) {
+    for (int i = 0; i < book->count; i++) {
+        if (book->entries[i].port == port && strcmp(book->entries[i].ip, ip) == 0) {
+            return &book->entries[i];
+        }
+    }
+    return NULL;
+}
+
+// New entry for ip:port, replacing the worst one when full (caller holds book mutex)
+static BookEntry* add_entry(AddressBook* book, const char* ip, int port) {
+    BookEntry* entry;
+    if (book->count == BOOK_MAX_ENTRIES) {
+        entry = &book->entries[0];
+        for (int i = 1; i < book->count; i++) {
+            if (compare_entries(&book->entries[i], entry) > 0) {
+                entry = &book->entries[i];
+            }
+        }
+    } else {
+        if (book->count == book->capacity) {
+            int capacity = book->capacity > 0 ? book->capacity * 2 : 16;
+            BookEntry* entries = realloc(book->entries, capacity * sizeof(BookEntry));
+            if (entries == NULL) {
+                return NULL;
+            }
+            book->entries = entries;
+            book->capacity = capacity;
+        }
+        entry = &book->entries[book->count++];
+    }
+    
+    memset(entry, 0, sizeof(*entry));
+    strcpy(entry->ip, ip);
+    entry->port = port;
+    entry->connect_ms = -1;
+    return entry;
+}
+
+// Read "ip port node_id last_seen connect_ms successes failures" lines
+static void load_book(AddressBook* book) {
+    FILE* file = fopen(book->path, "r");
+    if (file == NULL) {
+        return;
+    }
+    
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char ip[INET_ADDRSTRLEN];
+        unsigned long long node_id;
+        struct in_addr address;
+        BookEntry loaded;
+        if (line[0] == '#' ||
+            sscanf(line, "%15s %d %llu %lld %d %d %d", ip, &loaded.port, &node_id,
+                   &loaded.last_seen, &loaded.connect_ms, &loaded.successes,
+                   &loaded.failures) != 7 ||
+            inet_pton(AF_INET, ip, &address) != 1 || loaded.port <= 0 || loaded.port > 65535 ||
+            find_entry(book, ip, loaded.port) != NULL) {
+            continue;
+        }
+        
+        BookEntry* entry = add_entry(book, ip, loaded.port);
+        if (entry != NULL) {
+            strcpy(loaded.ip, entry->ip);
+            loaded.node_id = node_id;
+            *entry = loaded;
+        }
+    }
+    fclose(file);
+}
+
+// Start empty, then read path if it exists
+void init_book(AddressBook* book, const char* path) {
+    pthread_mutex_init(&book->mutex, NULL);
+    book->entries = NULL;
+    book->count = 0;
+    book->capacity = 0;
+    book->dirty = 0;
+    snprintf(book->path, sizeof(book->path), "%s", path);
+    if (book->path[0] != '\0') {
+        load_book(book);
+    }
+}
+
+// Free entries
+void free_book(AddressBook* book) {
+    pthread_mutex_lock(&book->mutex);
+    free(book->entries);
+    book->entries = NULL;
+    book->count = 0;
+    book->capacity = 0;
+    pthread_mutex_unlock(&book->mutex);
+}
+
+// Write the book out if it changed, through a temporary file so a crash
+// leaves the previous version. Returns 0 on success.
+int book_save(AddressBook* book) {
+    pthread_mutex_lock(&book->mutex);
+    if (!book->dirty || book->path[0] == '\0') {
+        pthread_mutex_unlock(&book->mutex);
+        return 0;
+    }
+    
+    char temp[BOOK_PATH_LENGTH + 8];
+    snprintf(temp, sizeof(temp), "%s.tmp", book->path);
+    FILE* file = fopen(temp, "w");
+    int result = file != NULL ? 0 : -1;
+    if (file != NULL) {
+        fprintf(file, "# ip port node_id last_seen connect_ms successes failures\n");
+        for (int i = 0; i < book->count; i++) {
+            const BookEntry* entry = &book->entries[i];
+            fprintf(file, "%s %d %llu %lld %d %d %d\n", entry->ip, entry->port,
+                    (unsigned long long)entry->node_id, entry->last_seen,
+                    entry->connect_ms, entry->successes, entry->failures);
+        }
+        if (fclose(file) != 0) {
+            result = -1;
+        }
+        
+        #ifdef _WIN32
+        remove(book->path);
+        #endif
+        if (result == 0 && rename(temp, book->path) != 0) {
+            result = -1;
+        }
+        if (result < 0) {
+            remove(temp);
+        }
+    }
+    if (result == 0) {
+        book->dirty = 0;
+    }
+    
+    pthread_mutex_unlock(&book->mutex);
+    return result;
+}
+
+// Record a handshake with the peer listening on ip:port
+void book_seen(AddressBook* book, const char* ip, int port, uint64_t node_id,
+               long long now_ms) {
+    if (port <= 0) {
+        return;
+    }
+    
+    pthread_mutex_lock(&book->mutex);
+    BookEntry* entry = find_entry(book, ip, port);
+    if (entry == NULL) {
+        entry = add_entry(book, ip, port);
+    }
+    if (entry != NULL) {
+        entry->node_id = node_id;
+        entry->last_seen = now_ms;
+        book->dirty = 1;
+    }
+    pthread_mutex_unlock(&book->mutex);
+}
+
+// Record a dial of a known peer (connect_ms ignored when it failed)
+void book_dialed(AddressBook* book, const char* ip, int port, int connected,
+                 int connect_ms) {
+    pthread_mutex_lock(&book->mutex);
+    BookEntry* entry = find_entry(book, ip, port);
+    if (entry != NULL) {
+        if (connected) {
+            entry->connect_ms = entry->connect_ms < 0 ? connect_ms
+                                                      : (entry->connect_ms * 3 + connect_ms) / 4;
+            entry->successes++;
+            entry->failures = 0;
+        } else {
+            entry->failures++;
+        }
+        book->dirty = 1;
+    }
+    pthread_mutex_unlock(&book->mutex);
+}
+
+// Copy up to max entries best first
+int book_list(AddressBook* book, BookEntry* out, int max) {
+    pthread_mutex_lock(&book->mutex);
+    BookEntry* sorted = book->count > 0 ? malloc(book->count * sizeof(BookEntry)) : NULL;
+    int count = 0;
+    if (sorted != NULL) {
+        memcpy(sorted, book->entries, book->count * sizeof(BookEntry));
+        qsort(sorted, book->count, sizeof(BookEntry), compare_entries);
+        count = book->count < max ? book->count : max;
+        memcpy(out, sorted, count * sizeof(BookEntry));
+    }
+    pthread_mutex_unlock(&book->mutex);
+    
+    free(sorted);
+    return count;
+}
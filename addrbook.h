@@ -0,0 +1,61 @@
+#ifndef ADDRBOOK_H
+#define ADDRBOOK_H
+
+#include "common.h"
+#include <stdint.h>
+#include <pthread.h>
+
+// Address book: peers this node has completed a handshake with, kept in a
+// text file across restarts. At startup the best of them are dialed in
+// parallel, so the first message to a known peer finds a connection ready.
+
+#define BOOK_MAX_ENTRIES 1024        // The worst ranked entry makes room for a new one
+#define BOOK_MAX_FAILURES 8          // Failed dials in a row before a peer is no longer warmed
+#define BOOK_SAVE_MS 30000           // Changes are written out at least this often
+#define BOOK_PATH_LENGTH 256
+#define BOOK_FILE_FORMAT "%s/p2p_peers_%d.txt"  // Directory, listen port
+
+// Known peer, by address and listen port
+typedef struct {
+    char ip[INET_ADDRSTRLEN];
+    int port;
+    uint64_t node_id;                // Last node ID seen there, 0 = never reached
+    long long last_seen;             // Wall time of the last handshake, ms since the epoch
+    int connect_ms;                  // Smoothed dial time, -1 = never dialed
+    int successes;                   // Dials that connected
+    int failures;                    // Failed dials since the last one that connected
+} BookEntry;
+
+// Address book of a node
+typedef struct {
+    pthread_mutex_t mutex;
+    BookEntry* entries;
+    int count;
+    int capacity;
+    int dirty;                       // Changed since the last save
+    char path[BOOK_PATH_LENGTH];     // Empty = not saved
+} AddressBook;
+
+// Address book of this node
+extern AddressBook node_book;
+
+// Start empty, then read path if it exists
+void init_book(AddressBook* book, const char* path);
+void free_book(AddressBook* book);
+
+// Write the book out if it changed, 0 on success
+int book_save(AddressBook* book);
+
+// Record a handshake with the peer listening on ip:port
+void book_seen(AddressBook* book, const char* ip, int port, uint64_t node_id,
+               long long now_ms);
+
+// Record a dial of ip:port (connect_ms ignored when it failed)
+void book_dialed(AddressBook* book, const char* ip, int port, int connected,
+                 int connect_ms);
+
+// Copy up to max entries best first: fewest failures, most recently
+// seen, fastest to dial. Returns the number copied.
+int book_list(AddressBook* book, BookEntry* out, int max);
+
+#endif // ADDRBOOK_H
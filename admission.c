@@ -0,0 +1,91 @@
+#include "admission.h"
+#include "p2pchat.h"
+
+// Admission of this node
+Admission node_admission;
+
+// Set of address (multiplicative hash, addresses of a subnet spread out)
+static unsigned int address_set(uint32_t address) {
+    return (unsigned int)((address * 2654435761u) >> 24) % ADMISSION_SETS;
+}
+
+// Reset buckets and counters
+void init_admission(Admission* admission, int rate, int burst) {
+    memset(admission->buckets, 0, sizeof(admission->buckets));
+    pthread_mutex_init(&admission->mutex, NULL);
+    admission->rate = rate;
+    admission->burst = burst > 0 ? burst : 1;
+    admission->accepted = 0;
+    admission->shed_rate = 0;
+    admission->shed_full = 0;
+}
+
+// Take a token for a connection from address, 0 = shed it
+int admission_allow(Admission* admission, uint32_t address, long long now_ms) {
+    if (admission->rate <= 0) {
+        return 1;
+    }
+    
+    long long capacity = (long long)admission->burst * 1000;
+    AdmissionBucket* set = &admission->buckets[address_set(address) * ADMISSION_WAYS];
+    AdmissionBucket* bucket = NULL;
+    AdmissionBucket* oldest = &set[0];
+    
+    pthread_mutex_lock(&admission->mutex);
+    
+    for (int i = 0; i < ADMISSION_WAYS && bucket == NULL; i++) {
+        if (set[i].address == address) {
+            bucket = &set[i];
+        } else if (set[i].updated_ms < oldest->updated_ms) {
+            oldest = &set[i];
+        }
+    }
+    
+    // A new address starts with a full bucket
+    if (bucket == NULL) {
+        bucket = oldest;
+        bucket->address = address;
+        bucket->tokens = capacity;
+        bucket->updated_ms = now_ms;
+    }
+    
+    // rate connections per second = rate thousandths per millisecond
+    if (now_ms > bucket->updated_ms) {
+        bucket->tokens += (now_ms - bucket->updated_ms) * admission->rate;
+        if (bucket->tokens > capacity) {
+            bucket->tokens = capacity;
+        }
+        bucket->updated_ms = now_ms;
+    }
+    
+    int allowed = bucket->tokens >= 1000;
+    if (allowed) {
+        bucket->tokens -= 1000;
+    } else {
+        admission->shed_rate++;
+    }
+    
+    pthread_mutex_unlock(&admission->mutex);
+    return allowed;
+}
+
+// Count the outcome of add_connection for an admitted connection
+void admission_record(Admission* admission, int conn_id) {
+    pthread_mutex_lock(&admission->mutex);
+    if (conn_id >= 0) {
+        admission->accepted++;
+    } else if (conn_id == P2P_ERR_LIMIT) {
+        admission->shed_full++;
+    }
+    pthread_mutex_unlock(&admission->mutex);
+}
+
+// Connections accepted, shed over rate, shed with the table full
+void admission_stats(Admission* admission, long long* accepted,
+                     long long* shed_rate, long long* shed_full) {
+    pthread_mutex_lock(&admission->mutex);
+    *accepted = admission->accepted;
+    *shed_rate = admission->shed_rate;
+    *shed_full = admission->shed_full;
+    pthread_mutex_unlock(&admission->mutex);
+}
@@ -0,0 +1,51 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include "common.h"
+#include <stdint.h>
+#include <pthread.h>
+
+// Admission control for inbound connections. Each source address has a
+// token bucket refilled at accept_rate connections per second, holding up
+// to accept_burst. A connection finding the bucket empty is reset at once,
+// before it takes a slot or a receiver thread, so a reconnect storm from a
+// few addresses cannot crowd out everyone else.
+
+#define ADMISSION_SETS 256           // Address sets, hashed by address
+#define ADMISSION_WAYS 4             // Addresses per set, the least recently seen is replaced
+
+// Bucket of one source address
+typedef struct {
+    uint32_t address;                // IPv4 in network order, 0 = free
+    long long tokens;                // Thousandths of a connection
+    long long updated_ms;            // Last refill, also how recently it was seen
+} AdmissionBucket;
+
+// Admission state of the listener
+typedef struct {
+    pthread_mutex_t mutex;
+    AdmissionBucket buckets[ADMISSION_SETS * ADMISSION_WAYS];
+    int rate;                        // Connections per second per address, 0 = unlimited
+    int burst;                       // Connections an idle address may open at once
+    long long accepted;
+    long long shed_rate;             // Over their address's rate
+    long long shed_full;             // Connection table full
+} Admission;
+
+// Admission of this node
+extern Admission node_admission;
+
+// Reset buckets and counters
+void init_admission(Admission* admission, int rate, int burst);
+
+// Take a token for a connection from address, 0 = shed it
+int admission_allow(Admission* admission, uint32_t address, long long now_ms);
+
+// Count the outcome of add_connection for an admitted connection
+void admission_record(Admission* admission, int conn_id);
+
+// Connections accepted, shed over rate, shed with the table full
+void admission_stats(Admission* admission, long long* accepted,
+                     long long* shed_rate, long long* shed_full);
+
+#endif // ADMISSION_H
@@ -0,0 +1,219 @@
+#include "batch.h"
+#include "socket.h"
+#include "config.h"
+#include <time.h>
+
+#define BATCH_INITIAL_CAPACITY 1024
+
+// Grow pending buffer to hold length more bytes (caller holds mutex)
+static int reserve(SendBatch* batch, size_t length) {
+    if (batch->used + length <= batch->capacity) {
+        return 0;
+    }
+    
+    size_t capacity = batch->capacity ? batch->capacity : BATCH_INITIAL_CAPACITY;
+    while (capacity < batch->used + length) {
+        capacity *= 2;
+    }
+    
+    unsigned char* data = realloc(batch->data, capacity);
+    if (data == NULL) {
+        return -1;
+    }
+    batch->data = data;
+    batch->capacity = capacity;
+    return 0;
+}
+
+// Give other writers up to coalesce_delay to fill the window (caller holds mutex)
+static void wait_for_window(SendBatch* batch) {
+    long delay_us = node_config.coalesce_delay;
+    size_t window = (size_t)node_config.coalesce_bytes;
+    if (delay_us <= 0 || batch->used >= window) {
+        return;
+    }
+    
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += delay_us * 1000;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000;
+    deadline.tv_nsec %= 1000000000;
+    
+    while (batch->used < window && !batch->corked) {
+        if (pthread_cond_timedwait(&batch->more, &batch->mutex, &deadline) != 0) {
+            break;
+        }
+    }
+}
+
+// Initialize empty batch for socket
+void batch_init(SendBatch* batch, SOCKET sock) {
+    memset(batch, 0, sizeof(*batch));
+    batch->socket = sock;
+    pthread_mutex_init(&batch->mutex, NULL);
+    pthread_cond_init(&batch->space, NULL);
+    pthread_cond_init(&batch->more, NULL);
+}
+
+// Free batch once no write is in flight
+void batch_destroy(SendBatch* batch) {
+    pthread_mutex_lock(&batch->mutex);
+    while (batch->flushing) {
+        pthread_cond_wait(&batch->space, &batch->mutex);
+    }
+    pthread_mutex_unlock(&batch->mutex);
+    
+    free(batch->data);
+    free(batch->spare);
+    pthread_cond_destroy(&batch->more);
+    pthread_cond_destroy(&batch->space);
+    pthread_mutex_destroy(&batch->mutex);
+}
+
+// Drop pending frames and attach to a new socket
+void batch_reset(SendBatch* batch, SOCKET sock) {
+    pthread_mutex_lock(&batch->mutex);
+    batch->socket = sock;
+    batch->used = 0;
+    batch->corked = 0;
+    pthread_cond_broadcast(&batch->space);
+    pthread_mutex_unlock(&batch->mutex);
+}
+
+// Free the buffers of an idle batch, they are allocated again on the next
+// frame. Returns 1 if freed, 0 if frames are pending or being written.
+int batch_trim(SendBatch* batch) {
+    pthread_mutex_lock(&batch->mutex);
+    int idle = batch->used == 0 && !batch->flushing && !batch->corked;
+    if (idle) {
+        free(batch->data);
+        free(batch->spare);
+        batch->data = NULL;
+        batch->spare = NULL;
+        batch->capacity = 0;
+        batch->spare_capacity = 0;
+    }
+    pthread_mutex_unlock(&batch->mutex);
+    return idle;
+}
+
+// Append a frame
+int batch_write(void* ctx, const void* data, size_t length) {
+    SendBatch* batch = ctx;
+    size_t window = (size_t)node_config.coalesce_bytes;
+    int result = 0;
+    
+    pthread_mutex_lock(&batch->mutex);
+    batch->frames++;
+    
+    // Coalescing off: one send per frame, after any write in flight
+    if (window == 0 && !batch->corked && batch->used == 0) {
+        while (batch->flushing) {
+            pthread_cond_wait(&batch->space, &batch->mutex);
+        }
+        batch->writes++;
+        result = send_all(batch->socket, data, length);
+        pthread_mutex_unlock(&batch->mutex);
+        return result < 0 ? -1 : (int)length;
+    }
+    
+    // Don't buffer past the window while a write is in flight
+    while (batch->flushing && batch->used > 0 && batch->used + length > window) {
+        pthread_cond_wait(&batch->space, &batch->mutex);
+    }
+    
+    if (reserve(batch, length) < 0) {
+        pthread_mutex_unlock(&batch->mutex);
+        return -1;
+    }
+    memcpy(batch->data + batch->used, data, length);
+    batch->used += length;
+    pthread_cond_signal(&batch->more);
+    
+    // A corked burst larger than the window goes out now, flagged as more to come
+    if (batch->corked && !batch->flushing && batch->used >= window) {
+        batch->writes++;
+        result = send_all_more(batch->socket, batch->data, batch->used);
+        batch->used = 0;
+    }
+    
+    pthread_mutex_unlock(&batch->mutex);
+    return result < 0 ? -1 : (int)length;
+}
+
+// Write pending frames; frames appended meanwhile go out in the next round
+int batch_flush(SendBatch* batch) {
+    int result = 0;
+    
+    pthread_mutex_lock(&batch->mutex);
+    if (batch->flushing) {
+        // The writer in flight picks up our frames
+        pthread_mutex_unlock(&batch->mutex);
+        return 0;
+    }
+    
+    batch->flushing = 1;
+    while (batch->used > 0 && !batch->corked) {
+        wait_for_window(batch);
+        
+        // Take pending frames, appenders continue in the spare buffer
+        unsigned char* data = batch->data;
+        size_t length = batch->used;
+        size_t capacity = batch->capacity;
+        SOCKET sock = batch->socket;
+        batch->data = batch->spare;
+        batch->capacity = batch->spare_capacity;
+        batch->used = 0;
+        batch->spare = data;
+        batch->spare_capacity = capacity;
+        pthread_cond_broadcast(&batch->space);
+        pthread_mutex_unlock(&batch->mutex);
+        
+        int sent = send_all(sock, data, length);
+        
+        pthread_mutex_lock(&batch->mutex);
+        batch->writes++;
+        if (sent < 0) {
+            // Link is broken; sequenced frames stay in the store for replay
+            if (batch->socket == sock) {
+                batch->used = 0;
+            }
+            result = -1;
+            break;
+        }
+    }
+    batch->flushing = 0;
+    pthread_cond_broadcast(&batch->space);
+    pthread_mutex_unlock(&batch->mutex);
+    
+    return result;
+}
+
+// Write pending frames and wait for any write in flight
+int batch_drain(SendBatch* batch) {
+    int result = batch_flush(batch);
+    
+    pthread_mutex_lock(&batch->mutex);
+    while (batch->flushing) {
+        pthread_cond_wait(&batch->space, &batch->mutex);
+    }
+    pthread_mutex_unlock(&batch->mutex);
+    
+    return result;
+}
+
+// Hold frames back
+void batch_cork(SendBatch* batch) {
+    pthread_mutex_lock(&batch->mutex);
+    batch->corked++;
+    pthread_mutex_unlock(&batch->mutex);
+}
+
+// Release held frames, caller flushes
+void batch_uncork(SendBatch* batch) {
+    pthread_mutex_lock(&batch->mutex);
+    if (batch->corked > 0) {
+        batch->corked--;
+    }
+    pthread_mutex_unlock(&batch->mutex);
+}
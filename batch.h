@@ -0,0 +1,48 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "common.h"
+#include <pthread.h>
+
+// Outbound frame coalescing for one connection.
+// Writers append frames; whoever finds the socket idle writes them out at
+// once, frames appended while that write is in progress go out together in
+// the next one. Corking holds frames back to send a known burst as one write.
+typedef struct {
+    SOCKET socket;
+    pthread_mutex_t mutex;
+    pthread_cond_t space;           // Signalled when pending frames are taken
+    pthread_cond_t more;            // Signalled when a frame is appended
+    unsigned char* data;            // Frames waiting to be written
+    size_t used;
+    size_t capacity;
+    unsigned char* spare;           // Buffer being written by the flusher
+    size_t spare_capacity;
+    int flushing;                   // A thread is writing
+    int corked;
+    long long frames;               // Frames appended
+    long long writes;               // Socket writes issued
+} SendBatch;
+
+// Batch lifecycle
+void batch_init(SendBatch* batch, SOCKET sock);
+void batch_destroy(SendBatch* batch);
+void batch_reset(SendBatch* batch, SOCKET sock);
+
+// Free the buffers of an idle batch, 1 if it was idle
+int batch_trim(SendBatch* batch);
+
+// frame_write_fn sink: append a frame (ctx is the SendBatch)
+int batch_write(void* ctx, const void* data, size_t length);
+
+// Write pending frames unless another thread already is; -1 on socket error
+int batch_flush(SendBatch* batch);
+
+// Write pending frames and wait until nothing is in flight
+int batch_drain(SendBatch* batch);
+
+// Hold frames back; flush after uncorking
+void batch_cork(SendBatch* batch);
+void batch_uncork(SendBatch* batch);
+
+#endif // BATCH_H
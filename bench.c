@@ -0,0 +1,1420 @@
+#include "common.h"
+#include "protocol.h"
+#include "socket.h"
+#include "config.h"
+#include "batch.h"
+#include "search.h"
+#include "p2pchat.h"
+#include "discovery.h"
+#include "timeutil.h"
+#include <stdint.h>
+#include <getopt.h>
+#include <time.h>
+#include <dirent.h>
+#include <netinet/tcp.h>
+#include <sys/wait.h>
+#include <poll.h>
+
+// Send path benchmark: writer threads push small frames through one loopback
+// TCP connection, the way concurrent senders share a peer in the node. Compares
+// a write per frame under the send mutex with the coalescing SendBatch.
+// With --search N it benchmarks the message index instead: indexing rate,
+// size on disk, reopening and query latency over N synthetic messages.
+// With --accept N the writer threads dial a node N times at once, the way
+// peers come back after an outage: connections per second, dial latency
+// and how many the node sheds.
+// With --idle N it opens N connections that say hello, send one message
+// and go quiet: resident memory per connection with and without parking,
+// and how fast parked connections take a message again.
+// With --rtt N it times N round trips through a node that echoes every
+// message, with receiver threads and then with the pinned spin thread.
+// With --discover N it starts N node processes with discovery on and no
+// peers configured: how soon each hears every other node and gets a first
+// connection, the announcement rate on the group and whether one mesh formed.
+
+// Defaults
+#define BENCH_DEFAULT_THREADS 4
+#define BENCH_DEFAULT_MESSAGES 100000
+#define BENCH_DEFAULT_SIZE 64
+#define BENCH_LATENCY_SAMPLES 2000
+#define BENCH_LATENCY_GAP_US 200     // Idle time between latency probes
+#define BENCH_RECV_BUFFER 65536
+
+// Search benchmark
+#define BENCH_SEARCH_DIR "p2p_bench_index"
+#define BENCH_VOCABULARY 50000       // Distinct words, frequency falls off steeply
+#define BENCH_QUERY_RUNS 200         // Runs per query shape
+#define BENCH_SEARCH_HITS 20
+
+// Accept benchmark
+#define BENCH_ACCEPT_PORT 47391
+#define BENCH_ACCEPT_TIMEOUT_MS 30000  // Longest wait for the node to see every dial
+
+// Idle benchmark
+#define BENCH_IDLE_PORT 47392
+#define BENCH_IDLE_PARK_MS 500         // park_idle of the parking run
+#define BENCH_IDLE_TIMEOUT_MS 60000    // Longest wait for a phase
+#define BENCH_IDLE_SETTLE_MS 1500      // Wait after parking, past the node's heap trim
+
+// Round trip benchmark
+#define BENCH_RTT_PORT 47393
+#define BENCH_RTT_WARMUP 200           // Round trips before timing starts
+
+// Discovery benchmark
+#define BENCH_DISCOVER_PORT 47500      // Node i listens on this plus i
+#define BENCH_DISCOVER_GROUP_PORT 47401  // Off the default group port, away from real nodes
+#define BENCH_DISCOVER_TIMEOUT_MS 60000  // Longest wait for a node to hear all others
+#define BENCH_DISCOVER_POLL_MS 10
+#define BENCH_DISCOVER_SETTLE_MS 2000  // Dialing time once every node heard all others
+#define BENCH_DISCOVER_MAX 1000
+
+// Send path under test
+#define BENCH_MODE_SEND_FRAME 0      // send_frame per message under a mutex
+#define BENCH_MODE_BATCH 1           // SendBatch sink, then flush
+
+// Benchmark parameters
+typedef struct {
+    int threads;
+    int messages;
+    int size;
+    int coalesce_bytes;
+    int coalesce_delay;
+    int search_messages;             // > 0 runs the search benchmark
+    int accept_connections;          // > 0 runs the accept benchmark
+    int idle_connections;            // > 0 runs the idle benchmark
+    int round_trips;                 // > 0 runs the round trip benchmark
+    int discover_nodes;              // > 0 runs the discovery benchmark
+} BenchConfig;
+
+// Shared state of one run
+typedef struct {
+    const BenchConfig* config;
+    int mode;
+    SOCKET writer;
+    SOCKET reader;
+    pthread_mutex_t send_mutex;
+    SendBatch batch;
+    long long expected;
+    long long received;
+    long long send_frame_writes;
+    long long* latencies;            // Receive time minus send time, in ns
+    int latency_count;
+} BenchRun;
+
+// Dialer of the accept benchmark: connections [first, last)
+typedef struct {
+    int first;
+    int last;
+    SOCKET* sockets;                 // Kept open until the run ends
+    long long* latencies;            // connect() time in ns, -1 = failed
+} BenchDialer;
+
+// What a node of the discovery benchmark reports over its pipe
+typedef struct {
+    int heard_all_ms;                // Until it had heard every other node, -1 = never
+    int linked_ms;                   // Until its first connection, -1 = never
+    int elapsed_ms;                  // Since it was created, at the final report
+    long long announced;
+    long long heard;
+    int links;                       // Entries used in linked_ports
+    int linked_ports[64];            // Listen ports of discovered peers it is connected to
+} DiscoverReport;
+
+// Monotonic clock in nanoseconds
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Compare latencies for qsort
+static int compare_latency(const void* a, const void* b) {
+    long long x = *(const long long*)a;
+    long long y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+// Order millisecond times for qsort
+static int compare_ms(const void* a, const void* b) {
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+// Connected loopback socket pair, returns 0 on success
+static int open_loopback_pair(SOCKET* writer, SOCKET* reader) {
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    SOCKET server = socket(AF_INET, SOCK_STREAM, 0);
+    if (server == INVALID_SOCKET) {
+        return -1;
+    }
+    
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    
+    if (bind(server, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(server, 1) < 0 ||
+        getsockname(server, (struct sockaddr*)&addr, &addr_len) < 0) {
+        close(server);
+        return -1;
+    }
+    
+    *writer = socket(AF_INET, SOCK_STREAM, 0);
+    if (*writer == INVALID_SOCKET ||
+        connect(*writer, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(server);
+        return -1;
+    }
+    
+    *reader = accept(server, NULL, NULL);
+    close(server);
+    if (*reader == INVALID_SOCKET) {
+        close(*writer);
+        return -1;
+    }
+    
+    // Same socket options as node connections
+    apply_socket_options(*writer);
+    apply_socket_options(*reader);
+    return 0;
+}
+
+// Send one frame through the path under test
+static int bench_send(BenchRun* run, const unsigned char* payload, uint32_t length) {
+    int result;
+    
+    if (run->mode == BENCH_MODE_SEND_FRAME) {
+        pthread_mutex_lock(&run->send_mutex);
+        result = send_frame(run->writer, FRAME_MESSAGE, 0, payload, length);
+        run->send_frame_writes++;
+        pthread_mutex_unlock(&run->send_mutex);
+        return result;
+    }
+    
+    // Mirrors send_to_connection: append under the send mutex, flush outside it
+    pthread_mutex_lock(&run->send_mutex);
+    result = write_frame(batch_write, &run->batch, FRAME_MESSAGE, 0, payload, length);
+    pthread_mutex_unlock(&run->send_mutex);
+    if (result >= 0) {
+        result = batch_flush(&run->batch);
+    }
+    return result;
+}
+
+// Writer thread: messages frames stamped with their send time
+static void* writer_thread(void* arg) {
+    BenchRun* run = arg;
+    unsigned char* payload = calloc(1, run->config->size);
+    if (payload == NULL) {
+        return NULL;
+    }
+    
+    for (int i = 0; i < run->config->messages; i++) {
+        encode_u64((uint64_t)now_ns(), payload);
+        if (bench_send(run, payload, run->config->size) < 0) {
+            break;
+        }
+    }
+    
+    free(payload);
+    return NULL;
+}
+
+// Reader thread: parse frames until the expected count arrived
+static void* reader_thread(void* arg) {
+    BenchRun* run = arg;
+    unsigned char* buffer = malloc(BENCH_RECV_BUFFER);
+    FrameReader reader;
+    FrameHeader header;
+    const unsigned char* payload;
+    
+    if (buffer == NULL) {
+        return NULL;
+    }
+    frame_reader_init(&reader, buffer, BENCH_RECV_BUFFER);
+    
+    while (run->received < run->expected) {
+        int bytes = recv(run->reader, (char*)reader.data + reader.used,
+                         reader.capacity - reader.used, 0);
+        if (bytes <= 0) {
+            break;
+        }
+        
+        long long arrived = now_ns();
+        reader.used += bytes;
+        while (frame_reader_next(&reader, &header, &payload) > 0) {
+            if (run->latencies != NULL && run->latency_count < run->expected) {
+                run->latencies[run->latency_count++] = arrived - (long long)decode_u64(payload);
+            }
+            run->received++;
+            frame_reader_consume(&reader, &header);
+        }
+    }
+    
+    free(buffer);
+    return NULL;
+}
+
+// Set up sockets and send path for a run
+static int start_run(BenchRun* run, const BenchConfig* config, int mode, int coalesce_bytes) {
+    memset(run, 0, sizeof(*run));
+    run->config = config;
+    run->mode = mode;
+    
+    if (open_loopback_pair(&run->writer, &run->reader) < 0) {
+        printf("Error: Could not open loopback connection\n");
+        return -1;
+    }
+    
+    node_config.coalesce_bytes = coalesce_bytes;
+    node_config.coalesce_delay = config->coalesce_delay;
+    pthread_mutex_init(&run->send_mutex, NULL);
+    batch_init(&run->batch, run->writer);
+    return 0;
+}
+
+// Release a run's sockets and send path
+static void finish_run(BenchRun* run) {
+    batch_destroy(&run->batch);
+    pthread_mutex_destroy(&run->send_mutex);
+    close(run->writer);
+    close(run->reader);
+    free(run->latencies);
+}
+
+// Socket writes issued by a run
+static long long run_writes(const BenchRun* run) {
+    return run->mode == BENCH_MODE_SEND_FRAME ? run->send_frame_writes : run->batch.writes;
+}
+
+// Throughput: threads x messages frames as fast as possible
+static int bench_throughput(const BenchConfig* config, const char* name,
+                            int mode, int coalesce_bytes) {
+    BenchRun run;
+    pthread_t reader;
+    pthread_t* writers = calloc(config->threads, sizeof(pthread_t));
+    
+    if (writers == NULL || start_run(&run, config, mode, coalesce_bytes) < 0) {
+        free(writers);
+        return -1;
+    }
+    run.expected = (long long)config->threads * config->messages;
+    
+    long long start = now_ns();
+    pthread_create(&reader, NULL, reader_thread, &run);
+    for (int i = 0; i < config->threads; i++) {
+        pthread_create(&writers[i], NULL, writer_thread, &run);
+    }
+    for (int i = 0; i < config->threads; i++) {
+        pthread_join(writers[i], NULL);
+    }
+    pthread_join(reader, NULL);
+    double seconds = (now_ns() - start) / 1e9;
+    
+    long long writes = run_writes(&run);
+    double bytes = (double)run.received * (FRAME_HEADER_SIZE + config->size);
+    printf("%-22s %11.0f msg/s | %8.1f MB/s | writes %9lld | %7.1f frames/write\n",
+           name, run.received / seconds, bytes / seconds / 1e6, writes,
+           writes > 0 ? (double)run.received / writes : 0.0);
+    
+    free(writers);
+    finish_run(&run);
+    return run.received == run.expected ? 0 : -1;
+}
+
+// Idle latency: one writer, a frame at a time with the link otherwise quiet
+static int bench_latency(const BenchConfig* config, const char* name,
+                         int mode, int coalesce_bytes) {
+    BenchRun run;
+    pthread_t reader;
+    unsigned char* payload = calloc(1, config->size);
+    
+    if (payload == NULL || start_run(&run, config, mode, coalesce_bytes) < 0) {
+        free(payload);
+        return -1;
+    }
+    run.expected = BENCH_LATENCY_SAMPLES;
+    run.latencies = calloc(BENCH_LATENCY_SAMPLES, sizeof(long long));
+    if (run.latencies == NULL) {
+        free(payload);
+        finish_run(&run);
+        return -1;
+    }
+    
+    pthread_create(&reader, NULL, reader_thread, &run);
+    for (int i = 0; i < BENCH_LATENCY_SAMPLES; i++) {
+        encode_u64((uint64_t)now_ns(), payload);
+        if (bench_send(&run, payload, config->size) < 0) {
+            break;
+        }
+        
+        struct timespec gap = { 0, BENCH_LATENCY_GAP_US * 1000 };
+        nanosleep(&gap, NULL);
+    }
+    pthread_join(reader, NULL);
+    
+    qsort(run.latencies, run.latency_count, sizeof(long long), compare_latency);
+    if (run.latency_count > 0) {
+        printf("%-22s p50 %8.1f us | p99 %8.1f us\n", name,
+               run.latencies[run.latency_count / 2] / 1000.0,
+               run.latencies[run.latency_count * 99 / 100] / 1000.0);
+    }
+    
+    free(payload);
+    finish_run(&run);
+    return 0;
+}
+
+// xorshift64 step
+static uint64_t next_random(uint64_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+// Word of the synthetic vocabulary; low numbers are common, like chat
+static void bench_word(int number, char* out, size_t size) {
+    static const char* syllables[] = { "ka", "lo", "mi", "ne", "ru", "ta", "vo", "zi",
+                                       "be", "do", "fu", "gi", "ha", "jo", "pe", "si" };
+    size_t length = 0;
+    do {
+        const char* syllable = syllables[number % 16];
+        if (length + 3 > size) {
+            break;
+        }
+        memcpy(out + length, syllable, 2);
+        length += 2;
+        number /= 16;
+    } while (number > 0);
+    out[length] = '\0';
+}
+
+// Skewed pick from the vocabulary (cube of a uniform draw)
+static int bench_pick(uint64_t* state) {
+    double u = (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+    return (int)(u * u * u * BENCH_VOCABULARY);
+}
+
+// Synthetic chat message of 6 to 17 words
+static int bench_message(uint64_t* state, char* out, size_t size) {
+    int words = 6 + (int)(next_random(state) % 12);
+    size_t length = 0;
+    for (int i = 0; i < words; i++) {
+        char word[32];
+        bench_word(bench_pick(state), word, sizeof(word));
+        int written = snprintf(out + length, size - length, i > 0 ? " %s" : "%s", word);
+        if (written < 0 || (size_t)written >= size - length) {
+            break;
+        }
+        length += written;
+    }
+    return (int)length;
+}
+
+// Remove the benchmark's index directory
+static void remove_search_dir(void) {
+    DIR* dir = opendir(BENCH_SEARCH_DIR);
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char path[SEARCH_PATH_LENGTH];
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%.64s", BENCH_SEARCH_DIR, entry->d_name);
+        remove(path);
+    }
+    closedir(dir);
+    rmdir(BENCH_SEARCH_DIR);
+}
+
+// Query latency over BENCH_QUERY_RUNS runs
+static void bench_query(SearchIndex* index, const char* name, const char* query) {
+    long long* samples = calloc(BENCH_QUERY_RUNS, sizeof(long long));
+    long long total = 0;
+    if (samples == NULL) {
+        return;
+    }
+    
+    for (int i = 0; i < BENCH_QUERY_RUNS; i++) {
+        SearchHit* hits;
+        long long start = now_ns();
+        int count = search_query(index, query, BENCH_SEARCH_HITS, &hits, &total);
+        samples[i] = now_ns() - start;
+        if (count >= 0) {
+            search_free_hits(hits, count);
+        }
+    }
+    
+    qsort(samples, BENCH_QUERY_RUNS, sizeof(long long), compare_latency);
+    printf("%-22s %-18s %9lld matches | p50 %8.3f ms | p99 %8.3f ms\n", name, query, total,
+           samples[BENCH_QUERY_RUNS / 2] / 1e6, samples[BENCH_QUERY_RUNS * 99 / 100] / 1e6);
+    free(samples);
+}
+
+// Index benchmark: feed messages as fast as the index takes them, reopen
+// the written segments, then time queries of increasing selectivity
+static int bench_search(const BenchConfig* config) {
+    SearchIndex* index = calloc(1, sizeof(SearchIndex));
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    char message[512];
+    long long text_bytes = 0;
+    long long waits = 0;
+    
+    remove_search_dir();
+    if (index == NULL || search_open(index, BENCH_SEARCH_DIR) < 0) {
+        printf("Error: Could not open index in %s\n", BENCH_SEARCH_DIR);
+        free(index);
+        return -1;
+    }
+    
+    long long start = now_ns();
+    for (int i = 0; i < config->search_messages; i++) {
+        int length = bench_message(&state, message, sizeof(message));
+        text_bytes += length;
+        
+        // A full queue drops in the node; here the feed waits instead
+        while (search_add(index, start / 1000000 + i, "#bench", message, length) < 0) {
+            struct timespec pause = { 0, 100000 };
+            nanosleep(&pause, NULL);
+            waits++;
+        }
+    }
+    search_sync(index);
+    double seconds = (now_ns() - start) / 1e9;
+    
+    long long start_close = now_ns();
+    search_close(index);
+    double close_ms = (now_ns() - start_close) / 1e6;
+    
+    long long start_open = now_ns();
+    int opened = search_open(index, BENCH_SEARCH_DIR);
+    double open_ms = (now_ns() - start_open) / 1e6;
+    if (opened < 0) {
+        printf("Error: Could not reopen index\n");
+        free(index);
+        remove_search_dir();
+        return -1;
+    }
+    
+    long long messages;
+    long long bytes;
+    long long dropped;
+    int segments;
+    search_stats(index, &messages, &segments, &bytes, &dropped);
+    
+    printf("Indexing\n");
+    printf("%-22s %11.0f msg/s | %8.1f MB/s of text | %lld full-queue waits\n", "live feed",
+           config->search_messages / seconds, text_bytes / seconds / 1e6, waits);
+    printf("%-22s %8.1f ms\n", "final flush", close_ms);
+    printf("%-22s %8.1f ms | %lld messages in %d segments\n", "reopen (mmap)", open_ms,
+           messages, segments);
+    printf("%-22s %8.1f MB | %5.2f x text (messages included)\n", "size on disk",
+           bytes / 1e6, text_bytes > 0 ? (double)bytes / text_bytes : 0.0);
+    
+    // Words by rank in the vocabulary: common, middling, rare
+    char common[32];
+    char middling[32];
+    char rare[32];
+    char pair[64];
+    char triple[96];
+    bench_word(1, common, sizeof(common));
+    bench_word(40, middling, sizeof(middling));
+    bench_word(BENCH_VOCABULARY / 2, rare, sizeof(rare));
+    snprintf(pair, sizeof(pair), "%s %s", common, middling);
+    snprintf(triple, sizeof(triple), "%s %s %s", common, middling, rare);
+    
+    printf("\nQueries (%d runs, newest %d hits copied)\n", BENCH_QUERY_RUNS, BENCH_SEARCH_HITS);
+    bench_query(index, "common word", common);
+    bench_query(index, "middling word", middling);
+    bench_query(index, "rare word", rare);
+    bench_query(index, "common AND middling", pair);
+    bench_query(index, "three words", triple);
+    
+    search_close(index);
+    free(index);
+    remove_search_dir();
+    return messages == config->search_messages ? 0 : -1;
+}
+
+// Dial the node for each connection of the dialer
+static void* dialer_thread(void* arg) {
+    BenchDialer* dialer = arg;
+    struct sockaddr_in addr;
+    
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(BENCH_ACCEPT_PORT);
+    
+    for (int i = dialer->first; i < dialer->last; i++) {
+        long long start = now_ns();
+        SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (sock != INVALID_SOCKET &&
+            connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            close(sock);
+            sock = INVALID_SOCKET;
+        }
+        dialer->sockets[i] = sock;
+        dialer->latencies[i] = sock != INVALID_SOCKET ? now_ns() - start : -1;
+    }
+    return NULL;
+}
+
+// One accept storm against a fresh node with the given listen backlog and
+// admission rate, returns 0 if the node saw every dial
+static int bench_accept_run(const BenchConfig* config, const char* name,
+                            const char* backlog, const char* accept_rate) {
+    int total = config->accept_connections;
+    char capacity[16];
+    snprintf(capacity, sizeof(capacity), "%d", total + 16);
+    p2p_config_set("max_connections", capacity);
+    p2p_config_set("backlog", backlog);
+    p2p_config_set("accept_rate", accept_rate);
+    
+    P2PContext* node = p2p_create(BENCH_ACCEPT_PORT, NULL, NULL);
+    if (node == NULL) {
+        printf("Error: Could not start a node on port %d\n", BENCH_ACCEPT_PORT);
+        return -1;
+    }
+    
+    SOCKET* sockets = calloc(total, sizeof(SOCKET));
+    long long* latencies = calloc(total, sizeof(long long));
+    BenchDialer* dialers = calloc(config->threads, sizeof(BenchDialer));
+    pthread_t* threads = calloc(config->threads, sizeof(pthread_t));
+    if (sockets == NULL || latencies == NULL || dialers == NULL || threads == NULL) {
+        free(sockets);
+        free(latencies);
+        free(dialers);
+        free(threads);
+        p2p_destroy(node);
+        return -1;
+    }
+    
+    long long start = now_ns();
+    for (int i = 0; i < config->threads; i++) {
+        dialers[i].first = (int)((long long)total * i / config->threads);
+        dialers[i].last = (int)((long long)total * (i + 1) / config->threads);
+        dialers[i].sockets = sockets;
+        dialers[i].latencies = latencies;
+        pthread_create(&threads[i], NULL, dialer_thread, &dialers[i]);
+    }
+    for (int i = 0; i < config->threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    
+    // Done once the node has admitted or shed every connection
+    P2PAcceptStats stats;
+    long long deadline = now_ns() + BENCH_ACCEPT_TIMEOUT_MS * 1000000LL;
+    for (;;) {
+        p2p_accept_stats(node, &stats);
+        if (stats.accepted + stats.shed_rate + stats.shed_full >= total ||
+            now_ns() > deadline) {
+            break;
+        }
+        struct timespec pause = { 0, 100000 };
+        nanosleep(&pause, NULL);
+    }
+    double seconds = (now_ns() - start) / 1e9;
+    
+    int dialed = 0;
+    for (int i = 0; i < total; i++) {
+        if (latencies[i] >= 0) {
+            latencies[dialed++] = latencies[i];
+        }
+    }
+    qsort(latencies, dialed, sizeof(long long), compare_latency);
+    
+    printf("%-26s %7.0f conn/s | accepted %6lld | shed %6lld", name,
+           (stats.accepted + stats.shed_rate + stats.shed_full) / seconds,
+           stats.accepted, stats.shed_rate + stats.shed_full);
+    if (dialed > 0) {
+        printf(" | connect p50 %7.2f ms | p99 %8.2f ms | max %8.2f ms",
+               latencies[dialed / 2] / 1e6, latencies[dialed * 99 / 100] / 1e6,
+               latencies[dialed - 1] / 1e6);
+    }
+    printf("\n");
+    
+    for (int i = 0; i < total; i++) {
+        if (sockets[i] != INVALID_SOCKET) {
+            close(sockets[i]);
+        }
+    }
+    p2p_destroy(node);
+    free(sockets);
+    free(latencies);
+    free(dialers);
+    free(threads);
+    return stats.accepted + stats.shed_rate + stats.shed_full == total ? 0 : -1;
+}
+
+// Accept storms: the old backlog, the default one, and default admission
+static int bench_accept(const BenchConfig* config) {
+    char backlog[16];
+    char rate[16];
+    snprintf(backlog, sizeof(backlog), "%d", BACKLOG);
+    snprintf(rate, sizeof(rate), "%d", ACCEPT_RATE);
+    
+    int failed = 0;
+    failed |= bench_accept_run(config, "backlog 10, no limit", "10", "0");
+    failed |= bench_accept_run(config, "default backlog, no limit", backlog, "0");
+    failed |= bench_accept_run(config, "default admission", backlog, rate);
+    return failed;
+}
+
+// Messages the node of the idle benchmark received
+static long long idle_messages = 0;
+static pthread_mutex_t idle_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Node callback of the idle benchmark: count messages
+static void count_message(const P2PEvent* event, void* user_data) {
+    (void)user_data;
+    if (event->type == P2P_EVENT_MESSAGE) {
+        pthread_mutex_lock(&idle_mutex);
+        idle_messages++;
+        pthread_mutex_unlock(&idle_mutex);
+    }
+}
+
+// Messages counted so far
+static long long idle_count(void) {
+    pthread_mutex_lock(&idle_mutex);
+    long long count = idle_messages;
+    pthread_mutex_unlock(&idle_mutex);
+    return count;
+}
+
+// Poll stats until done() holds or the timeout passes, 0 if it held
+static int wait_idle_state(P2PContext* node, P2PMemoryStats* stats, long long messages,
+                           int (*done)(const P2PMemoryStats*, int), int total) {
+    long long deadline = now_ns() + BENCH_IDLE_TIMEOUT_MS * 1000000LL;
+    for (;;) {
+        p2p_memory_stats(node, stats);
+        if (idle_count() >= messages && done(stats, total)) {
+            return 0;
+        }
+        if (now_ns() > deadline) {
+            return -1;
+        }
+        struct timespec pause = { 0, 1000000 };
+        nanosleep(&pause, NULL);
+    }
+}
+
+// Every connection is still there
+static int all_connected(const P2PMemoryStats* stats, int total) {
+    return stats->connections == total;
+}
+
+// Every connection has a receiver
+static int all_receiving(const P2PMemoryStats* stats, int total) {
+    return stats->connections == total && stats->receivers == total;
+}
+
+// Every connection is parked
+static int all_parked(const P2PMemoryStats* stats, int total) {
+    return stats->connections == total && stats->parked == total;
+}
+
+// Print resident memory over the node's start for a phase
+static void print_idle_memory(const char* name, const P2PMemoryStats* stats, int total) {
+    long long grown = stats->rss - stats->rss_start;
+    printf("%-26s RSS +%7lld KB | %6lld bytes/connection | receivers %5d | parked %5d\n",
+           name, grown / 1024, grown / total, stats->receivers, stats->parked);
+}
+
+// Send a message frame on each socket, returns 0 if all went out
+static int send_idle_messages(SOCKET* sockets, int total, uint64_t seq) {
+    int failed = 0;
+    for (int i = 0; i < total; i++) {
+        if (send_frame(sockets[i], FRAME_MESSAGE, seq, "ping", 4) < 0) {
+            failed = -1;
+        }
+    }
+    return failed;
+}
+
+// Idle connections against a fresh node with the given park_idle,
+// returns 0 if every phase completed
+static int bench_idle_run(const BenchConfig* config, const char* name, const char* park_idle) {
+    int total = config->idle_connections;
+    char capacity[16];
+    snprintf(capacity, sizeof(capacity), "%d", total + 16);
+    p2p_config_set("max_connections", capacity);
+    p2p_config_set("accept_rate", "0");
+    p2p_config_set("warm_peers", "0");
+    p2p_config_set("park_idle", park_idle);
+    
+    pthread_mutex_lock(&idle_mutex);
+    idle_messages = 0;
+    pthread_mutex_unlock(&idle_mutex);
+    
+    P2PContext* node = p2p_create(BENCH_IDLE_PORT, count_message, NULL);
+    SOCKET* sockets = calloc(total, sizeof(SOCKET));
+    if (node == NULL || sockets == NULL) {
+        printf("Error: Could not start a node on port %d\n", BENCH_IDLE_PORT);
+        free(sockets);
+        p2p_destroy(node);
+        return -1;
+    }
+    
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(BENCH_IDLE_PORT);
+    
+    // Dial, say hello and send one message, like a peer that then goes quiet
+    int opened = 0;
+    for (int i = 0; i < total; i++) {
+        sockets[i] = socket(AF_INET, SOCK_STREAM, 0);
+        if (sockets[i] == INVALID_SOCKET) {
+            continue;
+        }
+        
+        HelloPayload hello = { (uint64_t)i + 1, 0, 0 };
+        unsigned char payload[HELLO_PAYLOAD_SIZE];
+        encode_hello(&hello, payload);
+        if (connect(sockets[i], (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+            send_frame(sockets[i], FRAME_HELLO, 0, payload, HELLO_PAYLOAD_SIZE) < 0) {
+            close(sockets[i]);
+            sockets[i] = INVALID_SOCKET;
+            continue;
+        }
+        opened++;
+    }
+    
+    P2PMemoryStats stats;
+    int failed = opened == total && send_idle_messages(sockets, total, 1) == 0 ? 0 : -1;
+    if (failed == 0) {
+        failed = wait_idle_state(node, &stats, total, all_receiving, total);
+    }
+    if (failed == 0) {
+        print_idle_memory(name, &stats, total);
+    }
+    
+    // Parked: every connection still takes a message, through a new receiver
+    if (failed == 0 && atoi(park_idle) > 0) {
+        failed = wait_idle_state(node, &stats, total, all_parked, total);
+        if (failed == 0) {
+            // The node trims the heap at most once a second
+            struct timespec pause = { BENCH_IDLE_SETTLE_MS / 1000, BENCH_IDLE_SETTLE_MS % 1000 * 1000000L };
+            nanosleep(&pause, NULL);
+            p2p_memory_stats(node, &stats);
+            print_idle_memory("  parked", &stats, total);
+            
+            long long start = now_ns();
+            failed = send_idle_messages(sockets, total, 2);
+            if (failed == 0) {
+                failed = wait_idle_state(node, &stats, 2LL * total, all_connected, total);
+            }
+            if (failed == 0) {
+                printf("  woken                    %d messages in %.1f ms\n",
+                       total, (now_ns() - start) / 1e6);
+            }
+        }
+    }
+    if (failed != 0) {
+        printf("%-26s did not complete (%lld of %d messages)\n", name, idle_count(), total);
+    }
+    
+    for (int i = 0; i < total; i++) {
+        if (sockets[i] != INVALID_SOCKET) {
+            close(sockets[i]);
+        }
+    }
+    p2p_destroy(node);
+    free(sockets);
+    return failed;
+}
+
+// Idle connections: receivers kept forever, then parked after BENCH_IDLE_PARK_MS
+static int bench_idle(const BenchConfig* config) {
+    char park[16];
+    snprintf(park, sizeof(park), "%d", BENCH_IDLE_PARK_MS);
+    
+    int failed = 0;
+    failed |= bench_idle_run(config, "never park", "0");
+    failed |= bench_idle_run(config, "park after idle", park);
+    return failed;
+}
+
+// Node callback of the round trip benchmark: send every message back
+static void echo_message(const P2PEvent* event, void* user_data) {
+    P2PContext** node = (P2PContext**)user_data;
+    if (event->type == P2P_EVENT_MESSAGE && *node != NULL) {
+        p2p_send(*node, event->conn_id, event->data, event->length);
+    }
+}
+
+// Read frames from sock until a message comes back, acknowledging it;
+// returns its send time, -1 if the connection failed
+static long long read_echo(SOCKET sock, FrameReader* reader) {
+    FrameHeader header;
+    const unsigned char* payload;
+    unsigned char ack[ACK_PAYLOAD_SIZE];
+    
+    for (;;) {
+        while (frame_reader_next(reader, &header, &payload) > 0) {
+            if (header.type == FRAME_MESSAGE && header.length >= 8) {
+                long long sent = (long long)decode_u64(payload);
+                frame_reader_consume(reader, &header);
+                encode_u64(header.seq, ack);
+                send_frame(sock, FRAME_ACK, 0, ack, sizeof(ack));
+                return sent;
+            }
+            frame_reader_consume(reader, &header);
+        }
+        
+        int received = recv(sock, (char*)reader->data + reader->used,
+                            reader->capacity - reader->used, 0);
+        if (received <= 0) {
+            return -1;
+        }
+        reader->used += received;
+    }
+}
+
+// Round trips through a fresh node with the given spin setting; fills
+// latencies (ns, sorted) and returns how many completed
+static int bench_rtt_run(const BenchConfig* config, const char* spin, long long* latencies) {
+    static P2PContext* node;
+    
+    p2p_config_set("spin", spin);
+    p2p_config_set("tcp_nodelay", "on");
+    p2p_config_set("warm_peers", "0");
+    
+    node = NULL;
+    P2PContext* created = p2p_create(BENCH_RTT_PORT, echo_message, &node);
+    unsigned char* buffer = malloc(BENCH_RECV_BUFFER);
+    unsigned char* payload = calloc(1, config->size);
+    if (created == NULL || buffer == NULL || payload == NULL) {
+        printf("Error: Could not start a node on port %d\n", BENCH_RTT_PORT);
+        p2p_destroy(created);
+        free(buffer);
+        free(payload);
+        return 0;
+    }
+    node = created;
+    
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(BENCH_RTT_PORT);
+    
+    HelloPayload hello = { 1, 0, 0 };
+    unsigned char hello_payload[HELLO_PAYLOAD_SIZE];
+    encode_hello(&hello, hello_payload);
+    
+    int nodelay = 1;
+    int count = 0;
+    SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock != INVALID_SOCKET &&
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char*)&nodelay, sizeof(nodelay)) == 0 &&
+        connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == 0 &&
+        send_frame(sock, FRAME_HELLO, 0, hello_payload, HELLO_PAYLOAD_SIZE) >= 0) {
+        FrameReader reader;
+        frame_reader_init(&reader, buffer, BENCH_RECV_BUFFER);
+        
+        for (int i = 0; i < BENCH_RTT_WARMUP + config->round_trips; i++) {
+            encode_u64((uint64_t)now_ns(), payload);
+            if (send_frame(sock, FRAME_MESSAGE, (uint64_t)i + 1, payload, config->size) < 0) {
+                break;
+            }
+            long long sent = read_echo(sock, &reader);
+            if (sent < 0) {
+                break;
+            }
+            if (i >= BENCH_RTT_WARMUP) {
+                latencies[count++] = now_ns() - sent;
+            }
+            
+            struct timespec gap = { 0, BENCH_LATENCY_GAP_US * 1000 };
+            nanosleep(&gap, NULL);
+        }
+    }
+    
+    if (sock != INVALID_SOCKET) {
+        close(sock);
+    }
+    p2p_destroy(node);
+    node = NULL;
+    free(buffer);
+    free(payload);
+    
+    qsort(latencies, count, sizeof(long long), compare_latency);
+    return count;
+}
+
+// Print round trip percentiles, with the change from a baseline run
+static void print_rtt(const char* name, const long long* latencies, int count,
+                      const long long* baseline, int baseline_count) {
+    long long p50 = latencies[count / 2];
+    long long p99 = latencies[count * 99 / 100];
+    printf("%-22s p50 %8.1f us | p99 %8.1f us | max %8.1f us", name,
+           p50 / 1000.0, p99 / 1000.0, latencies[count - 1] / 1000.0);
+    if (baseline != NULL && baseline_count > 0) {
+        printf(" | p50 %+.1f us, p99 %+.1f us",
+               (p50 - baseline[baseline_count / 2]) / 1000.0,
+               (p99 - baseline[baseline_count * 99 / 100]) / 1000.0);
+    }
+    printf("\n");
+}
+
+// Round trips: receiver threads and frame_pool, then the spin thread
+static int bench_rtt(const BenchConfig* config) {
+    long long* receivers = calloc(config->round_trips, sizeof(long long));
+    long long* spinning = calloc(config->round_trips, sizeof(long long));
+    if (receivers == NULL || spinning == NULL) {
+        free(receivers);
+        free(spinning);
+        return -1;
+    }
+    
+    // The spin thread takes the last CPU, the client runs wherever
+    long long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    char cpu[24];
+    snprintf(cpu, sizeof(cpu), "%lld", cpus > 1 ? cpus - 1 : 0);
+    p2p_config_set("spin_cpu", cpu);
+    
+    int failed = 0;
+    int receiver_count = bench_rtt_run(config, "off", receivers);
+    int spin_count = bench_rtt_run(config, "on", spinning);
+    if (receiver_count > 0) {
+        print_rtt("receiver threads", receivers, receiver_count, NULL, 0);
+    }
+    if (spin_count > 0) {
+        print_rtt("spin thread", spinning, spin_count, receivers, receiver_count);
+    }
+    if (receiver_count < config->round_trips || spin_count < config->round_trips) {
+        printf("Round trips did not complete (%d and %d of %d)\n",
+               receiver_count, spin_count, config->round_trips);
+        failed = -1;
+    }
+    
+    free(receivers);
+    free(spinning);
+    return failed;
+}
+
+// Wait up to timeout_ms for fd to become readable, 1 if it did
+static int wait_pipe(int fd, int timeout_ms) {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    return poll(&pfd, 1, timeout_ms) > 0;
+}
+
+// Read exactly size bytes from a pipe, 0 on success
+static int read_full(int fd, void* data, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t got = read(fd, (char*)data + done, size - done);
+        if (got <= 0) {
+            return -1;
+        }
+        done += (size_t)got;
+    }
+    return 0;
+}
+
+// Fill in which discovered peers node is connected to
+static void list_links(P2PContext* node, DiscoverReport* report) {
+    P2PDiscoveredPeer peers[BENCH_DISCOVER_MAX];
+    int count = p2p_list_discovered(node, peers, BENCH_DISCOVER_MAX);
+    int max = (int)(sizeof(report->linked_ports) / sizeof(report->linked_ports[0]));
+    
+    report->links = 0;
+    for (int i = 0; i < count && report->links < max; i++) {
+        if (peers[i].connected) {
+            report->linked_ports[report->links++] = peers[i].port;
+        }
+    }
+}
+
+// One node of the discovery benchmark (a child process): sends a first
+// report once it heard every other node and has a connection, a final one
+// when release becomes readable, and exits once release is closed
+static void discover_node(int index, int total, int report_fd, int release_fd) {
+    char port[16];
+    char book[64];
+    char group_port[16];
+    snprintf(port, sizeof(port), "%d", BENCH_DISCOVER_PORT + index);
+    snprintf(book, sizeof(book), "p2p_bench_peers_%s.txt", port);
+    snprintf(group_port, sizeof(group_port), "%d", BENCH_DISCOVER_GROUP_PORT);
+    p2p_config_set("discovery", "on");
+    p2p_config_set("discovery_port", group_port);
+    p2p_config_set("peer_book", book);
+    p2p_config_set("warm_peers", "0");
+    
+    DiscoverReport report;
+    memset(&report, 0, sizeof(report));
+    report.heard_all_ms = -1;
+    report.linked_ms = -1;
+    
+    long long start = get_monotonic_ms();
+    P2PContext* node = p2p_create(BENCH_DISCOVER_PORT + index, NULL, NULL);
+    while (node != NULL && (report.heard_all_ms < 0 || report.linked_ms < 0) &&
+           get_monotonic_ms() - start < BENCH_DISCOVER_TIMEOUT_MS) {
+        P2PDiscoveryStats stats;
+        P2PConnectionInfo connection;
+        int elapsed = (int)(get_monotonic_ms() - start);
+        if (report.heard_all_ms < 0 && p2p_discovery_stats(node, &stats) == P2P_OK &&
+            stats.peers >= total - 1) {
+            report.heard_all_ms = elapsed;
+        }
+        if (report.linked_ms < 0 && p2p_list_connections(node, &connection, 1) > 0) {
+            report.linked_ms = elapsed;
+        }
+        
+        struct timespec pause = { 0, BENCH_DISCOVER_POLL_MS * 1000000L };
+        nanosleep(&pause, NULL);
+    }
+    
+    int failed = write(report_fd, &report, sizeof(report)) != (ssize_t)sizeof(report);
+    char release;
+    if (!failed && read(release_fd, &release, 1) == 1) {
+        P2PDiscoveryStats stats;
+        if (node != NULL && p2p_discovery_stats(node, &stats) == P2P_OK) {
+            report.announced = stats.announced;
+            report.heard = stats.heard;
+            list_links(node, &report);
+        }
+        report.elapsed_ms = (int)(get_monotonic_ms() - start);
+        failed = write(report_fd, &report, sizeof(report)) != (ssize_t)sizeof(report);
+        
+        // Every node stays up until all have reported their links
+        while (read(release_fd, &release, 1) > 0) {
+        }
+    }
+    
+    p2p_destroy(node);
+    remove(book);
+    _exit(failed || node == NULL ? 1 : 0);
+}
+
+// Root of node in a union-find forest, halving the path
+static int find_root(int* parent, int node) {
+    while (parent[node] != node) {
+        parent[node] = parent[parent[node]];
+        node = parent[node];
+    }
+    return node;
+}
+
+// Print the median and largest of count times in ms, ignoring -1
+static void print_discover_times(const char* name, int* times, int count) {
+    int reached = 0;
+    for (int i = 0; i < count; i++) {
+        if (times[i] >= 0) {
+            times[reached++] = times[i];
+        }
+    }
+    if (reached == 0) {
+        printf("%-22s no node got there\n", name);
+        return;
+    }
+    
+    qsort(times, reached, sizeof(int), compare_ms);
+    printf("%-22s p50 %6d ms | max %6d ms | %d of %d nodes\n", name,
+           times[reached / 2], times[reached - 1], reached, count);
+}
+
+// Discovery: N node processes, no peers configured; returns 0 if every
+// node heard all others and the connections form one mesh
+static int bench_discover(const BenchConfig* config) {
+    int total = config->discover_nodes;
+    pid_t* children = calloc(total, sizeof(pid_t));
+    int* report_fds = calloc(total, sizeof(int));
+    int* release_fds = calloc(total, sizeof(int));
+    DiscoverReport* reports = calloc(total, sizeof(DiscoverReport));
+    int* times = calloc(total, sizeof(int));
+    int* parent = calloc(total, sizeof(int));
+    if (children == NULL || report_fds == NULL || release_fds == NULL || reports == NULL ||
+        times == NULL || parent == NULL) {
+        free(children);
+        free(report_fds);
+        free(release_fds);
+        free(reports);
+        free(times);
+        free(parent);
+        return -1;
+    }
+    
+    int started = 0;
+    fflush(stdout);
+    for (; started < total; started++) {
+        int report_pipe[2];
+        int release_pipe[2];
+        if (pipe(report_pipe) < 0) {
+            break;
+        }
+        if (pipe(release_pipe) < 0) {
+            close(report_pipe[0]);
+            close(report_pipe[1]);
+            break;
+        }
+        
+        pid_t pid = fork();
+        if (pid == 0) {
+            // Only this node's ends stay open, so a parent exit releases it
+            for (int i = 0; i < started; i++) {
+                close(report_fds[i]);
+                close(release_fds[i]);
+            }
+            close(report_pipe[0]);
+            close(release_pipe[1]);
+            discover_node(started, total, report_pipe[1], release_pipe[0]);
+        }
+        close(report_pipe[1]);
+        close(release_pipe[0]);
+        if (pid < 0) {
+            close(report_pipe[0]);
+            close(release_pipe[1]);
+            break;
+        }
+        children[started] = pid;
+        report_fds[started] = report_pipe[0];
+        release_fds[started] = release_pipe[1];
+    }
+    
+    // First reports: hearing everyone and a first connection
+    int failed = started < total ? -1 : 0;
+    for (int i = 0; i < started; i++) {
+        if (!wait_pipe(report_fds[i], BENCH_DISCOVER_TIMEOUT_MS + 5000) ||
+            read_full(report_fds[i], &reports[i], sizeof(DiscoverReport)) < 0) {
+            reports[i].heard_all_ms = -1;
+            reports[i].linked_ms = -1;
+            failed = -1;
+        }
+    }
+    
+    // Let the last dials land, then collect links and counters
+    struct timespec settle = { BENCH_DISCOVER_SETTLE_MS / 1000,
+                               BENCH_DISCOVER_SETTLE_MS % 1000 * 1000000L };
+    nanosleep(&settle, NULL);
+    for (int i = 0; i < started; i++) {
+        char release = 1;
+        DiscoverReport final;
+        if (write(release_fds[i], &release, 1) != 1 ||
+            !wait_pipe(report_fds[i], BENCH_DISCOVER_TIMEOUT_MS) ||
+            read_full(report_fds[i], &final, sizeof(final)) < 0) {
+            failed = -1;
+            continue;
+        }
+        reports[i].announced = final.announced;
+        reports[i].heard = final.heard;
+        reports[i].elapsed_ms = final.elapsed_ms;
+        reports[i].links = final.links;
+        memcpy(reports[i].linked_ports, final.linked_ports, sizeof(final.linked_ports));
+    }
+    
+    for (int i = 0; i < started; i++) {
+        close(release_fds[i]);
+        close(report_fds[i]);
+    }
+    for (int i = 0; i < started; i++) {
+        int status;
+        waitpid(children[i], &status, 0);
+    }
+    
+    for (int i = 0; i < started; i++) {
+        times[i] = reports[i].heard_all_ms;
+    }
+    print_discover_times("heard every node", times, started);
+    for (int i = 0; i < started; i++) {
+        times[i] = reports[i].linked_ms;
+    }
+    print_discover_times("first connection", times, started);
+    
+    // Group traffic over the whole run, and the mesh the links form
+    long long announced = 0;
+    long long heard = 0;
+    long long links = 0;
+    int elapsed = 1;
+    for (int i = 0; i < total; i++) {
+        parent[i] = i;
+    }
+    for (int i = 0; i < started; i++) {
+        announced += reports[i].announced;
+        heard += reports[i].heard;
+        links += reports[i].links;
+        elapsed = reports[i].elapsed_ms > elapsed ? reports[i].elapsed_ms : elapsed;
+        for (int j = 0; j < reports[i].links; j++) {
+            int peer = reports[i].linked_ports[j] - BENCH_DISCOVER_PORT;
+            if (peer >= 0 && peer < total) {
+                parent[find_root(parent, i)] = find_root(parent, peer);
+            }
+        }
+    }
+    
+    int components = 0;
+    for (int i = 0; i < total; i++) {
+        components += find_root(parent, i) == i;
+    }
+    printf("%-22s %lld sent, %.1f/s on the group | %lld heard\n", "announcements",
+           announced, announced * 1000.0 / elapsed, heard);
+    printf("%-22s %.1f connections per node | %d mesh component%s\n", "mesh",
+           started > 0 ? (double)links / started : 0.0, components, components == 1 ? "" : "s");
+    if (components != 1) {
+        failed = -1;
+    }
+    
+    free(children);
+    free(report_fds);
+    free(release_fds);
+    free(reports);
+    free(times);
+    free(parent);
+    return failed;
+}
+
+// Print usage
+static void print_usage(const char* program) {
+    printf("Usage: %s [options]\n", program);
+    printf("  --threads T        Concurrent writers (default %d)\n", BENCH_DEFAULT_THREADS);
+    printf("  --messages M       Frames per writer (default %d)\n", BENCH_DEFAULT_MESSAGES);
+    printf("  --size S           Payload bytes per frame (default %d)\n",
+           BENCH_DEFAULT_SIZE);
+    printf("  --coalesce BYTES   Coalescing window (default %d)\n", COALESCE_BYTES);
+    printf("  --delay US         Coalescing delay (default 0)\n");
+    printf("  --search N         Benchmark the search index with N messages instead\n");
+    printf("  --accept N         Benchmark accepting N simultaneous dials instead\n");
+    printf("  --idle N           Benchmark memory of N idle connections instead\n");
+    printf("  --rtt N            Benchmark N round trips through a node, spinning or not\n");
+    printf("  --discover N       Benchmark LAN discovery among N node processes\n");
+}
+
+// Parse command line into config, returns 0 on success
+static int parse_options(int argc, char* argv[], BenchConfig* config) {
+    static struct option options[] = {
+        { "threads", required_argument, NULL, 't' },
+        { "messages", required_argument, NULL, 'm' },
+        { "size", required_argument, NULL, 's' },
+        { "coalesce", required_argument, NULL, 'c' },
+        { "delay", required_argument, NULL, 'd' },
+        { "search", required_argument, NULL, 'S' },
+        { "accept", required_argument, NULL, 'A' },
+        { "idle", required_argument, NULL, 'I' },
+        { "rtt", required_argument, NULL, 'R' },
+        { "discover", required_argument, NULL, 'D' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    
+    config->threads = BENCH_DEFAULT_THREADS;
+    config->messages = BENCH_DEFAULT_MESSAGES;
+    config->size = BENCH_DEFAULT_SIZE;
+    config->coalesce_bytes = COALESCE_BYTES;
+    config->coalesce_delay = 0;
+    config->search_messages = 0;
+    config->accept_connections = 0;
+    config->idle_connections = 0;
+    config->round_trips = 0;
+    config->discover_nodes = 0;
+    
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", options, NULL)) != -1) {
+        switch (opt) {
+            case 't': config->threads = atoi(optarg); break;
+            case 'm': config->messages = atoi(optarg); break;
+            case 's': config->size = atoi(optarg); break;
+            case 'c': config->coalesce_bytes = atoi(optarg); break;
+            case 'd': config->coalesce_delay = atoi(optarg); break;
+            case 'S': config->search_messages = atoi(optarg); break;
+            case 'A': config->accept_connections = atoi(optarg); break;
+            case 'I': config->idle_connections = atoi(optarg); break;
+            case 'R': config->round_trips = atoi(optarg); break;
+            case 'D': config->discover_nodes = atoi(optarg); break;
+            default: return -1;
+        }
+    }
+    
+    if (config->threads < 1 || config->messages < 1 || config->size < 8 ||
+        config->size > MAX_FRAME_PAYLOAD || config->coalesce_bytes < 1 ||
+        config->coalesce_delay < 0 || config->search_messages < 0 ||
+        config->accept_connections < 0 || config->accept_connections > 65000 ||
+        config->idle_connections < 0 || config->idle_connections > 65000 ||
+        config->round_trips < 0 || config->discover_nodes < 0 ||
+        config->discover_nodes > BENCH_DISCOVER_MAX) {
+        printf("Error: Invalid benchmark parameters\n");
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig config;
+    
+    if (parse_options(argc, argv, &config) < 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    if (config.search_messages > 0) {
+        printf("=== P2P Search Index Benchmark ===\n");
+        printf("Messages: %d | Vocabulary: %d words | Segment: %d messages | Fan-in: %d\n\n",
+               config.search_messages, BENCH_VOCABULARY, SEARCH_FLUSH_DOCS, SEARCH_MERGE_FANIN);
+        return bench_search(&config) < 0 ? 1 : 0;
+    }
+    
+    if (config.accept_connections > 0) {
+        printf("=== P2P Accept Benchmark ===\n");
+        printf("Connections: %d | Dialers: %d | Admission: %d/s per address, burst %d\n\n",
+               config.accept_connections, config.threads, ACCEPT_RATE, ACCEPT_BURST);
+        return bench_accept(&config) ? 1 : 0;
+    }
+    
+    if (config.idle_connections > 0) {
+        printf("=== P2P Idle Connection Benchmark ===\n");
+        printf("Connections: %d | Receive buffer: %d bytes | Parking after %d ms\n\n",
+               config.idle_connections, BUFFER_SIZE, BENCH_IDLE_PARK_MS);
+        return bench_idle(&config) ? 1 : 0;
+    }
+    
+    if (config.round_trips > 0) {
+        printf("=== P2P Round Trip Benchmark ===\n");
+        printf("Round trips: %d | Payload: %d bytes | %d us apart | Spin idle: %d us\n\n",
+               config.round_trips, config.size, BENCH_LATENCY_GAP_US, SPIN_IDLE_US);
+        return bench_rtt(&config) ? 1 : 0;
+    }
+    
+    if (config.discover_nodes > 0) {
+        printf("=== P2P Discovery Benchmark ===\n");
+        printf("Nodes: %d | Interval: %d ms | Group rate: %d/s | Dials per node: %d\n\n",
+               config.discover_nodes, DISCOVERY_INTERVAL_MS, DISCOVERY_GROUP_RATE,
+               DISCOVERY_PEERS);
+        return bench_discover(&config) ? 1 : 0;
+    }
+    
+    if (initialize_sockets() < 0) {
+        printf("Error: Socket initialization failed\n");
+        return 1;
+    }
+    
+    printf("=== P2P Send Path Benchmark ===\n");
+    printf("Writers: %d | Frames per writer: %d | Payload: %d bytes | "
+           "Window: %d bytes | Delay: %d us\n\n", config.threads, config.messages,
+           config.size, config.coalesce_bytes, config.coalesce_delay);
+    
+    int failed = 0;
+    printf("Throughput\n");
+    failed |= bench_throughput(&config, "send per message", BENCH_MODE_SEND_FRAME, 0);
+    failed |= bench_throughput(&config, "batch, no coalescing", BENCH_MODE_BATCH, 0);
+    failed |= bench_throughput(&config, "batch, coalesced", BENCH_MODE_BATCH,
+                               config.coalesce_bytes);
+    
+    printf("\nIdle latency (%d frames, %d us apart)\n", BENCH_LATENCY_SAMPLES,
+           BENCH_LATENCY_GAP_US);
+    failed |= bench_latency(&config, "send per message", BENCH_MODE_SEND_FRAME, 0);
+    failed |= bench_latency(&config, "batch, coalesced", BENCH_MODE_BATCH,
+                            config.coalesce_bytes);
+    
+    cleanup_sockets();
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,79 @@
+#include "bufpool.h"
+
+// Receive buffers of this node
+BufferPool recv_buffers;
+
+// Start empty with buffers of size bytes
+int init_buffer_pool(BufferPool* pool, size_t size, int keep) {
+    pool->free = malloc(keep * sizeof(void*));
+    if (pool->free == NULL) {
+        return -1;
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+    pool->count = 0;
+    pool->keep = keep;
+    pool->size = size;
+    pool->in_use = 0;
+    return 0;
+}
+
+// Free the kept buffers (taken ones are freed as they come back)
+void free_buffer_pool(BufferPool* pool) {
+    pthread_mutex_lock(&pool->mutex);
+    for (int i = 0; i < pool->count; i++) {
+        free(pool->free[i]);
+    }
+    free(pool->free);
+    pool->free = NULL;
+    pool->count = 0;
+    pool->keep = 0;
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+// Take a kept buffer, or allocate one
+void* buffer_take(BufferPool* pool) {
+    void* buffer = NULL;
+    
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->count > 0) {
+        buffer = pool->free[--pool->count];
+    }
+    size_t size = pool->size;
+    pool->in_use++;
+    pthread_mutex_unlock(&pool->mutex);
+    
+    if (buffer == NULL) {
+        buffer = malloc(size);
+    }
+    if (buffer == NULL) {
+        pthread_mutex_lock(&pool->mutex);
+        pool->in_use--;
+        pthread_mutex_unlock(&pool->mutex);
+    }
+    return buffer;
+}
+
+// Keep the buffer for reuse, or free it when enough are kept
+void buffer_give(BufferPool* pool, void* buffer) {
+    if (buffer == NULL) {
+        return;
+    }
+    
+    pthread_mutex_lock(&pool->mutex);
+    pool->in_use--;
+    if (pool->count < pool->keep) {
+        pool->free[pool->count++] = buffer;
+        buffer = NULL;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    
+    free(buffer);
+}
+
+// Buffers taken, and free ones kept
+void buffer_pool_stats(BufferPool* pool, int* in_use, int* pooled) {
+    pthread_mutex_lock(&pool->mutex);
+    *in_use = pool->in_use;
+    *pooled = pool->count;
+    pthread_mutex_unlock(&pool->mutex);
+}
@@ -0,0 +1,38 @@
+#ifndef BUFPOOL_H
+#define BUFPOOL_H
+
+#include "common.h"
+#include <pthread.h>
+
+// Pool of equally sized buffers. Receivers take one when data arrives and
+// give it back once their connection goes quiet, so an idle connection
+// holds no receive buffer; a few returned buffers are kept for the next
+// burst, the rest are freed.
+
+#define BUFFER_POOL_KEEP 32          // Free buffers kept for reuse
+
+// Buffer pool
+typedef struct {
+    pthread_mutex_t mutex;
+    void** free;                     // Returned buffers, up to keep
+    int count;
+    int keep;
+    size_t size;
+    int in_use;                      // Taken and not returned
+} BufferPool;
+
+// Receive buffers of this node, buffer_size bytes each
+extern BufferPool recv_buffers;
+
+// Start empty with buffers of size bytes; 0 on success
+int init_buffer_pool(BufferPool* pool, size_t size, int keep);
+void free_buffer_pool(BufferPool* pool);
+
+// Take a buffer (NULL when out of memory), give it back when done
+void* buffer_take(BufferPool* pool);
+void buffer_give(BufferPool* pool, void* buffer);
+
+// Buffers taken, and free ones kept
+void buffer_pool_stats(BufferPool* pool, int* in_use, int* pooled);
+
+#endif // BUFPOOL_H
@@ -0,0 +1,354 @@
+#include "capture.h"
+#include "timeutil.h"
+#include "trace.h"
+#include <time.h>
+
+// Capture of this node
+Capture node_capture;
+
+// Longest record before its payload: five varints and two bytes
+#define CAPTURE_RECORD_HEADER 40
+
+// Append value as LEB128 varint, returns bytes written
+static int encode_varint(uint64_t value, unsigned char* out) {
+    int length = 0;
+    while (value >= 0x80) {
+        out[length++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[length++] = (unsigned char)value;
+    return length;
+}
+
+// Read a varint from file, -1 at the end or past 64 bits
+static int read_varint(FILE* file, uint64_t* value) {
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = getc(file);
+        if (byte == EOF) {
+            return -1;
+        }
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Start stopped
+void init_capture(Capture* capture) {
+    memset(capture, 0, sizeof(*capture));
+    pthread_mutex_init(&capture->mutex, NULL);
+    pthread_cond_init(&capture->ready, NULL);
+}
+
+// Move the records being appended to spare for the writer (caller holds mutex)
+static void swap_buffers(Capture* capture) {
+    unsigned char* full = capture->buffer;
+    capture->buffer = capture->spare;
+    capture->spare = full;
+    capture->spare_used = capture->used;
+    capture->used = 0;
+}
+
+// Write full buffers as they come, and a partly filled one every
+// CAPTURE_FLUSH_MS; on stop, whatever is left
+static void* capture_writer_thread(void* arg) {
+    Capture* capture = arg;
+    TRACE_THREAD("capture");
+    
+    pthread_mutex_lock(&capture->mutex);
+    for (;;) {
+        if (capture->spare_used == 0 && !capture->stopping) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += CAPTURE_FLUSH_MS * 1000000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000;
+            deadline.tv_nsec %= 1000000000;
+            pthread_cond_timedwait(&capture->ready, &capture->mutex, &deadline);
+        }
+        if (capture->spare_used == 0 && capture->used > 0) {
+            swap_buffers(capture);
+        }
+        if (capture->spare_used == 0) {
+            if (capture->stopping) {
+                break;
+            }
+            continue;
+        }
+        
+        // Appending goes on into the other buffer meanwhile
+        size_t length = capture->spare_used;
+        pthread_mutex_unlock(&capture->mutex);
+        TRACE_BEGIN("capture write");
+        int written = fwrite(capture->spare, 1, length, capture->file) == length &&
+                      fflush(capture->file) == 0;
+        TRACE_END("capture write");
+        pthread_mutex_lock(&capture->mutex);
+        
+        capture->spare_used = 0;
+        if (!written) {
+            // Recording on would only count frames that never reach the disk
+            capture->failed = 1;
+            capture->active = 0;
+            break;
+        }
+        capture->bytes += (long long)length;
+    }
+    pthread_mutex_unlock(&capture->mutex);
+    return NULL;
+}
+
+// Open capture->path with mode, write header unless NULL, allocate the
+// buffers and start the writer (caller holds mutex)
+static int open_capture(Capture* capture, const char* mode, const unsigned char* header) {
+    // Room for the largest frame this node sends or accepts
+    capture->size = CAPTURE_RECORD_HEADER + (size_t)frame_payload_limit;
+    if (capture->size < CAPTURE_BUFFER_SIZE) {
+        capture->size = CAPTURE_BUFFER_SIZE;
+    }
+    
+    capture->file = fopen(capture->path, mode);
+    capture->buffer = malloc(capture->size);
+    capture->spare = malloc(capture->size);
+    int result = capture->file != NULL && capture->buffer != NULL && capture->spare != NULL &&
+                 (header == NULL ||
+                  fwrite(header, 1, CAPTURE_HEADER_SIZE, capture->file) == CAPTURE_HEADER_SIZE)
+                 ? 0 : -1;
+    
+    capture->used = 0;
+    capture->spare_used = 0;
+    capture->stopping = 0;
+    capture->failed = 0;
+    if (result == 0 && pthread_create(&capture->writer, NULL, capture_writer_thread, capture) != 0) {
+        result = -1;
+    }
+    
+    if (result < 0) {
+        if (capture->file != NULL) {
+            fclose(capture->file);
+            if (header != NULL) {
+                remove(capture->path);
+            }
+        }
+        free(capture->buffer);
+        free(capture->spare);
+        capture->file = NULL;
+        capture->buffer = NULL;
+        capture->spare = NULL;
+    } else {
+        capture->active = 1;
+    }
+    return result;
+}
+
+// Create path, write the file header and start the writer thread
+int capture_start(Capture* capture, const char* path) {
+    if (strlen(path) >= sizeof(capture->path)) {
+        return -1;
+    }
+    
+    // A capture whose file failed has stopped recording but not closed
+    pthread_mutex_lock(&capture->mutex);
+    int failed = capture->file != NULL && capture->failed;
+    pthread_mutex_unlock(&capture->mutex);
+    if (failed) {
+        capture_stop(capture);
+    }
+    
+    pthread_mutex_lock(&capture->mutex);
+    if (capture->file != NULL) {
+        pthread_mutex_unlock(&capture->mutex);
+        return -2;
+    }
+    
+    unsigned char header[CAPTURE_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    encode_u32(CAPTURE_MAGIC, header);
+    header[4] = CAPTURE_VERSION;
+    encode_u64((uint64_t)get_wall_ms() * 1000000, header + 8);
+    
+    strcpy(capture->path, path);
+    capture->frames = 0;
+    capture->dropped = 0;
+    capture->bytes = CAPTURE_HEADER_SIZE;
+    capture->start_ns = get_monotonic_ns();
+    capture->last_ns = capture->start_ns;
+    int result = open_capture(capture, "wb", header);
+    pthread_mutex_unlock(&capture->mutex);
+    return result;
+}
+
+// Reopen the file of the capture last stopped and append to it; the time
+// between stop and resume becomes the delay before the next record
+int capture_resume(Capture* capture) {
+    pthread_mutex_lock(&capture->mutex);
+    if (capture->file != NULL) {
+        pthread_mutex_unlock(&capture->mutex);
+        return -2;
+    }
+    int result = capture->path[0] != '\0' ? open_capture(capture, "ab", NULL) : -1;
+    pthread_mutex_unlock(&capture->mutex);
+    return result;
+}
+
+// Stop recording, let the writer empty both buffers, then close the file;
+// returns 1 if a capture was recording
+int capture_stop(Capture* capture) {
+    pthread_mutex_lock(&capture->mutex);
+    if (capture->file == NULL) {
+        pthread_mutex_unlock(&capture->mutex);
+        return 0;
+    }
+    int recording = capture->active;
+    capture->active = 0;
+    capture->stopping = 1;
+    pthread_cond_signal(&capture->ready);
+    pthread_mutex_unlock(&capture->mutex);
+    
+    pthread_join(capture->writer, NULL);
+    
+    pthread_mutex_lock(&capture->mutex);
+    fclose(capture->file);
+    free(capture->buffer);
+    free(capture->spare);
+    capture->file = NULL;
+    capture->buffer = NULL;
+    capture->spare = NULL;
+    pthread_mutex_unlock(&capture->mutex);
+    return recording;
+}
+
+// Encode one frame into the buffer; when it is full and the writer has
+// finished the other one, hand it over, otherwise drop the frame
+void capture_frame(Capture* capture, int conn_id, int direction, const FrameHeader* header,
+                   const unsigned char* payload) {
+    if (!capture->active) {
+        return;
+    }
+    
+    size_t size = CAPTURE_RECORD_HEADER + header->length;
+    pthread_mutex_lock(&capture->mutex);
+    if (!capture->active) {
+        pthread_mutex_unlock(&capture->mutex);
+        return;
+    }
+    
+    if (capture->used + size > capture->size && capture->spare_used == 0 &&
+        capture->used > 0) {
+        swap_buffers(capture);
+        pthread_cond_signal(&capture->ready);
+    }
+    if (capture->used + size > capture->size) {
+        capture->dropped++;
+        pthread_mutex_unlock(&capture->mutex);
+        return;
+    }
+    
+    // Timed under the mutex so records are in time order
+    long long now = get_monotonic_ns();
+    unsigned char* out = capture->buffer + capture->used;
+    size_t length = 0;
+    length += encode_varint((uint64_t)(now - capture->last_ns), out + length);
+    length += encode_varint((uint64_t)conn_id << 1 | (uint64_t)direction, out + length);
+    out[length++] = header->type;
+    out[length++] = header->flags;
+    length += encode_varint(header->stream, out + length);
+    length += encode_varint(header->seq, out + length);
+    length += encode_varint(header->length, out + length);
+    if (header->length > 0) {
+        memcpy(out + length, payload, header->length);
+        length += header->length;
+    }
+    
+    capture->used += length;
+    capture->last_ns = now;
+    capture->frames++;
+    pthread_mutex_unlock(&capture->mutex);
+}
+
+// Frames recorded and dropped, bytes written, whether it is on and whether
+// writing to the file failed
+void capture_stats(Capture* capture, long long* frames, long long* bytes, long long* dropped,
+                   int* active, int* failed) {
+    pthread_mutex_lock(&capture->mutex);
+    *frames = capture->frames;
+    *bytes = capture->bytes;
+    *dropped = capture->dropped;
+    *active = capture->active;
+    *failed = capture->failed;
+    pthread_mutex_unlock(&capture->mutex);
+}
+
+// Open a capture file and check its header
+int capture_open(CaptureReader* reader, const char* path) {
+    unsigned char header[CAPTURE_HEADER_SIZE];
+    
+    memset(reader, 0, sizeof(*reader));
+    reader->file = fopen(path, "rb");
+    if (reader->file == NULL) {
+        return -1;
+    }
+    if (fread(header, 1, sizeof(header), reader->file) != sizeof(header) ||
+        decode_u32(header) != CAPTURE_MAGIC || header[4] != CAPTURE_VERSION) {
+        fclose(reader->file);
+        reader->file = NULL;
+        return -2;
+    }
+    reader->start_wall_ns = (long long)decode_u64(header + 8);
+    return 0;
+}
+
+// Read the next frame
+int capture_next(CaptureReader* reader, CaptureRecord* record) {
+    uint64_t delta, key, stream, seq, length;
+    int type, flags;
+    
+    int first = getc(reader->file);
+    if (first == EOF) {
+        return 0;
+    }
+    ungetc(first, reader->file);
+    
+    if (read_varint(reader->file, &delta) < 0 || read_varint(reader->file, &key) < 0 ||
+        (type = getc(reader->file)) == EOF || (flags = getc(reader->file)) == EOF ||
+        read_varint(reader->file, &stream) < 0 || read_varint(reader->file, &seq) < 0 ||
+        read_varint(reader->file, &length) < 0 || stream > 0xffff || length > 0xffffffffu) {
+        return -1;
+    }
+    
+    if (length > reader->capacity) {
+        unsigned char* payload = realloc(reader->payload, (size_t)length);
+        if (payload == NULL) {
+            return -1;
+        }
+        reader->payload = payload;
+        reader->capacity = (size_t)length;
+    }
+    if (length > 0 && fread(reader->payload, 1, (size_t)length, reader->file) != length) {
+        return -1;
+    }
+    
+    reader->time_ns += (long long)delta;
+    record->time_ns = reader->time_ns;
+    record->conn_id = (int)(key >> 1);
+    record->direction = (int)(key & 1);
+    record->header.type = (uint8_t)type;
+    record->header.flags = (uint8_t)flags;
+    record->header.stream = (uint16_t)stream;
+    record->header.seq = seq;
+    record->header.length = (uint32_t)length;
+    record->payload = reader->payload;
+    return 1;
+}
+
+// Close the file and free the payload buffer
+void capture_close(CaptureReader* reader) {
+    if (reader->file != NULL) {
+        fclose(reader->file);
+    }
+    free(reader->payload);
+    memset(reader, 0, sizeof(*reader));
+}
@@ -0,0 +1,105 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "common.h"
+#include "protocol.h"
+#include <stdint.h>
+#include <pthread.h>
+
+// Wire capture: every frame the node sends or receives, per connection,
+// with a nanosecond timestamp. Frames are encoded into a memory buffer
+// under a short lock; a writer thread takes the buffer when it fills (or
+// every CAPTURE_FLUSH_MS) and writes it out while the next one fills, so
+// senders and receivers never wait for the disk. When both buffers are
+// full, frames are dropped and counted instead; when a write fails, the
+// capture stops recording and reports it.
+//
+// File: magic(4) version(1) reserved(3) start(8, wall clock ns since the
+// epoch), then per frame: varint ns since the previous frame, varint
+// conn_id << 1 | direction, type(1), flags(1), varint stream, varint seq,
+// varint length, payload.
+
+#define CAPTURE_MAGIC 0x50325743u      // "P2WC"
+#define CAPTURE_VERSION 1
+#define CAPTURE_HEADER_SIZE 16
+#define CAPTURE_BUFFER_SIZE (1 << 20)  // Bytes per buffer at least, two are in use
+#define CAPTURE_PATH_LENGTH 256
+#define CAPTURE_FLUSH_MS 100           // A partly filled buffer is written after this
+
+// Direction of a captured frame
+#define CAPTURE_IN 0                   // Received from the peer
+#define CAPTURE_OUT 1                  // Sent to the peer
+
+// Capture of a node
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t ready;           // A buffer is waiting to be written, or stop
+    volatile int active;            // Read without the mutex on the frame paths
+    int stopping;
+    FILE* file;                     // NULL = no writer to stop
+    char path[CAPTURE_PATH_LENGTH]; // File of the current or last capture
+    pthread_t writer;
+    size_t size;                    // Bytes per buffer, fits the largest frame
+    unsigned char* buffer;          // Records being appended
+    size_t used;
+    unsigned char* spare;           // Records being written
+    size_t spare_used;              // 0 = spare is free
+    long long start_ns;             // Monotonic time of the start
+    long long last_ns;              // Monotonic time of the last record
+    long long frames;               // Frames recorded
+    long long bytes;                // Bytes written to the file
+    long long dropped;              // Frames lost to full buffers
+    int failed;                     // A write to the file failed, recording stopped
+} Capture;
+
+// One frame read back from a capture file
+typedef struct {
+    long long time_ns;              // Since the capture started
+    int conn_id;
+    int direction;                  // CAPTURE_IN or CAPTURE_OUT
+    FrameHeader header;
+    const unsigned char* payload;   // Valid until the next capture_next
+} CaptureRecord;
+
+// Sequential reader of a capture file
+typedef struct {
+    FILE* file;
+    long long start_wall_ns;        // Wall clock at the start of the capture
+    long long time_ns;
+    unsigned char* payload;
+    size_t capacity;
+} CaptureReader;
+
+// Capture of this node, on while config capture names a file or after
+// p2p_capture_start
+extern Capture node_capture;
+
+void init_capture(Capture* capture);
+
+// Start writing to path: 0 on success, -1 if it cannot be created,
+// -2 if already capturing
+int capture_start(Capture* capture, const char* path);
+
+// Write what is buffered and close the file; returns 1 if it was recording
+int capture_stop(Capture* capture);
+
+// Append to the file of the last capture again, as after capture_start:
+// 0, -1 if it cannot be opened, -2 if already capturing
+int capture_resume(Capture* capture);
+
+// Record a frame (payload is header->length bytes); no-op unless capturing
+void capture_frame(Capture* capture, int conn_id, int direction, const FrameHeader* header,
+                   const unsigned char* payload);
+
+// Frames recorded and dropped, bytes written, whether it is on and whether
+// a write to the file failed
+void capture_stats(Capture* capture, long long* frames, long long* bytes, long long* dropped,
+                   int* active, int* failed);
+
+// Reading: open returns 0, -1 if the file cannot be read, -2 if it is not
+// a capture; next returns 1 per record, 0 at the end, -1 if cut short
+int capture_open(CaptureReader* reader, const char* path);
+int capture_next(CaptureReader* reader, CaptureRecord* record);
+void capture_close(CaptureReader* reader);
+
+#endif // CAPTURE_H
@@ -1,10 +1,294 @@
 #include "command.h"
-#include "socket.h"
-#include "connection.h"
 #include "signal.h"
+#include "trace.h"
+#include "timeutil.h"
+#include <pthread.h>
+#include <time.h>
 
-// External global variables
-extern int running;
+// Incoming stream being written to disk; refused streams keep an entry
+// without a file so data already in flight is dropped quietly
+typedef struct {
+    int in_use;
+    int conn_id;
+    int stream;
+    FILE* file;
+    long bytes;
+    long limit;
+    char path[MAX_COMMAND_LENGTH + 48];
+} ReceivedFile;
+
+static ReceivedFile received_files[MAX_RECEIVED_FILES];
+static pthread_mutex_t received_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Outgoing file, owned by its sender thread
+typedef struct {
+    P2PContext* ctx;
+    int conn_id;
+    char path[MAX_COMMAND_LENGTH];
+} FileTransfer;
+
+// Read a numeric configuration value
+static int config_int(const char* key) {
+    char value[32];
+    if (p2p_config_get(key, value, sizeof(value)) != P2P_OK) {
+        return 0;
+    }
+    return atoi(value);
+}
+
+// Create dir/p2p_recv_<conn>_<stream>.dat, or with _<n> appended when that
+// name is taken; never opens an existing file
+static FILE* create_received_file(ReceivedFile* entry, const char* dir) {
+    for (int attempt = 0; attempt < RECV_NAME_ATTEMPTS; attempt++) {
+        if (attempt == 0) {
+            snprintf(entry->path, sizeof(entry->path), "%s/p2p_recv_%d_%d.dat",
+                     dir, entry->conn_id, entry->stream);
+        } else {
+            snprintf(entry->path, sizeof(entry->path), "%s/p2p_recv_%d_%d_%d.dat",
+                     dir, entry->conn_id, entry->stream, attempt);
+        }
+        FILE* file = fopen(entry->path, "wbx");
+        if (file != NULL || errno != EEXIST) {
+            return file;
+        }
+    }
+    errno = EEXIST;
+    return NULL;
+}
+
+// Give up on a file being received: delete what was written and keep the
+// entry as refused
+static void discard_received_file(ReceivedFile* entry) {
+    fclose(entry->file);
+    entry->file = NULL;
+    remove(entry->path);
+}
+
+// Save stream data under recv_dir, refusing the stream with a reset when
+// recv_dir is unset, the file cannot be written or it grows past recv_max.
+// Returns 1 if the event was printed
+static int receive_stream(const P2PEvent* event) {
+    pthread_mutex_lock(&received_mutex);
+    
+    ReceivedFile* entry = NULL;
+    ReceivedFile* unused = NULL;
+    ReceivedFile* refused = NULL;
+    for (int i = 0; i < MAX_RECEIVED_FILES; i++) {
+        ReceivedFile* candidate = &received_files[i];
+        if (!candidate->in_use) {
+            if (unused == NULL) {
+                unused = candidate;
+            }
+        } else if (candidate->conn_id == event->conn_id &&
+                   candidate->stream == event->stream) {
+            entry = candidate;
+            break;
+        } else if (candidate->file == NULL && refused == NULL) {
+            refused = candidate;
+        }
+    }
+    
+    int printed = 0;
+    int reset = 0;
+    if (entry == NULL) {
+        // A refused stream's entry only filters stragglers, so it may be reused
+        entry = unused != NULL ? unused : refused;
+        if (entry == NULL) {
+            pthread_mutex_unlock(&received_mutex);
+            printf("\n[Error] Too many incoming files, refused stream %d from %s:%d\n",
+                   event->stream, event->ip, event->port);
+            p2p_stream_reset(app_context, event->conn_id, event->stream);
+            return 1;
+        }
+        
+        char dir[MAX_COMMAND_LENGTH];
+        if (p2p_config_get("recv_dir", dir, sizeof(dir)) != P2P_OK) {
+            dir[0] = '\0';
+        }
+        
+        entry->in_use = 1;
+        entry->conn_id = event->conn_id;
+        entry->stream = event->stream;
+        entry->bytes = 0;
+        entry->limit = config_int("recv_max");
+        entry->file = NULL;
+        if (dir[0] == '\0') {
+            printf("\n[File from %s:%d] Refused stream %d, set recv_dir to accept files\n",
+                   event->ip, event->port, event->stream);
+            printed = 1;
+            reset = 1;
+        } else {
+            entry->file = create_received_file(entry, dir);
+            if (entry->file == NULL) {
+                printf("\n[Error] Cannot create %s: %s\n", entry->path, strerror(errno));
+                printed = 1;
+                reset = 1;
+            }
+        }
+    }
+    
+    if (entry->file != NULL && event->length > 0) {
+        if ((long)event->length > entry->limit - entry->bytes) {
+            discard_received_file(entry);
+            printf("\n[Error] File from %s:%d exceeds recv_max (%ld bytes), refused\n",
+                   event->ip, event->port, entry->limit);
+            printed = 1;
+            reset = 1;
+        } else if (fwrite(event->data, 1, event->length, entry->file) != event->length) {
+            printf("\n[Error] Cannot write %s: %s\n", entry->path, strerror(errno));
+            discard_received_file(entry);
+            printed = 1;
+            reset = 1;
+        } else {
+            entry->bytes += (long)event->length;
+        }
+    }
+    
+    if (event->fin) {
+        if (entry->file != NULL) {
+            int failed = fclose(entry->file) != 0;
+            entry->file = NULL;
+            if (failed) {
+                printf("\n[Error] Cannot write %s: %s\n", entry->path, strerror(errno));
+                remove(entry->path);
+            } else {
+                printf("\n[File from %s:%d] %ld bytes saved to %s\n",
+                       event->ip, event->port, entry->bytes, entry->path);
+            }
+            printed = 1;
+        }
+        entry->in_use = 0;
+        reset = 0;
+    }
+    
+    pthread_mutex_unlock(&received_mutex);
+    if (reset) {
+        p2p_stream_reset(app_context, event->conn_id, event->stream);
+    }
+    return printed;
+}
+
+// Close files of a connection whose link went away, streams end with it
+static void abandon_streams(int conn_id) {
+    pthread_mutex_lock(&received_mutex);
+    for (int i = 0; i < MAX_RECEIVED_FILES; i++) {
+        ReceivedFile* entry = &received_files[i];
+        if (!entry->in_use || entry->conn_id != conn_id) {
+            continue;
+        }
+        if (entry->file != NULL) {
+            fclose(entry->file);
+            entry->file = NULL;
+            printf("\n[Error] Incomplete file %s (%ld bytes)\n", entry->path, entry->bytes);
+        }
+        entry->in_use = 0;
+    }
+    pthread_mutex_unlock(&received_mutex);
+}
+
+// Local time of a timestamp in milliseconds, strftime format
+static void format_local(long long timestamp_ms, const char* format, char* out, size_t size) {
+    time_t seconds = (time_t)(timestamp_ms / 1000);
+    struct tm local;
+    #ifdef _WIN32
+    localtime_s(&local, &seconds);
+    #else
+    localtime_r(&seconds, &local);
+    #endif
+    strftime(out, size, format, &local);
+}
+
+// Local wall clock time of a room log timestamp
+static void format_clock(long long timestamp_ms, char* out, size_t size) {
+    format_local(timestamp_ms, "%H:%M:%S", out, size);
+}
+
+// Print an event from the library, then restore the prompt
+void handle_event(const P2PEvent* event, void* user_data) {
+    (void)user_data; // Unused parameter
+    
+    switch (event->type) {
+        case P2P_EVENT_CONNECTED:
+            // Outbound connections are reported by the connect command
+            if (event->outbound) {
+                return;
+            }
+            printf("\n[New connection] Peer connected from %s:%d (ID: %d)\n", 
+                   event->ip, event->port, event->conn_id);
+            break;
+            
+        case P2P_EVENT_MESSAGE:
+            printf("\n[Message from %s:%d]: %.*s\n", event->ip, event->port,
+                   (int)event->length, (const char*)event->data);
+            break;
+            
+        case P2P_EVENT_PUBLISH:
+            if (event->repaired || event->late) {
+                // Out of order: say where it belongs in the room
+                char when[16];
+                format_clock(event->timestamp, when, sizeof(when));
+                printf("\n[%s] %s %08llx at %s: %.*s\n", event->topic,
+                       event->repaired ? "missed from" : "late from",
+                       event->origin & 0xffffffffULL, when,
+                       (int)event->length, (const char*)event->data);
+            } else {
+                printf("\n[%s] %s:%d: %.*s\n", event->topic, event->ip, event->port,
+                       (int)event->length, (const char*)event->data);
+            }
+            break;
+            
+        case P2P_EVENT_RECONNECTED:
+            printf("\n[Reconnected] Peer %s:%d (ID: %d), "
+                   "replayed %d queued message(s)\n",
+                   event->ip, event->port, event->conn_id, event->replayed);
+            break;
+            
+        case P2P_EVENT_OFFLINE:
+            abandon_streams(event->conn_id);
+            printf("\n[Connection lost] Peer %s:%d (ID: %d), %s\n", 
+                   event->ip, event->port, event->conn_id, event->outbound ?
+                   "reconnecting" : "waiting for peer to reconnect");
+            break;
+            
+        case P2P_EVENT_DISCONNECTED:
+            abandon_streams(event->conn_id);
+            if (event->reason == P2P_REASON_CLOSED) {
+                printf("\n[Connection closed] Peer %s:%d disconnected (ID: %d)\n", 
+                       event->ip, event->port, event->conn_id);
+            } else if (event->reason == P2P_REASON_PROTOCOL) {
+                printf("\n[Error] Invalid frame from %s:%d (ID: %d)\n", 
+                       event->ip, event->port, event->conn_id);
+            } else {
+                printf("\n[Error] Connection with %s:%d lost (ID: %d)\n", 
+                       event->ip, event->port, event->conn_id);
+            }
+            break;
+            
+        case P2P_EVENT_ERROR:
+            if (event->conn_id >= 0) {
+                printf("\n[Error] Connection with %s:%d (ID: %d): %s\n", event->ip,
+                       event->port, event->conn_id, p2p_strerror(event->error));
+            } else if (event->ip != NULL) {
+                printf("\n[Error] Rejected %s:%d: %s\n", event->ip, event->port,
+                       p2p_strerror(event->error));
+            } else {
+                printf("\n[Error] Accept failed\n");
+            }
+            break;
+            
+        case P2P_EVENT_STREAM:
+            if (!receive_stream(event)) {
+                return;
+            }
+            break;
+            
+        default:
+            return;
+    }
+    
+    printf("> ");
+    fflush(stdout);
+}
 
 // Command: help
 void cmd_help(void) {
@@ -16,118 +300,571 @@ void cmd_help(void) {
     printf("list                     - List all active connections\n");
     printf("terminate <id>           - Terminate a connection\n");
     printf("send <id> <message>      - Send message to a peer\n");
+    printf("send <ip:port> <message> - Send to a peer, connecting in the background\n");
+    printf("broadcast <message>      - Send message to all peers\n");
+    printf("join <topic>             - Subscribe to a topic\n");
+    printf("leave <topic>            - Unsubscribe from a topic\n");
+    printf("publish <topic> <msg>    - Send message to topic subscribers\n");
+    printf("sendfile <id> <path>     - Stream a file to a peer in the background\n");
+    printf("topics                   - List known topics\n");
+    printf("peers                    - List the address book\n");
+    printf("discovered               - List peers heard on the LAN\n");
+    printf("stats                    - Show memory use per connection\n");
+    printf("history <topic> [n]      - Show the room log in its agreed order\n");
+    printf("search <words>           - Find messages containing all words\n");
+    printf("trace dump <file>        - Write trace events (Chrome JSON)\n");
+    printf("capture start <file>     - Record every frame sent and received\n");
+    printf("capture stop             - Stop recording (capture: show counts)\n");
+    printf("config show              - Show effective configuration\n");
+    printf("handoff                  - Pass peers to a new process (--takeover)\n");
     printf("exit                     - Exit the application\n");
     printf("=====================================\n\n");
 }
 
+// Check message against the node's limit, printing an error if too long
+static int check_message_length(const char* message) {
+    size_t limit = p2p_max_payload(app_context);
+    if (strlen(message) > limit) {
+        printf("Error: Message exceeds maximum length of %d characters\n", 
+               (int)limit);
+        return 0;
+    }
+    return 1;
+}
+
 // Command: myip
 void cmd_myip(void) {
-    printf("Your IP address: %s\n", local_ip);
+    printf("Your IP address: %s\n", p2p_local_ip(app_context));
 }
 
 // Command: myport
 void cmd_myport(void) {
-    printf("Listening port: %d\n", listen_port);
+    printf("Listening port: %d\n", p2p_listen_port(app_context));
 }
 
 // Command: connect
 void cmd_connect(const char* ip, int port) {
-    // Validate IP
-    if (!is_valid_ip(ip)) {
-        printf("Error: Invalid IP address\n");
-        return;
-    }
-    
     // Validate port
-    if (!is_valid_port(port)) {
+    if (port <= 0 || port > 65535) {
         printf("Error: Invalid port number (must be 1-65535)\n");
         return;
     }
     
-    // Check if connecting to self
-    if (strcmp(ip, local_ip) == 0 && port == listen_port) {
+    int conn_id = p2p_connect(app_context, ip, port);
+    if (conn_id >= 0) {
+        printf("Successfully connected to %s:%d (ID: %d)\n", ip, port, conn_id);
+    } else if (conn_id == P2P_ERR_INVALID) {
+        printf("Error: Invalid IP address\n");
+    } else if (conn_id == P2P_ERR_SELF) {
         printf("Error: Cannot connect to yourself\n");
-        return;
-    }
-    
-    // Check if connection already exists
-    if (find_connection_by_address(ip, port) != -1) {
+    } else if (conn_id == P2P_ERR_EXISTS) {
         printf("Error: Connection already exists to %s:%d\n", ip, port);
-        return;
-    }
-    
-    // Connect to peer
-    SOCKET sock;
-    if (connect_to_peer(ip, port, &sock) < 0) {
+    } else if (conn_id == P2P_ERR_CONNECT) {
         printf("Error: Failed to connect to %s:%d\n", ip, port);
-        return;
-    }
-    
-    // Add connection
-    int conn_id = add_connection(sock, ip, port);
-    if (conn_id != -1) {
-        printf("Successfully connected to %s:%d (ID: %d)\n", ip, port, conn_id);
     } else {
-        close(sock);
+        printf("Error: %s\n", p2p_strerror(conn_id));
     }
 }
 
 // Command: list
 void cmd_list(void) {
-    print_connection_list();
+    static const char* state_names[] = { "connecting", "online", "offline" };
+    int capacity = config_int("max_connections");
+    P2PConnectionInfo* info = malloc(sizeof(P2PConnectionInfo) * capacity);
+    if (info == NULL) {
+        printf("Error: Out of memory\n");
+        return;
+    }
+    
+    int count = p2p_list_connections(app_context, info, capacity);
+    
+    printf("\n=== Active Connections ===\n");
+    for (int i = 0; i < count; i++) {
+        printf("ID: %d | IP: %s | Port: %d | State: %s | Queued: %d\n", 
+               info[i].id, info[i].ip, info[i].port,
+               state_names[info[i].state], info[i].queued);
+    }
+    
+    if (count == 0) {
+        printf("No active connections\n");
+    }
+    
+    P2PAcceptStats accepts;
+    if (p2p_accept_stats(app_context, &accepts) == P2P_OK &&
+        accepts.shed_rate + accepts.shed_full > 0) {
+        printf("Inbound: %lld accepted | shed %lld over accept_rate, %lld with table full\n",
+               accepts.accepted, accepts.shed_rate, accepts.shed_full);
+    }
+    printf("==========================\n\n");
+    free(info);
 }
 
 // Command: terminate
 void cmd_terminate(int conn_id) {
-    if (find_connection_by_id(conn_id) == -1) {
+    if (p2p_close(app_context, conn_id) != P2P_OK) {
         printf("Error: Connection ID %d not found\n", conn_id);
         return;
     }
     
-    close_connection(conn_id);
     printf("Connection %d terminated\n", conn_id);
 }
 
 // Command: send
 void cmd_send(int conn_id, const char* message) {
-    if (strlen(message) > MAX_MESSAGE_LENGTH) {
-        printf("Error: Message exceeds maximum length of %d characters\n", 
-               MAX_MESSAGE_LENGTH);
+    if (!check_message_length(message)) {
         return;
     }
     
-    Connection* conn = get_connection_by_id(conn_id);
-    if (conn == NULL) {
+    int result = p2p_send(app_context, conn_id, message, strlen(message));
+    if (result == P2P_ERR_NOT_FOUND) {
         printf("Error: Connection ID %d not found\n", conn_id);
+    } else if (result < 0) {
+        printf("Error: Failed to send message\n");
+    } else if (result > 0) {
+        printf("Peer offline, message queued for connection %d\n", conn_id);
+    } else {
+        printf("Message sent to connection %d\n", conn_id);
+    }
+}
+
+// Command: send to ip:port
+void cmd_send_to(const char* address, const char* message) {
+    char ip[MAX_COMMAND_LENGTH];
+    int port;
+    char extra;
+    if (sscanf(address, "%[^:]:%d%c", ip, &port, &extra) != 2) {
+        printf("Usage: send <ip:port> <message>\n");
+        return;
+    }
+    if (!check_message_length(message)) {
         return;
     }
     
-    if (send_message(conn->socket, message) < 0) {
+    int result = p2p_send_to(app_context, ip, port, message, strlen(message));
+    if (result == P2P_ERR_INVALID) {
+        printf("Error: Invalid address %s\n", address);
+    } else if (result == P2P_ERR_SELF) {
+        printf("Error: Cannot send to yourself\n");
+    } else if (result == P2P_ERR_LIMIT) {
+        printf("Error: Connection table full\n");
+    } else if (result < 0) {
         printf("Error: Failed to send message\n");
-        remove_connection(conn_id);
+    } else if (result > 0) {
+        printf("Message queued for %s:%d\n", ip, port);
     } else {
-        printf("Message sent to connection %d\n", conn_id);
+        printf("Message sent to %s:%d\n", ip, port);
     }
 }
 
-// Command: exit
-void cmd_exit(void) {
-    printf("Shutting down...\n");
-    running = 0;
+// Command: broadcast
+void cmd_broadcast(const char* message) {
+    if (!check_message_length(message)) {
+        return;
+    }
+    
+    int delivered = p2p_broadcast(app_context, message, strlen(message));
+    if (delivered < 0) {
+        printf("Error: Failed to broadcast message\n");
+    } else {
+        printf("Message sent to %d connection(s)\n", delivered);
+    }
+}
+
+// Command: join
+void cmd_join(const char* topic) {
+    int result = p2p_join(app_context, topic);
+    if (result == P2P_ERR_INVALID) {
+        printf("Error: Invalid topic (1-%d printable characters)\n", P2P_TOPIC_LENGTH);
+    } else if (result == P2P_ERR_EXISTS) {
+        printf("Already joined topic %s\n", topic);
+    } else if (result < 0) {
+        printf("Error: Failed to join topic %s\n", topic);
+    } else {
+        printf("Joined topic %s\n", topic);
+    }
+}
+
+// Command: leave
+void cmd_leave(const char* topic) {
+    if (p2p_leave(app_context, topic) != P2P_OK) {
+        printf("Error: Not joined to topic %s\n", topic);
+        return;
+    }
+    
+    printf("Left topic %s\n", topic);
+}
+
+// Command: publish
+void cmd_publish(const char* topic, const char* message) {
+    if (!check_message_length(message)) {
+        return;
+    }
+    
+    int delivered = p2p_publish(app_context, topic, message);
+    if (delivered == P2P_ERR_INVALID) {
+        printf("Error: Invalid topic (1-%d printable characters)\n", P2P_TOPIC_LENGTH);
+    } else if (delivered < 0) {
+        printf("Error: Failed to publish message\n");
+    } else if (delivered == 0) {
+        printf("No peers subscribed to topic %s\n", topic);
+    } else {
+        printf("Message published to %d peer(s) on topic %s\n", delivered, topic);
+    }
+}
+
+// Command: topics
+void cmd_topics(void) {
+    P2PTopicInfo* info = malloc(sizeof(P2PTopicInfo) * MAX_LISTED_TOPICS);
+    if (info == NULL) {
+        printf("Error: Out of memory\n");
+        return;
+    }
+    
+    int count = p2p_list_topics(app_context, info, MAX_LISTED_TOPICS);
+    
+    printf("\n=== Topics ===\n");
+    for (int i = 0; i < count; i++) {
+        printf("%-*s | Joined: %-3s | Peers: %d\n", P2P_TOPIC_LENGTH,
+               info[i].name, info[i].joined ? "yes" : "no", info[i].subscribers);
+    }
+    
+    if (count == 0) {
+        printf("No topics\n");
+    }
+    printf("==============\n\n");
+    free(info);
+}
+
+// Command: peers
+void cmd_peers(void) {
+    P2PPeerInfo* info = malloc(sizeof(P2PPeerInfo) * MAX_LISTED_PEERS);
+    if (info == NULL) {
+        printf("Error: Out of memory\n");
+        return;
+    }
+    
+    int count = p2p_list_peers(app_context, info, MAX_LISTED_PEERS);
+    long long now = get_wall_ms();
+    
+    printf("\n=== Known Peers ===\n");
+    for (int i = 0; i < count; i++) {
+        char seen[32];
+        char dial[32];
+        if (info[i].last_seen > 0) {
+            snprintf(seen, sizeof(seen), "%llds ago", (now - info[i].last_seen) / 1000);
+        } else {
+            snprintf(seen, sizeof(seen), "never");
+        }
+        if (info[i].connect_ms >= 0) {
+            snprintf(dial, sizeof(dial), "%d ms", info[i].connect_ms);
+        } else {
+            snprintf(dial, sizeof(dial), "-");
+        }
+        printf("%s %s:%d | Seen: %s | Connect: %s | Dials: %d ok, %d failed\n",
+               info[i].connected ? "*" : " ", info[i].ip, info[i].port, seen, dial,
+               info[i].successes, info[i].failures);
+    }
+    
+    if (count == 0) {
+        printf("No known peers\n");
+    }
+    printf("===================\n\n");
+    free(info);
+}
+
+// Command: discovered
+void cmd_discovered(void) {
+    P2PDiscoveredPeer* info = malloc(sizeof(P2PDiscoveredPeer) * MAX_LISTED_PEERS);
+    if (info == NULL) {
+        printf("Error: Out of memory\n");
+        return;
+    }
+    
+    int count = p2p_list_discovered(app_context, info, MAX_LISTED_PEERS);
+    P2PDiscoveryStats stats;
+    char enabled[8];
+    
+    printf("\n=== Discovered Peers ===\n");
+    for (int i = 0; i < count; i++) {
+        printf("%s %s:%d | Load: %d/%d | Heard: %ds ago\n",
+               info[i].connected ? "*" : " ", info[i].ip, info[i].port,
+               info[i].load, info[i].capacity, info[i].age_ms / 1000);
+    }
+    
+    if (count == 0) {
+        if (p2p_config_get("discovery", enabled, sizeof(enabled)) == P2P_OK &&
+            strcmp(enabled, "on") == 0) {
+            printf("No peers heard yet\n");
+        } else {
+            printf("Discovery is off (--discovery=on)\n");
+        }
+    }
+    if (p2p_discovery_stats(app_context, &stats) == P2P_OK) {
+        printf("Announcements: %lld sent, %lld heard\n", stats.announced, stats.heard);
+    }
+    printf("========================\n\n");
+    free(info);
+}
+
+// Command: stats
+void cmd_stats(void) {
+    P2PMemoryStats stats;
+    if (p2p_memory_stats(app_context, &stats) != P2P_OK) {
+        printf("Error: Memory statistics unavailable\n");
+        return;
+    }
+    
+    printf("\n=== Memory ===\n");
+    if (stats.rss < 0) {
+        printf("RSS: unknown on this platform\n");
+    } else {
+        printf("RSS: %lld KB (%lld KB at start)\n", stats.rss / 1024, stats.rss_start / 1024);
+        if (stats.connections > 0) {
+            printf("Per connection: %lld bytes over start, %d connection(s)\n",
+                   (stats.rss - stats.rss_start) / stats.connections, stats.connections);
+        }
+    }
+    printf("Receivers: %d running, %d parked\n", stats.receivers, stats.parked);
+    printf("Receive buffers: %d in use, %d pooled\n", stats.recv_buffers, stats.pooled_buffers);
+    printf("==============\n\n");
+}
+
+// Command: trace
+void cmd_trace(const char* action, const char* path) {
+    if (strcmp(action, "dump") != 0 || strlen(path) == 0) {
+        printf("Usage: trace dump <file>\n");
+        return;
+    }
+    
+    int count = p2p_trace_dump(app_context, path);
+    if (count == P2P_ERR_UNSUPPORTED) {
+        printf("Error: Tracing not compiled in (rebuild with 'make TRACE=1')\n");
+    } else if (count < 0) {
+        printf("Error: Failed to write trace to %s\n", path);
+    } else {
+        printf("Wrote %d trace events to %s\n", count, path);
+    }
+}
+
+// Command: capture
+void cmd_capture(const char* action, const char* path) {
+    if (strcmp(action, "start") == 0 && strlen(path) > 0) {
+        int result = p2p_capture_start(app_context, path);
+        if (result == P2P_ERR_EXISTS) {
+            printf("Error: A capture is already running (capture stop)\n");
+        } else if (result < 0) {
+            printf("Error: Cannot write capture to %s\n", path);
+        } else {
+            printf("Capturing frames to %s\n", path);
+        }
+        return;
+    }
+    if (strcmp(action, "stop") == 0) {
+        p2p_capture_stop(app_context);
+    } else if (strlen(action) > 0) {
+        printf("Usage: capture [start <file> | stop]\n");
+        return;
+    }
+    
+    P2PCaptureStats stats;
+    if (p2p_capture_stats(app_context, &stats) == P2P_OK) {
+        printf("Capture %s: %lld frames, %lld bytes written, %lld dropped\n",
+               stats.active ? "running" : stats.failed ? "stopped, writing the file failed"
+                                                        : "stopped",
+               stats.frames, stats.bytes, stats.dropped);
+    }
+}
+
+// Command: config
+void cmd_config(const char* action) {
+    if (strcmp(action, "show") != 0) {
+        printf("Usage: config show\n");
+        return;
+    }
+    
+    printf("\n=== Configuration ===\n");
+    const char* key;
+    for (int i = 0; (key = p2p_config_key(i)) != NULL; i++) {
+        char value[256];
+        int effective;
+        
+        p2p_config_get(key, value, sizeof(value));
+        if (p2p_config_effective(app_context, key, &effective) == P2P_OK) {
+            printf("%-20s %-10s (effective: %d)\n", key, value, effective);
+        } else {
+            printf("%-20s %s\n", key, value);
+        }
+    }
+    printf("=====================\n\n");
+}
+
+// Sender thread of sendfile: queue the file on a stream, chunk by chunk
+static void* send_file_thread(void* arg) {
+    FileTransfer* transfer = (FileTransfer*)arg;
+    
+    long sent = 0;
+    int result = P2P_ERR_SYSTEM;
+    int stream = -1;
+    unsigned char* buffer = malloc(SENDFILE_CHUNK);
+    FILE* file = fopen(transfer->path, "rb");
+    
+    if (buffer != NULL && file != NULL) {
+        stream = p2p_stream_open(transfer->ctx, transfer->conn_id, 1);
+        result = stream;
+    }
+    
+    while (stream > 0) {
+        size_t length = fread(buffer, 1, SENDFILE_CHUNK, file);
+        if (length == 0) {
+            result = ferror(file) ? P2P_ERR_SYSTEM :
+                     p2p_stream_close(transfer->ctx, transfer->conn_id, stream);
+            break;
+        }
+        result = p2p_stream_send(transfer->ctx, transfer->conn_id, stream, buffer, length);
+        if (result < 0) {
+            break;
+        }
+        sent += (long)length;
+    }
+    
+    if (result == P2P_ERR_LIMIT) {
+        printf("\n[Error] Too many open streams to connection %d\n", transfer->conn_id);
+    } else if (result < 0) {
+        printf("\n[Error] Sending %s to connection %d: %s\n", transfer->path,
+               transfer->conn_id, p2p_strerror(result));
+    } else {
+        printf("\n[Sendfile] %s: %ld bytes queued on stream %d to connection %d\n",
+               transfer->path, sent, stream, transfer->conn_id);
+    }
+    printf("> ");
+    fflush(stdout);
     
-    // Close all connections
-    close_all_connections();
+    if (file != NULL) {
+        fclose(file);
+    }
+    free(buffer);
+    free(transfer);
+    return NULL;
+}
+
+// Command: sendfile (runs in the background, chat keeps flowing)
+void cmd_sendfile(int conn_id, const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        printf("Error: Cannot open %s\n", path);
+        return;
+    }
+    fclose(file);
+    
+    FileTransfer* transfer = malloc(sizeof(FileTransfer));
+    if (transfer == NULL) {
+        printf("Error: Out of memory\n");
+        return;
+    }
+    transfer->ctx = app_context;
+    transfer->conn_id = conn_id;
+    snprintf(transfer->path, sizeof(transfer->path), "%s", path);
+    
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, send_file_thread, transfer) != 0) {
+        printf("Error: Failed to start transfer\n");
+        free(transfer);
+        return;
+    }
+    pthread_detach(thread);
+    printf("Sending %s to connection %d\n", path, conn_id);
+}
+
+// History visitor: one line per room log entry
+static void print_history_entry(const P2PRoomEntry* entry, void* user_data) {
+    (void)user_data; // Unused parameter
+    char when[16];
+    format_clock(entry->timestamp, when, sizeof(when));
+    if (entry->local) {
+        printf("%s.%03lld  you       %s\n", when, entry->timestamp % 1000, entry->message);
+    } else {
+        printf("%s.%03lld  %08llx  %s\n", when, entry->timestamp % 1000,
+               entry->origin & 0xffffffffULL, entry->message);
+    }
+}
+
+// Command: history
+void cmd_history(const char* topic, int count) {
+    printf("\n=== Room %s ===\n", topic);
+    int result = p2p_history(app_context, topic, count, print_history_entry, NULL);
+    if (result == P2P_ERR_NOT_FOUND) {
+        printf("Not joined, use: join %s\n", topic);
+    } else if (result < 0) {
+        printf("Error: %s\n", p2p_strerror(result));
+    } else if (result == 0) {
+        printf("No messages yet\n");
+    }
+    printf("=====================\n\n");
+}
+
+// Search visitor: one line per message
+static void print_search_hit(const P2PSearchHit* hit, void* user_data) {
+    (void)user_data; // Unused parameter
+    char when[32];
+    format_local(hit->timestamp, "%Y-%m-%d %H:%M:%S", when, sizeof(when));
+    printf("%s  %-21s  %.*s\n", when, hit->source, (int)hit->length, hit->message);
+}
+
+// Command: search
+void cmd_search(const char* query) {
+    printf("\n=== Search: %s ===\n", query);
     
-    // Close listening socket
-    if (listen_socket != INVALID_SOCKET) {
-        close(listen_socket);
+    long long started = get_monotonic_ms();
+    int result = p2p_search(app_context, query, SEARCH_RESULTS, print_search_hit, NULL);
+    long long elapsed = get_monotonic_ms() - started;
+    
+    P2PSearchStats stats;
+    if (result < 0) {
+        printf("Error: %s\n", p2p_strerror(result));
+    } else if (result == 0) {
+        printf("No matches (%lld ms)\n", elapsed);
+    } else {
+        printf("%d match%s, newest %d shown (%lld ms)\n", result, result == 1 ? "" : "es",
+               result < SEARCH_RESULTS ? result : SEARCH_RESULTS, elapsed);
     }
+    if (p2p_search_stats(app_context, &stats) == P2P_OK) {
+        printf("Index: %lld messages, %d segment%s, %lld KB", stats.messages, stats.segments,
+               stats.segments == 1 ? "" : "s", stats.bytes / 1024);
+        if (stats.dropped > 0) {
+            printf(", %lld not indexed (arrived too fast)", stats.dropped);
+        }
+        printf("\n");
+    }
+    printf("=====================\n\n");
+}
+
+// Command: handoff (hot restart, peers stay connected)
+void cmd_handoff(void) {
+    int port = p2p_listen_port(app_context);
+    printf("Waiting for a successor started with --takeover %d...\n", port);
     
-    // Wait for threads to finish
-    sleep(1);
+    int result = p2p_handoff(app_context, HANDOFF_TIMEOUT_MS);
+    if (result < 0) {
+        printf("Error: Handoff failed: %s\n", p2p_strerror(result));
+        return;
+    }
     
-    cleanup_sockets();
-    printf("Goodbye!\n");
+    printf("Handed over %d connection(s), exiting\n", result);
+    p2p_destroy(app_context);
+    app_context = NULL;
+    exit(0);
+}
+
+// Command: exit
+void cmd_exit(void) {
+    printf("Shutting down...\n");
+    
+    // Close all connections and stop background threads
+    long long started = get_monotonic_ms();
+    p2p_destroy(app_context);
+    app_context = NULL;
+    
+    printf("Goodbye! (stopped in %lld ms)\n", get_monotonic_ms() - started);
     exit(0);
 }
 
@@ -151,6 +888,8 @@ void process_command(char* command) {
     // Parse command
     int args = sscanf(command, "%s %s %[^\n]", cmd, arg1, arg2);
     
+    TRACE_BEGIN("command");
+    
     if (strcmp(cmd, "help") == 0) {
         cmd_help();
     } else if (strcmp(cmd, "myip") == 0) {
@@ -174,16 +913,90 @@ void process_command(char* command) {
             printf("Usage: terminate <connection_id>\n");
         }
     } else if (strcmp(cmd, "send") == 0) {
-        if (args >= 3) {
+        if (args >= 3 && strchr(arg1, ':') != NULL) {
+            cmd_send_to(arg1, arg2);
+        } else if (args >= 3) {
             int conn_id = atoi(arg1);
             cmd_send(conn_id, arg2);
         } else {
-            printf("Usage: send <connection_id> <message>\n");
+            printf("Usage: send <connection_id|ip:port> <message>\n");
         }
+    } else if (strcmp(cmd, "broadcast") == 0) {
+        if (args >= 2) {
+            // Message is everything after the command word
+            const char* message = command + strlen(cmd);
+            while (isspace((unsigned char)*message)) {
+                message++;
+            }
+            cmd_broadcast(message);
+        } else {
+            printf("Usage: broadcast <message>\n");
+        }
+    } else if (strcmp(cmd, "join") == 0) {
+        if (args >= 2) {
+            cmd_join(arg1);
+        } else {
+            printf("Usage: join <topic>\n");
+        }
+    } else if (strcmp(cmd, "leave") == 0) {
+        if (args >= 2) {
+            cmd_leave(arg1);
+        } else {
+            printf("Usage: leave <topic>\n");
+        }
+    } else if (strcmp(cmd, "publish") == 0) {
+        if (args >= 3) {
+            cmd_publish(arg1, arg2);
+        } else {
+            printf("Usage: publish <topic> <message>\n");
+        }
+    } else if (strcmp(cmd, "sendfile") == 0) {
+        if (args >= 3) {
+            int conn_id = atoi(arg1);
+            cmd_sendfile(conn_id, arg2);
+        } else {
+            printf("Usage: sendfile <connection_id> <path>\n");
+        }
+    } else if (strcmp(cmd, "topics") == 0) {
+        cmd_topics();
+    } else if (strcmp(cmd, "peers") == 0) {
+        cmd_peers();
+    } else if (strcmp(cmd, "discovered") == 0) {
+        cmd_discovered();
+    } else if (strcmp(cmd, "stats") == 0) {
+        cmd_stats();
+    } else if (strcmp(cmd, "history") == 0) {
+        if (args >= 2) {
+            int count = args >= 3 ? atoi(arg2) : HISTORY_LINES;
+            cmd_history(arg1, count > 0 ? count : HISTORY_LINES);
+        } else {
+            printf("Usage: history <topic> [count]\n");
+        }
+    } else if (strcmp(cmd, "search") == 0) {
+        if (args >= 2) {
+            // Query is everything after the command word
+            const char* query = command + strlen(cmd);
+            while (isspace((unsigned char)*query)) {
+                query++;
+            }
+            cmd_search(query);
+        } else {
+            printf("Usage: search <words>\n");
+        }
+    } else if (strcmp(cmd, "trace") == 0) {
+        cmd_trace(arg1, arg2);
+    } else if (strcmp(cmd, "capture") == 0) {
+        cmd_capture(arg1, arg2);
+    } else if (strcmp(cmd, "config") == 0) {
+        cmd_config(arg1);
+    } else if (strcmp(cmd, "handoff") == 0) {
+        cmd_handoff();
     } else if (strcmp(cmd, "exit") == 0) {
         cmd_exit();
     } else {
         printf("Unknown command: %s\n", cmd);
         printf("Type 'help' for available commands\n");
     }
+    
+    TRACE_END("command");
 }
\ No newline at end of file
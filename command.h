@@ -2,6 +2,37 @@
 #define COMMAND_H
 
 #include "common.h"
+#include "p2pchat.h"
+
+// Most topics shown by the topics command
+#define MAX_LISTED_TOPICS 1024
+
+// How long handoff and --takeover wait for the other process
+#define HANDOFF_TIMEOUT_MS 60000
+
+// sendfile reads and queues this much at a time
+#define SENDFILE_CHUNK (64 * 1024)
+
+// Incoming files written at the same time
+#define MAX_RECEIVED_FILES 16
+
+// Numbered names tried when an incoming file's name is taken
+#define RECV_NAME_ATTEMPTS 100
+
+// Room log entries the history command shows by default
+#define HISTORY_LINES 20
+
+// Matches the search command shows, newest first
+#define SEARCH_RESULTS 20
+
+// Address book entries the peers command shows, best first
+#define MAX_LISTED_PEERS 64
+
+// Library context of the running node
+extern P2PContext* app_context;
+
+// Library event printer
+void handle_event(const P2PEvent* event, void* user_data);
 
 // Command processing
 void process_command(char* command);
@@ -14,6 +45,22 @@ void cmd_connect(const char* ip, int port);
 void cmd_list(void);
 void cmd_terminate(int conn_id);
 void cmd_send(int conn_id, const char* message);
+void cmd_send_to(const char* address, const char* message);
+void cmd_broadcast(const char* message);
+void cmd_join(const char* topic);
+void cmd_leave(const char* topic);
+void cmd_publish(const char* topic, const char* message);
+void cmd_sendfile(int conn_id, const char* path);
+void cmd_history(const char* topic, int count);
+void cmd_search(const char* query);
+void cmd_topics(void);
+void cmd_peers(void);
+void cmd_discovered(void);
+void cmd_stats(void);
+void cmd_trace(const char* action, const char* path);
+void cmd_capture(const char* action, const char* path);
+void cmd_config(const char* action);
+void cmd_handoff(void);
 void cmd_exit(void);
 
 #endif // COMMAND_H
\ No newline at end of file
@@ -30,11 +30,11 @@
     typedef int SOCKET;
 #endif
 
-// Constants
+// Constants (limits are defaults, overridable at runtime, see config.h)
 #define BUFFER_SIZE 1024
 #define MAX_MESSAGE_LENGTH 100
 #define MAX_CONNECTIONS 50
-#define BACKLOG 10
+#define BACKLOG 1024
 #define MAX_COMMAND_LENGTH 256
 #define INET_ADDRSTRLEN 16
 
@@ -0,0 +1,278 @@
+#include "config.h"
+#include "worker.h"
+#include <stddef.h>
+#include <limits.h>
+
+// Compiled-in defaults, fields not named are 0 or empty
+#define CONFIG_DEFAULTS {                           \
+    .buffer_size = BUFFER_SIZE,                     \
+    .max_connections = MAX_CONNECTIONS,             \
+    .backlog = BACKLOG,                             \
+    .accept_rate = ACCEPT_RATE,                     \
+    .accept_burst = ACCEPT_BURST,                   \
+    .max_message_length = MAX_MESSAGE_LENGTH,       \
+    .coalesce_bytes = COALESCE_BYTES,               \
+    .work_queue = WORK_QUEUE,                       \
+    .shutdown_drain = SHUTDOWN_DRAIN_MS,            \
+    .room_log = ROOM_LOG_ENTRIES,                   \
+    .room_sync = ROOM_SYNC_MS,                      \
+    .warm_peers = WARM_PEERS,                       \
+    .park_idle = PARK_IDLE_MS,                      \
+    .spin_cpu = -1,                                 \
+    .spin_idle = SPIN_IDLE_US,                      \
+    .discovery_port = DISCOVERY_PORT,               \
+    .discovery_interval = DISCOVERY_INTERVAL_MS,    \
+    .discovery_peers = DISCOVERY_PEERS,             \
+    .recv_max = RECV_MAX_BYTES,                     \
+    .discovery_group = DISCOVERY_GROUP              \
+}
+
+// Configuration of this node
+NodeConfig node_config = CONFIG_DEFAULTS;
+
+// Value kinds
+enum { CONFIG_INT, CONFIG_BOOL, CONFIG_ADDRESS, CONFIG_PATH };
+
+// Config key description
+typedef struct {
+    const char* key;
+    size_t offset;                  // Field in NodeConfig
+    int min;
+    int max;
+    int type;
+} ConfigEntry;
+
+// Known keys, in display order
+static const ConfigEntry config_entries[] = {
+    { "buffer_size",        offsetof(NodeConfig, buffer_size),        128, 1 << 20, CONFIG_INT },
+    { "max_connections",    offsetof(NodeConfig, max_connections),    1, 65535, CONFIG_INT },
+    { "backlog",            offsetof(NodeConfig, backlog),            1, 65535, CONFIG_INT },
+    { "accept_rate",        offsetof(NodeConfig, accept_rate),        0, 1000000, CONFIG_INT },
+    { "accept_burst",       offsetof(NodeConfig, accept_burst),       1, 1000000, CONFIG_INT },
+    { "max_message_length", offsetof(NodeConfig, max_message_length), 1, 1 << 20, CONFIG_INT },
+    { "sndbuf",             offsetof(NodeConfig, sndbuf),             0, INT_MAX, CONFIG_INT },
+    { "rcvbuf",             offsetof(NodeConfig, rcvbuf),             0, INT_MAX, CONFIG_INT },
+    { "tcp_nodelay",        offsetof(NodeConfig, tcp_nodelay),        0, 1, CONFIG_BOOL },
+    { "keepalive",          offsetof(NodeConfig, keepalive),          0, 1, CONFIG_BOOL },
+    { "keepalive_idle",     offsetof(NodeConfig, keepalive_idle),     0, 32767, CONFIG_INT },
+    { "keepalive_interval", offsetof(NodeConfig, keepalive_interval), 0, 32767, CONFIG_INT },
+    { "keepalive_count",    offsetof(NodeConfig, keepalive_count),    0, 127, CONFIG_INT },
+    { "user_timeout",       offsetof(NodeConfig, user_timeout),       0, INT_MAX, CONFIG_INT },
+    { "busy_poll",          offsetof(NodeConfig, busy_poll),          0, INT_MAX, CONFIG_INT },
+    { "coalesce_bytes",     offsetof(NodeConfig, coalesce_bytes),     0, 1 << 24, CONFIG_INT },
+    { "coalesce_delay",     offsetof(NodeConfig, coalesce_delay),     0, 1000000, CONFIG_INT },
+    { "workers",            offsetof(NodeConfig, workers),            0, WORKER_MAX_THREADS, CONFIG_INT },
+    { "work_queue",         offsetof(NodeConfig, work_queue),         1, 1 << 20, CONFIG_INT },
+    { "shutdown_drain",     offsetof(NodeConfig, shutdown_drain),     0, 60000, CONFIG_INT },
+    { "room_log",           offsetof(NodeConfig, room_log),           16, 1 << 20, CONFIG_INT },
+    { "room_sync",          offsetof(NodeConfig, room_sync),          0, 3600000, CONFIG_INT },
+    { "warm_peers",         offsetof(NodeConfig, warm_peers),         0, 256, CONFIG_INT },
+    { "park_idle",          offsetof(NodeConfig, park_idle),          0, 3600000, CONFIG_INT },
+    { "spin",               offsetof(NodeConfig, spin),               0, 1, CONFIG_BOOL },
+    { "spin_cpu",           offsetof(NodeConfig, spin_cpu),           -1, 1023, CONFIG_INT },
+    { "spin_idle",          offsetof(NodeConfig, spin_idle),          0, 1000000, CONFIG_INT },
+    { "discovery",          offsetof(NodeConfig, discovery),          0, 1, CONFIG_BOOL },
+    { "discovery_group",    offsetof(NodeConfig, discovery_group),    0, 0, CONFIG_ADDRESS },
+    { "discovery_port",     offsetof(NodeConfig, discovery_port),     1, 65535, CONFIG_INT },
+    { "discovery_interval", offsetof(NodeConfig, discovery_interval), 100, 3600000, CONFIG_INT },
+    { "discovery_peers",    offsetof(NodeConfig, discovery_peers),    0, 256, CONFIG_INT },
+    { "local_ip",           offsetof(NodeConfig, local_ip),           0, 0, CONFIG_ADDRESS },
+    { "search_dir",         offsetof(NodeConfig, search_dir),         0, CONFIG_PATH_LENGTH - 1, CONFIG_PATH },
+    { "peer_book",          offsetof(NodeConfig, peer_book),          0, CONFIG_PATH_LENGTH - 1, CONFIG_PATH },
+    { "capture",            offsetof(NodeConfig, capture),            0, CONFIG_PATH_LENGTH - 1, CONFIG_PATH },
+    { "recv_dir",           offsetof(NodeConfig, recv_dir),           0, CONFIG_PATH_LENGTH - 1, CONFIG_PATH },
+    { "recv_max",           offsetof(NodeConfig, recv_max),           1, INT_MAX, CONFIG_INT }
+};
+
+#define CONFIG_ENTRY_COUNT ((int)(sizeof(config_entries) / sizeof(config_entries[0])))
+
+// Find key description
+static const ConfigEntry* find_entry(const char* key) {
+    for (int i = 0; i < CONFIG_ENTRY_COUNT; i++) {
+        if (strcmp(config_entries[i].key, key) == 0) {
+            return &config_entries[i];
+        }
+    }
+    return NULL;
+}
+
+// Field of config described by entry
+static int* entry_field(NodeConfig* config, const ConfigEntry* entry) {
+    return (int*)((char*)config + entry->offset);
+}
+
+// Parse boolean words or 0/1
+static int parse_bool(const char* value, int* out) {
+    if (strcmp(value, "1") == 0 || strcmp(value, "yes") == 0 ||
+        strcmp(value, "on") == 0 || strcmp(value, "true") == 0) {
+        *out = 1;
+        return 0;
+    }
+    if (strcmp(value, "0") == 0 || strcmp(value, "no") == 0 ||
+        strcmp(value, "off") == 0 || strcmp(value, "false") == 0) {
+        *out = 0;
+        return 0;
+    }
+    return -1;
+}
+
+// Parse decimal integer with optional k/m suffix (x1024)
+static int parse_int(const char* value, long long* out) {
+    char* end;
+    long long number = strtoll(value, &end, 10);
+    
+    if (end == value) {
+        return -1;
+    }
+    long long multiplier = 1;
+    if (*end == 'k' || *end == 'K') {
+        multiplier = 1024;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        multiplier = 1024 * 1024;
+        end++;
+    }
+    if (*end != '\0' || number > LLONG_MAX / multiplier || number < LLONG_MIN / multiplier) {
+        return -1;
+    }
+    
+    *out = number * multiplier;
+    return 0;
+}
+
+// Reset to compiled-in defaults
+void config_defaults(NodeConfig* config) {
+    NodeConfig defaults = CONFIG_DEFAULTS;
+    *config = defaults;
+}
+
+// Number of known keys
+int config_key_count(void) {
+    return CONFIG_ENTRY_COUNT;
+}
+
+// Key name by index, NULL past the end
+const char* config_key(int index) {
+    if (index < 0 || index >= CONFIG_ENTRY_COUNT) {
+        return NULL;
+    }
+    return config_entries[index].key;
+}
+
+// Set key from text
+int config_set(NodeConfig* config, const char* key, const char* value) {
+    const ConfigEntry* entry = find_entry(key);
+    if (entry == NULL) {
+        return -1;
+    }
+    
+    if (entry->type == CONFIG_ADDRESS) {
+        // Empty clears it
+        char* address = (char*)config + entry->offset;
+        struct in_addr parsed;
+        if (*value != '\0' && inet_pton(AF_INET, value, &parsed) != 1) {
+            return -2;
+        }
+        snprintf(address, INET_ADDRSTRLEN, "%s", value);
+        return 0;
+    }
+    
+    if (entry->type == CONFIG_PATH) {
+        // Empty clears it, max is the longest path that fits
+        if (strlen(value) > (size_t)entry->max) {
+            return -2;
+        }
+        snprintf((char*)config + entry->offset, entry->max + 1, "%s", value);
+        return 0;
+    }
+    
+    if (entry->type == CONFIG_BOOL) {
+        int flag;
+        if (parse_bool(value, &flag) < 0) {
+            return -2;
+        }
+        *entry_field(config, entry) = flag;
+        return 0;
+    }
+    
+    long long number;
+    if (parse_int(value, &number) < 0 || number < entry->min || number > entry->max) {
+        return -2;
+    }
+    *entry_field(config, entry) = (int)number;
+    return 0;
+}
+
+// Format key's value as text
+int config_get(const NodeConfig* config, const char* key, char* value, size_t size) {
+    const ConfigEntry* entry = find_entry(key);
+    if (entry == NULL) {
+        return -1;
+    }
+    
+    if (entry->type == CONFIG_ADDRESS || entry->type == CONFIG_PATH) {
+        snprintf(value, size, "%s", (const char*)config + entry->offset);
+        return 0;
+    }
+    
+    int field = *entry_field((NodeConfig*)config, entry);
+    if (entry->type == CONFIG_BOOL) {
+        snprintf(value, size, "%s", field ? "on" : "off");
+    } else {
+        snprintf(value, size, "%d", field);
+    }
+    return 0;
+}
+
+// Load config file
+int config_load(NodeConfig* config, const char* path) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    
+    char line[CONFIG_LINE_LENGTH];
+    int line_number = 0;
+    int error_line = 0;
+    
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+        
+        // Strip comment and surrounding whitespace
+        line[strcspn(line, "#\r\n")] = '\0';
+        char* key = line;
+        while (isspace((unsigned char)*key)) {
+            key++;
+        }
+        if (*key == '\0') {
+            continue;
+        }
+        
+        char* value = strchr(key, '=');
+        if (value == NULL) {
+            error_line = line_number;
+            break;
+        }
+        *value++ = '\0';
+        
+        char* end = value - 2;
+        while (end >= key && isspace((unsigned char)*end)) {
+            *end-- = '\0';
+        }
+        while (isspace((unsigned char)*value)) {
+            value++;
+        }
+        end = value + strlen(value) - 1;
+        while (end >= value && isspace((unsigned char)*end)) {
+            *end-- = '\0';
+        }
+        
+        if (config_set(config, key, value) != 0) {
+            error_line = line_number;
+            break;
+        }
+    }
+    
+    fclose(file);
+    return error_line;
+}
@@ -0,0 +1,107 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include "common.h"
+
+// Config file line limit
+#define CONFIG_LINE_LENGTH 256
+
+// Default send coalescing window (bytes pending before writers wait)
+#define COALESCE_BYTES 16384
+
+// Default frames a connection may have waiting for workers
+#define WORK_QUEUE 256
+
+// Default time shutdown gives peers to take unsent frames
+#define SHUTDOWN_DRAIN_MS 1000
+
+// Default messages kept per room and anti-entropy interval
+#define ROOM_LOG_ENTRIES 4096
+#define ROOM_SYNC_MS 2000
+
+// Default admission: connections per second one address may open, and
+// how many an idle address may open at once
+#define ACCEPT_RATE 20
+#define ACCEPT_BURST 40
+
+// Default known peers dialed at startup
+#define WARM_PEERS 8
+
+// Default quiet time before a connection returns its receive buffer and
+// parks its receiver thread
+#define PARK_IDLE_MS 5000
+
+// Default time the spin thread polls quiet sockets before it blocks
+#define SPIN_IDLE_US 10000
+
+// Default discovery group, its port, announcement interval and peers dialed
+#define DISCOVERY_GROUP "239.255.47.47"
+#define DISCOVERY_PORT 47400
+#define DISCOVERY_INTERVAL_MS 5000
+#define DISCOVERY_PEERS 8
+
+// Default size an incoming stream saved by the CLI may reach
+#define RECV_MAX_BYTES (64 * 1024 * 1024)
+
+// Longest directory a config value can name
+#define CONFIG_PATH_LENGTH 128
+
+// Runtime tuning, read when the node starts (0 = OS default for socket options)
+typedef struct {
+    int buffer_size;                // Receive buffer, bounds frame size
+    int max_connections;
+    int backlog;
+    int accept_rate;                // Connections per second per source address, 0 = unlimited
+    int accept_burst;               // Connections an idle address may open at once
+    int max_message_length;
+    int sndbuf;                     // SO_SNDBUF bytes
+    int rcvbuf;                     // SO_RCVBUF bytes
+    int tcp_nodelay;                // Disable Nagle for lower latency
+    int keepalive;                  // SO_KEEPALIVE
+    int keepalive_idle;             // Seconds idle before the first probe
+    int keepalive_interval;         // Seconds between probes
+    int keepalive_count;            // Unanswered probes before the link drops
+    int user_timeout;               // TCP_USER_TIMEOUT milliseconds
+    int busy_poll;                  // SO_BUSY_POLL microseconds
+    int coalesce_bytes;             // Send batching window, 0 = one send per frame
+    int coalesce_delay;             // Microseconds a flush waits to fill the window
+    int workers;                    // Frame processing threads, 0 = one per CPU
+    int work_queue;                 // Frames per connection before its receiver waits
+    int shutdown_drain;             // Milliseconds shutdown waits for unsent frames
+    int room_log;                   // Messages kept per joined topic
+    int room_sync;                  // Milliseconds between anti-entropy rounds, 0 = off
+    int warm_peers;                 // Best known peers dialed at startup, 0 = none
+    int park_idle;                  // Milliseconds before a quiet connection parks, 0 = never
+    int spin;                       // One pinned thread busy-polls every connection
+    int spin_cpu;                   // CPU the spin thread is pinned to, -1 = any
+    int spin_idle;                  // Microseconds it spins without data before blocking
+    int discovery;                  // Announce on and listen to the multicast group
+    int discovery_port;
+    int discovery_interval;         // Milliseconds between announcements, at least
+    int discovery_peers;            // Discovered peers this node dials
+    int recv_max;                   // Bytes a saved incoming stream may reach
+    char local_ip[INET_ADDRSTRLEN]; // Address to report, empty = detect at startup
+    char search_dir[CONFIG_PATH_LENGTH];  // Search index segments, empty = kept in memory
+    char peer_book[CONFIG_PATH_LENGTH];   // Address book file, empty = p2p_peers_<port>.txt
+    char capture[CONFIG_PATH_LENGTH];     // Wire capture file, empty = no capture
+    char recv_dir[CONFIG_PATH_LENGTH];    // Incoming streams saved here, empty = refused
+    char discovery_group[INET_ADDRSTRLEN];  // Multicast group, empty = DISCOVERY_GROUP
+} NodeConfig;
+
+// Configuration of this node
+extern NodeConfig node_config;
+
+// Defaults and lookup
+void config_defaults(NodeConfig* config);
+int config_key_count(void);
+const char* config_key(int index);
+
+// Set from text (0 = ok, -1 = unknown key, -2 = bad value)
+int config_set(NodeConfig* config, const char* key, const char* value);
+int config_get(const NodeConfig* config, const char* key, char* value, size_t size);
+
+// Load "key = value" lines, '#' starts a comment.
+// Returns 0, -1 if the file can't be opened, or the 1-based line of the first error.
+int config_load(NodeConfig* config, const char* path);
+
+#endif // CONFIG_H
@@ -1,128 +1,574 @@
 #include "connection.h"
 #include "socket.h"
+#include "timeutil.h"
+#include "event.h"
+#include "config.h"
+#include "topic.h"
+#include "pubsub.h"
+#include "trace.h"
+#include "worker.h"
+#include "roomlog.h"
+#include "search.h"
+#include "admission.h"
+#include "addrbook.h"
+#include "bufpool.h"
+#include "capture.h"
+#include <time.h>
+
+#ifndef _WIN32
+    #include <poll.h>
+    #include <sched.h>
+#endif
+#ifdef __GLIBC__
+    #include <malloc.h>
+#endif
 
 // Global variables
-Connection connections[MAX_CONNECTIONS];
+Connection* connections = NULL;
+int connection_capacity = 0;
 pthread_mutex_t connections_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_t accept_thread;
+pthread_t reconnect_thread;
+pthread_t park_thread;
+pthread_t spin_thread;
+uint64_t local_node_id = 0;
 extern int running;
+
+// Live receiver threads (guarded by connections_mutex); they are detached,
+// join_receivers() waits for the count to reach zero
+static int receiver_count = 0;
+static pthread_cond_t receivers_exited = PTHREAD_COND_INITIALIZER;
+
+// Cold half of the table, slot for slot
+static ConnectionPeer* connection_peers = NULL;
+
+// Bumped under connections_mutex whenever a slot joins or leaves the spin
+// thread's set; it rescans the table only then
+static volatile int spin_changes = 0;
+
+// Set by schedule_warm_pool(), the reconnect thread dials the book once
+static int warm_scheduled = 0;
 extern int next_connection_id;
 
-// Initialize connections array
-void init_connections(void) {
-    memset(connections, 0, sizeof(connections));
+// Generate random node ID identifying this process to peers
+static uint64_t generate_node_id(void) {
+    uint64_t id = 0;
+    
+    FILE* urandom = fopen("/dev/urandom", "rb");
+    if (urandom != NULL) {
+        if (fread(&id, sizeof(id), 1, urandom) != 1) {
+            id = 0;
+        }
+        fclose(urandom);
+    }
+    
+    if (id == 0) {
+        id = ((uint64_t)time(NULL) << 32) ^ (uint64_t)clock() ^
+             (uint64_t)(size_t)&local_node_id;
+    }
+    return id ? id : 1;
+}
+
+// Jittered exponential backoff delay for the given attempt
+static long long backoff_delay(int attempts) {
+    long long delay = RECONNECT_BASE_MS;
+    while (attempts-- > 0 && delay < RECONNECT_MAX_MS) {
+        delay *= 2;
+    }
+    if (delay > RECONNECT_MAX_MS) {
+        delay = RECONNECT_MAX_MS;
+    }
+    
+    // Half fixed, half random so peers don't retry in lockstep
+    return delay / 2 + rand() % (delay / 2 + 1);
+}
+
+// Find slot by connection ID (caller holds connections_mutex)
+static int find_slot(int conn_id) {
+    for (int i = 0; i < connection_capacity; i++) {
+        if (connections[i].active && connections[i].id == conn_id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Stop the stream sender of conn and drop unsent stream data; abort cuts the
+// link first so a sender blocked on a stalled peer returns (caller holds
+// connections_mutex)
+static void stop_streams(Connection* conn, int abort) {
+    if (conn->streams == NULL) {
+        return;
+    }
+    
+    if (abort && conn->socket != INVALID_SOCKET) {
+        shutdown(conn->socket, 2);  // SD_BOTH
+    }
+    stream_set_destroy(conn->streams);
+    conn->streams = NULL;
+}
+
+// Whether the spin thread reads every connection
+static int spin_mode(void) {
+    return SPIN_SUPPORTED && node_config.spin;
+}
+
+// Tell the spin thread its set changed (caller holds connections_mutex)
+static void spin_set_changed(void) {
+    spin_changes++;
+    wakeup_spin();
+}
+
+// Free slot and its queued messages (caller holds connections_mutex)
+static void release_slot(int slot) {
+    stop_streams(&connections[slot], 0);
+    
+    pthread_mutex_lock(&connections[slot].send_mutex);
+    store_destroy(connections[slot].queue);
+    connections[slot].queue = NULL;
+    pthread_mutex_unlock(&connections[slot].send_mutex);
+    
+    free(connections[slot].peer->rx_backlog);
+    connections[slot].peer->rx_backlog = NULL;
+    connections[slot].peer->rx_backlog_length = 0;
+    
+    connections[slot].active = 0;
+    connections[slot].socket = INVALID_SOCKET;
+    batch_reset(&connections[slot].batch, INVALID_SOCKET);
+    
+    // The park thread lets go of the socket, a close completes only then
+    if (connections[slot].parked) {
+        connections[slot].parked = 0;
+        wakeup_park();
+    }
+    
+    // The spin thread closes its descriptor of the socket
+    if (connections[slot].spin != SPIN_NONE) {
+        connections[slot].spin = SPIN_NONE;
+        spin_set_changed();
+    }
+}
+
+// frame_write_fn sink of a connection (ctx): its batch, after the capture
+// when one is running
+static int connection_write(void* ctx, const void* data, size_t length) {
+    Connection* conn = ctx;
+    if (node_capture.active) {
+        FrameHeader header;
+        decode_frame_header(data, &header);
+        capture_frame(&node_capture, conn->id, CAPTURE_OUT, &header,
+                      (const unsigned char*)data + FRAME_HEADER_SIZE);
+    }
+    return batch_write(&conn->batch, data, length);
+}
+
+// Tell peer we are closing on purpose, then close (caller holds connections_mutex)
+static void shutdown_slot(int slot) {
+    Connection* conn = &connections[slot];
+    
+    // The chunk being written completes, so CLOSE starts on a frame boundary.
+    // One stuck on a stalled peer would hold the table until TCP gives up,
+    // so the link is cut instead; the peer cannot take a CLOSE either
+    if (conn->streams != NULL && stream_set_stop(conn->streams, CLOSE_SEND_TIMEOUT_MS) < 0 &&
+        conn->socket != INVALID_SOCKET) {
+        shutdown(conn->socket, 2);  // SD_BOTH
+    }
+    stop_streams(conn, 0);
+    
+    // Same bound for the CLOSE and the frames still batched, unless shutdown
+    // has set a shorter deadline
+    if (conn->socket != INVALID_SOCKET) {
+        int timeout = get_send_timeout(conn->socket);
+        if (timeout == 0 || timeout > CLOSE_SEND_TIMEOUT_MS) {
+            set_send_timeout(conn->socket, CLOSE_SEND_TIMEOUT_MS);
+        }
+    }
+    
+    if (conn->socket == INVALID_SOCKET) {
+        return;
+    }
+    
+    if (conn->state == CONN_ONLINE) {
+        pthread_mutex_lock(&conn->send_mutex);
+        write_frame(connection_write, conn, FRAME_CLOSE, 0, NULL, 0);
+        pthread_mutex_unlock(&conn->send_mutex);
+    }
+    
+    // Frames still batched go out before the socket closes
+    batch_drain(&conn->batch);
+    shutdown(conn->socket, 2);  // SD_BOTH
+    close(conn->socket);
+}
+
+// Fill in the fields every connection event carries
+static void init_event(P2PEvent* event, P2PEventType type, int conn_id,
+                       const char* ip, int port) {
+    memset(event, 0, sizeof(*event));
+    event->type = type;
+    event->conn_id = conn_id;
+    event->ip = ip;
+    event->port = port;
 }
 
-// Add new connection
-int add_connection(SOCKET sock, const char* ip, int port) {
+// Receiver thread entry: run, then report the exit to join_receivers()
+static void* run_receiver(void* arg) {
+    handle_peer_messages_thread(arg);
+    
     pthread_mutex_lock(&connections_mutex);
+    if (--receiver_count == 0) {
+        pthread_cond_broadcast(&receivers_exited);
+    }
+    pthread_mutex_unlock(&connections_mutex);
+    return NULL;
+}
+
+// Create the detached receiver thread of slot, counted in receiver_count
+// by the caller
+static int spawn_receiver(int slot) {
+    int* thread_arg = malloc(sizeof(int));
+    if (thread_arg == NULL) {
+        return -1;
+    }
+    *thread_arg = slot;
+    
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, run_receiver, thread_arg) != 0) {
+        free(thread_arg);
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+// Start receiver thread for slot, or hand it to the spin thread (caller
+// holds connections_mutex)
+static int start_reader_thread(int slot) {
+    if (spin_mode()) {
+        connections[slot].spin = SPIN_PENDING;
+        spin_set_changed();
+        return 0;
+    }
+    if (spawn_receiver(slot) != 0) {
+        return -1;
+    }
+    receiver_count++;
+    return 0;
+}
+
+// Bound blocking sends on conn by deadline (caller holds connections_mutex)
+static void limit_send_time(Connection* conn, long long deadline_ms) {
+    long long remaining = deadline_ms - get_monotonic_ms();
+    if (conn->socket != INVALID_SOCKET) {
+        set_send_timeout(conn->socket, remaining > 0 ? (int)remaining : 1);
+    }
+}
+
+// Initialize connections array sized by max_connections, returns 0 on success
+int init_connections(void) {
+    // The previous node's table is released here rather than at shutdown,
+    // its receiver threads may still be unwinding then
+    if (connections != NULL) {
+        for (int i = 0; i < connection_capacity; i++) {
+            batch_destroy(&connections[i].batch);
+            pthread_mutex_destroy(&connections[i].send_mutex);
+        }
+        free(connections);
+        free(connection_peers);
+        connections = NULL;
+        connection_peers = NULL;
+        connection_capacity = 0;
+    }
+    
+    connections = calloc(node_config.max_connections, sizeof(Connection));
+    connection_peers = calloc(node_config.max_connections, sizeof(ConnectionPeer));
+    if (connections == NULL || connection_peers == NULL) {
+        free(connections);
+        free(connection_peers);
+        connections = NULL;
+        connection_peers = NULL;
+        return -1;
+    }
+    connection_capacity = node_config.max_connections;
+    for (int i = 0; i < connection_capacity; i++) {
+        connections[i].peer = &connection_peers[i];
+        pthread_mutex_init(&connections[i].send_mutex, NULL);
+        batch_init(&connections[i].batch, INVALID_SOCKET);
+    }
     
-    // Find empty slot
+    local_node_id = generate_node_id();
+    srand((unsigned int)(local_node_id ^ (local_node_id >> 32)));
+    return 0;
+}
+
+// Take a free slot for a peer, -1 if the table is full (caller holds connections_mutex)
+static int claim_slot(SOCKET sock, const char* ip, int port, int outbound) {
     int slot = -1;
-    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+    for (int i = 0; i < connection_capacity; i++) {
         if (!connections[i].active) {
             slot = i;
             break;
         }
     }
-    
     if (slot == -1) {
-        pthread_mutex_unlock(&connections_mutex);
-        printf("Maximum connections reached\n");
         return -1;
     }
     
-    connections[slot].id = next_connection_id++;
-    connections[slot].socket = sock;
-    strcpy(connections[slot].ip, ip);
-    connections[slot].port = port;
-    connections[slot].active = 1;
+    Connection* conn = &connections[slot];
+    conn->id = next_connection_id++;
+    conn->socket = sock;
+    batch_reset(&conn->batch, sock);
+    strcpy(conn->peer->ip, ip);
+    conn->peer->port = port;
+    conn->active = 1;
+    conn->state = sock != INVALID_SOCKET ? CONN_CONNECTING : CONN_OFFLINE;
+    conn->parked = 0;
+    conn->spin = SPIN_NONE;
+    conn->peer->outbound = outbound;
+    conn->peer->node_id = 0;
+    conn->peer->listen_port = outbound ? port : 0;
+    conn->tx_seq = 0;
+    conn->rx_seq = 0;
+    conn->rx_unacked = 0;
+    conn->queue = NULL;
+    conn->peer->retry_attempts = 0;
+    conn->peer->next_retry_ms = 0;
+    conn->peer->rx_backlog = NULL;
+    conn->peer->rx_backlog_length = 0;
+    conn->peer->resumed = 0;
+    conn->streams = NULL;
+    return slot;
+}
+
+// Add new connection, returns its ID or P2P_ERR_LIMIT / P2P_ERR_SYSTEM
+int add_connection(SOCKET sock, const char* ip, int port, int outbound) {
+    pthread_mutex_lock(&connections_mutex);
     
-    // Create thread for handling messages
-    int* thread_arg = malloc(sizeof(int));
-    *thread_arg = slot;
+    int slot = claim_slot(sock, ip, port, outbound);
+    if (slot == -1) {
+        pthread_mutex_unlock(&connections_mutex);
+        return P2P_ERR_LIMIT;
+    }
+    Connection* conn = &connections[slot];
+    int conn_id = conn->id;
     
-    if (pthread_create(&connections[slot].thread, NULL, 
-                       handle_peer_messages_thread, thread_arg) != 0) {
-        printf("Failed to create thread for connection\n");
-        connections[slot].active = 0;
+    if (spin_mode()) {
+        start_reader_thread(slot);
         pthread_mutex_unlock(&connections_mutex);
-        free(thread_arg);
-        return -1;
+        return conn_id;
+    }
+    
+    // The thread is created without holding the table, so an accept storm
+    // does not stall every sender; counting it first keeps shutdown waiting
+    receiver_count++;
+    pthread_mutex_unlock(&connections_mutex);
+    if (spawn_receiver(slot) == 0) {
+        return conn_id;
     }
     
+    pthread_mutex_lock(&connections_mutex);
+    if (--receiver_count == 0) {
+        pthread_cond_broadcast(&receivers_exited);
+    }
+    
+    // Closed meanwhile: the socket is gone, as if the receiver had run
+    if (!conn->active || conn->socket != sock) {
+        pthread_mutex_unlock(&connections_mutex);
+        return conn_id;
+    }
+    conn->socket = INVALID_SOCKET;
+    release_slot(slot);
     pthread_mutex_unlock(&connections_mutex);
-    return connections[slot].id;
+    return P2P_ERR_SYSTEM;
 }
 
 // Remove connection
 void remove_connection(int conn_id) {
     pthread_mutex_lock(&connections_mutex);
     
-    for (int i = 0; i < MAX_CONNECTIONS; i++) {
-        if (connections[i].active && connections[i].id == conn_id) {
-            connections[i].active = 0;
-            close(connections[i].socket);
-            break;
+    int slot = find_slot(conn_id);
+    if (slot != -1) {
+        stop_streams(&connections[slot], 1);
+        if (connections[slot].socket != INVALID_SOCKET) {
+            close(connections[slot].socket);
         }
+        release_slot(slot);
     }
     
     pthread_mutex_unlock(&connections_mutex);
+    topic_remove_connection(&node_topics, conn_id);
 }
 
 // Close connection properly
 void close_connection(int conn_id) {
     pthread_mutex_lock(&connections_mutex);
     
-    for (int i = 0; i < MAX_CONNECTIONS; i++) {
-        if (connections[i].active && connections[i].id == conn_id) {
-            connections[i].active = 0;
-            shutdown(connections[i].socket, 2);  // SD_BOTH
-            close(connections[i].socket);
-            break;
-        }
+    int slot = find_slot(conn_id);
+    if (slot != -1) {
+        shutdown_slot(slot);
+        release_slot(slot);
     }
     
     pthread_mutex_unlock(&connections_mutex);
+    topic_remove_connection(&node_topics, conn_id);
 }
 
-// Close all connections
-void close_all_connections(void) {
+// Close all connections, giving up on unsent frames at deadline_ms
+void close_all_connections(long long deadline_ms) {
     pthread_mutex_lock(&connections_mutex);
     
-    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+    for (int i = 0; i < connection_capacity; i++) {
         if (connections[i].active) {
-            shutdown(connections[i].socket, 2);
-            close(connections[i].socket);
-            connections[i].active = 0;
+            limit_send_time(&connections[i], deadline_ms);
+            shutdown_slot(i);
+            release_slot(i);
         }
     }
     
     pthread_mutex_unlock(&connections_mutex);
 }
 
-// Find connection by IP and port
-int find_connection_by_address(const char* ip, int port) {
+// Make sends blocked on stalled peers fail at deadline_ms (shutdown)
+void set_send_deadline(long long deadline_ms) {
+    pthread_mutex_lock(&connections_mutex);
+    for (int i = 0; i < connection_capacity; i++) {
+        if (connections[i].active) {
+            limit_send_time(&connections[i], deadline_ms);
+        }
+    }
+    pthread_mutex_unlock(&connections_mutex);
+}
+
+// Forget all connections without telling the peers, another process owns
+// the sockets now (caller holds connections_mutex)
+void detach_all_connections(void) {
+    for (int i = 0; i < connection_capacity; i++) {
+        if (connections[i].active) {
+            if (connections[i].socket != INVALID_SOCKET) {
+                close(connections[i].socket);
+            }
+            release_slot(i);
+        }
+    }
+}
+
+// Start receivers for slots with a socket, returns the number that failed
+int start_receivers(void) {
+    int failed = 0;
+    
+    pthread_mutex_lock(&connections_mutex);
+    for (int i = 0; i < connection_capacity; i++) {
+        if (connections[i].active && connections[i].socket != INVALID_SOCKET) {
+            connections[i].parked = 0;
+            connections[i].peer->resumed = 1;
+            if (start_reader_thread(i) != 0) {
+                failed++;
+            }
+        }
+    }
+    pthread_mutex_unlock(&connections_mutex);
+    
+    return failed;
+}
+
+// Wait for every receiver thread to exit
+void join_receivers(void) {
     pthread_mutex_lock(&connections_mutex);
+    while (receiver_count > 0) {
+        pthread_cond_wait(&receivers_exited, &connections_mutex);
+    }
+    pthread_mutex_unlock(&connections_mutex);
+}
+
+// Create the slot's store queue on first use (caller holds send_mutex)
+int open_queue(Connection* conn) {
+    if (conn->queue != NULL) {
+        return 0;
+    }
     
-    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+    // Process ID keeps a successor's spill files apart from ours during a handoff
+    char spill_path[STORE_PATH_LENGTH];
+    snprintf(spill_path, sizeof(spill_path), "%s/p2p_spool_%d_%ld_%d.dat",
+             STORE_SPOOL_DIR, listen_port, (long)getpid(), conn->id);
+    conn->queue = store_create(spill_path);
+    return conn->queue != NULL ? 0 : -1;
+}
+
+// Find slot by IP and port (caller holds connections_mutex)
+static int find_address_slot(const char* ip, int port) {
+    for (int i = 0; i < connection_capacity; i++) {
         if (connections[i].active && 
-            strcmp(connections[i].ip, ip) == 0 && 
-            connections[i].port == port) {
-            pthread_mutex_unlock(&connections_mutex);
+            strcmp(connections[i].peer->ip, ip) == 0 && 
+            (connections[i].peer->port == port ||
+             connections[i].peer->listen_port == port)) {
             return i;
         }
     }
+    return -1;
+}
+
+// Find connection by IP and port (dialed port or peer's listen port)
+int find_connection_by_address(const char* ip, int port) {
+    pthread_mutex_lock(&connections_mutex);
+    int slot = find_address_slot(ip, port);
+    pthread_mutex_unlock(&connections_mutex);
+    return slot;
+}
+
+// Connection to the peer listening on ip:port. Without one, an offline
+// outbound slot is opened for the reconnect thread to dial right away;
+// messages queue there and go out after the handshake, so the caller
+// never waits for the dial. Returns its ID or P2P_ERR_LIMIT.
+int lazy_connection(const char* ip, int port) {
+    pthread_mutex_lock(&connections_mutex);
+    
+    int slot = find_address_slot(ip, port);
+    if (slot == -1) {
+        slot = claim_slot(INVALID_SOCKET, ip, port, 1);
+    }
+    int conn_id = slot != -1 ? connections[slot].id : P2P_ERR_LIMIT;
+    int dial = slot != -1 && connections[slot].state == CONN_OFFLINE;
     
     pthread_mutex_unlock(&connections_mutex);
-    return -1;
+    
+    if (dial) {
+        wakeup_nudge();
+    }
+    return conn_id;
+}
+
+// Connections this node dialed, reached or not
+int get_outbound_count(void) {
+    int count = 0;
+    pthread_mutex_lock(&connections_mutex);
+    for (int i = 0; i < connection_capacity; i++) {
+        if (connections[i].active && connections[i].peer->outbound) {
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&connections_mutex);
+    return count;
+}
+
+// Stop dialing ip:port if no handshake with it ever completed and nothing
+// is queued for it, 1 if stopped
+int drop_unreached(const char* ip, int port) {
+    pthread_mutex_lock(&connections_mutex);
+    int slot = find_address_slot(ip, port);
+    int dropped = slot != -1 && connections[slot].peer->outbound &&
+                  connections[slot].peer->node_id == 0 &&
+                  connections[slot].state == CONN_OFFLINE && connections[slot].queue == NULL;
+    if (dropped) {
+        release_slot(slot);
+    }
+    pthread_mutex_unlock(&connections_mutex);
+    return dropped;
 }
 
 // Find connection by ID
 int find_connection_by_id(int conn_id) {
     pthread_mutex_lock(&connections_mutex);
     
-    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+    for (int i = 0; i < connection_capacity; i++) {
         if (connections[i].active && connections[i].id == conn_id) {
             pthread_mutex_unlock(&connections_mutex);
             return i;
@@ -137,7 +583,7 @@ int find_connection_by_id(int conn_id) {
 Connection* get_connection_by_id(int conn_id) {
     pthread_mutex_lock(&connections_mutex);
     
-    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+    for (int i = 0; i < connection_capacity; i++) {
         if (connections[i].active && connections[i].id == conn_id) {
             pthread_mutex_unlock(&connections_mutex);
             return &connections[i];
@@ -148,124 +594,1401 @@ Connection* get_connection_by_id(int conn_id) {
     return NULL;
 }
 
-// Get active connection count
-int get_active_connection_count(void) {
-    int count = 0;
+// Copy address of connection, -1 if unknown
+int get_connection_address(int conn_id, char* ip, int* port) {
+    int slot = find_connection_by_id(conn_id);
+    int result = -1;
     
     pthread_mutex_lock(&connections_mutex);
-    for (int i = 0; i < MAX_CONNECTIONS; i++) {
-        if (connections[i].active) {
-            count++;
-        }
+    if (slot >= 0 && connections[slot].active && connections[slot].id == conn_id) {
+        strcpy(ip, connections[slot].peer->ip);
+        *port = connections[slot].peer->port;
+        result = 0;
     }
     pthread_mutex_unlock(&connections_mutex);
     
-    return count;
+    return result;
 }
 
-// Print connection list
-void print_connection_list(void) {
-    printf("\n=== Active Connections ===\n");
-    int count = 0;
-    
+// Send an unsequenced frame to an online connection, serialized with other writers
+int send_control(int conn_id, uint8_t type, uint8_t flags, uint16_t stream,
+                 const void* payload, uint32_t length) {
     pthread_mutex_lock(&connections_mutex);
-    for (int i = 0; i < MAX_CONNECTIONS; i++) {
-        if (connections[i].active) {
-            printf("ID: %d | IP: %s | Port: %d\n", 
-                   connections[i].id, connections[i].ip, connections[i].port);
-            count++;
-        }
+    
+    int slot = find_slot(conn_id);
+    if (slot == -1 || connections[slot].state != CONN_ONLINE) {
+        pthread_mutex_unlock(&connections_mutex);
+        return -1;
     }
+    
+    Connection* conn = &connections[slot];
+    pthread_mutex_lock(&conn->send_mutex);
     pthread_mutex_unlock(&connections_mutex);
     
-    if (count == 0) {
-        printf("No active connections\n");
+    int result = write_stream_frame(connection_write, conn, type, flags, stream,
+                                    payload, length);
+    pthread_mutex_unlock(&conn->send_mutex);
+    
+    // Written outside send_mutex so concurrent senders coalesce behind us
+    if (result >= 0) {
+        result = batch_flush(&conn->batch);
     }
-    printf("==========================\n\n");
+    return result;
 }
 
-// Accept connections thread
-void* accept_connections_thread(void* arg) {
-    struct sockaddr_in client_addr;
-    SOCKET client_socket;
+// Send a control frame to an online connection
+int send_to_connection(int conn_id, uint8_t type, const void* payload, uint32_t length) {
+    return send_control(conn_id, type, 0, 0, payload, length);
+}
+
+// Send a sequenced frame, kept queued until the peer acknowledges it.
+// Returns 0 if sent, 1 if queued for an offline peer, -1 on error.
+int queue_to_connection(int conn_id, uint8_t type, const void* payload, uint32_t length) {
+    pthread_mutex_lock(&connections_mutex);
     
-    (void)arg; // Unused parameter
+    int slot = find_slot(conn_id);
+    if (slot == -1) {
+        pthread_mutex_unlock(&connections_mutex);
+        return -1;
+    }
     
-    while (running) {
-        client_socket = accept_client(&client_addr);
-        
-        if (client_socket == INVALID_SOCKET) {
-            if (running) {
-                printf("Accept failed\n");
-            }
-            continue;
-        }
-        
-        char client_ip[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
-        int client_port = ntohs(client_addr.sin_port);
-        
-        int conn_id = add_connection(client_socket, client_ip, client_port);
-        if (conn_id != -1) {
-            printf("\n[New connection] Peer connected from %s:%d (ID: %d)\n", 
-                   client_ip, client_port, conn_id);
-            printf("> ");
-            fflush(stdout);
-        } else {
-            close(client_socket);
-        }
+    Connection* conn = &connections[slot];
+    int online = conn->state == CONN_ONLINE;
+    pthread_mutex_lock(&conn->send_mutex);
+    pthread_mutex_unlock(&connections_mutex);
+    
+    if (open_queue(conn) < 0) {
+        pthread_mutex_unlock(&conn->send_mutex);
+        return -1;
     }
     
-    return NULL;
+    uint64_t seq = conn->tx_seq + 1;
+    if (store_push(conn->queue, seq, type, payload, length) < 0) {
+        pthread_mutex_unlock(&conn->send_mutex);
+        return -1;
+    }
+    conn->tx_seq = seq;
+    
+    // A failed send leaves the frame queued; the receiver thread notices the loss
+    if (online) {
+        write_frame(connection_write, conn, type, seq, payload, length);
+    }
+    pthread_mutex_unlock(&conn->send_mutex);
+    
+    if (online) {
+        batch_flush(&conn->batch);
+    }
+    return online ? 0 : 1;
 }
 
-// Handle peer messages thread
-void* handle_peer_messages_thread(void* arg) {
-    int slot = *(int*)arg;
-    free(arg);
+// Stream sender callback: one DATA frame between whatever else is batched
+static int send_stream_chunk(void* ctx, uint16_t stream, uint8_t flags,
+                             const void* data, uint32_t length) {
+    Connection* conn = ctx;
     
-    char buffer[BUFFER_SIZE];
-    int bytes_received;
+    pthread_mutex_lock(&conn->send_mutex);
+    int result = write_stream_frame(connection_write, conn, FRAME_DATA, flags, stream,
+                                    data, length);
+    pthread_mutex_unlock(&conn->send_mutex);
     
-    while (running) {
-        pthread_mutex_lock(&connections_mutex);
-        if (!connections[slot].active) {
+    if (result >= 0) {
+        result = batch_flush(&conn->batch);
+    }
+    return result;
+}
+
+// Open a bulk stream, starting the connection's sender on first use
+int open_stream(int conn_id, int weight) {
+    pthread_mutex_lock(&connections_mutex);
+    
+    int slot = find_slot(conn_id);
+    if (slot == -1 || connections[slot].state != CONN_ONLINE) {
+        pthread_mutex_unlock(&connections_mutex);
+        return P2P_ERR_NOT_FOUND;
+    }
+    
+    Connection* conn = &connections[slot];
+    if (conn->streams == NULL) {
+        conn->streams = stream_set_create(send_stream_chunk, conn);
+        if (conn->streams == NULL) {
             pthread_mutex_unlock(&connections_mutex);
-            break;
+            return P2P_ERR_SYSTEM;
         }
-        
-        SOCKET sock = connections[slot].socket;
-        char ip[INET_ADDRSTRLEN];
-        strcpy(ip, connections[slot].ip);
-        int port = connections[slot].port;
-        int conn_id = connections[slot].id;
+        // Bulk data waits in our queues, not the kernel's, so chat overtakes it
+        set_notsent_lowat(conn->socket, STREAM_NOTSENT_LOWAT);
+    }
+    
+    int stream = stream_open(conn->streams, weight);
+    pthread_mutex_unlock(&connections_mutex);
+    return stream < 0 ? P2P_ERR_LIMIT : stream;
+}
+
+// Queue bulk data, waiting while the stream's queue is full
+int write_stream(int conn_id, int stream, const void* data, size_t length) {
+    pthread_mutex_lock(&connections_mutex);
+    
+    int slot = find_slot(conn_id);
+    if (slot == -1 || connections[slot].streams == NULL) {
         pthread_mutex_unlock(&connections_mutex);
-        
-        bytes_received = receive_message(sock, buffer, BUFFER_SIZE);
-        
-        if (bytes_received > 0) {
-            buffer[bytes_received] = '\0';
-            printf("\n[Message from %s:%d]: %s\n", ip, port, buffer);
-            printf("> ");
-            fflush(stdout);
-        } else if (bytes_received == 0) {
-            printf("\n[Connection closed] Peer %s:%d disconnected (ID: %d)\n", 
-                   ip, port, conn_id);
-            printf("> ");
-            fflush(stdout);
-            remove_connection(conn_id);
-            break;
-        } else {
-            if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                printf("\n[Error] Connection with %s:%d lost (ID: %d)\n", 
-                       ip, port, conn_id);
-                printf("> ");
-                fflush(stdout);
-                remove_connection(conn_id);
-                break;
-            }
-        }
+        return P2P_ERR_NOT_FOUND;
     }
     
-    return NULL;
-}
\ No newline at end of file
+    // Held, not locked: teardown waits for us instead of us blocking it
+    StreamSet* set = connections[slot].streams;
+    stream_set_hold(set);
+    pthread_mutex_unlock(&connections_mutex);
+    
+    int result = stream_write(set, (uint16_t)stream, data, length,
+                              frame_payload_limit);
+    stream_set_release(set);
+    
+    if (result == -3) {
+        return P2P_ERR_SYSTEM;
+    }
+    return result < 0 ? P2P_ERR_NOT_FOUND : P2P_OK;
+}
+
+// Finish a stream after its queued data
+int close_stream(int conn_id, int stream) {
+    int result = P2P_ERR_NOT_FOUND;
+    
+    pthread_mutex_lock(&connections_mutex);
+    int slot = find_slot(conn_id);
+    if (slot != -1 && connections[slot].streams != NULL &&
+        stream_close(connections[slot].streams, (uint16_t)stream) == 0) {
+        result = P2P_OK;
+    }
+    pthread_mutex_unlock(&connections_mutex);
+    
+    return result;
+}
+
+// Refuse a stream the peer is sending
+int reset_stream(int conn_id, int stream) {
+    return send_control(conn_id, FRAME_RESET, 0, (uint16_t)stream, NULL, 0) < 0
+           ? P2P_ERR_NOT_FOUND : P2P_OK;
+}
+
+// Stop every stream sender (before the sockets change hands)
+void stop_all_streams(void) {
+    pthread_mutex_lock(&connections_mutex);
+    for (int i = 0; i < connection_capacity; i++) {
+        if (connections[i].active) {
+            stop_streams(&connections[i], 0);
+        }
+    }
+    pthread_mutex_unlock(&connections_mutex);
+}
+
+// Get active connection count
+int get_active_connection_count(void) {
+    int count = 0;
+    
+    pthread_mutex_lock(&connections_mutex);
+    for (int i = 0; i < connection_capacity; i++) {
+        if (connections[i].active) {
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&connections_mutex);
+    
+    return count;
+}
+
+// Copy IDs of active connections, returns count
+int get_active_connection_ids(int* conn_ids, int max) {
+    int count = 0;
+    
+    pthread_mutex_lock(&connections_mutex);
+    for (int i = 0; i < connection_capacity && count < max; i++) {
+        if (connections[i].active) {
+            conn_ids[count++] = connections[i].id;
+        }
+    }
+    pthread_mutex_unlock(&connections_mutex);
+    
+    return count;
+}
+
+// Copy connection snapshot, returns count
+int get_connection_info(P2PConnectionInfo* out, int max) {
+    int count = 0;
+    
+    pthread_mutex_lock(&connections_mutex);
+    for (int i = 0; i < connection_capacity && count < max; i++) {
+        if (connections[i].active) {
+            pthread_mutex_lock(&connections[i].send_mutex);
+            int queued = connections[i].queue ? store_count(connections[i].queue) : 0;
+            pthread_mutex_unlock(&connections[i].send_mutex);
+            
+            out[count].id = connections[i].id;
+            strcpy(out[count].ip, connections[i].peer->ip);
+            out[count].port = connections[i].peer->port;
+            out[count].state = (P2PState)connections[i].state;  // Same ordering
+            out[count].queued = queued;
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&connections_mutex);
+    
+    return count;
+}
+
+// Admit and add one accepted connection
+static void admit_connection(SOCKET client_socket, const struct sockaddr_in* client_addr) {
+    // Over its address's rate: reset before it costs a slot or a thread
+    if (!admission_allow(&node_admission, client_addr->sin_addr.s_addr, get_monotonic_ms())) {
+        reset_socket(client_socket);
+        return;
+    }
+    
+    TRACE_BEGIN("accept");
+    char client_ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &client_addr->sin_addr, client_ip, INET_ADDRSTRLEN);
+    int client_port = ntohs(client_addr->sin_port);
+    
+    int conn_id = add_connection(client_socket, client_ip, client_port, 0);
+    TRACE_END("accept");
+    admission_record(&node_admission, conn_id);
+    if (conn_id < 0) {
+        P2PEvent event;
+        init_event(&event, P2P_EVENT_ERROR, -1, client_ip, client_port);
+        event.error = conn_id;
+        emit_event(&event);
+        reset_socket(client_socket);
+    }
+}
+
+// Accept connections thread: every wakeup drains the listen queue, so a
+// burst of peers is not left waiting in a small backlog
+void* accept_connections_thread(void* arg) {
+    struct sockaddr_in client_addr;
+    SOCKET client_socket;
+    
+    (void)arg; // Unused parameter
+    TRACE_THREAD("accept");
+    
+    while (running) {
+        // Woken by a stop, the listening socket stays open (handoff)
+        if (wait_readable(listen_socket, -1) == 0) {
+            continue;
+        }
+        
+        int result = 0;
+        while (running && (result = accept_client(&client_socket, &client_addr)) > 0) {
+            admit_connection(client_socket, &client_addr);
+            
+            #ifdef _WIN32
+            break;  // Blocking listener, wait for the next one
+            #endif
+        }
+        
+        // Out of descriptors the queue stays readable, don't spin on it
+        if (result < 0 && running) {
+            P2PEvent event;
+            init_event(&event, P2P_EVENT_ERROR, -1, NULL, 0);
+            event.error = P2P_ERR_SYSTEM;
+            emit_event(&event);
+            wait_wakeup(ACCEPT_ERROR_PAUSE_MS);
+        }
+    }
+    
+    return NULL;
+}
+
+// Send handshake with our identity and last delivered sequence number
+// (caller holds the slot's send_mutex and flushes)
+static void send_hello(int slot) {
+    unsigned char payload[HELLO_PAYLOAD_SIZE];
+    HelloPayload hello;
+    
+    hello.node_id = local_node_id;
+    hello.listen_port = (uint16_t)listen_port;
+    hello.last_received_seq = connections[slot].rx_seq;
+    encode_hello(&hello, payload);
+    write_frame(connection_write, &connections[slot], FRAME_HELLO, 0,
+                payload, sizeof(payload));
+}
+
+// Send cumulative acknowledgement
+static void send_ack(int slot, uint64_t seq) {
+    unsigned char payload[ACK_PAYLOAD_SIZE];
+    Connection* conn = &connections[slot];
+    
+    encode_u64(seq, payload);
+    pthread_mutex_lock(&conn->send_mutex);
+    write_frame(connection_write, conn, FRAME_ACK, 0, payload, sizeof(payload));
+    pthread_mutex_unlock(&conn->send_mutex);
+    batch_flush(&conn->batch);
+}
+
+// Replay callback: resend a queued frame through the batch
+static int resend_entry(void* ctx, uint64_t seq, uint8_t type,
+                        const unsigned char* data, uint32_t length) {
+    return write_frame(connection_write, ctx, type, seq, data, length);
+}
+
+// Merge callback: move a frame queued on a temporary slot into the resumed one
+static int requeue_entry(void* ctx, uint64_t seq, uint8_t type,
+                         const unsigned char* data, uint32_t length) {
+    Connection* conn = ctx;
+    (void)seq;
+    
+    if (store_push(conn->queue, conn->tx_seq + 1, type, data, length) < 0) {
+        return -1;
+    }
+    conn->tx_seq++;
+    return 0;
+}
+
+// Find an earlier inbound connection from the same peer (caller holds connections_mutex)
+static int find_resumable_slot(int slot, const char* ip, const HelloPayload* hello) {
+    for (int i = 0; i < connection_capacity; i++) {
+        Connection* conn = &connections[i];
+        if (i == slot || !conn->active || conn->peer->outbound || conn->peer->node_id == 0) {
+            continue;
+        }
+        
+        // Same process reconnecting, or a restarted peer on the same address
+        if (conn->peer->node_id == hello->node_id ||
+            (conn->state == CONN_OFFLINE && strcmp(conn->peer->ip, ip) == 0 &&
+             conn->peer->listen_port == hello->listen_port)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Move a freshly accepted socket into the peer's earlier slot (caller holds connections_mutex)
+static void resume_into_slot(int from, int to) {
+    Connection* src = &connections[from];
+    Connection* dst = &connections[to];
+    
+    // Drop a half-open predecessor, its receiver exits on socket mismatch
+    stop_streams(dst, 1);
+    if (dst->socket != INVALID_SOCKET) {
+        shutdown(dst->socket, 2);
+        close(dst->socket);
+    }
+    if (dst->parked) {
+        dst->parked = 0;
+        wakeup_park();
+    }
+    
+    dst->socket = src->socket;
+    batch_reset(&dst->batch, dst->socket);
+    strcpy(dst->peer->ip, src->peer->ip);
+    dst->peer->port = src->peer->port;
+    
+    // Carry over anything the user queued on the temporary ID
+    pthread_mutex_lock(&dst->send_mutex);
+    pthread_mutex_lock(&src->send_mutex);
+    if (src->queue != NULL) {
+        if (dst->queue == NULL) {
+            dst->queue = src->queue;
+            src->queue = NULL;
+            dst->tx_seq = src->tx_seq;
+        } else {
+            store_replay(src->queue, 0, requeue_entry, dst);
+        }
+    }
+    pthread_mutex_unlock(&src->send_mutex);
+    pthread_mutex_unlock(&dst->send_mutex);
+    
+    // The reader moves along with the socket
+    dst->spin = src->spin;
+    
+    src->socket = INVALID_SOCKET;
+    release_slot(from);
+}
+
+// Process peer handshake; may move this receiver to a resumed slot.
+// Returns 1 if an earlier session resumed, 0 if new, -1 if stale.
+static int handle_hello(int* slot, SOCKET sock, const HelloPayload* hello, int* replayed) {
+    pthread_mutex_lock(&connections_mutex);
+    
+    Connection* conn = &connections[*slot];
+    if (!conn->active || conn->socket != sock) {
+        pthread_mutex_unlock(&connections_mutex);
+        return -1;
+    }
+    
+    if (!conn->peer->outbound) {
+        int previous = find_resumable_slot(*slot, conn->peer->ip, hello);
+        if (previous != -1) {
+            resume_into_slot(*slot, previous);
+            *slot = previous;
+            conn = &connections[previous];
+        }
+    }
+    
+    int resumed = conn->peer->node_id != 0;
+    
+    // A restarted peer numbers its messages from the beginning again
+    if (conn->peer->node_id != hello->node_id) {
+        conn->rx_seq = 0;
+    }
+    conn->peer->node_id = hello->node_id;
+    conn->peer->listen_port = hello->listen_port;
+    conn->peer->retry_attempts = 0;
+    
+    // Going online under send_mutex keeps new sends behind the replay
+    pthread_mutex_lock(&conn->send_mutex);
+    conn->state = CONN_ONLINE;
+    int conn_id = conn->id;
+    int outbound = conn->peer->outbound;
+    char ip[INET_ADDRSTRLEN];
+    strcpy(ip, conn->peer->ip);
+    pthread_mutex_unlock(&connections_mutex);
+    
+    // Handshake reply, replay and subscriptions leave as one burst
+    batch_cork(&conn->batch);
+    
+    // The accepting side answers once it knows which session this is
+    if (!outbound) {
+        send_hello(*slot);
+    }
+    
+    // Replay only what the peer has not seen
+    *replayed = 0;
+    if (conn->queue != NULL) {
+        store_ack(conn->queue, hello->last_received_seq);
+        *replayed = store_replay(conn->queue, hello->last_received_seq,
+                                 resend_entry, conn);
+    }
+    pthread_mutex_unlock(&conn->send_mutex);
+    
+    // Peer resends its full subscription set after the handshake
+    topic_remove_connection(&node_topics, conn_id);
+    send_subscriptions(conn_id);
+    batch_uncork(&conn->batch);
+    batch_flush(&conn->batch);
+    
+    book_seen(&node_book, ip, hello->listen_port, hello->node_id, get_wall_ms());
+    return resumed;
+}
+
+// Process cumulative acknowledgement
+static void handle_ack(int slot, SOCKET sock, const unsigned char* payload, uint32_t length) {
+    if (length < ACK_PAYLOAD_SIZE) {
+        return;
+    }
+    
+    uint64_t seq = decode_u64(payload);
+    
+    pthread_mutex_lock(&connections_mutex);
+    Connection* conn = &connections[slot];
+    if (!conn->active || conn->socket != sock) {
+        pthread_mutex_unlock(&connections_mutex);
+        return;
+    }
+    pthread_mutex_lock(&conn->send_mutex);
+    pthread_mutex_unlock(&connections_mutex);
+    
+    if (conn->queue != NULL) {
+        store_ack(conn->queue, seq);
+    }
+    pthread_mutex_unlock(&conn->send_mutex);
+}
+
+// Process stream credit: the peer consumed data of one of our streams
+static void handle_credit(int slot, SOCKET sock, const FrameHeader* header,
+                          const unsigned char* payload) {
+    if (header->length < CREDIT_PAYLOAD_SIZE) {
+        return;
+    }
+    
+    pthread_mutex_lock(&connections_mutex);
+    Connection* conn = &connections[slot];
+    if (conn->active && conn->socket == sock && conn->streams != NULL) {
+        stream_credit(conn->streams, header->stream, decode_u32(payload));
+    }
+    pthread_mutex_unlock(&connections_mutex);
+}
+
+// Process a stream reset: the peer wants no more of it
+static void handle_reset(int slot, SOCKET sock, const FrameHeader* header) {
+    pthread_mutex_lock(&connections_mutex);
+    Connection* conn = &connections[slot];
+    if (conn->active && conn->socket == sock && conn->streams != NULL) {
+        stream_reset(conn->streams, header->stream);
+    }
+    pthread_mutex_unlock(&connections_mutex);
+}
+
+// Handle a dropped socket: handshaken peers are kept so messages queue up
+// until they come back. Returns 1 if kept, 0 if removed, -1 if already gone.
+static int handle_connection_lost(int slot, SOCKET sock) {
+    pthread_mutex_lock(&connections_mutex);
+    
+    Connection* conn = &connections[slot];
+    if (!conn->active || conn->socket != sock) {
+        pthread_mutex_unlock(&connections_mutex);
+        return -1;
+    }
+    
+    stop_streams(conn, 1);
+    close(sock);
+    conn->socket = INVALID_SOCKET;
+    batch_reset(&conn->batch, INVALID_SOCKET);
+    
+    if (conn->peer->node_id == 0) {
+        int conn_id = conn->id;
+        release_slot(slot);
+        pthread_mutex_unlock(&connections_mutex);
+        topic_remove_connection(&node_topics, conn_id);
+        return 0;
+    }
+    
+    conn->state = CONN_OFFLINE;
+    if (conn->peer->outbound) {
+        conn->peer->retry_attempts = 0;
+        conn->peer->next_retry_ms = get_monotonic_ms() + backoff_delay(0);
+    }
+    
+    pthread_mutex_unlock(&connections_mutex);
+    return 1;
+}
+
+// Snapshot peer info for slot, returns 0 if the slot still owns sock
+static int load_peer_info(int slot, SOCKET sock, char* ip, int* port, int* conn_id) {
+    pthread_mutex_lock(&connections_mutex);
+    
+    if (!connections[slot].active || connections[slot].socket != sock) {
+        pthread_mutex_unlock(&connections_mutex);
+        return -1;
+    }
+    
+    strcpy(ip, connections[slot].peer->ip);
+    *port = connections[slot].peer->port;
+    *conn_id = connections[slot].id;
+    
+    pthread_mutex_unlock(&connections_mutex);
+    return 0;
+}
+
+// Dispatch a received frame
+static void handle_frame(int conn_id, const char* ip, int port,
+                         const FrameHeader* header, const unsigned char* payload,
+                         char* message, size_t message_size) {
+    char topic[MAX_TOPIC_LENGTH + 1];
+    char source[SEARCH_SOURCE_LENGTH];
+    unsigned char credit[CREDIT_PAYLOAD_SIZE];
+    EntryKey key;
+    int late;
+    uint8_t type = header->type;
+    uint32_t length = header->length;
+    P2PEvent event;
+    
+    switch (type) {
+        case FRAME_MESSAGE:
+            init_event(&event, P2P_EVENT_MESSAGE, conn_id, ip, port);
+            event.data = payload;
+            event.length = length;
+            emit_event(&event);
+            
+            snprintf(source, sizeof(source), "%s:%d", ip, port);
+            search_add(&node_index, get_wall_ms(), source, payload, length);
+            break;
+            
+        case FRAME_SUBSCRIBE:
+        case FRAME_UNSUBSCRIBE:
+            if (length == 0 || length > MAX_TOPIC_LENGTH) {
+                break;
+            }
+            memcpy(topic, payload, length);
+            topic[length] = '\0';
+            
+            // Same names as p2p_subscribe accepts, an embedded NUL included
+            if (strlen(topic) != length || !is_valid_topic(topic)) {
+                break;
+            }
+            if (type == FRAME_SUBSCRIBE) {
+                topic_add_subscriber(&node_topics, topic, conn_id);
+                
+                // Closed while the frame waited on a worker: the close has
+                // cleared its subscriptions already, or does so after this check
+                if (find_connection_by_id(conn_id) == -1) {
+                    topic_remove_subscriber(&node_topics, topic, conn_id);
+                } else if (topic_is_joined(&node_topics, topic)) {
+                    // A new or returning member catches up on what it missed
+                    sync_room_with(conn_id, topic);
+                }
+            } else {
+                topic_remove_subscriber(&node_topics, topic, conn_id);
+            }
+            break;
+            
+        case FRAME_PUBLISH:
+            if (decode_publish(payload, length, topic, sizeof(topic),
+                               message, message_size) < 0 ||
+                !topic_is_joined(&node_topics, topic)) {
+                break;
+            }
+            init_event(&event, P2P_EVENT_PUBLISH, conn_id, ip, port);
+            event.topic = topic;
+            event.data = (const unsigned char*)message;
+            event.length = strlen(message);
+            emit_event(&event);
+            
+            snprintf(source, sizeof(source), "#%s", topic);
+            search_add(&node_index, get_wall_ms(), source, message, strlen(message));
+            break;
+            
+        case FRAME_ENTRY:
+            if (!handle_entry(payload, length, &key, topic, sizeof(topic),
+                              message, message_size, &late)) {
+                break;
+            }
+            init_event(&event, P2P_EVENT_PUBLISH, conn_id, ip, port);
+            event.topic = topic;
+            event.data = (const unsigned char*)message;
+            event.length = strlen(message);
+            event.timestamp = (long long)(key.clock >> 16);
+            event.origin = key.origin;
+            event.late = late;
+            event.repaired = (header->flags & FRAME_FLAG_SYNC) != 0;
+            emit_event(&event);
+            
+            // Logged once, so each entry is indexed once
+            snprintf(source, sizeof(source), "#%s", topic);
+            search_add(&node_index, event.timestamp, source, message, event.length);
+            break;
+            
+        case FRAME_DIGEST:
+            handle_digest(conn_id, payload, length);
+            break;
+            
+        case FRAME_DATA:
+            if (header->stream == 0) {
+                break;
+            }
+            init_event(&event, P2P_EVENT_STREAM, conn_id, ip, port);
+            event.stream = header->stream;
+            event.fin = (header->flags & FRAME_FLAG_FIN) != 0;
+            event.data = payload;
+            event.length = length;
+            emit_event(&event);
+            
+            // Credit once the application took the data: a slow consumer
+            // stalls only its own stream
+            if (length > 0) {
+                encode_u32(length, credit);
+                send_control(conn_id, FRAME_CREDIT, 0, header->stream,
+                             credit, sizeof(credit));
+            }
+            break;
+            
+        default:
+            // Ignore unknown frame types from newer peers
+            break;
+    }
+}
+
+// Worker pool handler: process a frame in the order its receiver read it
+void process_frame(const WorkItem* item, void* scratch) {
+    handle_frame(item->key, item->ip, item->port, &item->header, item->data,
+                 (char*)scratch, (size_t)node_config.buffer_size);
+}
+
+// Keep unparsed bytes with the slot when its receiver stops
+static void save_backlog(int slot, SOCKET sock, const FrameReader* reader) {
+    pthread_mutex_lock(&connections_mutex);
+    
+    Connection* conn = &connections[slot];
+    if (conn->active && conn->socket == sock && reader->used > 0) {
+        conn->peer->rx_backlog = malloc(reader->used);
+        if (conn->peer->rx_backlog != NULL) {
+            memcpy(conn->peer->rx_backlog, reader->data, reader->used);
+            conn->peer->rx_backlog_length = reader->used;
+        }
+    }
+    
+    pthread_mutex_unlock(&connections_mutex);
+}
+
+// Load bytes left by a previous receiver, -1 if they don't fit the buffer
+static int restore_backlog(int slot, FrameReader* reader) {
+    int result = 0;
+    
+    pthread_mutex_lock(&connections_mutex);
+    
+    Connection* conn = &connections[slot];
+    if (conn->peer->rx_backlog != NULL) {
+        if (conn->peer->rx_backlog_length <= reader->capacity) {
+            memcpy(reader->data, conn->peer->rx_backlog, conn->peer->rx_backlog_length);
+            reader->used = conn->peer->rx_backlog_length;
+        } else {
+            result = -1;
+        }
+        free(conn->peer->rx_backlog);
+        conn->peer->rx_backlog = NULL;
+        conn->peer->rx_backlog_length = 0;
+    }
+    
+    pthread_mutex_unlock(&connections_mutex);
+    return result;
+}
+
+// Hand a quiet online slot over to the park thread, 1 if parked and its
+// receiver exits
+static int park_slot(int slot, SOCKET sock) {
+    pthread_mutex_lock(&connections_mutex);
+    Connection* conn = &connections[slot];
+    int parked = running && conn->active && conn->socket == sock && conn->state == CONN_ONLINE;
+    if (parked) {
+        conn->parked = 1;
+    }
+    pthread_mutex_unlock(&connections_mutex);
+    
+    if (parked) {
+        wakeup_park();
+    }
+    return parked;
+}
+
+// Read side of a connection, kept by its receiver thread or the spin thread
+typedef struct {
+    int slot;
+    SOCKET sock;                     // The slot's socket, identifies the session
+    SOCKET fd;                       // Read from: sock, or the spin thread's duplicate
+    char ip[INET_ADDRSTRLEN];
+    int port;
+    int conn_id;
+    unsigned char* buffer;           // NULL while a quiet receiver holds none
+    FrameReader reader;
+} Receiver;
+
+// Start reading slot: announce it, open the handshake and load what an
+// earlier receiver left. The spin thread takes only pending slots and reads
+// a duplicate descriptor, which stays valid whoever closes the socket.
+// Returns 0, or -1 when there is nothing to read (events sent).
+static int open_receiver(Receiver* rx, int slot, int duplicate) {
+    P2PEvent event;
+    
+    rx->buffer = buffer_take(&recv_buffers);
+    
+    pthread_mutex_lock(&connections_mutex);
+    Connection* conn = &connections[slot];
+    if (duplicate && (!conn->active || conn->spin != SPIN_PENDING)) {
+        pthread_mutex_unlock(&connections_mutex);
+        buffer_give(&recv_buffers, rx->buffer);
+        return -1;
+    }
+    rx->slot = slot;
+    rx->sock = conn->socket;
+    rx->fd = rx->sock;
+    if (duplicate) {
+        conn->spin = SPIN_READING;
+        rx->fd = rx->sock != INVALID_SOCKET ? dup(rx->sock) : INVALID_SOCKET;
+    }
+    int outbound = conn->peer->outbound;
+    int redial = conn->peer->node_id != 0;
+    int resumed = conn->peer->resumed;
+    strcpy(rx->ip, conn->peer->ip);
+    rx->port = conn->peer->port;
+    rx->conn_id = conn->id;
+    conn->peer->resumed = 0;
+    pthread_mutex_unlock(&connections_mutex);
+    
+    // Announce before any frame is delivered; redials report RECONNECTED instead
+    if (!redial) {
+        init_event(&event, P2P_EVENT_CONNECTED, rx->conn_id, rx->ip, rx->port);
+        event.outbound = outbound;
+        emit_event(&event);
+    }
+    
+    // The dialing side opens the handshake, unless it did before the restart
+    if (outbound && !resumed) {
+        pthread_mutex_lock(&connections[slot].send_mutex);
+        send_hello(slot);
+        pthread_mutex_unlock(&connections[slot].send_mutex);
+        batch_flush(&connections[slot].batch);
+    }
+    
+    if (rx->buffer == NULL || rx->fd == INVALID_SOCKET) {
+        init_event(&event, P2P_EVENT_ERROR, rx->conn_id, rx->ip, rx->port);
+        event.error = P2P_ERR_SYSTEM;
+        emit_event(&event);
+        handle_connection_lost(slot, rx->sock);
+        buffer_give(&recv_buffers, rx->buffer);
+        return -1;
+    }
+    
+    frame_reader_init(&rx->reader, rx->buffer, (size_t)node_config.buffer_size);
+    if (restore_backlog(slot, &rx->reader) < 0) {
+        remove_connection(rx->conn_id);
+        init_event(&event, P2P_EVENT_DISCONNECTED, rx->conn_id, rx->ip, rx->port);
+        event.reason = P2P_REASON_PROTOCOL;
+        emit_event(&event);
+        if (rx->fd != rx->sock) {
+            close(rx->fd);
+        }
+        buffer_give(&recv_buffers, rx->buffer);
+        return -1;
+    }
+    return 0;
+}
+
+// Read once and dispatch the whole frames: through frame_pool, or with
+// scratch right here on the reading thread. Returns 1 after data, 0 if
+// none was waiting, -1 once the connection ended (events sent).
+static int receive_frames(Receiver* rx, int flags, char* scratch) {
+    FrameReader* reader = &rx->reader;
+    FrameHeader header;
+    const unsigned char* payload;
+    P2PEvent event;
+    
+    int bytes_received = recv(rx->fd, (char*)reader->data + reader->used,
+                              reader->capacity - reader->used, flags);
+    
+    if (bytes_received > 0) {
+        TRACE_INSTANT("recv", bytes_received);
+        reader->used += bytes_received;
+        
+        int status;
+        int peer_closed = 0;
+        while ((status = frame_reader_next(reader, &header, &payload)) > 0) {
+            TRACE_BEGIN("decode");
+            capture_frame(&node_capture, rx->conn_id, CAPTURE_IN, &header, payload);
+            if (header.type == FRAME_HELLO) {
+                HelloPayload hello;
+                int replayed;
+                if (decode_hello(payload, header.length, &hello) == 0 &&
+                    handle_hello(&rx->slot, rx->sock, &hello, &replayed) > 0 &&
+                    load_peer_info(rx->slot, rx->sock, rx->ip, &rx->port, &rx->conn_id) == 0) {
+                    init_event(&event, P2P_EVENT_RECONNECTED, rx->conn_id, rx->ip, rx->port);
+                    event.replayed = replayed;
+                    emit_event(&event);
+                }
+            } else if (header.type == FRAME_ACK) {
+                handle_ack(rx->slot, rx->sock, payload, header.length);
+            } else if (header.type == FRAME_CREDIT) {
+                handle_credit(rx->slot, rx->sock, &header, payload);
+            } else if (header.type == FRAME_RESET) {
+                handle_reset(rx->slot, rx->sock, &header);
+            } else if (header.type == FRAME_CLOSE) {
+                peer_closed = 1;
+            } else if (header.seq != 0 && header.seq <= connections[rx->slot].rx_seq) {
+                // Duplicate from a replay, already delivered
+            } else {
+                if (header.seq != 0) {
+                    connections[rx->slot].rx_seq = header.seq;
+                    connections[rx->slot].rx_unacked++;
+                }
+                if (scratch != NULL) {
+                    handle_frame(rx->conn_id, rx->ip, rx->port, &header, payload,
+                                 scratch, (size_t)node_config.buffer_size);
+                } else {
+                    // Only fails once the node is stopping
+                    worker_submit(&frame_pool, rx->conn_id, rx->ip, rx->port, &header, payload);
+                }
+            }
+            frame_reader_consume(reader, &header);
+            TRACE_END("decode");
+            
+            if (peer_closed) {
+                break;
+            }
+        }
+        
+        // Frames already handed to workers come before the disconnect
+        if (peer_closed || status < 0) {
+            worker_wait_key(&frame_pool, rx->conn_id);
+        }
+        
+        if (peer_closed) {
+            close_connection(rx->conn_id);
+            init_event(&event, P2P_EVENT_DISCONNECTED, rx->conn_id, rx->ip, rx->port);
+            event.reason = P2P_REASON_CLOSED;
+            emit_event(&event);
+            return -1;
+        }
+        
+        if (status < 0) {
+            remove_connection(rx->conn_id);
+            init_event(&event, P2P_EVENT_DISCONNECTED, rx->conn_id, rx->ip, rx->port);
+            event.reason = P2P_REASON_PROTOCOL;
+            emit_event(&event);
+            return -1;
+        }
+        
+        // One cumulative ACK per read burst
+        if (connections[rx->slot].rx_unacked > 0) {
+            send_ack(rx->slot, connections[rx->slot].rx_seq);
+            connections[rx->slot].rx_unacked = 0;
+        }
+        return 1;
+    }
+    
+    if (bytes_received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        worker_wait_key(&frame_pool, rx->conn_id);
+        int kept = handle_connection_lost(rx->slot, rx->sock);
+        if (kept > 0) {
+            init_event(&event, P2P_EVENT_OFFLINE, rx->conn_id, rx->ip, rx->port);
+            event.outbound = connections[rx->slot].peer->outbound;
+            emit_event(&event);
+        } else if (kept == 0) {
+            init_event(&event, P2P_EVENT_DISCONNECTED, rx->conn_id, rx->ip, rx->port);
+            event.reason = bytes_received == 0 ? P2P_REASON_CLOSED : P2P_REASON_IO_ERROR;
+            emit_event(&event);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+// Stop reading: stopped with the link up, the next receiver continues mid-frame
+static void close_receiver(Receiver* rx) {
+    if (!running && rx->buffer != NULL) {
+        save_backlog(rx->slot, rx->sock, &rx->reader);
+    }
+    if (rx->fd != rx->sock && rx->fd != INVALID_SOCKET) {
+        close(rx->fd);
+    }
+    buffer_give(&recv_buffers, rx->buffer);
+    rx->buffer = NULL;
+}
+
+// Handle peer messages thread
+void* handle_peer_messages_thread(void* arg) {
+    int slot = *(int*)arg;
+    free(arg);
+    
+    Receiver rx;
+    
+    TRACE_THREAD("receiver");
+    
+    // Receive buffer sized by buffer_size, frames are processed by frame_pool;
+    // a quiet connection gives it back to the pool, then parks
+    int idle_ms = node_config.park_idle > 0 ? node_config.park_idle : -1;
+    if (open_receiver(&rx, slot, 0) < 0) {
+        return NULL;
+    }
+    
+    while (running) {
+        if (load_peer_info(rx.slot, rx.sock, rx.ip, &rx.port, &rx.conn_id) < 0) {
+            break;
+        }
+        
+        // Woken by a stop, the socket stays open for a successor
+        int ready = wait_readable(rx.sock, rx.buffer != NULL ? idle_ms : -1);
+        if (ready == 0) {
+            if (running && rx.buffer != NULL && rx.reader.used == 0) {
+                buffer_give(&recv_buffers, rx.buffer);
+                rx.buffer = NULL;
+                batch_trim(&connections[rx.slot].batch);
+                if (park_slot(rx.slot, rx.sock)) {
+                    return NULL;
+                }
+            }
+            continue;
+        }
+        
+        if (rx.buffer == NULL) {
+            rx.buffer = buffer_take(&recv_buffers);
+            if (rx.buffer == NULL) {
+                // Out of memory: leave the data queued in the socket for now
+                wait_wakeup(PARK_ERROR_PAUSE_MS);
+                continue;
+            }
+            frame_reader_init(&rx.reader, rx.buffer, (size_t)node_config.buffer_size);
+        }
+        
+        if (receive_frames(&rx, 0, NULL) < 0) {
+            break;
+        }
+    }
+    
+    close_receiver(&rx);
+    return NULL;
+}
+
+// Have the reconnect thread dial the best known peers
+void schedule_warm_pool(void) {
+    warm_scheduled = 1;
+    wakeup_nudge();
+}
+
+// Dial up to warm_peers known peers that are not connected, all at once
+static void warm_pool(void) {
+    int max = node_config.warm_peers;
+    BookEntry* entries = malloc(BOOK_MAX_ENTRIES * sizeof(BookEntry));
+    DialTarget* targets = max > 0 ? malloc(max * sizeof(DialTarget)) : NULL;
+    if (entries == NULL || targets == NULL) {
+        free(entries);
+        free(targets);
+        return;
+    }
+    
+    // Ranked fewest failures first, so the rest are skipped too
+    int count = book_list(&node_book, entries, BOOK_MAX_ENTRIES);
+    int dials = 0;
+    for (int i = 0; i < count && dials < max; i++) {
+        const BookEntry* entry = &entries[i];
+        if (entry->failures >= BOOK_MAX_FAILURES) {
+            break;
+        }
+        if ((strcmp(entry->ip, local_ip) == 0 && entry->port == listen_port) ||
+            find_connection_by_address(entry->ip, entry->port) != -1) {
+            continue;
+        }
+        strcpy(targets[dials].ip, entry->ip);
+        targets[dials].port = entry->port;
+        dials++;
+    }
+    free(entries);
+    
+    connect_peers(targets, dials);
+    
+    for (int i = 0; i < dials; i++) {
+        DialTarget* target = &targets[i];
+        int connected = target->sock != INVALID_SOCKET;
+        book_dialed(&node_book, target->ip, target->port, connected, target->connect_ms);
+        
+        // The peer may have dialed us, or been sent to, meanwhile
+        if (connected && (!running || find_connection_by_address(target->ip, target->port) != -1 ||
+                          add_connection(target->sock, target->ip, target->port, 1) < 0)) {
+            close(target->sock);
+        }
+    }
+    free(targets);
+}
+
+// Install the outcome of dialing slot (its ID conn_id then) into it
+static void install_dial(int slot, int conn_id, DialTarget* target) {
+    Connection* conn = &connections[slot];
+    int connected = target->sock != INVALID_SOCKET;
+    
+    pthread_mutex_lock(&connections_mutex);
+    if (!conn->active || conn->id != conn_id || conn->state != CONN_OFFLINE) {
+        // Terminated while we were dialing
+        pthread_mutex_unlock(&connections_mutex);
+        if (connected) {
+            close(target->sock);
+        }
+        return;
+    }
+    
+    if (connected) {
+        conn->socket = target->sock;
+        batch_reset(&conn->batch, target->sock);
+        conn->state = CONN_CONNECTING;
+        if (start_reader_thread(slot) != 0) {
+            close(target->sock);
+            conn->socket = INVALID_SOCKET;
+            batch_reset(&conn->batch, INVALID_SOCKET);
+            conn->state = CONN_OFFLINE;
+            connected = 0;
+        }
+    }
+    
+    if (!connected) {
+        conn->peer->retry_attempts++;
+        conn->peer->next_retry_ms = get_monotonic_ms() +
+                                    backoff_delay(conn->peer->retry_attempts);
+    }
+    pthread_mutex_unlock(&connections_mutex);
+}
+
+// Redial dropped outbound peers with jittered exponential backoff. Every
+// peer due is dialed in parallel, so one unreachable peer does not hold
+// up the rest; lazy_connection() and schedule_warm_pool() nudge it awake.
+void* reconnect_peers_thread(void* arg) {
+    (void)arg; // Unused parameter
+    TRACE_THREAD("reconnect");
+    
+    DialTarget* targets = malloc(connection_capacity * sizeof(DialTarget));
+    int* slots = malloc(connection_capacity * sizeof(int));
+    int* conn_ids = malloc(connection_capacity * sizeof(int));
+    if (targets == NULL || slots == NULL || conn_ids == NULL) {
+        free(targets);
+        free(slots);
+        free(conn_ids);
+        return NULL;
+    }
+    long long saved_ms = get_monotonic_ms();
+    
+    while (running) {
+        wait_nudge(RECONNECT_POLL_MS);
+        
+        // Room anti-entropy rides on the same timer
+        long long now = get_monotonic_ms();
+        sync_rooms(now);
+        
+        if (warm_scheduled && running) {
+            warm_scheduled = 0;
+            warm_pool();
+        }
+        
+        int dials = 0;
+        pthread_mutex_lock(&connections_mutex);
+        for (int i = 0; i < connection_capacity; i++) {
+            Connection* conn = &connections[i];
+            if (conn->active && conn->peer->outbound && conn->state == CONN_OFFLINE &&
+                now >= conn->peer->next_retry_ms) {
+                strcpy(targets[dials].ip, conn->peer->ip);
+                targets[dials].port = conn->peer->port;
+                slots[dials] = i;
+                conn_ids[dials] = conn->id;
+                dials++;
+            }
+        }
+        pthread_mutex_unlock(&connections_mutex);
+        
+        if (dials > 0 && running) {
+            connect_peers(targets, dials);
+            for (int i = 0; i < dials; i++) {
+                book_dialed(&node_book, targets[i].ip, targets[i].port,
+                            targets[i].sock != INVALID_SOCKET, targets[i].connect_ms);
+                install_dial(slots[i], conn_ids[i], &targets[i]);
+            }
+        }
+        
+        if (get_monotonic_ms() - saved_ms >= BOOK_SAVE_MS) {
+            book_save(&node_book);
+            saved_ms = get_monotonic_ms();
+        }
+    }
+    
+    free(targets);
+    free(slots);
+    free(conn_ids);
+    return NULL;
+}
+
+// Give free heap memory back to the system
+static void trim_heap(void) {
+    #ifdef __GLIBC__
+    malloc_trim(0);
+    #endif
+}
+
+// Watch parked connections and restart the receiver of one that becomes
+// readable: data, the peer closing or an error all need it
+void* park_connections_thread(void* arg) {
+    (void)arg; // Unused parameter
+    TRACE_THREAD("park");
+    
+    struct pollfd* pfd = malloc((connection_capacity + 2) * sizeof(struct pollfd));
+    int* slots = malloc(connection_capacity * sizeof(int));
+    if (pfd == NULL || slots == NULL) {
+        free(pfd);
+        free(slots);
+        return NULL;
+    }
+    
+    int trimmed = 0;                 // Parked at the last trim
+    long long trim_ms = 0;
+    
+    while (running) {
+        int count = 0;
+        pthread_mutex_lock(&connections_mutex);
+        for (int i = 0; i < connection_capacity; i++) {
+            if (connections[i].active && connections[i].parked) {
+                pfd[count].fd = connections[i].socket;
+                pfd[count].events = POLLIN;
+                slots[count] = i;
+                count++;
+            }
+        }
+        pthread_mutex_unlock(&connections_mutex);
+        
+        // Memory the parked receivers freed stays with the allocator until
+        // trimmed; more parked since the last trim, at most once per interval
+        int timeout_ms = -1;
+        if (count > trimmed) {
+            long long now = get_monotonic_ms();
+            if (now - trim_ms >= PARK_TRIM_MS) {
+                trim_heap();
+                trimmed = count;
+                trim_ms = now;
+            } else {
+                timeout_ms = (int)(trim_ms + PARK_TRIM_MS - now);
+            }
+        } else {
+            trimmed = count;
+        }
+        
+        if (wait_parked(pfd, count, timeout_ms) < 0) {
+            wait_wakeup(PARK_ERROR_PAUSE_MS);
+            continue;
+        }
+        
+        int failed = 0;
+        pthread_mutex_lock(&connections_mutex);
+        for (int i = 0; i < count && running; i++) {
+            Connection* conn = &connections[slots[i]];
+            if (pfd[i].revents == 0 || !conn->active || !conn->parked ||
+                conn->socket != pfd[i].fd) {
+                continue;
+            }
+            
+            // Same socket, same session: no HELLO and no CONNECTED event
+            conn->parked = 0;
+            conn->peer->resumed = 1;
+            if (start_reader_thread(slots[i]) != 0) {
+                conn->parked = 1;
+                failed = 1;
+            }
+        }
+        pthread_mutex_unlock(&connections_mutex);
+        
+        // Out of threads: the socket stays readable, try again shortly
+        if (failed) {
+            wait_wakeup(PARK_ERROR_PAUSE_MS);
+        }
+    }
+    
+    free(pfd);
+    free(slots);
+    return NULL;
+}
+
+// Pin the calling thread to cpu where the platform allows it
+static void pin_thread(int cpu) {
+    #ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    #else
+    (void)cpu;
+    #endif
+}
+
+// Refresh rx from its slot, -1 once the spin thread no longer reads it there
+static int reload_spinner(Receiver* rx) {
+    pthread_mutex_lock(&connections_mutex);
+    Connection* conn = &connections[rx->slot];
+    int owned = conn->active && conn->socket == rx->sock && conn->spin == SPIN_READING;
+    if (owned) {
+        strcpy(rx->ip, conn->peer->ip);
+        rx->port = conn->peer->port;
+        rx->conn_id = conn->id;
+    }
+    pthread_mutex_unlock(&connections_mutex);
+    return owned ? 0 : -1;
+}
+
+// Slots waiting for the spin thread, returns how many
+static int pending_spinners(int* slots) {
+    int count = 0;
+    pthread_mutex_lock(&connections_mutex);
+    for (int i = 0; i < connection_capacity; i++) {
+        if (connections[i].active && connections[i].spin == SPIN_PENDING) {
+            slots[count++] = i;
+        }
+    }
+    pthread_mutex_unlock(&connections_mutex);
+    return count;
+}
+
+// Spin mode: read every connection from one thread that polls their sockets
+// without blocking and handles frames itself, so a message costs no thread
+// wakeup and no frame_pool hand-off. After spin_idle quiet microseconds it
+// blocks until a socket is readable, and spins again from the next frame.
+void* spin_connections_thread(void* arg) {
+    (void)arg; // Unused parameter
+    TRACE_THREAD("spin");
+    
+    if (node_config.spin_cpu >= 0) {
+        pin_thread(node_config.spin_cpu);
+    }
+    
+    Receiver* receivers = malloc(connection_capacity * sizeof(Receiver));
+    int* slots = malloc(connection_capacity * sizeof(int));
+    struct pollfd* pfd = malloc((connection_capacity + 2) * sizeof(struct pollfd));
+    char* scratch = malloc((size_t)node_config.buffer_size);
+    if (receivers == NULL || slots == NULL || pfd == NULL || scratch == NULL) {
+        free(receivers);
+        free(slots);
+        free(pfd);
+        free(scratch);
+        return NULL;
+    }
+    
+    int count = 0;
+    int seen = spin_changes - 1;
+    long long quiet_since = get_monotonic_us();
+    
+    while (running) {
+        // The set changed: drop readers of released slots, take pending ones
+        if (spin_changes != seen) {
+            seen = spin_changes;
+            for (int i = 0; i < count; i++) {
+                if (reload_spinner(&receivers[i]) < 0) {
+                    close_receiver(&receivers[i]);
+                    receivers[i--] = receivers[--count];
+                }
+            }
+            int waiting = pending_spinners(slots);
+            for (int i = 0; i < waiting && count < connection_capacity; i++) {
+                if (open_receiver(&receivers[count], slots[i], 1) == 0) {
+                    count++;
+                }
+            }
+        }
+        
+        int received = 0;
+        for (int i = 0; i < count && running; i++) {
+            #ifdef MSG_DONTWAIT
+            int status = receive_frames(&receivers[i], MSG_DONTWAIT, scratch);
+            #else
+            int status = receive_frames(&receivers[i], 0, scratch);
+            #endif
+            if (status < 0) {
+                close_receiver(&receivers[i]);
+                receivers[i--] = receivers[--count];
+            } else if (status > 0) {
+                received = 1;
+            }
+        }
+        
+        long long now = get_monotonic_us();
+        if (received) {
+            quiet_since = now;
+            continue;
+        }
+        
+        // Give the core away for a moment, it may be shared after all
+        if (now - quiet_since < node_config.spin_idle) {
+            #ifndef _WIN32
+            sched_yield();
+            #endif
+            continue;
+        }
+        
+        // Quiet: block until a socket is readable or the set changes
+        for (int i = 0; i < count; i++) {
+            pfd[i].fd = receivers[i].fd;
+            pfd[i].events = POLLIN;
+        }
+        if (wait_spinning(pfd, count, -1) < 0) {
+            wait_wakeup(PARK_ERROR_PAUSE_MS);
+        }
+        quiet_since = get_monotonic_us();
+    }
+    
+    for (int i = 0; i < count; i++) {
+        close_receiver(&receivers[i]);
+    }
+    free(receivers);
+    free(slots);
+    free(pfd);
+    free(scratch);
+    return NULL;
+}
+
+// Connections with a receiver thread, and parked ones
+void get_receiver_stats(int* receivers, int* parked) {
+    pthread_mutex_lock(&connections_mutex);
+    *receivers = receiver_count;
+    *parked = 0;
+    for (int i = 0; i < connection_capacity; i++) {
+        if (connections[i].active && connections[i].parked) {
+            (*parked)++;
+        }
+    }
+    pthread_mutex_unlock(&connections_mutex);
+}
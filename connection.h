@@ -2,41 +2,156 @@
 #define CONNECTION_H
 
 #include "common.h"
+#include "protocol.h"
+#include "store.h"
+#include "batch.h"
+#include "worker.h"
+#include "stream.h"
+#include "p2pchat.h"
 #include <pthread.h>
 
-// Connection structure
+// Reconnect backoff (jittered exponential)
+#define RECONNECT_BASE_MS 250
+#define RECONNECT_MAX_MS 30000
+#define RECONNECT_POLL_MS 100
+
+// Pause of the accept thread after a failed accept (out of descriptors)
+#define ACCEPT_ERROR_PAUSE_MS 100
+
+// Pause of a receiver or the park thread out of memory or threads
+#define PARK_ERROR_PAUSE_MS 100
+
+// Shortest time between heap trims after connections park
+#define PARK_TRIM_MS 1000
+
+// Longest a close waits on sends to a stalled peer, holding the table
+#define CLOSE_SEND_TIMEOUT_MS 1000
+
+// Readers of the spin thread (config spin): duplicated descriptors, so
+// POSIX only; elsewhere every connection keeps a receiver thread
+#ifndef _WIN32
+    #define SPIN_SUPPORTED 1
+#else
+    #define SPIN_SUPPORTED 0
+#endif
+
+// Who reads a connection in spin mode
+enum {
+    SPIN_NONE = 0,                  // A receiver thread, or parked
+    SPIN_PENDING,                   // Waiting for the spin thread to take it
+    SPIN_READING                    // Read by the spin thread
+};
+
+// Connection state
+typedef enum {
+    CONN_CONNECTING = 0,            // Socket open, waiting for HELLO
+    CONN_ONLINE,                    // Handshake done, frames flow
+    CONN_OFFLINE                    // Link lost, messages are queued
+} ConnState;
+
+// Peer details of a connection: read when connecting, reconnecting or
+// listing, not per frame, so they live apart from the hot table
 typedef struct {
-    int id;
-    SOCKET socket;
     char ip[INET_ADDRSTRLEN];
     int port;
-    pthread_t thread;
-    int active;
+    int outbound;                   // We dialed, so we redial after a drop
+    uint64_t node_id;               // From HELLO, 0 until first handshake
+    int listen_port;
+    int retry_attempts;
+    long long next_retry_ms;
+    unsigned char* rx_backlog;      // Partial frame left by a stopped receiver
+    size_t rx_backlog_length;
+    int resumed;                    // Receiver restarted on a live socket (handoff, unpark)
+} ConnectionPeer;
+
+// Connection structure: what the send and receive paths touch per frame
+typedef struct {
+    int id;
+    SOCKET socket;
+    int active;                     // Slot in use
+    ConnState state;
+    int parked;                     // Idle: no receiver thread, the park thread watches it
+    int spin;                       // SPIN_*, set under connections_mutex
+    uint64_t tx_seq;                // Last sequence number assigned
+    uint64_t rx_seq;                // Last sequence number delivered
+    int rx_unacked;                 // Delivered but not yet acknowledged
+    StoreQueue* queue;              // Unacknowledged outbound frames
+    StreamSet* streams;             // Outbound bulk streams, created on first open
+    ConnectionPeer* peer;           // Same slot of the peer table
+    pthread_mutex_t send_mutex;     // Orders frames, guards queue and tx_seq
+    SendBatch batch;                // Coalesces frames into fewer socket writes
 } Connection;
 
 // Global connections array and mutex
-extern Connection connections[MAX_CONNECTIONS];
+extern Connection* connections;
+extern int connection_capacity;
 extern pthread_mutex_t connections_mutex;
 extern pthread_t accept_thread;
+extern pthread_t reconnect_thread;
+extern pthread_t park_thread;
+extern pthread_t spin_thread;
+extern uint64_t local_node_id;
 
 // Connection management functions
-void init_connections(void);
-int add_connection(SOCKET sock, const char* ip, int port);
+int init_connections(void);
+int add_connection(SOCKET sock, const char* ip, int port, int outbound);
 void remove_connection(int conn_id);
 void close_connection(int conn_id);
-void close_all_connections(void);
+void close_all_connections(long long deadline_ms);
+void set_send_deadline(long long deadline_ms);
+void detach_all_connections(void);   // Caller holds connections_mutex
+
+// Receiver threads of live sockets (stop: clear running and raise the wakeup)
+int start_receivers(void);
+void join_receivers(void);
+
+// Store queue of a slot, created on first use (caller holds send_mutex)
+int open_queue(Connection* conn);
 
 // Connection search functions
 int find_connection_by_address(const char* ip, int port);
 int find_connection_by_id(int conn_id);
 Connection* get_connection_by_id(int conn_id);
+int get_connection_address(int conn_id, char* ip, int* port);
+
+// Connection to ip:port for sending, dialed in the background if needed
+int lazy_connection(const char* ip, int port);
+
+// Dials of this node, and forgetting one that never reached its peer
+int get_outbound_count(void);
+int drop_unreached(const char* ip, int port);
+
+// Frame transmission
+int send_to_connection(int conn_id, uint8_t type, const void* payload, uint32_t length);
+int send_control(int conn_id, uint8_t type, uint8_t flags, uint16_t stream,
+                 const void* payload, uint32_t length);
+int queue_to_connection(int conn_id, uint8_t type, const void* payload, uint32_t length);
+
+// Bulk streams of an online connection (P2P_ERR_* on failure). Streams end
+// with the link: a drop, close or handoff discards what is still queued.
+int open_stream(int conn_id, int weight);
+int write_stream(int conn_id, int stream, const void* data, size_t length);
+int close_stream(int conn_id, int stream);
+int reset_stream(int conn_id, int stream);
+void stop_all_streams(void);
 
 // Connection info functions
 int get_active_connection_count(void);
-void print_connection_list(void);
+int get_active_connection_ids(int* conn_ids, int max);
+int get_connection_info(P2PConnectionInfo* out, int max);
+void get_receiver_stats(int* receivers, int* parked);
 
 // Thread functions
 void* accept_connections_thread(void* arg);
 void* handle_peer_messages_thread(void* arg);
+void* reconnect_peers_thread(void* arg);
+void* park_connections_thread(void* arg);
+void* spin_connections_thread(void* arg);
+
+// Dial the best peers of the address book from the reconnect thread
+void schedule_warm_pool(void);
+
+// frame_pool handler for frames the receivers read
+void process_frame(const WorkItem* item, void* scratch);
 
-#endif // CONNECTION_H
\ No newline at end of file
+#endif // CONNECTION_H
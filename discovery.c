@@ -0,0 +1,311 @@
+#include "discovery.h"
+#include "protocol.h"
+#include "socket.h"
+#include "connection.h"
+#include "config.h"
+#include "timeutil.h"
+#include "trace.h"
+
+// Discovery of this node
+Discovery node_discovery;
+pthread_t discovery_thread;
+extern int running;
+
+// Room for announcements of newer versions, which may be longer
+#define DISCOVERY_PACKET_SIZE 256
+
+// Start with an empty cache
+void init_discovery(Discovery* discovery) {
+    pthread_mutex_init(&discovery->mutex, NULL);
+    discovery->peers = NULL;
+    discovery->count = 0;
+    discovery->capacity = 0;
+    discovery->announced = 0;
+    discovery->heard = 0;
+}
+
+// Free the cache
+void free_discovery(Discovery* discovery) {
+    pthread_mutex_lock(&discovery->mutex);
+    free(discovery->peers);
+    discovery->peers = NULL;
+    discovery->count = 0;
+    discovery->capacity = 0;
+    pthread_mutex_unlock(&discovery->mutex);
+}
+
+// Order peers by the share of their table in use for qsort
+static int compare_load(const void* a, const void* b) {
+    const DiscoveredPeer* x = (const DiscoveredPeer*)a;
+    const DiscoveredPeer* y = (const DiscoveredPeer*)b;
+    long long x_share = (long long)x->load * (y->capacity > 0 ? y->capacity : 1);
+    long long y_share = (long long)y->load * (x->capacity > 0 ? x->capacity : 1);
+    return (x_share > y_share) - (x_share < y_share);
+}
+
+// Cached entry for ip:port, a new one or the stalest when full (caller holds mutex)
+static DiscoveredPeer* find_peer(Discovery* discovery, const char* ip, int port, int* added) {
+    *added = 0;
+    for (int i = 0; i < discovery->count; i++) {
+        if (discovery->peers[i].port == port && strcmp(discovery->peers[i].ip, ip) == 0) {
+            return &discovery->peers[i];
+        }
+    }
+    
+    if (discovery->count == DISCOVERY_MAX_PEERS) {
+        DiscoveredPeer* stalest = &discovery->peers[0];
+        for (int i = 1; i < discovery->count; i++) {
+            if (discovery->peers[i].heard_ms < stalest->heard_ms) {
+                stalest = &discovery->peers[i];
+            }
+        }
+        *added = 1;
+        return stalest;
+    }
+    
+    if (discovery->count == discovery->capacity) {
+        int capacity = discovery->capacity > 0 ? discovery->capacity * 2 : 16;
+        DiscoveredPeer* peers = realloc(discovery->peers, capacity * sizeof(DiscoveredPeer));
+        if (peers == NULL) {
+            return NULL;
+        }
+        discovery->peers = peers;
+        discovery->capacity = capacity;
+    }
+    *added = 1;
+    return &discovery->peers[discovery->count++];
+}
+
+// Record an announcement from ip, returns 1 if the peer was not cached
+static int peer_heard(Discovery* discovery, const char* ip, const AnnouncePayload* announce,
+                      long long now_ms) {
+    int added;
+    
+    pthread_mutex_lock(&discovery->mutex);
+    discovery->heard++;
+    DiscoveredPeer* peer = find_peer(discovery, ip, announce->listen_port, &added);
+    if (peer != NULL) {
+        uint32_t interval = announce->interval_ms;
+        interval = interval < DISCOVERY_MIN_INTERVAL_MS ? DISCOVERY_MIN_INTERVAL_MS : interval;
+        interval = interval > DISCOVERY_MAX_INTERVAL_MS ? DISCOVERY_MAX_INTERVAL_MS : interval;
+        
+        strcpy(peer->ip, ip);
+        peer->port = announce->listen_port;
+        peer->node_id = announce->node_id;
+        peer->load = (int)announce->load;
+        peer->capacity = (int)announce->capacity;
+        peer->interval_ms = (int)interval;
+        peer->heard_ms = now_ms;
+    }
+    pthread_mutex_unlock(&discovery->mutex);
+    return peer != NULL && added;
+}
+
+// Forget peers silent for DISCOVERY_EXPIRE_INTERVALS of their longest
+// interval, and dials to them that never got through
+static void expire_peers(Discovery* discovery, long long now_ms) {
+    DiscoveredPeer expired[16];
+    int batch = (int)(sizeof(expired) / sizeof(expired[0]));
+    int count;
+    
+    // In batches, dropping dials without holding the cache, until none is left
+    do {
+        count = 0;
+        pthread_mutex_lock(&discovery->mutex);
+        for (int i = 0; i < discovery->count && count < batch; i++) {
+            DiscoveredPeer* peer = &discovery->peers[i];
+            long long silence = (long long)peer->interval_ms * 3 / 2 * DISCOVERY_EXPIRE_INTERVALS;
+            if (now_ms - peer->heard_ms > silence) {
+                expired[count++] = *peer;
+                discovery->peers[i--] = discovery->peers[--discovery->count];
+            }
+        }
+        pthread_mutex_unlock(&discovery->mutex);
+        
+        for (int i = 0; i < count; i++) {
+            drop_unreached(expired[i].ip, expired[i].port);
+        }
+    } while (count == batch);
+}
+
+// Copy up to max cached peers, least loaded first
+int discovery_list(Discovery* discovery, DiscoveredPeer* out, int max) {
+    pthread_mutex_lock(&discovery->mutex);
+    DiscoveredPeer* sorted = discovery->count > 0
+        ? malloc(discovery->count * sizeof(DiscoveredPeer)) : NULL;
+    int count = 0;
+    if (sorted != NULL) {
+        memcpy(sorted, discovery->peers, discovery->count * sizeof(DiscoveredPeer));
+        count = discovery->count;
+    }
+    pthread_mutex_unlock(&discovery->mutex);
+    
+    if (count > 0) {
+        qsort(sorted, count, sizeof(DiscoveredPeer), compare_load);
+        count = count < max ? count : max;
+        memcpy(out, sorted, count * sizeof(DiscoveredPeer));
+    }
+    free(sorted);
+    return count;
+}
+
+// Announcements sent and heard, peers cached
+void discovery_stats(Discovery* discovery, long long* announced, long long* heard, int* peers) {
+    pthread_mutex_lock(&discovery->mutex);
+    *announced = discovery->announced;
+    *heard = discovery->heard;
+    *peers = discovery->count;
+    pthread_mutex_unlock(&discovery->mutex);
+}
+
+// Nodes in the group as far as this one knows, itself included
+static int group_size(Discovery* discovery) {
+    pthread_mutex_lock(&discovery->mutex);
+    int members = discovery->count + 1;
+    pthread_mutex_unlock(&discovery->mutex);
+    return members;
+}
+
+// Average time between announcements: discovery_interval, longer once the
+// group is big enough to send more than DISCOVERY_GROUP_RATE per second
+static int announce_interval(int members) {
+    long long interval = (long long)members * 1000 / DISCOVERY_GROUP_RATE;
+    return interval > node_config.discovery_interval ? (int)interval
+                                                     : node_config.discovery_interval;
+}
+
+// Send this node's announcement to the group
+static void announce(Discovery* discovery, SOCKET sock, const struct sockaddr_in* target,
+                     uint8_t flags, int interval_ms) {
+    AnnouncePayload payload;
+    unsigned char packet[ANNOUNCE_SIZE];
+    
+    payload.flags = flags;
+    payload.node_id = local_node_id;
+    payload.listen_port = (uint16_t)listen_port;
+    payload.load = (uint32_t)get_active_connection_count();
+    payload.capacity = (uint32_t)connection_capacity;
+    payload.interval_ms = (uint32_t)interval_ms;
+    encode_announce(&payload, packet);
+    
+    if (sendto(sock, (const char*)packet, ANNOUNCE_SIZE, 0, (const struct sockaddr*)target,
+               sizeof(*target)) == ANNOUNCE_SIZE) {
+        pthread_mutex_lock(&discovery->mutex);
+        discovery->announced++;
+        pthread_mutex_unlock(&discovery->mutex);
+    }
+}
+
+// Dial the least loaded discovered peers until discovery_peers dials of
+// this node exist. Only the node with the lower ID dials, so two nodes
+// that hear each other open one connection between them.
+static void dial_discovered(Discovery* discovery) {
+    int wanted = node_config.discovery_peers - get_outbound_count();
+    if (wanted <= 0) {
+        return;
+    }
+    
+    DiscoveredPeer* peers = malloc(DISCOVERY_MAX_PEERS * sizeof(DiscoveredPeer));
+    if (peers == NULL) {
+        return;
+    }
+    
+    int count = discovery_list(discovery, peers, DISCOVERY_MAX_PEERS);
+    for (int i = 0; i < count && wanted > 0; i++) {
+        if (peers[i].node_id <= local_node_id || peers[i].load >= peers[i].capacity ||
+            find_connection_by_address(peers[i].ip, peers[i].port) != -1) {
+            continue;
+        }
+        if (lazy_connection(peers[i].ip, peers[i].port) < 0) {
+            break;
+        }
+        wanted--;
+    }
+    
+    free(peers);
+}
+
+// Announce on the group at jittered intervals, cache what other nodes
+// announce and dial some of them. A starting node asks the group for early
+// answers, which a random share of the members sends within a second.
+void* discover_peers_thread(void* arg) {
+    (void)arg; // Unused parameter
+    TRACE_THREAD("discovery");
+    
+    Discovery* discovery = &node_discovery;
+    const char* group = node_config.discovery_group[0] != '\0' ? node_config.discovery_group
+                                                               : DISCOVERY_GROUP;
+    struct sockaddr_in target;
+    SOCKET sock = INVALID_SOCKET;
+    
+    // The host may get a multicast route later (an interface coming up)
+    while (running) {
+        sock = open_multicast_socket(group, node_config.discovery_port,
+                                     node_config.local_ip, &target);
+        if (sock != INVALID_SOCKET) {
+            break;
+        }
+        wait_wakeup(DISCOVERY_ERROR_PAUSE_MS);
+    }
+    if (sock == INVALID_SOCKET) {
+        return NULL;
+    }
+    
+    unsigned char packet[DISCOVERY_PACKET_SIZE];
+    uint8_t flags = ANNOUNCE_FLAG_QUERY;
+    long long now = get_monotonic_ms();
+    long long next_announce = now + rand() % DISCOVERY_START_MS;
+    long long last_announce = now - DISCOVERY_ANSWER_MS;
+    
+    while (running) {
+        int ready = wait_readable(sock, next_announce > now ? (int)(next_announce - now) : 0);
+        now = get_monotonic_ms();
+        
+        int found = 0;
+        while (ready > 0) {
+            struct sockaddr_in from;
+            socklen_t from_length = sizeof(from);
+            int received = recvfrom(sock, (char*)packet, sizeof(packet), 0,
+                                    (struct sockaddr*)&from, &from_length);
+            if (received < 0) {
+                break;
+            }
+            
+            AnnouncePayload payload;
+            char ip[INET_ADDRSTRLEN];
+            if (decode_announce(packet, (size_t)received, &payload) < 0 ||
+                payload.node_id == local_node_id ||
+                inet_ntop(AF_INET, &from.sin_addr, ip, sizeof(ip)) == NULL) {
+                continue;
+            }
+            found |= peer_heard(discovery, ip, &payload, now);
+            
+            // About DISCOVERY_ANSWERS members answer a query, none twice a second
+            if ((payload.flags & ANNOUNCE_FLAG_QUERY) &&
+                now - last_announce >= DISCOVERY_ANSWER_MS &&
+                next_announce - now > DISCOVERY_ANSWER_MS &&
+                rand() % group_size(discovery) < DISCOVERY_ANSWERS) {
+                next_announce = now + rand() % DISCOVERY_ANSWER_MS;
+            }
+        }
+        
+        if (now >= next_announce) {
+            int interval = announce_interval(group_size(discovery));
+            announce(discovery, sock, &target, flags, interval);
+            flags = 0;
+            last_announce = now;
+            next_announce = now + interval / 2 + rand() % (interval + 1);
+            
+            // Also replaces dials lost since the last announcement
+            expire_peers(discovery, now);
+            found = 1;
+        }
+        
+        if (found && running) {
+            dial_discovered(discovery);
+        }
+    }
+    
+    close(sock);
+    return NULL;
+}
@@ -0,0 +1,63 @@
+#ifndef DISCOVERY_H
+#define DISCOVERY_H
+
+#include "common.h"
+#include <stdint.h>
+#include <pthread.h>
+
+// LAN discovery: nodes announce their ID, listen port and load to a UDP
+// multicast group and cache what they hear, then dial a few of the least
+// loaded peers they have no connection to, so a mesh forms without connect
+// commands. Announcements are jittered and spaced out as the group grows,
+// keeping the whole group near DISCOVERY_GROUP_RATE per second.
+
+#define DISCOVERY_MAX_PEERS 1024         // Peers cached, the stalest makes room
+#define DISCOVERY_GROUP_RATE 50          // Announcements per second the group aims for
+#define DISCOVERY_START_MS 500           // First announcement within this of starting
+#define DISCOVERY_ANSWER_MS 1000         // Answers to a query spread over this
+#define DISCOVERY_ANSWERS 32             // Members expected to answer one query
+#define DISCOVERY_EXPIRE_INTERVALS 3     // Announcements missed before a peer is dropped
+#define DISCOVERY_ERROR_PAUSE_MS 1000    // Retry after the group could not be joined
+
+// Announced intervals are clamped to the range config discovery_interval allows
+#define DISCOVERY_MIN_INTERVAL_MS 100
+#define DISCOVERY_MAX_INTERVAL_MS 3600000
+
+// Peer heard on the group
+typedef struct {
+    char ip[INET_ADDRSTRLEN];        // Source of its announcements
+    int port;                        // Listen port
+    uint64_t node_id;
+    int load;                        // Connections in use
+    int capacity;                    // Connection table size
+    int interval_ms;                 // Its announcement interval
+    long long heard_ms;              // Monotonic time of the last announcement
+} DiscoveredPeer;
+
+// Discovery cache and counters of a node
+typedef struct {
+    pthread_mutex_t mutex;
+    DiscoveredPeer* peers;
+    int count;
+    int capacity;
+    long long announced;             // Announcements sent
+    long long heard;                 // Announcements received from other nodes
+} Discovery;
+
+// Discovery of this node, run by discovery_thread when config discovery is on
+extern Discovery node_discovery;
+extern pthread_t discovery_thread;
+
+void init_discovery(Discovery* discovery);
+void free_discovery(Discovery* discovery);
+
+// Copy up to max cached peers, least loaded first; returns the number copied
+int discovery_list(Discovery* discovery, DiscoveredPeer* out, int max);
+
+// Announcements sent and heard, peers cached
+void discovery_stats(Discovery* discovery, long long* announced, long long* heard, int* peers);
+
+// Thread function: announce, listen and dial until the node stops
+void* discover_peers_thread(void* arg);
+
+#endif // DISCOVERY_H
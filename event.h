@@ -0,0 +1,9 @@
+#ifndef EVENT_H
+#define EVENT_H
+
+#include "p2pchat.h"
+
+// Deliver an event to the application callback (call without library locks held)
+void emit_event(const P2PEvent* event);
+
+#endif // EVENT_H
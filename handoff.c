@@ -0,0 +1,739 @@
+#include "handoff.h"
+#include "p2pchat.h"
+
+#ifndef _WIN32
+
+#include "socket.h"
+#include "connection.h"
+#include "topic.h"
+#include "roomlog.h"
+#include "store.h"
+#include "timeutil.h"
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+
+// Record layout: tag(1) length(4) payload, integers in network byte order
+#define RECORD_HEADER_SIZE 5
+
+// Record tags
+#define RECORD_HELLO      1    // Successor: magic(4) version(4)
+#define RECORD_NODE       2    // node_id(8) next_connection_id(4), listening socket attached
+#define RECORD_CONNECTION 3    // See send_connection, peer socket attached if open
+#define RECORD_QUEUED     4    // seq(8) type(1) data, for the preceding connection
+#define RECORD_TOPIC      5    // joined(1) count(4) conn_id(4)... name
+#define RECORD_END        6    // Connection count(4)
+#define RECORD_DONE       7    // Successor: status(4), 0 = state installed
+#define RECORD_COMMIT     8    // Node let go, successor may start
+#define RECORD_ENTRY      9    // Room log entry, FRAME_ENTRY payload
+
+// Fixed part of a connection record, rx backlog follows
+#define CONNECTION_RECORD_SIZE 60
+
+#ifdef MSG_NOSIGNAL
+    #define HANDOFF_SEND_FLAGS MSG_NOSIGNAL
+#else
+    #define HANDOFF_SEND_FLAGS 0
+#endif
+
+// Channel passed to the replay and topic visitors
+typedef struct {
+    SOCKET channel;
+    int failed;
+} HandoffWriter;
+
+// Received record, data is NUL-terminated for convenience
+typedef struct {
+    uint8_t tag;
+    uint32_t length;
+    unsigned char* data;
+    int fd;                     // Attached descriptor, -1 if none
+} HandoffRecord;
+
+// 32-bit and 16-bit integers in network byte order
+static void put_u32(uint32_t value, unsigned char* out) {
+    value = htonl(value);
+    memcpy(out, &value, sizeof(value));
+}
+
+static uint32_t get_u32(const unsigned char* in) {
+    uint32_t value;
+    memcpy(&value, in, sizeof(value));
+    return ntohl(value);
+}
+
+static void put_u16(uint16_t value, unsigned char* out) {
+    value = htons(value);
+    memcpy(out, &value, sizeof(value));
+}
+
+static uint16_t get_u16(const unsigned char* in) {
+    uint16_t value;
+    memcpy(&value, in, sizeof(value));
+    return ntohs(value);
+}
+
+// Handoff socket address for a listen port
+static void handoff_address(int port, struct sockaddr_un* addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    snprintf(addr->sun_path, sizeof(addr->sun_path), HANDOFF_PATH_FORMAT,
+             STORE_SPOOL_DIR, port);
+}
+
+// Bound blocking I/O on the channel so a hung peer process can't stall us
+static void set_channel_timeout(SOCKET channel, int timeout_ms) {
+    struct timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    setsockopt(channel, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(channel, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+// Send one record, passing fd along when it is not -1
+static int send_record(SOCKET channel, uint8_t tag, const void* data,
+                       uint32_t length, int fd) {
+    unsigned char header[RECORD_HEADER_SIZE];
+    struct iovec iov[2];
+    struct msghdr msg;
+    union {
+        struct cmsghdr align;
+        char buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+    
+    header[0] = tag;
+    put_u32(length, header + 1);
+    iov[0].iov_base = header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = (void*)data;
+    iov[1].iov_len = length;
+    
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = length > 0 ? 2 : 1;
+    if (fd >= 0) {
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = sizeof(control.buffer);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    
+    ssize_t sent;
+    do {
+        sent = sendmsg(channel, &msg, HANDOFF_SEND_FLAGS);
+    } while (sent < 0 && errno == EINTR);
+    if (sent < 0) {
+        return -1;
+    }
+    
+    // The descriptor went with the first bytes, the rest is plain data
+    size_t done = (size_t)sent;
+    if (done < sizeof(header)) {
+        if (send_all(channel, header + done, sizeof(header) - done) < 0) {
+            return -1;
+        }
+        done = sizeof(header);
+    }
+    done -= sizeof(header);
+    if (done < length && send_all(channel, (const char*)data + done, length - done) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Receive exactly length bytes
+static int recv_exact(SOCKET channel, void* buffer, size_t length) {
+    char* ptr = buffer;
+    
+    while (length > 0) {
+        ssize_t received = recv(channel, ptr, length, 0);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) {
+            return -1;
+        }
+        ptr += received;
+        length -= received;
+    }
+    return 0;
+}
+
+// Receive one record; caller frees data and owns fd
+static int recv_record(SOCKET channel, HandoffRecord* record) {
+    unsigned char header[RECORD_HEADER_SIZE];
+    size_t received = 0;
+    
+    record->data = NULL;
+    record->fd = -1;
+    
+    // Header through recvmsg, a descriptor arrives with its first byte
+    while (received < sizeof(header)) {
+        struct iovec iov;
+        struct msghdr msg;
+        union {
+            struct cmsghdr align;
+            char buffer[CMSG_SPACE(sizeof(int))];
+        } control;
+        
+        iov.iov_base = header + received;
+        iov.iov_len = sizeof(header) - received;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = sizeof(control.buffer);
+        
+        ssize_t count = recvmsg(channel, &msg, 0);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) {
+            break;
+        }
+        received += count;
+        
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+             cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+                record->fd < 0) {
+                memcpy(&record->fd, CMSG_DATA(cmsg), sizeof(int));
+            }
+        }
+    }
+    
+    record->tag = header[0];
+    record->length = get_u32(header + 1);
+    if (received == sizeof(header) && record->length <= HANDOFF_MAX_RECORD) {
+        record->data = malloc(record->length + 1);
+        if (record->data != NULL &&
+            recv_exact(channel, record->data, record->length) == 0) {
+            record->data[record->length] = '\0';
+            return 0;
+        }
+    }
+    
+    free(record->data);
+    record->data = NULL;
+    if (record->fd >= 0) {
+        close(record->fd);
+        record->fd = -1;
+    }
+    return -1;
+}
+
+// Send a status-only record
+static int send_status(SOCKET channel, uint8_t tag, uint32_t value) {
+    unsigned char payload[4];
+    put_u32(value, payload);
+    return send_record(channel, tag, payload, sizeof(payload), -1);
+}
+
+// Connection record: id(4) state(1) outbound(1) has_socket(1) reserved(1)
+// port(2) peer_listen_port(2) peer_node_id(8) tx_seq(8) rx_seq(8)
+// retry_attempts(4) retry_in_ms(4) ip(16), then the rx backlog
+static int send_connection(SOCKET channel, const Connection* conn) {
+    size_t length = CONNECTION_RECORD_SIZE + conn->peer->rx_backlog_length;
+    unsigned char* out = calloc(1, length);
+    if (out == NULL) {
+        return -1;
+    }
+    
+    long long retry_in = conn->peer->next_retry_ms - get_monotonic_ms();
+    put_u32((uint32_t)conn->id, out);
+    out[4] = (unsigned char)conn->state;
+    out[5] = (unsigned char)conn->peer->outbound;
+    out[6] = conn->socket != INVALID_SOCKET;
+    put_u16((uint16_t)conn->peer->port, out + 8);
+    put_u16((uint16_t)conn->peer->listen_port, out + 10);
+    encode_u64(conn->peer->node_id, out + 12);
+    encode_u64(conn->tx_seq, out + 20);
+    encode_u64(conn->rx_seq, out + 28);
+    put_u32((uint32_t)conn->peer->retry_attempts, out + 36);
+    put_u32(retry_in > 0 ? (uint32_t)retry_in : 0, out + 40);
+    memcpy(out + 44, conn->peer->ip, INET_ADDRSTRLEN);
+    if (conn->peer->rx_backlog_length > 0) {
+        memcpy(out + CONNECTION_RECORD_SIZE, conn->peer->rx_backlog, conn->peer->rx_backlog_length);
+    }
+    
+    int result = send_record(channel, RECORD_CONNECTION, out, (uint32_t)length,
+                             conn->socket != INVALID_SOCKET ? conn->socket : -1);
+    free(out);
+    return result;
+}
+
+// Replay callback: one queued frame per record
+static int send_queued(void* ctx, uint64_t seq, uint8_t type,
+                       const unsigned char* data, uint32_t length) {
+    HandoffWriter* writer = ctx;
+    unsigned char* out = malloc(9 + (size_t)length);
+    if (out == NULL) {
+        writer->failed = 1;
+        return -1;
+    }
+    
+    encode_u64(seq, out);
+    out[8] = type;
+    memcpy(out + 9, data, length);
+    int result = send_record(writer->channel, RECORD_QUEUED, out, 9 + length, -1);
+    free(out);
+    if (result < 0) {
+        writer->failed = 1;
+    }
+    return result;
+}
+
+// Topic visitor: joined flag and subscribed connections
+static int send_topic(void* ctx, const Topic* topic) {
+    HandoffWriter* writer = ctx;
+    size_t name_length = strlen(topic->name);
+    size_t length = 5 + 4 * (size_t)topic->subscriber_count + name_length;
+    unsigned char* out = malloc(length);
+    if (out == NULL) {
+        return -1;
+    }
+    
+    out[0] = (unsigned char)topic->joined;
+    put_u32((uint32_t)topic->subscriber_count, out + 1);
+    for (int i = 0; i < topic->subscriber_count; i++) {
+        put_u32((uint32_t)topic->subscribers[i], out + 5 + 4 * i);
+    }
+    memcpy(out + 5 + 4 * topic->subscriber_count, topic->name, name_length);
+    
+    int result = send_record(writer->channel, RECORD_TOPIC, out, (uint32_t)length, -1);
+    free(out);
+    return result;
+}
+
+// Wait for a successor on the node's handoff socket
+int handoff_accept(int port, int timeout_ms, SOCKET* channel) {
+    struct sockaddr_un addr;
+    
+    handoff_address(port, &addr);
+    SOCKET server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server == INVALID_SOCKET) {
+        return P2P_ERR_SYSTEM;
+    }
+    
+    // A crashed predecessor may have left the path behind. The socket is
+    // created owner-only: whoever connects receives every peer descriptor
+    unlink(addr.sun_path);
+    mode_t mask = umask(S_IRWXG | S_IRWXO);
+    int bound = bind(server, (struct sockaddr*)&addr, sizeof(addr));
+    umask(mask);
+    if (bound < 0 || listen(server, 1) < 0) {
+        close(server);
+        unlink(addr.sun_path);
+        return P2P_ERR_SYSTEM;
+    }
+    
+    int ready = wait_readable(server, timeout_ms);
+    *channel = ready > 0 ? accept(server, NULL, NULL) : INVALID_SOCKET;
+    close(server);
+    unlink(addr.sun_path);
+    if (*channel == INVALID_SOCKET) {
+        return ready == 0 ? P2P_ERR_TIMEOUT : P2P_ERR_SYSTEM;
+    }
+    set_channel_timeout(*channel, timeout_ms);
+    
+    // Only a successor speaking our handoff version may take over
+    HandoffRecord hello;
+    if (recv_record(*channel, &hello) < 0) {
+        close(*channel);
+        return P2P_ERR_SYSTEM;
+    }
+    int valid = hello.tag == RECORD_HELLO && hello.length >= 8 &&
+                get_u32(hello.data) == HANDOFF_MAGIC &&
+                get_u32(hello.data + 4) == HANDOFF_VERSION;
+    free(hello.data);
+    if (hello.fd >= 0) {
+        close(hello.fd);
+    }
+    if (!valid) {
+        close(*channel);
+        return P2P_ERR_INVALID;
+    }
+    return P2P_OK;
+}
+
+// Room log visitor: one entry per record
+static int send_entry(void* ctx, const char* room, const RoomEntry* entry) {
+    HandoffWriter* writer = ctx;
+    size_t size = ENTRY_KEY_SIZE + 1 + strlen(room) + strlen(entry->message);
+    unsigned char* out = malloc(size);
+    if (out == NULL) {
+        return -1;
+    }
+    
+    int length = encode_entry(&entry->key, room, entry->message, out, size);
+    int result = length < 0 ? -1 :
+                 send_record(writer->channel, RECORD_ENTRY, out, (uint32_t)length, -1);
+    free(out);
+    return result;
+}
+
+// Stream node state, detach on confirmation
+int handoff_send(SOCKET channel) {
+    HandoffWriter writer = { channel, 0 };
+    unsigned char node[12];
+    int count = 0;
+    int result = 0;
+    
+    // Held throughout, so no send slips in between snapshot and detach
+    pthread_mutex_lock(&connections_mutex);
+    
+    encode_u64(local_node_id, node);
+    put_u32((uint32_t)next_connection_id, node + 8);
+    if (send_record(channel, RECORD_NODE, node, sizeof(node), listen_socket) < 0) {
+        result = -1;
+    }
+    
+    for (int i = 0; i < connection_capacity && result == 0; i++) {
+        Connection* conn = &connections[i];
+        if (!conn->active) continue;
+        
+        // Frames already batched reach the peer before the socket changes hands
+        pthread_mutex_lock(&conn->send_mutex);
+        batch_drain(&conn->batch);
+        if (send_connection(channel, conn) < 0) {
+            result = -1;
+        } else if (conn->queue != NULL) {
+            store_replay(conn->queue, 0, send_queued, &writer);
+            result = writer.failed ? -1 : 0;
+        }
+        pthread_mutex_unlock(&conn->send_mutex);
+        count++;
+    }
+    
+    if (result == 0 && (topic_visit(&node_topics, send_topic, &writer) < 0 ||
+                        room_visit(&node_rooms, send_entry, &writer) < 0 ||
+                        send_status(channel, RECORD_END, (uint32_t)count) < 0)) {
+        result = -1;
+    }
+    
+    // The successor has everything once it says so
+    HandoffRecord done;
+    if (result == 0 && recv_record(channel, &done) == 0) {
+        result = done.tag == RECORD_DONE && done.length >= 4 &&
+                 get_u32(done.data) == 0 ? 0 : -1;
+        free(done.data);
+        if (done.fd >= 0) {
+            close(done.fd);
+        }
+    } else {
+        result = -1;
+    }
+    
+    // From here on the successor owns the sockets
+    if (result == 0 && send_status(channel, RECORD_COMMIT, 0) < 0) {
+        result = -1;
+    }
+    if (result == 0) {
+        detach_all_connections();
+    }
+    pthread_mutex_unlock(&connections_mutex);
+    
+    return result == 0 ? count : P2P_ERR_SYSTEM;
+}
+
+// Connect to the predecessor, retrying until it listens or time runs out
+static int connect_predecessor(int port, int timeout_ms, SOCKET* channel) {
+    struct sockaddr_un addr;
+    long long deadline = get_monotonic_ms() + timeout_ms;
+    
+    handoff_address(port, &addr);
+    for (;;) {
+        *channel = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (*channel == INVALID_SOCKET) {
+            return P2P_ERR_SYSTEM;
+        }
+        if (connect(*channel, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+            set_channel_timeout(*channel, timeout_ms);
+            return P2P_OK;
+        }
+        close(*channel);
+        
+        if (errno != ENOENT && errno != ECONNREFUSED) {
+            return P2P_ERR_CONNECT;
+        }
+        if (get_monotonic_ms() >= deadline) {
+            return P2P_ERR_TIMEOUT;
+        }
+        sleep_ms(HANDOFF_RETRY_MS);
+    }
+}
+
+// Install a connection record into the next free slot, returns the slot or -1
+static int adopt_connection(const HandoffRecord* record) {
+    if (record->length < CONNECTION_RECORD_SIZE) {
+        return -1;
+    }
+    
+    int slot = -1;
+    for (int i = 0; i < connection_capacity; i++) {
+        if (!connections[i].active) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot == -1) {
+        return -1;
+    }
+    
+    const unsigned char* in = record->data;
+    size_t backlog_length = record->length - CONNECTION_RECORD_SIZE;
+    Connection* conn = &connections[slot];
+    unsigned char* backlog = NULL;
+    if (backlog_length > 0) {
+        backlog = malloc(backlog_length);
+        if (backlog == NULL) {
+            return -1;
+        }
+        memcpy(backlog, in + CONNECTION_RECORD_SIZE, backlog_length);
+    }
+    
+    conn->id = (int)get_u32(in);
+    conn->state = in[4] <= CONN_OFFLINE ? (ConnState)in[4] : CONN_OFFLINE;
+    conn->peer->outbound = in[5];
+    conn->socket = in[6] ? record->fd : INVALID_SOCKET;
+    conn->peer->port = get_u16(in + 8);
+    conn->peer->listen_port = get_u16(in + 10);
+    conn->peer->node_id = decode_u64(in + 12);
+    conn->tx_seq = decode_u64(in + 20);
+    conn->rx_seq = decode_u64(in + 28);
+    conn->rx_unacked = 0;
+    conn->peer->retry_attempts = (int)get_u32(in + 36);
+    conn->peer->next_retry_ms = get_monotonic_ms() + get_u32(in + 40);
+    memcpy(conn->peer->ip, in + 44, INET_ADDRSTRLEN);
+    conn->peer->ip[INET_ADDRSTRLEN - 1] = '\0';
+    conn->queue = NULL;
+    conn->peer->rx_backlog = backlog;
+    conn->peer->rx_backlog_length = backlog_length;
+    conn->active = 1;
+    batch_reset(&conn->batch, conn->socket);
+    
+    // Our configuration may tune sockets differently than the predecessor's
+    if (conn->socket != INVALID_SOCKET) {
+        apply_socket_options(conn->socket);
+    }
+    return slot;
+}
+
+// Add a queued frame to a connection
+static int adopt_queued(Connection* conn, const HandoffRecord* record) {
+    if (conn == NULL || record->length < 9 || open_queue(conn) < 0) {
+        return -1;
+    }
+    return store_push(conn->queue, decode_u64(record->data), record->data[8],
+                      record->data + 9, record->length - 9);
+}
+
+// Restore a topic's joined flag and subscribers
+static int adopt_topic(const HandoffRecord* record) {
+    if (record->length < 5) {
+        return -1;
+    }
+    
+    uint32_t count = get_u32(record->data + 1);
+    if (count > (record->length - 5) / 4) {
+        return -1;
+    }
+    
+    const char* name = (const char*)record->data + 5 + 4 * count;
+    if (!is_valid_topic(name)) {
+        return -1;
+    }
+    if (record->data[0] && topic_join(&node_topics, name) < 0) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (topic_add_subscriber(&node_topics, name,
+                                 (int)get_u32(record->data + 5 + 4 * i)) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Restore a room log entry, the clock follows the newest one
+static int adopt_entry(const HandoffRecord* record) {
+    char room[MAX_TOPIC_LENGTH + 1];
+    EntryKey key;
+    
+    char* message = malloc(record->length + 1);
+    if (message == NULL) {
+        return -1;
+    }
+    
+    int result = decode_entry(record->data, record->length, &key, room, sizeof(room),
+                              message, record->length + 1);
+    if (result == 0 && room_insert(&node_rooms, room, &key, message, NULL) < 0) {
+        result = -1;
+    }
+    free(message);
+    return result;
+}
+
+// Fetch and install the predecessor's state
+int handoff_receive(int port, int timeout_ms) {
+    SOCKET channel;
+    unsigned char hello[8];
+    
+    int result = connect_predecessor(port, timeout_ms, &channel);
+    if (result != P2P_OK) {
+        return result;
+    }
+    
+    put_u32(HANDOFF_MAGIC, hello);
+    put_u32(HANDOFF_VERSION, hello + 4);
+    if (send_record(channel, RECORD_HELLO, hello, sizeof(hello), -1) < 0) {
+        close(channel);
+        return P2P_ERR_SYSTEM;
+    }
+    
+    // Restored if the handoff fails; topics and rooms start out empty
+    uint64_t own_node_id = local_node_id;
+    int own_next_id = next_connection_id;
+    int own_port = listen_port;
+    uint64_t own_clock = node_rooms.clock;
+    
+    Connection* last = NULL;
+    int count = 0;
+    int finished = 0;
+    result = 0;
+    
+    while (!finished && result == 0) {
+        HandoffRecord record;
+        if (recv_record(channel, &record) < 0) {
+            result = P2P_ERR_SYSTEM;
+            break;
+        }
+        
+        int kept_fd = 0;
+        switch (record.tag) {
+            case RECORD_NODE:
+                if (record.length < 12 || record.fd < 0) {
+                    result = P2P_ERR_SYSTEM;
+                    break;
+                }
+                local_node_id = decode_u64(record.data);
+                next_connection_id = (int)get_u32(record.data + 8);
+                listen_socket = record.fd;
+                listen_port = port;
+                apply_socket_options(listen_socket);
+                set_listen_nonblocking();
+                kept_fd = 1;
+                break;
+                
+            case RECORD_CONNECTION: {
+                int slot = adopt_connection(&record);
+                if (slot < 0) {
+                    result = P2P_ERR_LIMIT;
+                    break;
+                }
+                last = &connections[slot];
+                kept_fd = last->socket == record.fd;
+                count++;
+                break;
+            }
+            
+            case RECORD_QUEUED:
+                if (adopt_queued(last, &record) < 0) {
+                    result = P2P_ERR_SYSTEM;
+                }
+                break;
+                
+            case RECORD_TOPIC:
+                if (adopt_topic(&record) < 0) {
+                    result = P2P_ERR_SYSTEM;
+                }
+                break;
+                
+            case RECORD_ENTRY:
+                if (adopt_entry(&record) < 0) {
+                    result = P2P_ERR_SYSTEM;
+                }
+                break;
+                
+            case RECORD_END:
+                finished = 1;
+                if (record.length < 4 || (int)get_u32(record.data) != count) {
+                    result = P2P_ERR_SYSTEM;
+                }
+                break;
+                
+            default:
+                result = P2P_ERR_SYSTEM;
+                break;
+        }
+        
+        if (record.fd >= 0 && !kept_fd) {
+            close(record.fd);
+        }
+        free(record.data);
+    }
+    
+    // Adopted state survives only if the predecessor lets go of it
+    if (result == 0) {
+        HandoffRecord commit;
+        if (send_status(channel, RECORD_DONE, 0) < 0 || recv_record(channel, &commit) < 0) {
+            result = P2P_ERR_SYSTEM;
+        } else {
+            if (commit.tag != RECORD_COMMIT) {
+                result = P2P_ERR_SYSTEM;
+            }
+            if (commit.fd >= 0) {
+                close(commit.fd);
+            }
+            free(commit.data);
+        }
+    } else {
+        send_status(channel, RECORD_DONE, 1);
+    }
+    if (result != 0) {
+        
+        // Close our copies only, the predecessor keeps serving the peers
+        pthread_mutex_lock(&connections_mutex);
+        detach_all_connections();
+        pthread_mutex_unlock(&connections_mutex);
+        if (listen_socket != INVALID_SOCKET) {
+            close(listen_socket);
+            listen_socket = INVALID_SOCKET;
+        }
+        
+        // And forget whose node this was
+        local_node_id = own_node_id;
+        next_connection_id = own_next_id;
+        listen_port = own_port;
+        free_topics(&node_topics);
+        free_rooms(&node_rooms);
+        node_rooms.clock = own_clock;
+    }
+    close(channel);
+    
+    return result == 0 ? count : result;
+}
+
+#else
+
+// Descriptor passing needs UNIX sockets
+int handoff_accept(int port, int timeout_ms, SOCKET* channel) {
+    (void)port;
+    (void)timeout_ms;
+    *channel = INVALID_SOCKET;
+    return P2P_ERR_UNSUPPORTED;
+}
+
+int handoff_send(SOCKET channel) {
+    (void)channel;
+    return P2P_ERR_UNSUPPORTED;
+}
+
+int handoff_receive(int port, int timeout_ms) {
+    (void)port;
+    (void)timeout_ms;
+    return P2P_ERR_UNSUPPORTED;
+}
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include "common.h"
+
+// Hot restart: a running node passes its listening socket, peer sockets,
+// connection table, queued messages and topics to a successor process over a
+// UNIX socket (descriptors travel as SCM_RIGHTS), so peers see no disconnect.
+
+#define HANDOFF_PATH_FORMAT "%s/p2p_handoff_%d.sock"   // Directory, listen port
+#define HANDOFF_MAGIC 0x50325048u                       // "P2PH"
+#define HANDOFF_VERSION 2
+#define HANDOFF_RETRY_MS 100                            // Successor redial interval
+#define HANDOFF_MAX_RECORD (64 * 1024 * 1024)
+
+// Old process: wait for a successor on the node's handoff socket.
+// Returns P2P_OK with the channel, or P2P_ERR_TIMEOUT / P2P_ERR_SYSTEM.
+int handoff_accept(int port, int timeout_ms, SOCKET* channel);
+
+// Old process, threads stopped: stream node state and, once the successor
+// confirms, forget the connections. Returns connections handed over or P2P_ERR_*.
+int handoff_send(SOCKET channel);
+
+// New process, before threads start: fetch and install the state of the node
+// on port, whose topics and room logs must still be empty. Returns connections
+// adopted or P2P_ERR_*; on failure the node's identity, connections, topics
+// and rooms are as before.
+int handoff_receive(int port, int timeout_ms);
+
+#endif // HANDOFF_H
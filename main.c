@@ -1,74 +1,186 @@
 #include "common.h"
-#include "socket.h"
-#include "connection.h"
+#include "p2pchat.h"
 #include "command.h"
 #include "signal.h"
-#include <pthread.h>
+#include "trace.h"
+#include "timeutil.h"
 
-// Global variables
-int running = 1;
-int next_connection_id = 1;
+// Config file read at startup unless --config names another
+#define CONFIG_FILE "p2p_chat.conf"
 
-int main(int argc, char* argv[]) {
-    // Check command line arguments
-    if (argc != 2) {
-        printf("Usage: %s <port>\n", argv[0]);
-        return 1;
+// Library context of the running node
+P2PContext* app_context = NULL;
+
+// Take over a running node on the same port (--takeover)
+static int takeover = 0;
+
+// Print command line usage
+static void print_usage(const char* program) {
+    printf("Usage: %s [--help] [--config <file>] [--takeover] [--<key>=<value>]... <port>\n",
+           program);
+    printf("Keys (see 'config show'):");
+    const char* key;
+    for (int i = 0; (key = p2p_config_key(i)) != NULL; i++) {
+        printf(" %s", key);
     }
-    
-    // Parse and validate port
-    int port = atoi(argv[1]);
-    if (!is_valid_port(port)) {
-        printf("Error: Invalid port number (must be 1-65535)\n");
-        return 1;
+    printf("\n");
+}
+
+// Load the config file named with --config, or the default one if present
+static int load_config(int argc, char* argv[]) {
+    const char* path = NULL;
+    for (int i = 1; i < argc - 1; i++) {
+        if (strcmp(argv[i], "--config") == 0) {
+            path = argv[i + 1];
+        }
     }
     
-    // Initialize sockets
-    initialize_sockets();
+    int line;
+    int result = p2p_config_load(path ? path : CONFIG_FILE, &line);
+    if (result == P2P_ERR_NOT_FOUND && path == NULL) {
+        return 0;
+    }
+    if (result == P2P_ERR_INVALID) {
+        printf("Error: %s:%d: invalid setting\n", path ? path : CONFIG_FILE, line);
+        return -1;
+    }
+    if (result != P2P_OK) {
+        printf("Error: Cannot read config file %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+// Apply --key=value / --key value overrides, returns the port or -1
+static int parse_arguments(int argc, char* argv[]) {
+    int port = -1;
     
-    // Initialize connections array
-    init_connections();
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) != 0) {
+            if (port != -1) {
+                return -1;
+            }
+            port = atoi(argv[i]);
+            continue;
+        }
+        
+        // --config was handled before the overrides
+        if (strcmp(argv[i], "--config") == 0) {
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--takeover") == 0) {
+            takeover = 1;
+            continue;
+        }
+        
+        char key[MAX_COMMAND_LENGTH];
+        snprintf(key, sizeof(key), "%s", argv[i] + 2);
+        char* value = strchr(key, '=');
+        if (value != NULL) {
+            *value++ = '\0';
+        } else if (i + 1 < argc) {
+            value = argv[++i];
+        } else {
+            printf("Error: Missing value for %s\n", argv[i]);
+            return -1;
+        }
+        
+        // Accept --tcp-nodelay as well as --tcp_nodelay
+        for (char* c = key; *c; c++) {
+            if (*c == '-') {
+                *c = '_';
+            }
+        }
+        
+        int result = p2p_config_set(key, value);
+        if (result == P2P_ERR_NOT_FOUND) {
+            printf("Error: Unknown option --%s\n", key);
+            return -1;
+        }
+        if (result != P2P_OK) {
+            printf("Error: Invalid value for %s: %s\n", key, value);
+            return -1;
+        }
+    }
     
-    // Setup signal handlers
-    setup_signal_handlers();
+    return port;
+}
+
+int main(int argc, char* argv[]) {
+    // Help needs neither a config file nor a port
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        }
+    }
     
-    // Get local IP address
-    get_local_ip();
+    // Config file first, command line overrides on top
+    if (load_config(argc, argv) < 0) {
+        return 1;
+    }
     
-    // Setup listening socket
-    if (setup_listening_socket(port) < 0) {
-        printf("Failed to setup listening socket\n");
-        cleanup_sockets();
+    int port = parse_arguments(argc, argv);
+    if (port == -1) {
+        print_usage(argv[0]);
         return 1;
     }
     
-    // Start accept thread
-    if (pthread_create(&accept_thread, NULL, accept_connections_thread, NULL) != 0) {
-        printf("Failed to create accept thread\n");
-        cleanup_sockets();
+    // Validate port
+    if (port <= 0 || port > 65535) {
+        printf("Error: Invalid port number (must be 1-65535)\n");
         return 1;
     }
     
+    // Setup signal handlers
+    setup_signal_handlers();
+    
+    // Start node: listening socket, accept and reconnect threads
+    long long started = get_monotonic_ms();
+    if (takeover) {
+        printf("Taking over the node on port %d...\n", port);
+        app_context = p2p_takeover(port, HANDOFF_TIMEOUT_MS, handle_event, NULL);
+        if (app_context == NULL) {
+            printf("Failed to take over the node on port %d\n", port);
+            return 1;
+        }
+    } else {
+        app_context = p2p_create(port, handle_event, NULL);
+        if (app_context == NULL) {
+            printf("Failed to setup listening socket on port %d\n", port);
+            return 1;
+        }
+    }
+    printf("Listening on port %d (ready in %lld ms)\n", port, get_monotonic_ms() - started);
+    
     // Print startup information
     print_banner();
-    print_startup_info();
+    print_startup_info(p2p_local_ip(app_context), p2p_listen_port(app_context));
     
     // Main command loop
     char command[MAX_COMMAND_LENGTH];
+    TRACE_THREAD("main");
     while (running) {
         printf("> ");
         fflush(stdout);
         
-        if (fgets(command, sizeof(command), stdin) != NULL) {
-            // Remove newline
-            command[strcspn(command, "\n")] = '\0';
-            process_command(command);
+        if (fgets(command, sizeof(command), stdin) == NULL) {
+            // End of input quits; a signal only interrupts the read
+            if (feof(stdin)) {
+                break;
+            }
+            clearerr(stdin);
+            continue;
         }
+        
+        // Remove newline
+        command[strcspn(command, "\n")] = '\0';
+        process_command(command);
     }
     
     // Cleanup
-    pthread_join(accept_thread, NULL);
-    cleanup_sockets();
+    cmd_exit();
     
     return 0;
-}
\ No newline at end of file
+}
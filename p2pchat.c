@@ -0,0 +1,875 @@
+#include "p2pchat.h"
+#include "event.h"
+#include "config.h"
+#include "socket.h"
+#include "connection.h"
+#include "topic.h"
+#include "pubsub.h"
+#include "trace.h"
+#include "handoff.h"
+#include "worker.h"
+#include "roomlog.h"
+#include "search.h"
+#include "admission.h"
+#include "addrbook.h"
+#include "discovery.h"
+#include "capture.h"
+#include "bufpool.h"
+#include "timeutil.h"
+#include <pthread.h>
+#include <limits.h>
+
+// Global state shared by the core modules
+int running = 0;
+int next_connection_id = 1;
+
+// Library context
+struct P2PContext {
+    int accept_started;
+    int reconnect_started;
+    int park_started;
+    int spin_started;
+    int discovery_started;
+    long long rss_start;            // Resident bytes once the node was up
+};
+
+// Only one context at a time, node state is process-wide
+static P2PContext* active_context = NULL;
+static pthread_mutex_t context_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Event callback, write-locked only while it is replaced
+static p2p_event_fn event_callback = NULL;
+static void* event_user_data = NULL;
+static pthread_rwlock_t callback_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+// Deliver an event to the application callback
+void emit_event(const P2PEvent* event) {
+    pthread_rwlock_rdlock(&callback_lock);
+    if (event_callback != NULL) {
+        event_callback(event, event_user_data);
+    }
+    pthread_rwlock_unlock(&callback_lock);
+}
+
+// Replace the callback; waits for callbacks already running
+static void set_callback(p2p_event_fn callback, void* user_data) {
+    pthread_rwlock_wrlock(&callback_lock);
+    event_callback = callback;
+    event_user_data = user_data;
+    pthread_rwlock_unlock(&callback_lock);
+}
+
+// Start accept, reconnect and (for adopted sockets) receiver threads
+static int start_threads(P2PContext* ctx, int receivers) {
+    wakeup_clear();
+    running = 1;
+    ctx->accept_started = pthread_create(&accept_thread, NULL,
+                                         accept_connections_thread, NULL) == 0;
+    ctx->reconnect_started = pthread_create(&reconnect_thread, NULL,
+                                            reconnect_peers_thread, NULL) == 0;
+    ctx->park_started = pthread_create(&park_thread, NULL,
+                                       park_connections_thread, NULL) == 0;
+    if (!ctx->accept_started || !ctx->reconnect_started || !ctx->park_started) {
+        return -1;
+    }
+    if (SPIN_SUPPORTED && node_config.spin) {
+        ctx->spin_started = pthread_create(&spin_thread, NULL,
+                                           spin_connections_thread, NULL) == 0;
+        if (!ctx->spin_started) {
+            return -1;
+        }
+    }
+    if (node_config.discovery) {
+        ctx->discovery_started = pthread_create(&discovery_thread, NULL,
+                                                discover_peers_thread, NULL) == 0;
+        if (!ctx->discovery_started) {
+            return -1;
+        }
+    }
+    return receivers && start_receivers() != 0 ? -1 : 0;
+}
+
+// Stop every thread but leave all sockets open; receivers keep partial frames
+static void stop_threads(P2PContext* ctx) {
+    running = 0;
+    wakeup_raise();
+    if (ctx->accept_started) {
+        pthread_join(accept_thread, NULL);
+        ctx->accept_started = 0;
+    }
+    if (ctx->reconnect_started) {
+        pthread_join(reconnect_thread, NULL);
+        ctx->reconnect_started = 0;
+    }
+    if (ctx->park_started) {
+        pthread_join(park_thread, NULL);
+        ctx->park_started = 0;
+    }
+    if (ctx->spin_started) {
+        pthread_join(spin_thread, NULL);
+        ctx->spin_started = 0;
+    }
+    if (ctx->discovery_started) {
+        pthread_join(discovery_thread, NULL);
+        ctx->discovery_started = 0;
+    }
+    join_receivers();
+    
+    // Stream data is not handed over, senders finish their current chunk
+    stop_all_streams();
+    
+    // Subscriptions still in flight must reach the topic index
+    worker_pool_drain(&frame_pool);
+}
+
+// Stop the node: wake and join every thread, then close connections,
+// spending at most shutdown_drain on frames peers have not taken yet
+static void stop_node(P2PContext* ctx) {
+    // No events once shutdown starts, our own closes are not news
+    set_callback(NULL, NULL);
+    long long deadline = get_monotonic_ms() + node_config.shutdown_drain;
+    
+    // A receiver stuck sending to a stalled peer gives up at the deadline
+    set_send_deadline(deadline);
+    stop_threads(ctx);
+    worker_pool_stop(&frame_pool);
+    close_all_connections(deadline);
+    capture_stop(&node_capture);
+    
+    // Nothing is received any more, what was is written out
+    search_close(&node_index);
+    book_save(&node_book);
+    free_book(&node_book);
+    free_discovery(&node_discovery);
+    
+    if (listen_socket != INVALID_SOCKET) {
+        close(listen_socket);
+        listen_socket = INVALID_SOCKET;
+    }
+    
+    free_topics(&node_topics);
+    free_rooms(&node_rooms);
+    free_buffer_pool(&recv_buffers);
+    wakeup_close();
+    cleanup_sockets();
+}
+
+// Resident set size of the process in bytes, -1 where unknown
+static long long resident_bytes(void) {
+    long long bytes = -1;
+    #ifdef __linux__
+    FILE* file = fopen("/proc/self/statm", "r");
+    long long pages;
+    long long resident;
+    if (file != NULL) {
+        if (fscanf(file, "%lld %lld", &pages, &resident) == 2) {
+            bytes = resident * sysconf(_SC_PAGESIZE);
+        }
+        fclose(file);
+    }
+    #endif
+    return bytes;
+}
+
+// Address book file of the node on port
+static void book_path(char* path, size_t size, int port) {
+    if (node_config.peer_book[0] != '\0') {
+        snprintf(path, size, "%s", node_config.peer_book);
+    } else {
+        snprintf(path, size, BOOK_FILE_FORMAT, ".", port);
+    }
+}
+
+// Create node on port: fresh listening socket, or the state of a predecessor
+// when takeover_ms is not negative
+static P2PContext* create_node(int port, int takeover_ms,
+                               p2p_event_fn callback, void* user_data) {
+    if (!is_valid_port(port)) {
+        return NULL;
+    }
+    
+    pthread_mutex_lock(&context_mutex);
+    if (active_context != NULL) {
+        pthread_mutex_unlock(&context_mutex);
+        return NULL;
+    }
+    
+    P2PContext* ctx = calloc(1, sizeof(P2PContext));
+    if (ctx == NULL || initialize_sockets() < 0) {
+        pthread_mutex_unlock(&context_mutex);
+        free(ctx);
+        return NULL;
+    }
+    if (wakeup_open() < 0) {
+        cleanup_sockets();
+        pthread_mutex_unlock(&context_mutex);
+        free(ctx);
+        return NULL;
+    }
+    
+    frame_payload_limit = (uint32_t)(node_config.buffer_size - FRAME_HEADER_SIZE);
+    if (init_connections() < 0 ||
+        init_buffer_pool(&recv_buffers, (size_t)node_config.buffer_size, BUFFER_POOL_KEEP) < 0) {
+        wakeup_close();
+        cleanup_sockets();
+        pthread_mutex_unlock(&context_mutex);
+        free(ctx);
+        return NULL;
+    }
+    init_topics(&node_topics);
+    init_rooms(&node_rooms, node_config.room_log);
+    init_admission(&node_admission, node_config.accept_rate, node_config.accept_burst);
+    init_discovery(&node_discovery);
+    init_capture(&node_capture);
+    get_local_ip();
+    set_callback(callback, user_data);
+    
+    int result = worker_pool_start(&frame_pool, node_config.workers, node_config.work_queue,
+                                   (size_t)node_config.buffer_size, process_frame);
+    if (result == 0) {
+        result = search_open(&node_index, node_config.search_dir);
+    }
+    if (result == 0) {
+        result = takeover_ms < 0 ? setup_listening_socket(port)
+                                 : handoff_receive(port, takeover_ms);
+    }
+    
+    // A predecessor has closed its capture by the time it hands over;
+    // handoff_receive returns the connections it adopted
+    if (result >= 0 && node_config.capture[0] != '\0') {
+        result = capture_start(&node_capture, node_config.capture);
+    }
+    
+    // A predecessor has saved its book by the time it hands over
+    char path[BOOK_PATH_LENGTH];
+    book_path(path, sizeof(path), port);
+    init_book(&node_book, path);
+    
+    if (result < 0 || start_threads(ctx, takeover_ms >= 0) < 0) {
+        stop_node(ctx);
+        pthread_mutex_unlock(&context_mutex);
+        free(ctx);
+        return NULL;
+    }
+    
+    // A successor inherits its connections, a fresh node dials known peers
+    if (takeover_ms < 0) {
+        schedule_warm_pool();
+    }
+    ctx->rss_start = resident_bytes();
+    
+    active_context = ctx;
+    pthread_mutex_unlock(&context_mutex);
+    return ctx;
+}
+
+// Create node listening on port
+P2PContext* p2p_create(int port, p2p_event_fn callback, void* user_data) {
+    return create_node(port, -1, callback, user_data);
+}
+
+// Create node from the running node on port, which must call p2p_handoff
+P2PContext* p2p_takeover(int port, int timeout_ms, p2p_event_fn callback,
+                         void* user_data) {
+    return create_node(port, timeout_ms > 0 ? timeout_ms : 0, callback, user_data);
+}
+
+// Pass the node to a successor, returns connections handed over
+int p2p_handoff(P2PContext* ctx, int timeout_ms) {
+    SOCKET channel;
+    
+    pthread_mutex_lock(&context_mutex);
+    if (ctx == NULL || ctx != active_context || listen_socket == INVALID_SOCKET) {
+        pthread_mutex_unlock(&context_mutex);
+        return P2P_ERR_INVALID;
+    }
+    
+    int result = handoff_accept(listen_port, timeout_ms, &channel);
+    if (result != P2P_OK) {
+        pthread_mutex_unlock(&context_mutex);
+        return result;
+    }
+    
+    // Nothing reads or accepts while the state is in transit
+    stop_threads(ctx);
+    book_save(&node_book);
+    
+    // The successor may reopen the same file, so the capture ends here
+    int capturing = capture_stop(&node_capture);
+    result = handoff_send(channel);
+    close(channel);
+    
+    if (result < 0) {
+        // Successor failed, carry on as before, appending to the capture
+        if (capturing) {
+            capture_resume(&node_capture);
+        }
+        if (start_threads(ctx, 1) < 0) {
+            result = P2P_ERR_SYSTEM;
+        }
+    } else {
+        // Closed, not shut down: the listening socket lives on in the successor
+        close(listen_socket);
+        listen_socket = INVALID_SOCKET;
+        
+        // The successor maps our last segment on its next search
+        search_close(&node_index);
+    }
+    
+    pthread_mutex_unlock(&context_mutex);
+    return result;
+}
+
+// Close all connections and stop the node
+void p2p_destroy(P2PContext* ctx) {
+    pthread_mutex_lock(&context_mutex);
+    if (ctx == NULL || ctx != active_context) {
+        pthread_mutex_unlock(&context_mutex);
+        return;
+    }
+    
+    stop_node(ctx);
+    active_context = NULL;
+    pthread_mutex_unlock(&context_mutex);
+    free(ctx);
+}
+
+// Dial a peer, returns connection ID
+int p2p_connect(P2PContext* ctx, const char* ip, int port) {
+    if (ctx == NULL || ip == NULL || !is_valid_ip(ip) || !is_valid_port(port)) {
+        return P2P_ERR_INVALID;
+    }
+    
+    if (strcmp(ip, local_ip) == 0 && port == listen_port) {
+        return P2P_ERR_SELF;
+    }
+    
+    if (find_connection_by_address(ip, port) != -1) {
+        return P2P_ERR_EXISTS;
+    }
+    
+    DialTarget target;
+    snprintf(target.ip, sizeof(target.ip), "%s", ip);
+    target.port = port;
+    TRACE_BEGIN("connect");
+    connect_peers(&target, 1);
+    book_dialed(&node_book, ip, port, target.sock != INVALID_SOCKET, target.connect_ms);
+    if (target.sock == INVALID_SOCKET) {
+        TRACE_END("connect");
+        return P2P_ERR_CONNECT;
+    }
+    
+    int conn_id = add_connection(target.sock, ip, port, 1);
+    TRACE_END("connect");
+    if (conn_id < 0) {
+        close(target.sock);
+    }
+    return conn_id;
+}
+
+// Close a connection, telling the peer not to reconnect
+int p2p_close(P2PContext* ctx, int conn_id) {
+    if (ctx == NULL) {
+        return P2P_ERR_INVALID;
+    }
+    
+    if (find_connection_by_id(conn_id) == -1) {
+        return P2P_ERR_NOT_FOUND;
+    }
+    
+    close_connection(conn_id);
+    return P2P_OK;
+}
+
+// Largest direct message: configured limit, capped by the frame size
+static size_t max_message_size(void) {
+    size_t limit = (size_t)node_config.max_message_length;
+    return limit < frame_payload_limit ? limit : frame_payload_limit;
+}
+
+// Send a direct message
+int p2p_send(P2PContext* ctx, int conn_id, const void* data, size_t length) {
+    if (ctx == NULL || (data == NULL && length > 0) || length > max_message_size()) {
+        return P2P_ERR_INVALID;
+    }
+    
+    if (find_connection_by_id(conn_id) == -1) {
+        return P2P_ERR_NOT_FOUND;
+    }
+    
+    int result = queue_to_connection(conn_id, FRAME_MESSAGE, data, (uint32_t)length);
+    if (result < 0) {
+        return P2P_ERR_SYSTEM;
+    }
+    
+    char ip[INET_ADDRSTRLEN];
+    int port;
+    if (get_connection_address(conn_id, ip, &port) == 0) {
+        char source[SEARCH_SOURCE_LENGTH];
+        snprintf(source, sizeof(source), "to %s:%d", ip, port);
+        search_add(&node_index, get_wall_ms(), source, data, length);
+    }
+    return result;
+}
+
+// Send a direct message to the peer listening on ip:port, connecting in
+// the background if there is no connection yet
+int p2p_send_to(P2PContext* ctx, const char* ip, int port, const void* data, size_t length) {
+    if (ctx == NULL || ip == NULL || !is_valid_ip(ip) || !is_valid_port(port) ||
+        (data == NULL && length > 0) || length > max_message_size()) {
+        return P2P_ERR_INVALID;
+    }
+    
+    if (strcmp(ip, local_ip) == 0 && port == listen_port) {
+        return P2P_ERR_SELF;
+    }
+    
+    int conn_id = lazy_connection(ip, port);
+    if (conn_id < 0) {
+        return conn_id;
+    }
+    return p2p_send(ctx, conn_id, data, length);
+}
+
+// Open a bulk stream to an online peer, returns the stream ID
+int p2p_stream_open(P2PContext* ctx, int conn_id, int weight) {
+    if (ctx == NULL || weight < 1 || weight > STREAM_MAX_WEIGHT) {
+        return P2P_ERR_INVALID;
+    }
+    return open_stream(conn_id, weight);
+}
+
+// Queue data on a stream
+int p2p_stream_send(P2PContext* ctx, int conn_id, int stream,
+                    const void* data, size_t length) {
+    if (ctx == NULL || (data == NULL && length > 0) || stream <= 0 || stream > 0xFFFF) {
+        return P2P_ERR_INVALID;
+    }
+    return write_stream(conn_id, stream, data, length);
+}
+
+// Finish a stream once its queued data is sent
+int p2p_stream_close(P2PContext* ctx, int conn_id, int stream) {
+    if (ctx == NULL || stream <= 0 || stream > 0xFFFF) {
+        return P2P_ERR_INVALID;
+    }
+    return close_stream(conn_id, stream);
+}
+
+// Refuse an incoming stream
+int p2p_stream_reset(P2PContext* ctx, int conn_id, int stream) {
+    if (ctx == NULL || stream <= 0 || stream > 0xFFFF) {
+        return P2P_ERR_INVALID;
+    }
+    return reset_stream(conn_id, stream);
+}
+
+// Send a direct message to every connection
+int p2p_broadcast(P2PContext* ctx, const void* data, size_t length) {
+    if (ctx == NULL || (data == NULL && length > 0) || length > max_message_size()) {
+        return P2P_ERR_INVALID;
+    }
+    
+    int* conn_ids = malloc(sizeof(int) * connection_capacity);
+    if (conn_ids == NULL) {
+        return P2P_ERR_SYSTEM;
+    }
+    
+    int count = get_active_connection_ids(conn_ids, connection_capacity);
+    int delivered = 0;
+    
+    for (int i = 0; i < count; i++) {
+        if (queue_to_connection(conn_ids[i], FRAME_MESSAGE, data, (uint32_t)length) >= 0) {
+            delivered++;
+        }
+    }
+    if (delivered > 0) {
+        search_add(&node_index, get_wall_ms(), "to all", data, length);
+    }
+    
+    free(conn_ids);
+    return delivered;
+}
+
+// Send a message to peers subscribed to topic
+int p2p_publish(P2PContext* ctx, const char* topic, const char* message) {
+    if (ctx == NULL || topic == NULL || message == NULL || !is_valid_topic(topic) ||
+        strlen(message) > (size_t)node_config.max_message_length) {
+        return P2P_ERR_INVALID;
+    }
+    
+    // Only fails when topic and message don't fit one frame
+    int delivered = publish_to_topic(topic, message);
+    return delivered < 0 ? P2P_ERR_INVALID : delivered;
+}
+
+// Subscribe to a topic and tell connected peers
+int p2p_join(P2PContext* ctx, const char* topic) {
+    if (ctx == NULL || topic == NULL || !is_valid_topic(topic)) {
+        return P2P_ERR_INVALID;
+    }
+    
+    int result = topic_join(&node_topics, topic);
+    if (result < 0) {
+        return P2P_ERR_SYSTEM;
+    }
+    if (result > 0) {
+        return P2P_ERR_EXISTS;
+    }
+    
+    announce_subscription(FRAME_SUBSCRIBE, topic);
+    
+    // Catch up from members we are already connected to
+    sync_room(topic);
+    return P2P_OK;
+}
+
+// Unsubscribe from a topic and tell connected peers
+int p2p_leave(P2PContext* ctx, const char* topic) {
+    if (ctx == NULL || topic == NULL) {
+        return P2P_ERR_INVALID;
+    }
+    
+    if (topic_leave(&node_topics, topic) != 0) {
+        return P2P_ERR_NOT_FOUND;
+    }
+    
+    announce_subscription(FRAME_UNSUBSCRIBE, topic);
+    room_drop(&node_rooms, topic);
+    return P2P_OK;
+}
+
+// Visit the newest max entries of a room log in order
+int p2p_history(P2PContext* ctx, const char* topic, int max,
+                p2p_history_fn visit, void* user_data) {
+    if (ctx == NULL || topic == NULL || visit == NULL || max < 0) {
+        return P2P_ERR_INVALID;
+    }
+    if (!topic_is_joined(&node_topics, topic)) {
+        return P2P_ERR_NOT_FOUND;
+    }
+    
+    // Visited from a copy, the callback may call back into the library
+    RoomEntry* entries;
+    int count = room_copy(&node_rooms, topic, NULL, &entries);
+    if (count < 0) {
+        return P2P_ERR_SYSTEM;
+    }
+    
+    int first = count > max ? count - max : 0;
+    for (int i = first; i < count; i++) {
+        P2PRoomEntry entry;
+        entry.timestamp = (long long)(entries[i].key.clock >> 16);
+        entry.origin = entries[i].key.origin;
+        entry.local = entries[i].key.origin == local_node_id;
+        entry.message = entries[i].message;
+        visit(&entry, user_data);
+    }
+    
+    room_free_copies(entries, count);
+    return count - first;
+}
+
+// Visit the newest max messages containing every word of query
+int p2p_search(P2PContext* ctx, const char* query, int max,
+               p2p_search_fn visit, void* user_data) {
+    if (ctx == NULL || query == NULL || visit == NULL || max < 0) {
+        return P2P_ERR_INVALID;
+    }
+    
+    // Visited from copies, the callback may call back into the library
+    SearchHit* hits;
+    long long total;
+    int count = search_query(&node_index, query, max, &hits, &total);
+    if (count < 0) {
+        return P2P_ERR_SYSTEM;
+    }
+    
+    for (int i = 0; i < count; i++) {
+        P2PSearchHit hit;
+        hit.timestamp = hits[i].timestamp;
+        hit.source = hits[i].source;
+        hit.message = hits[i].text;
+        hit.length = hits[i].length;
+        visit(&hit, user_data);
+    }
+    
+    search_free_hits(hits, count);
+    return total < INT_MAX ? (int)total : INT_MAX;
+}
+
+// Size of the search index
+int p2p_search_stats(P2PContext* ctx, P2PSearchStats* stats) {
+    if (ctx == NULL || stats == NULL) {
+        return P2P_ERR_INVALID;
+    }
+    search_stats(&node_index, &stats->messages, &stats->segments, &stats->bytes,
+                 &stats->dropped);
+    return P2P_OK;
+}
+
+// Local IP address
+const char* p2p_local_ip(P2PContext* ctx) {
+    return ctx != NULL ? local_ip : NULL;
+}
+
+// Listening port
+int p2p_listen_port(P2PContext* ctx) {
+    return ctx != NULL ? listen_port : 0;
+}
+
+// Largest message accepted by p2p_send
+size_t p2p_max_payload(P2PContext* ctx) {
+    (void)ctx; // Unused parameter
+    return max_message_size();
+}
+
+// Copy connection snapshot
+int p2p_list_connections(P2PContext* ctx, P2PConnectionInfo* out, int max) {
+    if (ctx == NULL || out == NULL || max <= 0) {
+        return 0;
+    }
+    return get_connection_info(out, max);
+}
+
+// Copy topic snapshot
+int p2p_list_topics(P2PContext* ctx, P2PTopicInfo* out, int max) {
+    if (ctx == NULL || out == NULL || max <= 0) {
+        return 0;
+    }
+    return topic_get_info(&node_topics, out, max);
+}
+
+// Copy the address book best first
+int p2p_list_peers(P2PContext* ctx, P2PPeerInfo* out, int max) {
+    if (ctx == NULL || out == NULL || max <= 0) {
+        return 0;
+    }
+    
+    BookEntry* entries = malloc(max * sizeof(BookEntry));
+    if (entries == NULL) {
+        return 0;
+    }
+    
+    int count = book_list(&node_book, entries, max);
+    for (int i = 0; i < count; i++) {
+        strcpy(out[i].ip, entries[i].ip);
+        out[i].port = entries[i].port;
+        out[i].node_id = entries[i].node_id;
+        out[i].last_seen = entries[i].last_seen;
+        out[i].connect_ms = entries[i].connect_ms;
+        out[i].successes = entries[i].successes;
+        out[i].failures = entries[i].failures;
+        out[i].connected = find_connection_by_address(entries[i].ip, entries[i].port) != -1;
+    }
+    
+    free(entries);
+    return count;
+}
+
+// Copy the discovered peers least loaded first
+int p2p_list_discovered(P2PContext* ctx, P2PDiscoveredPeer* out, int max) {
+    if (ctx == NULL || out == NULL || max <= 0) {
+        return 0;
+    }
+    
+    DiscoveredPeer* peers = malloc(max * sizeof(DiscoveredPeer));
+    if (peers == NULL) {
+        return 0;
+    }
+    
+    long long now = get_monotonic_ms();
+    int count = discovery_list(&node_discovery, peers, max);
+    for (int i = 0; i < count; i++) {
+        strcpy(out[i].ip, peers[i].ip);
+        out[i].port = peers[i].port;
+        out[i].node_id = peers[i].node_id;
+        out[i].load = peers[i].load;
+        out[i].capacity = peers[i].capacity;
+        out[i].age_ms = (int)(now - peers[i].heard_ms);
+        out[i].connected = find_connection_by_address(peers[i].ip, peers[i].port) != -1;
+    }
+    
+    free(peers);
+    return count;
+}
+
+// Announcements sent and heard, peers cached
+int p2p_discovery_stats(P2PContext* ctx, P2PDiscoveryStats* stats) {
+    if (ctx == NULL || stats == NULL) {
+        return P2P_ERR_INVALID;
+    }
+    discovery_stats(&node_discovery, &stats->announced, &stats->heard, &stats->peers);
+    return P2P_OK;
+}
+
+// Resident memory and what idle connections hold on to
+int p2p_memory_stats(P2PContext* ctx, P2PMemoryStats* stats) {
+    if (ctx == NULL || stats == NULL) {
+        return P2P_ERR_INVALID;
+    }
+    stats->rss = resident_bytes();
+    stats->rss_start = ctx->rss_start;
+    stats->connections = get_active_connection_count();
+    get_receiver_stats(&stats->receivers, &stats->parked);
+    buffer_pool_stats(&recv_buffers, &stats->recv_buffers, &stats->pooled_buffers);
+    return P2P_OK;
+}
+
+// Inbound connections accepted and shed
+int p2p_accept_stats(P2PContext* ctx, P2PAcceptStats* stats) {
+    if (ctx == NULL || stats == NULL) {
+        return P2P_ERR_INVALID;
+    }
+    admission_stats(&node_admission, &stats->accepted, &stats->shed_rate, &stats->shed_full);
+    return P2P_OK;
+}
+
+// Write recorded trace events, returns event count
+int p2p_trace_dump(P2PContext* ctx, const char* path) {
+    if (ctx == NULL || path == NULL || strlen(path) == 0) {
+        return P2P_ERR_INVALID;
+    }
+    
+    if (!trace_enabled()) {
+        return P2P_ERR_UNSUPPORTED;
+    }
+    
+    int count = trace_dump(path);
+    return count < 0 ? P2P_ERR_SYSTEM : count;
+}
+
+// Start recording frames to path
+int p2p_capture_start(P2PContext* ctx, const char* path) {
+    if (ctx == NULL || path == NULL || strlen(path) == 0) {
+        return P2P_ERR_INVALID;
+    }
+    
+    int result = capture_start(&node_capture, path);
+    if (result == -2) {
+        return P2P_ERR_EXISTS;
+    }
+    return result < 0 ? P2P_ERR_SYSTEM : P2P_OK;
+}
+
+// Stop recording and close the file
+int p2p_capture_stop(P2PContext* ctx) {
+    if (ctx == NULL) {
+        return P2P_ERR_INVALID;
+    }
+    capture_stop(&node_capture);
+    return P2P_OK;
+}
+
+// Frames recorded and dropped, bytes written, whether the file failed
+int p2p_capture_stats(P2PContext* ctx, P2PCaptureStats* stats) {
+    if (ctx == NULL || stats == NULL) {
+        return P2P_ERR_INVALID;
+    }
+    capture_stats(&node_capture, &stats->frames, &stats->bytes, &stats->dropped,
+                  &stats->active, &stats->failed);
+    return P2P_OK;
+}
+
+// Set one configuration key
+int p2p_config_set(const char* key, const char* value) {
+    if (key == NULL || value == NULL) {
+        return P2P_ERR_INVALID;
+    }
+    
+    pthread_mutex_lock(&context_mutex);
+    int result = P2P_ERR_BUSY;
+    if (active_context == NULL) {
+        result = config_set(&node_config, key, value);
+        if (result == -1) {
+            result = P2P_ERR_NOT_FOUND;
+        } else if (result < 0) {
+            result = P2P_ERR_INVALID;
+        }
+    }
+    pthread_mutex_unlock(&context_mutex);
+    
+    return result;
+}
+
+// Load a config file; nothing changes unless every line is valid
+int p2p_config_load(const char* path, int* error_line) {
+    if (path == NULL) {
+        return P2P_ERR_INVALID;
+    }
+    
+    pthread_mutex_lock(&context_mutex);
+    if (active_context != NULL) {
+        pthread_mutex_unlock(&context_mutex);
+        return P2P_ERR_BUSY;
+    }
+    
+    NodeConfig loaded = node_config;
+    int result = config_load(&loaded, path);
+    if (result == 0) {
+        node_config = loaded;
+    }
+    pthread_mutex_unlock(&context_mutex);
+    
+    if (error_line != NULL) {
+        *error_line = result > 0 ? result : 0;
+    }
+    if (result < 0) {
+        return errno == ENOENT ? P2P_ERR_NOT_FOUND : P2P_ERR_SYSTEM;
+    }
+    return result > 0 ? P2P_ERR_INVALID : P2P_OK;
+}
+
+// Read one configuration key as text
+int p2p_config_get(const char* key, char* value, size_t size) {
+    if (key == NULL || value == NULL || size == 0) {
+        return P2P_ERR_INVALID;
+    }
+    return config_get(&node_config, key, value, size) < 0 ? P2P_ERR_NOT_FOUND : P2P_OK;
+}
+
+// Configuration key by index
+const char* p2p_config_key(int index) {
+    return config_key(index);
+}
+
+// Socket option as the OS applied it
+int p2p_config_effective(P2PContext* ctx, const char* key, int* value) {
+    if (ctx == NULL || key == NULL || value == NULL) {
+        return P2P_ERR_INVALID;
+    }
+    if (get_socket_option(listen_socket, key, value) < 0) {
+        return P2P_ERR_UNSUPPORTED;
+    }
+    return P2P_OK;
+}
+
+// Describe an error code
+const char* p2p_strerror(int error) {
+    switch (error) {
+        case P2P_OK:
+            return "Success";
+        case P2P_ERR_INVALID:
+            return "Invalid argument";
+        case P2P_ERR_NOT_FOUND:
+            return "Not found";
+        case P2P_ERR_EXISTS:
+            return "Already exists";
+        case P2P_ERR_CONNECT:
+            return "Connection failed";
+        case P2P_ERR_LIMIT:
+            return "Maximum connections reached";
+        case P2P_ERR_SYSTEM:
+            return "System error";
+        case P2P_ERR_SELF:
+            return "Cannot connect to yourself";
+        case P2P_ERR_UNSUPPORTED:
+            return "Not supported in this build";
+        case P2P_ERR_BUSY:
+            return "Not allowed while the node is running";
+        case P2P_ERR_TIMEOUT:
+            return "Timed out";
+        default:
+            return "Unknown error";
+    }
+}
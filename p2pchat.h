@@ -0,0 +1,305 @@
+#ifndef P2PCHAT_H
+#define P2PCHAT_H
+
+#include <stddef.h>
+
+// libp2pchat - embeddable peer-to-peer messaging
+//
+// The library runs its own accept, receiver and reconnect threads. Events
+// are delivered on those threads, so callbacks must be thread-safe and
+// should return quickly. Event data is only valid during the callback.
+// Node state is process-wide: only one context can exist at a time.
+// Callbacks may call back into the library, except p2p_destroy. No events
+// are delivered once p2p_destroy has started.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define P2P_IP_LENGTH 16
+#define P2P_TOPIC_LENGTH 32
+
+// Error codes (negative return values)
+#define P2P_OK              0
+#define P2P_ERR_INVALID    -1   // Bad argument (IP, port, topic, size)
+#define P2P_ERR_NOT_FOUND  -2   // Unknown connection ID or topic
+#define P2P_ERR_EXISTS     -3   // Already connected / joined
+#define P2P_ERR_CONNECT    -4   // TCP connect failed
+#define P2P_ERR_LIMIT      -5   // Connection table (or stream table) full
+#define P2P_ERR_SYSTEM     -6   // Socket, thread or memory failure
+#define P2P_ERR_SELF       -7   // Connecting to our own listen address
+#define P2P_ERR_UNSUPPORTED -8  // Feature not compiled in
+#define P2P_ERR_BUSY       -9   // Not allowed while a node is running
+#define P2P_ERR_TIMEOUT   -10   // Handoff partner did not show up in time
+
+// Event types
+typedef enum {
+    P2P_EVENT_CONNECTED = 1,    // New connection (outbound or accepted)
+    P2P_EVENT_DISCONNECTED,     // Connection removed, see reason
+    P2P_EVENT_OFFLINE,          // Link lost, messages queue until it returns
+    P2P_EVENT_RECONNECTED,      // Link restored, queued messages replayed
+    P2P_EVENT_MESSAGE,          // Direct message received
+    P2P_EVENT_PUBLISH,          // Topic message received
+    P2P_EVENT_ERROR,            // Background failure, see error
+    P2P_EVENT_STREAM            // Bulk stream data, see stream and fin
+} P2PEventType;
+
+// Disconnect reasons
+typedef enum {
+    P2P_REASON_CLOSED = 1,      // Peer closed the connection
+    P2P_REASON_IO_ERROR,        // Socket error before handshake
+    P2P_REASON_PROTOCOL         // Peer sent an invalid frame
+} P2PReason;
+
+// Connection states
+typedef enum {
+    P2P_STATE_CONNECTING = 0,
+    P2P_STATE_ONLINE,
+    P2P_STATE_OFFLINE
+} P2PState;
+
+// Event passed to the callback
+typedef struct {
+    P2PEventType type;
+    int conn_id;                // -1 if not tied to a connection
+    const char* ip;
+    int port;
+    int outbound;               // CONNECTED, OFFLINE: we dialed (and will redial)
+    P2PReason reason;           // DISCONNECTED
+    int replayed;               // RECONNECTED: messages resent from the queue
+    int error;                  // ERROR: P2P_ERR_* code
+    const char* topic;          // PUBLISH
+    const unsigned char* data;  // MESSAGE, PUBLISH, STREAM: raw payload, not terminated
+    size_t length;
+    int stream;                 // STREAM: sender's stream ID
+    int fin;                    // STREAM: last piece, the stream is finished
+    long long timestamp;        // PUBLISH: room log time, ms since the epoch (0 = unlogged)
+    unsigned long long origin;  // PUBLISH: author's node ID (ip/port is the sender)
+    int late;                   // PUBLISH: sorts before messages already delivered
+    int repaired;               // PUBLISH: missed earlier, recovered by anti-entropy
+} P2PEvent;
+
+// Connection snapshot
+typedef struct {
+    int id;
+    char ip[P2P_IP_LENGTH];
+    int port;
+    P2PState state;
+    int queued;                 // Messages waiting for acknowledgement
+} P2PConnectionInfo;
+
+// Room log entry (see p2p_history)
+typedef struct {
+    long long timestamp;        // Milliseconds since the epoch, author's clock
+    unsigned long long origin;  // Author's node ID
+    int local;                  // Written by this node
+    const char* message;
+} P2PRoomEntry;
+
+// Search result (see p2p_search)
+typedef struct {
+    long long timestamp;        // Milliseconds since the epoch
+    const char* source;         // "#topic", "ip:port" (received), "to ip:port" or "to all"
+    const char* message;        // Terminated, length excludes the terminator
+    size_t length;
+} P2PSearchHit;
+
+// Search index size
+typedef struct {
+    long long messages;
+    int segments;
+    long long bytes;            // Written segments (files with search_dir)
+    long long dropped;          // Arrived faster than they could be indexed
+} P2PSearchStats;
+
+// Inbound connection counts since the node started
+typedef struct {
+    long long accepted;
+    long long shed_rate;        // Reset: their address was over accept_rate
+    long long shed_full;        // Reset: connection table full
+} P2PAcceptStats;
+
+// Wire capture counters (see p2p_capture_stats)
+typedef struct {
+    int active;
+    long long frames;           // Frames recorded
+    long long bytes;            // Written to the file so far
+    long long dropped;          // Lost because the disk fell behind
+    int failed;                 // Writing the file failed, recording stopped
+} P2PCaptureStats;
+
+// Memory use (see p2p_memory_stats)
+typedef struct {
+    long long rss;              // Resident bytes of the process, -1 if unknown
+    long long rss_start;        // Resident bytes when the node had started
+    int connections;
+    int receivers;              // Connections with a receiver thread
+    int parked;                 // Quiet connections without one
+    int recv_buffers;           // Receive buffers in use
+    int pooled_buffers;         // Free receive buffers kept for reuse
+} P2PMemoryStats;
+
+// Address book entry (see p2p_list_peers)
+typedef struct {
+    char ip[P2P_IP_LENGTH];
+    int port;                   // Peer's listen port
+    unsigned long long node_id; // Last seen there, 0 = never reached
+    long long last_seen;        // Last handshake, ms since the epoch (0 = never)
+    int connect_ms;             // Smoothed dial time, -1 = never dialed
+    int successes;              // Dials that connected
+    int failures;               // Failed dials since the last success
+    int connected;              // A connection to it exists now
+} P2PPeerInfo;
+
+// Peer heard on the discovery group (see p2p_list_discovered)
+typedef struct {
+    char ip[P2P_IP_LENGTH];
+    int port;                   // Peer's listen port
+    unsigned long long node_id;
+    int load;                   // Connections it has in use
+    int capacity;               // Its connection table size
+    int age_ms;                 // Since its last announcement
+    int connected;              // A connection to it exists now
+} P2PDiscoveredPeer;
+
+// Discovery counters (see p2p_discovery_stats)
+typedef struct {
+    long long announced;        // Announcements sent
+    long long heard;            // Announcements received from other nodes
+    int peers;                  // Peers cached now
+} P2PDiscoveryStats;
+
+// Topic snapshot
+typedef struct {
+    char name[P2P_TOPIC_LENGTH + 1];
+    int joined;
+    int subscribers;
+} P2PTopicInfo;
+
+typedef struct P2PContext P2PContext;
+typedef void (*p2p_event_fn)(const P2PEvent* event, void* user_data);
+typedef void (*p2p_history_fn)(const P2PRoomEntry* entry, void* user_data);
+typedef void (*p2p_search_fn)(const P2PSearchHit* hit, void* user_data);
+
+// Runtime configuration: buffer_size, max_connections, backlog,
+// accept_rate, accept_burst, max_message_length and socket options
+// (sndbuf, rcvbuf, tcp_nodelay, keepalive*, user_timeout, busy_poll).
+// Set before p2p_create.
+int p2p_config_set(const char* key, const char* value);
+int p2p_config_load(const char* path, int* error_line);
+int p2p_config_get(const char* key, char* value, size_t size);
+const char* p2p_config_key(int index);  // NULL past the last key
+
+// Socket option as the OS applied it on the listening socket
+int p2p_config_effective(P2PContext* ctx, const char* key, int* value);
+
+// Lifecycle
+P2PContext* p2p_create(int port, p2p_event_fn callback, void* user_data);
+void p2p_destroy(P2PContext* ctx);
+
+// Hot restart (POSIX): the running node passes its listening socket, peer
+// sockets, connection table, queued messages and topics to a successor
+// process that called p2p_takeover with the same port; peers stay connected.
+// p2p_handoff waits up to timeout_ms and returns the connections handed
+// over; the node is then stopped and only p2p_destroy remains. On failure
+// the node keeps running. p2p_takeover waits up to timeout_ms for the
+// predecessor and returns NULL if nothing was taken over.
+int p2p_handoff(P2PContext* ctx, int timeout_ms);
+P2PContext* p2p_takeover(int port, int timeout_ms, p2p_event_fn callback,
+                         void* user_data);
+
+// Connections (IDs >= 1, negative P2P_ERR_* on failure)
+int p2p_connect(P2PContext* ctx, const char* ip, int port);
+int p2p_close(P2PContext* ctx, int conn_id);
+
+// Messaging: 0 = sent, 1 = queued for offline peer, negative on error
+int p2p_send(P2PContext* ctx, int conn_id, const void* data, size_t length);
+
+// Send to the peer listening on ip:port. Without a connection one is
+// dialed in the background and the message queued until the handshake,
+// so this never waits for the network (returns 1 then).
+int p2p_send_to(P2PContext* ctx, const char* ip, int port, const void* data, size_t length);
+
+// Bulk streams: ordered data of any size, interleaved with messages instead
+// of holding them up. Several streams share a connection by weight (1-16).
+// Streams need the peer online, are not queued or replayed, and end with
+// the link. p2p_stream_send blocks while the stream's queue is full.
+// The peer gets STREAM events; the one with fin set closes the stream.
+// A receiver refuses a stream with p2p_stream_reset: the sender drops it,
+// and its p2p_stream_send fails with P2P_ERR_NOT_FOUND. Events for data
+// already in flight may still arrive.
+int p2p_stream_open(P2PContext* ctx, int conn_id, int weight);
+int p2p_stream_send(P2PContext* ctx, int conn_id, int stream,
+                    const void* data, size_t length);
+int p2p_stream_close(P2PContext* ctx, int conn_id, int stream);
+int p2p_stream_reset(P2PContext* ctx, int conn_id, int stream);
+
+// Fan-out, return number of peers reached (sent + queued)
+int p2p_broadcast(P2PContext* ctx, const void* data, size_t length);
+int p2p_publish(P2PContext* ctx, const char* topic, const char* message);
+
+// Topics (join returns P2P_ERR_EXISTS if already joined)
+int p2p_join(P2PContext* ctx, const char* topic);
+int p2p_leave(P2PContext* ctx, const char* topic);
+
+// Room log of a joined topic: messages in the same total order on every
+// member (hybrid logical clock, then author). Members exchange range
+// digests every room_sync ms and on (re)connect, so missed messages arrive
+// later as PUBLISH events with repaired set. Visits the last max entries
+// oldest first and returns how many, P2P_ERR_NOT_FOUND if not joined.
+int p2p_history(P2PContext* ctx, const char* topic, int max,
+                p2p_history_fn visit, void* user_data);
+
+// Full-text search over direct, broadcast and logged topic messages, sent
+// and received. Words are letters and digits (any non-ASCII byte counts as
+// a letter), matched case-insensitively; a message matches when it has
+// every word of query. Visits up to max matches newest first and returns
+// how many matched in all. With search_dir set the index is kept there and
+// reopened on restart; otherwise it lasts as long as the node.
+int p2p_search(P2PContext* ctx, const char* query, int max,
+               p2p_search_fn visit, void* user_data);
+int p2p_search_stats(P2PContext* ctx, P2PSearchStats* stats);
+
+// Introspection (lists return number of entries written)
+const char* p2p_local_ip(P2PContext* ctx);
+int p2p_listen_port(P2PContext* ctx);
+size_t p2p_max_payload(P2PContext* ctx);
+int p2p_list_connections(P2PContext* ctx, P2PConnectionInfo* out, int max);
+int p2p_list_topics(P2PContext* ctx, P2PTopicInfo* out, int max);
+int p2p_accept_stats(P2PContext* ctx, P2PAcceptStats* stats);
+
+// Memory: a connection quiet for park_idle ms returns its receive buffer
+// to a pool, frees its send buffers and parks, its receiver thread exits
+// and one shared thread watches the socket until data arrives
+int p2p_memory_stats(P2PContext* ctx, P2PMemoryStats* stats);
+
+// Address book: every peer a handshake completed with, saved to peer_book
+// (default p2p_peers_<port>.txt) and reloaded on start, when the best
+// warm_peers of them are dialed in parallel
+int p2p_list_peers(P2PContext* ctx, P2PPeerInfo* out, int max);
+
+// LAN discovery (config discovery=on): nodes announce themselves to the
+// discovery_group multicast group and dial up to discovery_peers of the
+// least loaded nodes they hear. Lists the peers heard, least loaded first.
+int p2p_list_discovered(P2PContext* ctx, P2PDiscoveredPeer* out, int max);
+int p2p_discovery_stats(P2PContext* ctx, P2PDiscoveryStats* stats);
+int p2p_trace_dump(P2PContext* ctx, const char* path);
+
+// Wire capture: every frame sent and received, per connection, with a
+// nanosecond timestamp, to a compact binary file (format in capture.h)
+// that p2p_replay plays back against a node. Also started at p2p_create
+// by config capture. Start returns P2P_ERR_EXISTS while one is running.
+// Buffers fit the largest frame buffer_size allows, so any frame can be
+// recorded. A failed write stops recording and sets failed in the stats.
+int p2p_capture_start(P2PContext* ctx, const char* path);
+int p2p_capture_stop(P2PContext* ctx);
+int p2p_capture_stats(P2PContext* ctx, P2PCaptureStats* stats);
+
+// Error description
+const char* p2p_strerror(int error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // P2PCHAT_H
@@ -0,0 +1,369 @@
+#include "protocol.h"
+#include "socket.h"
+#include "trace.h"
+
+// Largest payload write_frame accepts
+uint32_t frame_payload_limit = MAX_FRAME_PAYLOAD;
+
+// Encode frame header into network byte order
+void encode_frame_header(const FrameHeader* header, unsigned char* out) {
+    uint16_t stream = htons(header->stream);
+    uint32_t length = htonl(header->length);
+    
+    out[0] = header->type;
+    out[1] = header->flags;
+    memcpy(out + 2, &stream, sizeof(stream));
+    memcpy(out + 4, &length, sizeof(length));
+    encode_u64(header->seq, out + 8);
+}
+
+// Decode frame header from network byte order
+void decode_frame_header(const unsigned char* in, FrameHeader* header) {
+    uint16_t stream;
+    uint32_t length;
+    
+    memcpy(&stream, in + 2, sizeof(stream));
+    memcpy(&length, in + 4, sizeof(length));
+    
+    header->type = in[0];
+    header->flags = in[1];
+    header->stream = ntohs(stream);
+    header->length = ntohl(length);
+    header->seq = decode_u64(in + 8);
+}
+
+// Encode 64-bit integer in network byte order
+void encode_u64(uint64_t value, unsigned char* out) {
+    for (int i = 7; i >= 0; i--) {
+        out[i] = (unsigned char)(value & 0xff);
+        value >>= 8;
+    }
+}
+
+// Decode 64-bit integer from network byte order
+uint64_t decode_u64(const unsigned char* in) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value = (value << 8) | in[i];
+    }
+    return value;
+}
+
+// Encode 32-bit integer in network byte order
+void encode_u32(uint32_t value, unsigned char* out) {
+    uint32_t network = htonl(value);
+    memcpy(out, &network, sizeof(network));
+}
+
+// Decode 32-bit integer from network byte order
+uint32_t decode_u32(const unsigned char* in) {
+    uint32_t network;
+    memcpy(&network, in, sizeof(network));
+    return ntohl(network);
+}
+
+// Write a complete frame (header and payload in a single write) to a sink
+static int write_full_frame(frame_write_fn write, void* ctx, const FrameHeader* header,
+                            const void* payload) {
+    uint32_t length = header->length;
+    unsigned char stack_frame[BUFFER_SIZE];
+    unsigned char* frame = stack_frame;
+    
+    if (length > frame_payload_limit) {
+        return -1;
+    }
+    
+    // Frames above the default size only exist with a larger buffer_size
+    if (FRAME_HEADER_SIZE + length > sizeof(stack_frame)) {
+        frame = malloc(FRAME_HEADER_SIZE + length);
+        if (frame == NULL) {
+            return -1;
+        }
+    }
+    
+    encode_frame_header(header, frame);
+    if (length > 0) {
+        memcpy(frame + FRAME_HEADER_SIZE, payload, length);
+    }
+    
+    int result = write(ctx, frame, FRAME_HEADER_SIZE + length);
+    if (frame != stack_frame) {
+        free(frame);
+    }
+    return result;
+}
+
+// Write a stream 0 frame
+int write_frame(frame_write_fn write, void* ctx, uint8_t type, uint64_t seq,
+                const void* payload, uint32_t length) {
+    FrameHeader header = { type, 0, 0, length, seq };
+    return write_full_frame(write, ctx, &header, payload);
+}
+
+// Write an unsequenced frame on a stream
+int write_stream_frame(frame_write_fn write, void* ctx, uint8_t type, uint8_t flags,
+                       uint16_t stream, const void* payload, uint32_t length) {
+    FrameHeader header = { type, flags, stream, length, 0 };
+    return write_full_frame(write, ctx, &header, payload);
+}
+
+// Socket sink for write_frame
+static int write_to_socket(void* ctx, const void* data, size_t length) {
+    return send_all(*(SOCKET*)ctx, data, length);
+}
+
+// Send a complete frame over a socket
+int send_frame(SOCKET sock, uint8_t type, uint64_t seq,
+               const void* payload, uint32_t length) {
+    TRACE_BEGIN("send");
+    int result = write_frame(write_to_socket, &sock, type, seq, payload, length);
+    TRACE_END("send");
+    return result;
+}
+
+// Initialize frame reader over a caller-owned buffer
+void frame_reader_init(FrameReader* reader, unsigned char* buffer, size_t capacity) {
+    reader->data = buffer;
+    reader->capacity = capacity;
+    reader->used = 0;
+    reader->start = 0;
+}
+
+// Move a partial frame to the front so the caller can receive after it
+static void frame_reader_compact(FrameReader* reader) {
+    if (reader->start > 0) {
+        reader->used -= reader->start;
+        memmove(reader->data, reader->data + reader->start, reader->used);
+        reader->start = 0;
+    }
+}
+
+// Get next complete frame: 1 = frame ready, 0 = need more data, -1 = bad frame
+int frame_reader_next(FrameReader* reader, FrameHeader* header,
+                      const unsigned char** payload) {
+    const unsigned char* frame = reader->data + reader->start;
+    size_t available = reader->used - reader->start;
+    
+    if (available < FRAME_HEADER_SIZE) {
+        frame_reader_compact(reader);
+        return 0;
+    }
+    
+    decode_frame_header(frame, header);
+    if (header->length > reader->capacity - FRAME_HEADER_SIZE) {
+        return -1;
+    }
+    
+    if (available < FRAME_HEADER_SIZE + header->length) {
+        frame_reader_compact(reader);
+        return 0;
+    }
+    
+    *payload = frame + FRAME_HEADER_SIZE;
+    return 1;
+}
+
+// Drop a processed frame; a burst of frames costs one move, not one per frame
+void frame_reader_consume(FrameReader* reader, const FrameHeader* header) {
+    reader->start += FRAME_HEADER_SIZE + header->length;
+    if (reader->start == reader->used) {
+        reader->start = 0;
+        reader->used = 0;
+    }
+}
+
+// Encode handshake payload
+void encode_hello(const HelloPayload* hello, unsigned char* out) {
+    uint16_t listen_port = htons(hello->listen_port);
+    
+    encode_u64(hello->node_id, out);
+    memcpy(out + 8, &listen_port, sizeof(listen_port));
+    encode_u64(hello->last_received_seq, out + 10);
+}
+
+// Decode handshake payload
+int decode_hello(const unsigned char* payload, uint32_t length, HelloPayload* hello) {
+    uint16_t listen_port;
+    
+    if (length < HELLO_PAYLOAD_SIZE) {
+        return -1;
+    }
+    
+    hello->node_id = decode_u64(payload);
+    memcpy(&listen_port, payload + 8, sizeof(listen_port));
+    hello->listen_port = ntohs(listen_port);
+    hello->last_received_seq = decode_u64(payload + 10);
+    return 0;
+}
+
+// Encode discovery announcement
+void encode_announce(const AnnouncePayload* announce, unsigned char* out) {
+    uint16_t listen_port = htons(announce->listen_port);
+    
+    encode_u32(ANNOUNCE_MAGIC, out);
+    out[4] = ANNOUNCE_VERSION;
+    out[5] = announce->flags;
+    memcpy(out + 6, &listen_port, sizeof(listen_port));
+    encode_u64(announce->node_id, out + 8);
+    encode_u32(announce->load, out + 16);
+    encode_u32(announce->capacity, out + 20);
+    encode_u32(announce->interval_ms, out + 24);
+}
+
+// Decode discovery announcement, -1 if it is not one
+int decode_announce(const unsigned char* packet, size_t length, AnnouncePayload* announce) {
+    uint16_t listen_port;
+    
+    // Newer versions may append fields
+    if (length < ANNOUNCE_SIZE || decode_u32(packet) != ANNOUNCE_MAGIC ||
+        packet[4] < ANNOUNCE_VERSION) {
+        return -1;
+    }
+    
+    announce->flags = packet[5];
+    memcpy(&listen_port, packet + 6, sizeof(listen_port));
+    announce->listen_port = ntohs(listen_port);
+    announce->node_id = decode_u64(packet + 8);
+    announce->load = decode_u32(packet + 16);
+    announce->capacity = decode_u32(packet + 20);
+    announce->interval_ms = decode_u32(packet + 24);
+    return announce->listen_port != 0 && announce->node_id != 0 ? 0 : -1;
+}
+
+// Encode publish payload
+int encode_publish(const char* topic, const char* message,
+                   unsigned char* out, size_t out_size) {
+    size_t topic_len = strlen(topic);
+    size_t message_len = strlen(message);
+    
+    if (topic_len == 0 || topic_len > MAX_TOPIC_LENGTH ||
+        1 + topic_len + message_len > out_size) {
+        return -1;
+    }
+    
+    out[0] = (unsigned char)topic_len;
+    memcpy(out + 1, topic, topic_len);
+    memcpy(out + 1 + topic_len, message, message_len);
+    return (int)(1 + topic_len + message_len);
+}
+
+// Decode publish payload into NUL-terminated topic and message
+int decode_publish(const unsigned char* payload, uint32_t length,
+                   char* topic, size_t topic_size,
+                   char* message, size_t message_size) {
+    if (length < 1) {
+        return -1;
+    }
+    
+    size_t topic_len = payload[0];
+    if (topic_len == 0 || topic_len >= topic_size || 1 + topic_len > length) {
+        return -1;
+    }
+    
+    size_t message_len = length - 1 - topic_len;
+    if (message_len >= message_size) {
+        return -1;
+    }
+    
+    memcpy(topic, payload + 1, topic_len);
+    topic[topic_len] = '\0';
+    memcpy(message, payload + 1 + topic_len, message_len);
+    message[message_len] = '\0';
+    return 0;
+}
+
+// Encode room entry payload
+int encode_entry(const EntryKey* key, const char* topic, const char* message,
+                 unsigned char* out, size_t out_size) {
+    if (out_size < ENTRY_KEY_SIZE) {
+        return -1;
+    }
+    
+    int length = encode_publish(topic, message, out + ENTRY_KEY_SIZE,
+                                out_size - ENTRY_KEY_SIZE);
+    if (length < 0) {
+        return -1;
+    }
+    
+    encode_u64(key->clock, out);
+    encode_u64(key->origin, out + 8);
+    return ENTRY_KEY_SIZE + length;
+}
+
+// Decode room entry payload, topic and message NUL-terminated
+int decode_entry(const unsigned char* payload, uint32_t length, EntryKey* key,
+                 char* topic, size_t topic_size,
+                 char* message, size_t message_size) {
+    if (length < ENTRY_KEY_SIZE) {
+        return -1;
+    }
+    
+    key->clock = decode_u64(payload);
+    key->origin = decode_u64(payload + 8);
+    return decode_publish(payload + ENTRY_KEY_SIZE, length - ENTRY_KEY_SIZE,
+                          topic, topic_size, message, message_size);
+}
+
+// Encode one key range
+static void encode_range(const KeyRange* range, unsigned char* out) {
+    encode_u64(range->lo.clock, out);
+    encode_u64(range->lo.origin, out + 8);
+    encode_u64(range->hi.clock, out + 16);
+    encode_u64(range->hi.origin, out + 24);
+    encode_u32(range->count, out + 32);
+    encode_u64(range->fingerprint, out + 36);
+}
+
+// Decode one key range
+static void decode_range(const unsigned char* in, KeyRange* range) {
+    range->lo.clock = decode_u64(in);
+    range->lo.origin = decode_u64(in + 8);
+    range->hi.clock = decode_u64(in + 16);
+    range->hi.origin = decode_u64(in + 24);
+    range->count = decode_u32(in + 32);
+    range->fingerprint = decode_u64(in + 36);
+}
+
+// Encode digest payload
+int encode_digest(const char* topic, const KeyRange* ranges, int count,
+                  unsigned char* out, size_t out_size) {
+    size_t topic_len = strlen(topic);
+    size_t length = 1 + topic_len + (size_t)count * RANGE_SIZE;
+    
+    if (topic_len == 0 || topic_len > MAX_TOPIC_LENGTH || length > out_size) {
+        return -1;
+    }
+    
+    out[0] = (unsigned char)topic_len;
+    memcpy(out + 1, topic, topic_len);
+    for (int i = 0; i < count; i++) {
+        encode_range(&ranges[i], out + 1 + topic_len + (size_t)i * RANGE_SIZE);
+    }
+    return (int)length;
+}
+
+// Decode digest payload, returns number of ranges or -1
+int decode_digest(const unsigned char* payload, uint32_t length,
+                  char* topic, size_t topic_size, KeyRange* ranges, int max) {
+    if (length < 1) {
+        return -1;
+    }
+    
+    size_t topic_len = payload[0];
+    if (topic_len == 0 || topic_len >= topic_size || 1 + topic_len > length ||
+        (length - 1 - topic_len) % RANGE_SIZE != 0) {
+        return -1;
+    }
+    
+    int count = (int)((length - 1 - topic_len) / RANGE_SIZE);
+    if (count > max) {
+        return -1;
+    }
+    
+    memcpy(topic, payload + 1, topic_len);
+    topic[topic_len] = '\0';
+    for (int i = 0; i < count; i++) {
+        decode_range(payload + 1 + topic_len + (size_t)i * RANGE_SIZE, &ranges[i]);
+    }
+    return count;
+}
@@ -0,0 +1,155 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include "common.h"
+#include <stdint.h>
+
+// Frame types
+#define FRAME_MESSAGE     1    // Direct chat message
+#define FRAME_SUBSCRIBE   2    // Peer joined a topic (delta)
+#define FRAME_UNSUBSCRIBE 3    // Peer left a topic (delta)
+#define FRAME_PUBLISH     4    // Message published to a topic
+#define FRAME_HELLO       5    // Handshake: node ID, listen port, last received seq
+#define FRAME_ACK         6    // Cumulative acknowledgement of sequenced frames
+#define FRAME_CLOSE       7    // Orderly close, peer should not reconnect
+#define FRAME_DATA        8    // Bulk stream chunk (stream > 0)
+#define FRAME_CREDIT      9    // Flow control: peer may send more on a stream
+#define FRAME_ENTRY      10    // Room log entry: clock, origin, topic, message
+#define FRAME_DIGEST     11    // Room log summary: topic and key ranges
+#define FRAME_RESET      12    // Receiver refuses a stream, sender drops it
+
+// Frame flags
+#define FRAME_FLAG_FIN 0x01    // DATA: last chunk of the stream
+#define FRAME_FLAG_SYNC 0x02   // ENTRY: resent by anti-entropy, not live
+
+// Frame layout: type(1) flags(1) stream(2) length(4) seq(8), network byte order
+// Sequenced frames (messages, publishes) carry seq > 0, control frames seq 0.
+// Control and chat frames use stream 0; bulk streams are unsequenced.
+#define FRAME_HEADER_SIZE 16
+#define HELLO_PAYLOAD_SIZE 18
+#define ACK_PAYLOAD_SIZE 8
+#define CREDIT_PAYLOAD_SIZE 4
+#define ENTRY_KEY_SIZE 16
+#define RANGE_SIZE 44
+#define STREAM_WINDOW (256 * 1024)  // Credit each stream starts with, in bytes
+#define MAX_FRAME_PAYLOAD (BUFFER_SIZE - FRAME_HEADER_SIZE)   // Default limit
+#define MAX_TOPIC_LENGTH 32
+
+// Discovery announcement, a UDP datagram rather than a frame:
+// magic(4) version(1) flags(1) listen_port(2) node_id(8) load(4)
+// capacity(4) interval(4), network byte order
+#define ANNOUNCE_MAGIC 0x50325044u  // "P2PD"
+#define ANNOUNCE_VERSION 1
+#define ANNOUNCE_SIZE 28
+#define ANNOUNCE_FLAG_QUERY 0x01    // Sender just started, members answer early
+
+// Largest payload write_frame accepts, follows the configured buffer_size
+extern uint32_t frame_payload_limit;
+
+// Frame header
+typedef struct {
+    uint8_t type;
+    uint8_t flags;
+    uint16_t stream;
+    uint32_t length;
+    uint64_t seq;
+} FrameHeader;
+
+// Room log entry identity and total order: clock, then origin node
+typedef struct {
+    uint64_t clock;                 // Hybrid logical clock: ms << 16 | counter
+    uint64_t origin;                // Node ID of the author
+} EntryKey;
+
+// Summary of the entries with lo <= key < hi
+typedef struct {
+    EntryKey lo;
+    EntryKey hi;
+    uint32_t count;
+    uint64_t fingerprint;           // XOR of the entry key hashes
+} KeyRange;
+
+// Handshake payload
+typedef struct {
+    uint64_t node_id;
+    uint16_t listen_port;
+    uint64_t last_received_seq;
+} HelloPayload;
+
+// Discovery announcement
+typedef struct {
+    uint8_t flags;
+    uint64_t node_id;
+    uint16_t listen_port;
+    uint32_t load;                  // Connections in use
+    uint32_t capacity;              // Connection table size
+    uint32_t interval_ms;           // Average time to the sender's next announcement
+} AnnouncePayload;
+
+// Frame output sink: a socket in the node, an in-memory pipe in the simulator
+typedef int (*frame_write_fn)(void* ctx, const void* data, size_t length);
+
+// Incremental frame parser over a receive buffer
+typedef struct {
+    unsigned char* data;
+    size_t capacity;
+    size_t used;
+    size_t start;                   // Next unparsed frame, moved to the front lazily
+} FrameReader;
+
+// Header encoding
+void encode_frame_header(const FrameHeader* header, unsigned char* out);
+void decode_frame_header(const unsigned char* in, FrameHeader* header);
+
+// Frame transmission
+int write_frame(frame_write_fn write, void* ctx, uint8_t type, uint64_t seq,
+                const void* payload, uint32_t length);
+int write_stream_frame(frame_write_fn write, void* ctx, uint8_t type, uint8_t flags,
+                       uint16_t stream, const void* payload, uint32_t length);
+int send_frame(SOCKET sock, uint8_t type, uint64_t seq,
+               const void* payload, uint32_t length);
+
+// Frame parsing
+void frame_reader_init(FrameReader* reader, unsigned char* buffer, size_t capacity);
+int frame_reader_next(FrameReader* reader, FrameHeader* header,
+                      const unsigned char** payload);
+void frame_reader_consume(FrameReader* reader, const FrameHeader* header);
+
+// 64-bit integers in network byte order
+void encode_u64(uint64_t value, unsigned char* out);
+uint64_t decode_u64(const unsigned char* in);
+
+// 32-bit integers in network byte order
+void encode_u32(uint32_t value, unsigned char* out);
+uint32_t decode_u32(const unsigned char* in);
+
+// Handshake payload helpers
+void encode_hello(const HelloPayload* hello, unsigned char* out);
+int decode_hello(const unsigned char* payload, uint32_t length, HelloPayload* hello);
+
+// Discovery announcement helpers
+void encode_announce(const AnnouncePayload* announce, unsigned char* out);
+int decode_announce(const unsigned char* packet, size_t length, AnnouncePayload* announce);
+
+// Publish payload helpers: topic_len(1) topic message
+int encode_publish(const char* topic, const char* message,
+                   unsigned char* out, size_t out_size);
+int decode_publish(const unsigned char* payload, uint32_t length,
+                   char* topic, size_t topic_size,
+                   char* message, size_t message_size);
+
+// Room entry payload: clock(8) origin(8), then a publish payload
+int encode_entry(const EntryKey* key, const char* topic, const char* message,
+                 unsigned char* out, size_t out_size);
+int decode_entry(const unsigned char* payload, uint32_t length, EntryKey* key,
+                 char* topic, size_t topic_size,
+                 char* message, size_t message_size);
+
+// Digest payload: topic_len(1) topic, then ranges of
+// lo(16) hi(16) count(4) fingerprint(8). decode returns the range count.
+int encode_digest(const char* topic, const KeyRange* ranges, int count,
+                  unsigned char* out, size_t out_size);
+int decode_digest(const unsigned char* payload, uint32_t length,
+                  char* topic, size_t topic_size, KeyRange* ranges, int max);
+
+#endif // PROTOCOL_H
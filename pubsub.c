@@ -0,0 +1,228 @@
+#include "pubsub.h"
+#include "topic.h"
+#include "connection.h"
+#include "roomlog.h"
+#include "search.h"
+#include "config.h"
+
+// Next anti-entropy round, driven by the reconnect thread
+static long long next_room_sync = 0;
+
+// Send full set of local subscriptions to a new peer
+void send_subscriptions(int conn_id) {
+    char (*names)[MAX_TOPIC_LENGTH + 1];
+    int count = topic_get_joined(&node_topics, &names);
+    
+    for (int i = 0; i < count; i++) {
+        send_to_connection(conn_id, FRAME_SUBSCRIBE, names[i], strlen(names[i]));
+    }
+    
+    free(names);
+}
+
+// Send subscription delta to all connected peers
+void announce_subscription(uint8_t type, const char* name) {
+    int* conn_ids = malloc(sizeof(int) * connection_capacity);
+    if (conn_ids == NULL) {
+        return;
+    }
+    
+    int count = get_active_connection_ids(conn_ids, connection_capacity);
+    for (int i = 0; i < count; i++) {
+        send_to_connection(conn_ids[i], type, name, strlen(name));
+    }
+    
+    free(conn_ids);
+}
+
+// Send message to all peers subscribed to topic, returns sent + queued count
+int publish_to_topic(const char* name, const char* message) {
+    unsigned char* payload = malloc(frame_payload_limit);
+    int* conn_ids = malloc(sizeof(int) * connection_capacity);
+    if (payload == NULL || conn_ids == NULL) {
+        free(payload);
+        free(conn_ids);
+        return -1;
+    }
+    
+    EntryKey key = room_next_key(&node_rooms, local_node_id);
+    int length = encode_entry(&key, name, message, payload, frame_payload_limit);
+    int delivered = -1;
+    if (length >= 0) {
+        // Our own copy takes part in anti-entropy like any other
+        if (topic_is_joined(&node_topics, name) &&
+            room_insert(&node_rooms, name, &key, message, NULL) > 0) {
+            char source[SEARCH_SOURCE_LENGTH];
+            snprintf(source, sizeof(source), "#%s", name);
+            search_add(&node_index, (long long)(key.clock >> 16), source, message, strlen(message));
+        }
+        
+        int count = topic_get_subscribers(&node_topics, name, conn_ids, connection_capacity);
+        delivered = 0;
+        
+        for (int i = 0; i < count; i++) {
+            if (queue_to_connection(conn_ids[i], FRAME_ENTRY, payload, length) >= 0) {
+                delivered++;
+            }
+        }
+    }
+    
+    free(payload);
+    free(conn_ids);
+    return delivered;
+}
+
+// Frame sink of this node's room sync
+static int send_sync_frame(void* ctx, int conn_id, uint8_t type, uint8_t flags,
+                           const void* payload, uint32_t length) {
+    (void)ctx;
+    return send_control(conn_id, type, flags, 0, payload, length);
+}
+
+// Rooms of this node, synced over its connections
+static RoomSync node_sync = { &node_topics, &node_rooms, send_sync_frame, NULL };
+
+// Send ranges of a room to a peer
+static void send_digest(const RoomSync* sync, int conn_id, const char* name,
+                        const KeyRange* ranges, int count) {
+    unsigned char payload[1 + MAX_TOPIC_LENGTH + ROOM_SYNC_FANOUT * RANGE_SIZE];
+    
+    int length = encode_digest(name, ranges, count, payload, sizeof(payload));
+    if (length >= 0) {
+        sync->send(sync->ctx, conn_id, FRAME_DIGEST, 0, payload, (uint32_t)length);
+    }
+}
+
+// Send our entries of a range the peer is missing something in
+static void send_entries(const RoomSync* sync, int conn_id, const char* name,
+                         const KeyRange* range) {
+    RoomEntry* entries;
+    int count = room_copy(sync->rooms, name, range, &entries);
+    if (count <= 0) {
+        return;
+    }
+    
+    unsigned char* payload = malloc(frame_payload_limit);
+    for (int i = 0; payload != NULL && i < count; i++) {
+        int length = encode_entry(&entries[i].key, name, entries[i].message,
+                                  payload, frame_payload_limit);
+        if (length >= 0) {
+            sync->send(sync->ctx, conn_id, FRAME_ENTRY, FRAME_FLAG_SYNC,
+                       payload, (uint32_t)length);
+        }
+    }
+    
+    free(payload);
+    room_free_copies(entries, count);
+}
+
+// Open a round with one peer: our whole room as a single range
+void room_sync_open(const RoomSync* sync, int conn_id, const char* name) {
+    KeyRange range;
+    room_full_range(sync->rooms, name, &range);
+    send_digest(sync, conn_id, name, &range, 1);
+}
+
+// Log an entry of a joined room, returns 1 if it was new
+int room_sync_entry(const RoomSync* sync, const unsigned char* payload, uint32_t length,
+                    EntryKey* key, char* topic, size_t topic_size,
+                    char* message, size_t message_size, int* late) {
+    if (decode_entry(payload, length, key, topic, topic_size, message, message_size) < 0 ||
+        !topic_is_joined(sync->topics, topic)) {
+        return 0;
+    }
+    return room_insert(sync->rooms, topic, key, message, late) > 0;
+}
+
+// Answer a peer's ranges. Matching ranges end the exchange; where the peer
+// has nothing we send ours; small ranges are settled by sending our entries
+// and our summary back; larger ones are split so only differing parts
+// travel further. Traffic grows with the difference, not the log.
+void room_sync_digest(const RoomSync* sync, int conn_id,
+                      const unsigned char* payload, uint32_t length) {
+    char name[MAX_TOPIC_LENGTH + 1];
+    KeyRange ranges[ROOM_DIGEST_RANGES];
+    
+    int count = decode_digest(payload, length, name, sizeof(name), ranges, ROOM_DIGEST_RANGES);
+    if (count < 0 || !topic_is_joined(sync->topics, name)) {
+        return;
+    }
+    
+    for (int i = 0; i < count; i++) {
+        KeyRange local = ranges[i];
+        int clamped = room_clamp(sync->rooms, name, &local);
+        if (clamped < 0) {
+            continue;
+        }
+        room_summarize(sync->rooms, name, &local);
+        
+        // We keep less history: compare again over what we have
+        if (clamped > 0) {
+            send_digest(sync, conn_id, name, &local, 1);
+            continue;
+        }
+        
+        if (local.count == ranges[i].count && local.fingerprint == ranges[i].fingerprint) {
+            continue;
+        }
+        
+        if (ranges[i].count == 0) {
+            send_entries(sync, conn_id, name, &local);
+        } else if (local.count <= ROOM_SYNC_LEAF) {
+            send_entries(sync, conn_id, name, &local);
+            send_digest(sync, conn_id, name, &local, 1);
+        } else {
+            KeyRange parts[ROOM_SYNC_FANOUT];
+            int parts_count = room_split(sync->rooms, name, &local, parts, ROOM_SYNC_FANOUT);
+            send_digest(sync, conn_id, name, parts, parts_count);
+        }
+    }
+}
+
+// Open a round with one peer
+void sync_room_with(int conn_id, const char* name) {
+    room_sync_open(&node_sync, conn_id, name);
+}
+
+// Open a round with every subscriber of a room
+void sync_room(const char* name) {
+    int* conn_ids = malloc(sizeof(int) * connection_capacity);
+    if (conn_ids == NULL) {
+        return;
+    }
+    
+    int count = topic_get_subscribers(&node_topics, name, conn_ids, connection_capacity);
+    for (int i = 0; i < count; i++) {
+        sync_room_with(conn_ids[i], name);
+    }
+    
+    free(conn_ids);
+}
+
+// Periodic round over all joined rooms
+void sync_rooms(long long now_ms) {
+    if (node_config.room_sync == 0 || now_ms < next_room_sync) {
+        return;
+    }
+    next_room_sync = now_ms + node_config.room_sync;
+    
+    char (*names)[MAX_TOPIC_LENGTH + 1];
+    int count = topic_get_joined(&node_topics, &names);
+    for (int i = 0; i < count; i++) {
+        sync_room(names[i]);
+    }
+    free(names);
+}
+
+// Answer a peer's ranges for this node
+void handle_digest(int conn_id, const unsigned char* payload, uint32_t length) {
+    room_sync_digest(&node_sync, conn_id, payload, length);
+}
+
+// Log an entry a peer sent this node, returns 1 if it was new
+int handle_entry(const unsigned char* payload, uint32_t length, EntryKey* key,
+                 char* topic, size_t topic_size, char* message, size_t message_size,
+                 int* late) {
+    return room_sync_entry(&node_sync, payload, length, key, topic, topic_size,
+                           message, message_size, late);
+}
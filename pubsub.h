@@ -0,0 +1,49 @@
+#ifndef PUBSUB_H
+#define PUBSUB_H
+
+#include "common.h"
+#include "topic.h"
+#include "roomlog.h"
+#include <stdint.h>
+
+// Sends one frame of a room sync to a connection, negative on failure
+typedef int (*room_send_fn)(void* ctx, int conn_id, uint8_t type, uint8_t flags,
+                            const void* payload, uint32_t length);
+
+// Topics and room logs a sync works on, and where its frames go: this node
+// and send_control, or a simulated node and its in-memory pipes
+typedef struct {
+    TopicIndex* topics;
+    RoomLog* rooms;
+    room_send_fn send;
+    void* ctx;
+} RoomSync;
+
+// Subscription exchange with peers
+void send_subscriptions(int conn_id);
+void announce_subscription(uint8_t type, const char* name);
+
+// Topic fan-out: logs the message in the room, then sends it to subscribers
+int publish_to_topic(const char* name, const char* message);
+
+// Room anti-entropy: one peer or every subscriber of a joined room now, or
+// all joined rooms when room_sync has passed since the last round
+void sync_room_with(int conn_id, const char* name);
+void sync_room(const char* name);
+void sync_rooms(long long now_ms);
+void handle_digest(int conn_id, const unsigned char* payload, uint32_t length);
+
+// ENTRY from a peer: decoded and logged if its room is joined, returns 1 if new
+int handle_entry(const unsigned char* payload, uint32_t length, EntryKey* key,
+                 char* topic, size_t topic_size, char* message, size_t message_size,
+                 int* late);
+
+// The same for any RoomSync
+void room_sync_open(const RoomSync* sync, int conn_id, const char* name);
+void room_sync_digest(const RoomSync* sync, int conn_id,
+                      const unsigned char* payload, uint32_t length);
+int room_sync_entry(const RoomSync* sync, const unsigned char* payload, uint32_t length,
+                    EntryKey* key, char* topic, size_t topic_size,
+                    char* message, size_t message_size, int* late);
+
+#endif // PUBSUB_H
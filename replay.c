@@ -0,0 +1,651 @@
+#include "common.h"
+#include "protocol.h"
+#include "socket.h"
+#include "capture.h"
+#include "timeutil.h"
+#include <stdint.h>
+#include <getopt.h>
+#include <time.h>
+#include <pthread.h>
+#include <poll.h>
+#include <netinet/tcp.h>
+
+// Replay of a wire capture (config capture, or capture start in the CLI):
+// every connection of the capture becomes one connection to the target
+// node, and the frames its peer sent are sent again at their original
+// times, scaled by --speed, or back to back with --max. HELLO, ACK and
+// CLOSE are generated live, sequenced frames are renumbered for the new
+// connection. Reports throughput, how closely sends kept to the schedule
+// and the time until the node acknowledged each sequenced frame.
+
+// Defaults
+#define REPLAY_DEFAULT_IP "127.0.0.1"
+#define REPLAY_RECV_BUFFER 65536
+#define REPLAY_POLL_MS 50
+#define REPLAY_DRAIN_MS 5000         // Longest wait for the last acknowledgements
+#define REPLAY_SPIN_NS 200000        // Busy-wait the last part of a gap, sleep the rest
+
+// Replay parameters
+typedef struct {
+    const char* path;
+    const char* ip;
+    int port;
+    double speed;                    // Time scale, 2 = twice as fast
+    int max_speed;                   // Ignore capture times
+    int info;                        // Describe the capture, replay nothing
+} ReplayConfig;
+
+// One captured connection, replayed over its own socket
+typedef struct {
+    int capture_id;                  // conn_id in the capture
+    SOCKET sock;
+    pthread_mutex_t send_mutex;      // Frames from the sender, ACKs from the reader
+    uint64_t tx_seq;                 // Sequenced frames sent, renumbered from 1
+    long long* sent_ns;              // Send time per sequence number
+    size_t sent_capacity;
+    uint64_t acked;                  // Highest sequence number the node acknowledged
+    FrameReader reader;
+    unsigned char* buffer;
+    int closed;                      // The node closed it or a send failed
+} ReplayConn;
+
+// Shared state of a replay
+typedef struct {
+    ReplayConn* conns;               // Sorted by capture_id
+    int count;
+    volatile int done;               // Stops the reader thread
+    long long* latencies;            // Send to acknowledgement, ns
+    long long latency_count;
+    long long latency_capacity;
+    long long received;              // Frames the node sent back
+} Replay;
+
+// Frame type names for --info
+static const char* frame_names[] = {
+    "?", "MESSAGE", "SUBSCRIBE", "UNSUBSCRIBE", "PUBLISH", "HELLO", "ACK", "CLOSE",
+    "DATA", "CREDIT", "ENTRY", "DIGEST", "RESET"
+};
+#define FRAME_NAME_COUNT ((int)(sizeof(frame_names) / sizeof(frame_names[0])))
+
+// Frames the node generates itself rather than replays
+static int is_live_frame(uint8_t type) {
+    return type == FRAME_HELLO || type == FRAME_ACK || type == FRAME_CLOSE;
+}
+
+// Node ID of replayed connection index: a new peer on every run, so
+// concurrent or repeated replays do not resume each other's sessions
+static uint64_t replay_node_id(uint64_t run, int index) {
+    uint64_t x = run + (uint64_t)(index + 1) * 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x != 0 ? x : 1;
+}
+
+// Order nanosecond times for qsort
+static int compare_ns(const void* a, const void* b) {
+    long long x = *(const long long*)a;
+    long long y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+// Order connections by capture ID for bsearch
+static int compare_conns(const void* a, const void* b) {
+    int x = ((const ReplayConn*)a)->capture_id;
+    int y = ((const ReplayConn*)b)->capture_id;
+    return (x > y) - (x < y);
+}
+
+// Connection replaying capture_id, NULL if it has no inbound frames
+static ReplayConn* find_conn(Replay* replay, int capture_id) {
+    ReplayConn key;
+    if (replay->count == 0) {
+        return NULL;
+    }
+    key.capture_id = capture_id;
+    return bsearch(&key, replay->conns, replay->count, sizeof(ReplayConn), compare_conns);
+}
+
+// Print median, p99 and largest of sorted ns times
+static void print_percentiles(const char* name, const long long* times, long long count) {
+    if (count == 0) {
+        printf("%-22s none\n", name);
+        return;
+    }
+    printf("%-22s p50 %9.1f us | p99 %9.1f us | max %9.1f us\n", name,
+           times[count / 2] / 1000.0, times[count * 99 / 100] / 1000.0,
+           times[count - 1] / 1000.0);
+}
+
+// Describe the capture: connections, duration, frames by type and direction
+static int replay_info(const ReplayConfig* config) {
+    CaptureReader reader;
+    CaptureRecord record;
+    long long frames[2][FRAME_NAME_COUNT];
+    long long bytes[2][FRAME_NAME_COUNT];
+    long long wire = 0;
+    long long last = 0;
+    int highest_id = 0;
+    int status;
+    
+    if (capture_open(&reader, config->path) < 0) {
+        printf("Error: %s is not a readable capture\n", config->path);
+        return -1;
+    }
+    memset(frames, 0, sizeof(frames));
+    memset(bytes, 0, sizeof(bytes));
+    
+    while ((status = capture_next(&reader, &record)) > 0) {
+        int type = record.header.type < FRAME_NAME_COUNT ? record.header.type : 0;
+        frames[record.direction][type]++;
+        bytes[record.direction][type] += record.header.length;
+        wire += FRAME_HEADER_SIZE + record.header.length;
+        last = record.time_ns;
+        highest_id = record.conn_id > highest_id ? record.conn_id : highest_id;
+    }
+    long file_size = ftell(reader.file);
+    capture_close(&reader);
+    
+    printf("Duration: %.3f s | Highest connection ID: %d | File: %ld bytes for %lld "
+           "bytes of frames%s\n\n", last / 1e9, highest_id, file_size, wire,
+           status < 0 ? " (cut short)" : "");
+    printf("%-12s %12s %14s %12s %14s\n", "Frame", "In", "In bytes", "Out", "Out bytes");
+    for (int type = 0; type < FRAME_NAME_COUNT; type++) {
+        if (frames[CAPTURE_IN][type] + frames[CAPTURE_OUT][type] > 0) {
+            printf("%-12s %12lld %14lld %12lld %14lld\n", frame_names[type],
+                   frames[CAPTURE_IN][type], bytes[CAPTURE_IN][type],
+                   frames[CAPTURE_OUT][type], bytes[CAPTURE_OUT][type]);
+        }
+    }
+    return 0;
+}
+
+// First pass: one ReplayConn per connection with inbound frames, and the
+// number of sequenced frames to replay
+static int scan_capture(const ReplayConfig* config, Replay* replay, long long* sequenced) {
+    CaptureReader reader;
+    CaptureRecord record;
+    int capacity = 0;
+    int status;
+    
+    *sequenced = 0;
+    if (capture_open(&reader, config->path) < 0) {
+        printf("Error: %s is not a readable capture\n", config->path);
+        return -1;
+    }
+    
+    while ((status = capture_next(&reader, &record)) > 0) {
+        if (record.direction != CAPTURE_IN || is_live_frame(record.header.type)) {
+            continue;
+        }
+        if (record.header.seq != 0) {
+            (*sequenced)++;
+        }
+        
+        if (find_conn(replay, record.conn_id) != NULL) {
+            continue;
+        }
+        if (replay->count == capacity) {
+            capacity = capacity > 0 ? capacity * 2 : 16;
+            ReplayConn* conns = realloc(replay->conns, capacity * sizeof(ReplayConn));
+            if (conns == NULL) {
+                capture_close(&reader);
+                return -1;
+            }
+            replay->conns = conns;
+        }
+        
+        // Kept sorted for find_conn
+        int at = replay->count;
+        while (at > 0 && replay->conns[at - 1].capture_id > record.conn_id) {
+            at--;
+        }
+        memmove(&replay->conns[at + 1], &replay->conns[at],
+                (replay->count - at) * sizeof(ReplayConn));
+        replay->count++;
+        
+        ReplayConn* conn = &replay->conns[at];
+        memset(conn, 0, sizeof(*conn));
+        conn->capture_id = record.conn_id;
+        conn->sock = INVALID_SOCKET;
+    }
+    capture_close(&reader);
+    
+    if (status < 0) {
+        printf("Warning: capture is cut short, replaying what was read\n");
+    }
+    return 0;
+}
+
+// Dial the node once per connection and say hello as a new peer;
+// returns how many connected
+static int open_conns(const ReplayConfig* config, Replay* replay) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)config->port);
+    if (inet_pton(AF_INET, config->ip, &addr.sin_addr) != 1) {
+        printf("Error: Invalid address %s\n", config->ip);
+        return 0;
+    }
+    
+    int opened = 0;
+    int nodelay = 1;
+    uint64_t run = (uint64_t)get_monotonic_ns() ^ (uint64_t)getpid() << 32;
+    for (int i = 0; i < replay->count; i++) {
+        ReplayConn* conn = &replay->conns[i];
+        pthread_mutex_init(&conn->send_mutex, NULL);
+        conn->closed = 1;
+        conn->buffer = malloc(REPLAY_RECV_BUFFER);
+        if (conn->buffer == NULL) {
+            continue;
+        }
+        frame_reader_init(&conn->reader, conn->buffer, REPLAY_RECV_BUFFER);
+        
+        HelloPayload hello = { replay_node_id(run, i), 0, 0 };
+        unsigned char payload[HELLO_PAYLOAD_SIZE];
+        encode_hello(&hello, payload);
+        
+        conn->sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (conn->sock == INVALID_SOCKET) {
+            continue;
+        }
+        setsockopt(conn->sock, IPPROTO_TCP, TCP_NODELAY, (char*)&nodelay, sizeof(nodelay));
+        if (connect(conn->sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+            send_frame(conn->sock, FRAME_HELLO, 0, payload, HELLO_PAYLOAD_SIZE) < 0) {
+            close(conn->sock);
+            conn->sock = INVALID_SOCKET;
+            continue;
+        }
+        conn->closed = 0;
+        opened++;
+    }
+    return opened;
+}
+
+// Take what the node sent on conn: time acknowledged frames and
+// acknowledge the node's own sequenced frames; -1 once it is closed
+static int read_conn(Replay* replay, ReplayConn* conn) {
+    FrameReader* reader = &conn->reader;
+    FrameHeader header;
+    const unsigned char* payload;
+    
+    int received = recv(conn->sock, (char*)reader->data + reader->used,
+                        reader->capacity - reader->used, 0);
+    if (received <= 0) {
+        return -1;
+    }
+    reader->used += received;
+    
+    long long now = get_monotonic_ns();
+    int status;
+    while ((status = frame_reader_next(reader, &header, &payload)) > 0) {
+        replay->received++;
+        if (header.type == FRAME_ACK && header.length >= ACK_PAYLOAD_SIZE) {
+            uint64_t ack = decode_u64(payload);
+            pthread_mutex_lock(&conn->send_mutex);
+            for (uint64_t seq = conn->acked + 1; seq <= ack && seq <= conn->tx_seq; seq++) {
+                if (replay->latency_count < replay->latency_capacity) {
+                    replay->latencies[replay->latency_count++] = now - conn->sent_ns[seq - 1];
+                }
+            }
+            if (ack > conn->acked) {
+                conn->acked = ack < conn->tx_seq ? ack : conn->tx_seq;
+            }
+            pthread_mutex_unlock(&conn->send_mutex);
+        } else if (header.type == FRAME_CLOSE) {
+            status = -1;
+            break;
+        } else if (header.seq != 0) {
+            unsigned char ack[ACK_PAYLOAD_SIZE];
+            encode_u64(header.seq, ack);
+            pthread_mutex_lock(&conn->send_mutex);
+            send_frame(conn->sock, FRAME_ACK, 0, ack, sizeof(ack));
+            pthread_mutex_unlock(&conn->send_mutex);
+        }
+        frame_reader_consume(reader, &header);
+    }
+    return status < 0 ? -1 : 0;
+}
+
+// Reader thread: poll every connection until the replay is done
+static void* replay_reader_thread(void* arg) {
+    Replay* replay = arg;
+    struct pollfd* fds = calloc(replay->count, sizeof(struct pollfd));
+    if (fds == NULL) {
+        return NULL;
+    }
+    
+    for (int i = 0; i < replay->count; i++) {
+        fds[i].fd = replay->conns[i].closed ? -1 : (int)replay->conns[i].sock;
+        fds[i].events = POLLIN;
+    }
+    
+    while (!replay->done) {
+        if (poll(fds, replay->count, REPLAY_POLL_MS) <= 0) {
+            continue;
+        }
+        for (int i = 0; i < replay->count; i++) {
+            if (fds[i].fd >= 0 && (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) &&
+                read_conn(replay, &replay->conns[i]) < 0) {
+                fds[i].fd = -1;
+                replay->conns[i].closed = 1;
+            }
+        }
+    }
+    
+    free(fds);
+    return NULL;
+}
+
+// Send one captured frame on conn, renumbering sequenced frames; -1 if
+// the connection is gone
+static int send_record(ReplayConn* conn, const CaptureRecord* record) {
+    const FrameHeader* captured = &record->header;
+    FrameHeader header = *captured;
+    unsigned char stack_frame[BUFFER_SIZE];
+    unsigned char* frame = stack_frame;
+    size_t size = FRAME_HEADER_SIZE + captured->length;
+    
+    if (size > sizeof(stack_frame)) {
+        frame = malloc(size);
+        if (frame == NULL) {
+            return -1;
+        }
+    }
+    
+    pthread_mutex_lock(&conn->send_mutex);
+    int result = 0;
+    if (captured->seq != 0) {
+        if (conn->tx_seq == conn->sent_capacity) {
+            size_t capacity = conn->sent_capacity > 0 ? conn->sent_capacity * 2 : 256;
+            long long* sent = realloc(conn->sent_ns, capacity * sizeof(long long));
+            if (sent == NULL) {
+                result = -1;
+            } else {
+                conn->sent_ns = sent;
+                conn->sent_capacity = capacity;
+            }
+        }
+        header.seq = conn->tx_seq + 1;
+    }
+    if (result == 0) {
+        encode_frame_header(&header, frame);
+        if (captured->length > 0) {
+            memcpy(frame + FRAME_HEADER_SIZE, record->payload, captured->length);
+        }
+        if (captured->seq != 0) {
+            conn->sent_ns[conn->tx_seq++] = get_monotonic_ns();
+        }
+        result = send_all(conn->sock, frame, size) < 0 ? -1 : 0;
+    }
+    pthread_mutex_unlock(&conn->send_mutex);
+    
+    if (frame != stack_frame) {
+        free(frame);
+    }
+    return result;
+}
+
+// Wait until due (monotonic ns): sleep most of the gap, spin the rest
+static void wait_until(long long due) {
+    long long now = get_monotonic_ns();
+    if (due - now > REPLAY_SPIN_NS) {
+        long long sleep_ns = due - now - REPLAY_SPIN_NS;
+        struct timespec pause = { (time_t)(sleep_ns / 1000000000), (long)(sleep_ns % 1000000000) };
+        nanosleep(&pause, NULL);
+    }
+    while (get_monotonic_ns() < due) {
+    }
+}
+
+// Second pass: send every inbound frame on its connection at its time;
+// fills lags (ns behind schedule per frame) and returns frames sent
+static long long send_capture(const ReplayConfig* config, Replay* replay, long long* lags,
+                              long long lag_capacity, long long* lag_count,
+                              long long* bytes, long long* skipped) {
+    CaptureReader reader;
+    CaptureRecord record;
+    long long sent = 0;
+    long long first_ns = -1;
+    long long start = 0;
+    
+    *lag_count = 0;
+    *bytes = 0;
+    *skipped = 0;
+    if (capture_open(&reader, config->path) < 0) {
+        return 0;
+    }
+    
+    while (capture_next(&reader, &record) > 0) {
+        if (record.direction != CAPTURE_IN || is_live_frame(record.header.type)) {
+            continue;
+        }
+        ReplayConn* conn = find_conn(replay, record.conn_id);
+        if (conn == NULL || conn->closed) {
+            (*skipped)++;
+            continue;
+        }
+        
+        // The schedule starts with the first replayed frame
+        if (first_ns < 0) {
+            first_ns = record.time_ns;
+            start = get_monotonic_ns();
+        }
+        long long due = start + (long long)((record.time_ns - first_ns) / config->speed);
+        if (!config->max_speed) {
+            wait_until(due);
+            if (*lag_count < lag_capacity) {
+                lags[(*lag_count)++] = get_monotonic_ns() - due;
+            }
+        }
+        
+        if (send_record(conn, &record) < 0) {
+            conn->closed = 1;
+            (*skipped)++;
+            continue;
+        }
+        sent++;
+        *bytes += FRAME_HEADER_SIZE + record.header.length;
+    }
+    
+    capture_close(&reader);
+    return sent;
+}
+
+// Sequenced frames sent and not yet acknowledged
+static long long unacked_frames(Replay* replay) {
+    long long unacked = 0;
+    for (int i = 0; i < replay->count; i++) {
+        ReplayConn* conn = &replay->conns[i];
+        pthread_mutex_lock(&conn->send_mutex);
+        if (!conn->closed) {
+            unacked += (long long)(conn->tx_seq - conn->acked);
+        }
+        pthread_mutex_unlock(&conn->send_mutex);
+    }
+    return unacked;
+}
+
+// Close orderly and free every connection
+static void close_conns(Replay* replay) {
+    for (int i = 0; i < replay->count; i++) {
+        ReplayConn* conn = &replay->conns[i];
+        if (conn->sock != INVALID_SOCKET) {
+            send_frame(conn->sock, FRAME_CLOSE, 0, NULL, 0);
+            close(conn->sock);
+        }
+        pthread_mutex_destroy(&conn->send_mutex);
+        free(conn->sent_ns);
+        free(conn->buffer);
+    }
+    free(replay->conns);
+}
+
+// Replay the capture against the node, returns 0 if every frame was sent
+static int replay_run(const ReplayConfig* config) {
+    Replay replay;
+    long long sequenced;
+    memset(&replay, 0, sizeof(replay));
+    
+    if (scan_capture(config, &replay, &sequenced) < 0) {
+        free(replay.conns);
+        return -1;
+    }
+    if (replay.count == 0) {
+        printf("Nothing to replay: the capture has no frames from peers\n");
+        free(replay.conns);
+        return -1;
+    }
+    
+    replay.latency_capacity = sequenced;
+    replay.latencies = malloc((sequenced > 0 ? sequenced : 1) * sizeof(long long));
+    long long lag_capacity = 1 << 20;
+    long long* lags = config->max_speed ? NULL : malloc(lag_capacity * sizeof(long long));
+    if (replay.latencies == NULL || (!config->max_speed && lags == NULL)) {
+        free(replay.latencies);
+        free(lags);
+        free(replay.conns);
+        return -1;
+    }
+    
+    int opened = open_conns(config, &replay);
+    printf("Connections: %d of %d opened to %s:%d\n", opened, replay.count, config->ip,
+           config->port);
+    
+    pthread_t reader;
+    int failed = opened == replay.count ? 0 : -1;
+    int reading = opened > 0 && pthread_create(&reader, NULL, replay_reader_thread, &replay) == 0;
+    if (reading) {
+        long long lag_count, bytes, skipped;
+        long long start = get_monotonic_ns();
+        long long sent = send_capture(config, &replay, lags, lag_capacity, &lag_count,
+                                      &bytes, &skipped);
+        double elapsed = (get_monotonic_ns() - start) / 1e9;
+        
+        // Sequenced frames count as delivered once the node acknowledges them
+        long long drain_end = get_monotonic_ns() + REPLAY_DRAIN_MS * 1000000LL;
+        while (unacked_frames(&replay) > 0 && get_monotonic_ns() < drain_end) {
+            sleep_ms(1);
+        }
+        long long unacked = unacked_frames(&replay);
+        replay.done = 1;
+        pthread_join(reader, NULL);
+        
+        printf("Sent: %lld frames, %lld bytes in %.3f s | %.0f frames/s | %.2f MB/s\n",
+               sent, bytes, elapsed, elapsed > 0 ? sent / elapsed : 0.0,
+               elapsed > 0 ? bytes / elapsed / 1e6 : 0.0);
+        printf("Received: %lld frames from the node\n", replay.received);
+        if (skipped > 0) {
+            printf("Skipped: %lld frames on connections the node closed\n", skipped);
+            failed = -1;
+        }
+        printf("\n");
+        
+        if (!config->max_speed) {
+            qsort(lags, lag_count, sizeof(long long), compare_ns);
+            print_percentiles("behind schedule", lags, lag_count);
+        }
+        qsort(replay.latencies, replay.latency_count, sizeof(long long), compare_ns);
+        print_percentiles("acknowledged after", replay.latencies, replay.latency_count);
+        if (unacked > 0) {
+            printf("%-22s %lld frames never acknowledged\n", "", unacked);
+            failed = -1;
+        }
+    } else {
+        printf("Error: Could not reach the node\n");
+        failed = -1;
+    }
+    
+    close_conns(&replay);
+    free(replay.latencies);
+    free(lags);
+    return failed;
+}
+
+// Print usage
+static void print_usage(const char* program) {
+    printf("Usage: %s [options] <capture> <port>\n", program);
+    printf("  --ip IP            Address of the node (default %s)\n", REPLAY_DEFAULT_IP);
+    printf("  --speed X          Replay X times as fast as captured (default 1)\n");
+    printf("  --max              Send every frame as fast as possible\n");
+    printf("  --info             Describe the capture instead of replaying it\n");
+}
+
+// Parse command line into config, returns 0 on success
+static int parse_options(int argc, char* argv[], ReplayConfig* config) {
+    static struct option options[] = {
+        { "ip", required_argument, NULL, 'i' },
+        { "speed", required_argument, NULL, 's' },
+        { "max", no_argument, NULL, 'm' },
+        { "info", no_argument, NULL, 'I' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    
+    config->ip = REPLAY_DEFAULT_IP;
+    config->port = 0;
+    config->speed = 1.0;
+    config->max_speed = 0;
+    config->info = 0;
+    
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", options, NULL)) != -1) {
+        switch (opt) {
+            case 'i': config->ip = optarg; break;
+            case 's': config->speed = atof(optarg); break;
+            case 'm': config->max_speed = 1; break;
+            case 'I': config->info = 1; break;
+            default: return -1;
+        }
+    }
+    
+    if (optind >= argc) {
+        return -1;
+    }
+    config->path = argv[optind];
+    if (!config->info) {
+        if (optind + 1 >= argc) {
+            return -1;
+        }
+        config->port = atoi(argv[optind + 1]);
+    }
+    
+    if (config->speed <= 0 || (!config->info && !is_valid_port(config->port))) {
+        printf("Error: Invalid replay parameters\n");
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    ReplayConfig config;
+    
+    if (parse_options(argc, argv, &config) < 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    if (config.info) {
+        printf("=== P2P Capture %s ===\n", config.path);
+        return replay_info(&config) < 0 ? 1 : 0;
+    }
+    
+    if (initialize_sockets() < 0) {
+        printf("Error: Socket initialization failed\n");
+        return 1;
+    }
+    
+    printf("=== P2P Replay ===\n");
+    if (config.max_speed) {
+        printf("Capture: %s | Target: %s:%d | Speed: max\n\n", config.path, config.ip,
+               config.port);
+    } else {
+        printf("Capture: %s | Target: %s:%d | Speed: %gx\n\n", config.path, config.ip,
+               config.port, config.speed);
+    }
+    
+    int failed = replay_run(&config);
+    cleanup_sockets();
+    return failed ? 1 : 0;
+}
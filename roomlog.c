@@ -0,0 +1,383 @@
+#include "roomlog.h"
+#include "timeutil.h"
+
+// Logs of this node
+RoomLog node_rooms;
+
+// FNV-1a hash of room name
+static unsigned int hash_room(const char* name) {
+    unsigned int hash = 2166136261u;
+    while (*name) {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+    return hash % ROOM_BUCKETS;
+}
+
+// Mix 64 bits (splitmix64 finalizer)
+static uint64_t mix64(uint64_t value) {
+    value ^= value >> 30;
+    value *= 0xbf58476d1ce4e5b9ULL;
+    value ^= value >> 27;
+    value *= 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
+
+// Fingerprint contribution of an entry key
+static uint64_t hash_key(const EntryKey* key) {
+    return mix64(key->clock ^ mix64(key->origin));
+}
+
+// Order keys by clock, then origin
+static int compare_keys(const EntryKey* a, const EntryKey* b) {
+    if (a->clock != b->clock) {
+        return a->clock < b->clock ? -1 : 1;
+    }
+    if (a->origin != b->origin) {
+        return a->origin < b->origin ? -1 : 1;
+    }
+    return 0;
+}
+
+// Find room (caller holds log mutex)
+static Room* find_room(RoomLog* log, const char* name) {
+    Room* room = log->table[hash_room(name)];
+    while (room != NULL && strcmp(room->name, name) != 0) {
+        room = room->next;
+    }
+    return room;
+}
+
+// Find or create room (caller holds log mutex)
+static Room* get_or_create_room(RoomLog* log, const char* name) {
+    Room* room = find_room(log, name);
+    if (room != NULL) {
+        return room;
+    }
+    
+    room = calloc(1, sizeof(Room));
+    if (room == NULL) {
+        return NULL;
+    }
+    
+    strcpy(room->name, name);
+    unsigned int bucket = hash_room(name);
+    room->next = log->table[bucket];
+    log->table[bucket] = room;
+    return room;
+}
+
+// Free room and its entries
+static void free_room(Room* room) {
+    for (int i = 0; i < room->count; i++) {
+        free(room->entries[i].message);
+    }
+    free(room->entries);
+    free(room);
+}
+
+// First entry not below key (caller holds log mutex)
+static int lower_bound(const Room* room, const EntryKey* key) {
+    int low = 0;
+    int high = room->count;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (compare_keys(&room->entries[middle].key, key) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Positions [first, last) of range in room (caller holds log mutex)
+static void find_span(const Room* room, const KeyRange* range, int* first, int* last) {
+    *first = lower_bound(room, &range->lo);
+    *last = lower_bound(room, &range->hi);
+    if (*last < *first) {
+        *last = *first;
+    }
+}
+
+// Count and fingerprint of entries [first, last) (caller holds log mutex)
+static void summarize_span(const Room* room, int first, int last, KeyRange* range) {
+    uint64_t fingerprint = 0;
+    for (int i = first; i < last; i++) {
+        fingerprint ^= room->entries[i].hash;
+    }
+    range->count = (uint32_t)(last - first);
+    range->fingerprint = fingerprint;
+}
+
+// Initialize empty logs
+void init_rooms(RoomLog* log, int limit) {
+    memset(log->table, 0, sizeof(log->table));
+    pthread_mutex_init(&log->mutex, NULL);
+    log->clock = 0;
+    log->limit = limit > 0 ? limit : 1;
+}
+
+// Free all rooms
+void free_rooms(RoomLog* log) {
+    pthread_mutex_lock(&log->mutex);
+    
+    for (int i = 0; i < ROOM_BUCKETS; i++) {
+        Room* room = log->table[i];
+        while (room != NULL) {
+            Room* next = room->next;
+            free_room(room);
+            room = next;
+        }
+        log->table[i] = NULL;
+    }
+    
+    pthread_mutex_unlock(&log->mutex);
+}
+
+// Forget a room (topic left)
+void room_drop(RoomLog* log, const char* name) {
+    pthread_mutex_lock(&log->mutex);
+    
+    Room** link = &log->table[hash_room(name)];
+    while (*link != NULL && strcmp((*link)->name, name) != 0) {
+        link = &(*link)->next;
+    }
+    if (*link != NULL) {
+        Room* room = *link;
+        *link = room->next;
+        free_room(room);
+    }
+    
+    pthread_mutex_unlock(&log->mutex);
+}
+
+// Key for an entry written now by origin
+EntryKey room_next_key(RoomLog* log, uint64_t origin) {
+    return room_next_key_at(log, origin, get_wall_ms());
+}
+
+// Hybrid logical clock: wall time when it is ahead, else one past the
+// latest clock issued or seen, so causally later entries always sort later
+EntryKey room_next_key_at(RoomLog* log, uint64_t origin, long long wall_ms) {
+    EntryKey key;
+    uint64_t wall = (uint64_t)wall_ms << 16;
+    
+    pthread_mutex_lock(&log->mutex);
+    log->clock = wall > log->clock ? wall : log->clock + 1;
+    key.clock = log->clock;
+    pthread_mutex_unlock(&log->mutex);
+    
+    key.origin = origin;
+    return key;
+}
+
+// Add entry in key order
+int room_insert(RoomLog* log, const char* name, const EntryKey* key,
+                const char* message, int* late) {
+    pthread_mutex_lock(&log->mutex);
+    
+    if (key->clock > log->clock) {
+        log->clock = key->clock;
+    }
+    
+    Room* room = get_or_create_room(log, name);
+    if (room == NULL) {
+        pthread_mutex_unlock(&log->mutex);
+        return -1;
+    }
+    
+    int position = lower_bound(room, key);
+    if (position < room->count && compare_keys(&room->entries[position].key, key) == 0) {
+        pthread_mutex_unlock(&log->mutex);
+        return 0;
+    }
+    
+    // A full room keeps the newest entries
+    if (room->count >= log->limit) {
+        if (position == 0) {
+            pthread_mutex_unlock(&log->mutex);
+            return 0;
+        }
+        free(room->entries[0].message);
+        memmove(room->entries, room->entries + 1, (room->count - 1) * sizeof(RoomEntry));
+        room->count--;
+        position--;
+    }
+    
+    if (room->count == room->capacity) {
+        int capacity = room->capacity > 0 ? room->capacity * 2 : 16;
+        RoomEntry* entries = realloc(room->entries, capacity * sizeof(RoomEntry));
+        if (entries == NULL) {
+            pthread_mutex_unlock(&log->mutex);
+            return -1;
+        }
+        room->entries = entries;
+        room->capacity = capacity;
+    }
+    
+    char* copy = malloc(strlen(message) + 1);
+    if (copy == NULL) {
+        pthread_mutex_unlock(&log->mutex);
+        return -1;
+    }
+    strcpy(copy, message);
+    
+    memmove(room->entries + position + 1, room->entries + position,
+            (room->count - position) * sizeof(RoomEntry));
+    room->entries[position].key = *key;
+    room->entries[position].hash = hash_key(key);
+    room->entries[position].message = copy;
+    room->count++;
+    
+    if (late != NULL) {
+        *late = position < room->count - 1;
+    }
+    
+    pthread_mutex_unlock(&log->mutex);
+    return 1;
+}
+
+// Everything from the start of time, clamped to what a full room keeps
+void room_full_range(RoomLog* log, const char* name, KeyRange* range) {
+    range->lo.clock = 0;
+    range->lo.origin = 0;
+    range->hi.clock = UINT64_MAX;
+    range->hi.origin = UINT64_MAX;
+    room_clamp(log, name, range);
+    room_summarize(log, name, range);
+}
+
+// Keep ranges inside the window of a full room, entries below it would be
+// dropped on arrival and could never match
+int room_clamp(RoomLog* log, const char* name, KeyRange* range) {
+    int result = 0;
+    
+    pthread_mutex_lock(&log->mutex);
+    Room* room = find_room(log, name);
+    if (room != NULL && room->count >= log->limit &&
+        compare_keys(&range->lo, &room->entries[0].key) < 0) {
+        range->lo = room->entries[0].key;
+        result = 1;
+    }
+    if (compare_keys(&range->lo, &range->hi) >= 0) {
+        result = -1;
+    }
+    pthread_mutex_unlock(&log->mutex);
+    
+    return result;
+}
+
+// Summarize a range of the room
+void room_summarize(RoomLog* log, const char* name, KeyRange* range) {
+    pthread_mutex_lock(&log->mutex);
+    
+    Room* room = find_room(log, name);
+    if (room != NULL) {
+        int first;
+        int last;
+        find_span(room, range, &first, &last);
+        summarize_span(room, first, last, range);
+    } else {
+        range->count = 0;
+        range->fingerprint = 0;
+    }
+    
+    pthread_mutex_unlock(&log->mutex);
+}
+
+// Split range at entry quantiles; the parts cover the whole range
+int room_split(RoomLog* log, const char* name, const KeyRange* range,
+               KeyRange* parts, int max) {
+    pthread_mutex_lock(&log->mutex);
+    
+    Room* room = find_room(log, name);
+    int first = 0;
+    int last = 0;
+    if (room != NULL) {
+        find_span(room, range, &first, &last);
+    }
+    
+    int total = last - first;
+    int count = total < max ? total : max;
+    for (int i = 0; i < count; i++) {
+        int start = first + (int)((long long)total * i / count);
+        int end = first + (int)((long long)total * (i + 1) / count);
+        parts[i].lo = i == 0 ? range->lo : room->entries[start].key;
+        parts[i].hi = i == count - 1 ? range->hi : room->entries[end].key;
+        summarize_span(room, start, end, &parts[i]);
+    }
+    
+    pthread_mutex_unlock(&log->mutex);
+    return count;
+}
+
+// Copy entries so they can be sent without holding the log
+int room_copy(RoomLog* log, const char* name, const KeyRange* range, RoomEntry** out) {
+    *out = NULL;
+    
+    pthread_mutex_lock(&log->mutex);
+    
+    Room* room = find_room(log, name);
+    if (room == NULL) {
+        pthread_mutex_unlock(&log->mutex);
+        return 0;
+    }
+    
+    int first = 0;
+    int last = room->count;
+    if (range != NULL) {
+        find_span(room, range, &first, &last);
+    }
+    if (last == first) {
+        pthread_mutex_unlock(&log->mutex);
+        return 0;
+    }
+    
+    RoomEntry* copies = calloc(last - first, sizeof(RoomEntry));
+    int count = 0;
+    for (int i = first; copies != NULL && i < last; i++) {
+        copies[count] = room->entries[i];
+        copies[count].message = malloc(strlen(room->entries[i].message) + 1);
+        if (copies[count].message == NULL) {
+            room_free_copies(copies, count);
+            copies = NULL;
+            break;
+        }
+        strcpy(copies[count].message, room->entries[i].message);
+        count++;
+    }
+    
+    pthread_mutex_unlock(&log->mutex);
+    
+    if (copies == NULL) {
+        return -1;
+    }
+    *out = copies;
+    return count;
+}
+
+// Free what room_copy returned
+void room_free_copies(RoomEntry* entries, int count) {
+    for (int i = 0; i < count; i++) {
+        free(entries[i].message);
+    }
+    free(entries);
+}
+
+// Visit every entry under the log mutex
+int room_visit(RoomLog* log, room_visit_fn visit, void* ctx) {
+    int result = 0;
+    
+    pthread_mutex_lock(&log->mutex);
+    for (int i = 0; i < ROOM_BUCKETS && result >= 0; i++) {
+        for (Room* room = log->table[i]; room != NULL && result >= 0; room = room->next) {
+            for (int j = 0; j < room->count && result >= 0; j++) {
+                result = visit(ctx, room->name, &room->entries[j]);
+            }
+        }
+    }
+    pthread_mutex_unlock(&log->mutex);
+    
+    return result;
+}
@@ -0,0 +1,88 @@
+#ifndef ROOMLOG_H
+#define ROOMLOG_H
+
+#include "common.h"
+#include "protocol.h"
+#include <stdint.h>
+#include <pthread.h>
+
+// Replicated room log.
+// Every joined topic keeps its messages sorted by hybrid logical clock
+// (wall clock milliseconds and a counter, the author's node ID breaks ties),
+// so all members list a room in the same order whatever order the frames
+// took. Anti-entropy (pubsub.c) compares key ranges by count and fingerprint
+// and only descends into ranges that differ.
+
+#define ROOM_BUCKETS 64
+#define ROOM_SYNC_LEAF 16           // Differing ranges this small are settled by sending entries
+#define ROOM_SYNC_FANOUT 4          // Subranges a larger differing range is split into
+#define ROOM_DIGEST_RANGES 16       // Most ranges accepted in one digest
+
+// Logged message
+typedef struct {
+    EntryKey key;
+    uint64_t hash;                  // Fingerprint contribution of key
+    char* message;
+} RoomEntry;
+
+// Log of one topic
+typedef struct Room {
+    char name[MAX_TOPIC_LENGTH + 1];
+    RoomEntry* entries;             // Sorted by key
+    int count;
+    int capacity;
+    struct Room* next;              // Hash bucket chain
+} Room;
+
+// Room logs of a node
+typedef struct {
+    Room* table[ROOM_BUCKETS];
+    pthread_mutex_t mutex;
+    uint64_t clock;                 // Latest clock issued or seen
+    int limit;                      // Entries kept per room, oldest dropped first
+} RoomLog;
+
+// Called for each entry by room_visit, negative return stops the walk
+typedef int (*room_visit_fn)(void* ctx, const char* room, const RoomEntry* entry);
+
+// Logs of this node
+extern RoomLog node_rooms;
+
+// Lifecycle
+void init_rooms(RoomLog* log, int limit);
+void free_rooms(RoomLog* log);
+void room_drop(RoomLog* log, const char* name);
+
+// Key for an entry written now by origin, or at wall_ms (simulated time)
+EntryKey room_next_key(RoomLog* log, uint64_t origin);
+EntryKey room_next_key_at(RoomLog* log, uint64_t origin, long long wall_ms);
+
+// Add an entry, creating the room. Returns 1 if added, 0 if already known or
+// older than a full room keeps, -1 out of memory. *late is set when the entry
+// sorts before one already logged.
+int room_insert(RoomLog* log, const char* name, const EntryKey* key,
+                const char* message, int* late);
+
+// Range covering everything the room keeps, summarized
+void room_full_range(RoomLog* log, const char* name, KeyRange* range);
+
+// Raise range->lo to the oldest entry of a full room.
+// Returns 0 if unchanged, 1 if raised, -1 if nothing of the range is kept.
+int room_clamp(RoomLog* log, const char* name, KeyRange* range);
+
+// Fill in count and fingerprint of [range->lo, range->hi)
+void room_summarize(RoomLog* log, const char* name, KeyRange* range);
+
+// Cut range into at most max summarized parts of about equal entry count
+int room_split(RoomLog* log, const char* name, const KeyRange* range,
+               KeyRange* parts, int max);
+
+// Copy entries within range (NULL = all) in order, returns count or -1.
+// Free with room_free_copies.
+int room_copy(RoomLog* log, const char* name, const KeyRange* range, RoomEntry** out);
+void room_free_copies(RoomEntry* entries, int count);
+
+// Walk all entries of all rooms
+int room_visit(RoomLog* log, room_visit_fn visit, void* ctx);
+
+#endif // ROOMLOG_H
@@ -0,0 +1,1549 @@
+#include "search.h"
+#include "protocol.h"
+#include "trace.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#endif
+
+// Segment layout: header, messages, message offset table, postings, term
+// strings, term entries sorted by term. Integers in network byte order.
+#define SEGMENT_MAGIC 0x50325049u        // "P2PI"
+#define SEGMENT_VERSION 1
+#define SEGMENT_HEADER_SIZE 72
+#define TERM_ENTRY_SIZE 20               // string(4) length(4) postings(8) docs(4)
+#define DOC_FIXED_SIZE 13                // timestamp(8) source length(1) text length(4)
+#define DOC_TABLE_ENTRY_SIZE 8
+#define MAX_TIER 32
+
+// Messages moved from the queue to the buffer per hold of the index mutex
+#define INDEX_BATCH 256
+
+// stdio buffer of a segment file, postings are written a few bytes at a time
+#define WRITE_BUFFER 65536
+
+// Index of this node
+SearchIndex node_index;
+
+// Section offsets and counts of a segment
+typedef struct {
+    uint64_t sequence;
+    uint32_t doc_count;
+    uint32_t term_count;
+    uint64_t terms;
+    uint64_t strings;
+    uint64_t postings;
+    uint64_t doc_table;
+    uint64_t docs;
+    uint64_t size;
+} SegmentLayout;
+
+// Output of a segment being written: a file, or a growing image in memory
+typedef struct {
+    FILE* file;
+    unsigned char* data;
+    size_t size;
+    size_t capacity;
+    int failed;
+} SegmentWriter;
+
+// Term dictionary collected while the postings are written
+typedef struct {
+    SegmentWriter entries;
+    SegmentWriter strings;
+    uint32_t count;
+    unsigned char entry[TERM_ENTRY_SIZE];  // Current term
+    uint32_t docs;
+    uint32_t last;
+} Dictionary;
+
+// Fills a segment after its header, sets everything in layout but sequence
+typedef int (*segment_fill_fn)(SegmentWriter* out, void* arg, SegmentLayout* layout);
+
+// Segments being merged, ascending sequence
+typedef struct {
+    Segment** segments;
+    int count;
+} MergeInput;
+
+// Walks a postings list: buffer array or varint deltas of a segment
+typedef struct {
+    const uint32_t* array;
+    const unsigned char* next;
+    const unsigned char* end;
+    uint32_t remaining;
+    uint32_t limit;                  // Doc IDs of the source
+    uint32_t doc;
+    int started;
+} PostingCursor;
+
+// Match of a query: message of a segment or of the buffer
+typedef struct {
+    long long timestamp;
+    int source;                      // Segment position, segment_count = buffer
+    uint32_t doc;
+} Candidate;
+
+// Append value as LEB128 varint, returns bytes written
+static int encode_varint(uint32_t value, unsigned char* out) {
+    int length = 0;
+    while (value >= 0x80) {
+        out[length++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[length++] = (unsigned char)value;
+    return length;
+}
+
+// Read a varint, NULL if it runs past end
+static const unsigned char* decode_varint(const unsigned char* in, const unsigned char* end,
+                                          uint32_t* value) {
+    uint32_t result = 0;
+    for (int shift = 0; shift < 35 && in < end; shift += 7) {
+        unsigned char byte = *in++;
+        result |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return in;
+        }
+    }
+    return NULL;
+}
+
+// Bytes that make up words: ASCII letters and digits, anything non-ASCII (UTF-8)
+static int is_word_byte(unsigned char c) {
+    return c >= 0x80 || isalnum(c);
+}
+
+// Next word from *cursor, lowercased into term (SEARCH_TERM_LENGTH + 1 bytes).
+// Returns its indexed length, 0 when no word is left.
+static int next_term(const char** cursor, const char* end, char* term) {
+    const unsigned char* p = (const unsigned char*)*cursor;
+    const unsigned char* stop = (const unsigned char*)end;
+    int length = 0;
+    
+    while (p < stop && !is_word_byte(*p)) {
+        p++;
+    }
+    while (p < stop && is_word_byte(*p)) {
+        if (length < SEARCH_TERM_LENGTH) {
+            term[length++] = (char)tolower(*p);
+        }
+        p++;
+    }
+    
+    term[length] = '\0';
+    *cursor = (const char*)p;
+    return length;
+}
+
+// Order terms as bytes, a prefix first
+static int compare_terms(const unsigned char* a, uint32_t a_length,
+                         const unsigned char* b, uint32_t b_length) {
+    int order = memcmp(a, b, a_length < b_length ? a_length : b_length);
+    if (order != 0) {
+        return order;
+    }
+    return (a_length > b_length) - (a_length < b_length);
+}
+
+// FNV-1a hash of a term
+static uint32_t hash_term(const char* term) {
+    uint32_t hash = 2166136261u;
+    while (*term) {
+        hash ^= (unsigned char)*term++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Slot of term, or the free slot where it goes (caller holds index mutex)
+static BufferTerm* buffer_slot(BufferTerm* table, uint32_t slots, const char* term,
+                               uint32_t hash) {
+    uint32_t i = hash & (slots - 1);
+    while (table[i].term != NULL &&
+           (table[i].hash != hash || strcmp(table[i].term, term) != 0)) {
+        i = (i + 1) & (slots - 1);
+    }
+    return &table[i];
+}
+
+// Rehash into slots, freeing terms the current buffer does not use when
+// prune is set (caller holds index mutex)
+static int buffer_rehash(SearchBuffer* buffer, uint32_t slots, int prune) {
+    BufferTerm* table = calloc(slots, sizeof(BufferTerm));
+    if (table == NULL) {
+        return -1;
+    }
+    
+    buffer->term_count = 0;
+    for (uint32_t i = 0; i < buffer->term_slots; i++) {
+        BufferTerm* entry = &buffer->terms[i];
+        if (entry->term == NULL) {
+            continue;
+        }
+        if (prune && entry->count == 0) {
+            free(entry->term);
+            free(entry->docs);
+            continue;
+        }
+        *buffer_slot(table, slots, entry->term, entry->hash) = *entry;
+        buffer->term_count++;
+    }
+    free(buffer->terms);
+    buffer->terms = table;
+    buffer->term_slots = slots;
+    return 0;
+}
+
+// Note that buffered message doc contains term (caller holds index mutex)
+static int buffer_post(SearchBuffer* buffer, const char* term, uint32_t doc) {
+    if ((buffer->term_count + 1) * 2 > buffer->term_slots &&
+        buffer_rehash(buffer, buffer->term_slots > 0 ? buffer->term_slots * 2 : 1024, 0) < 0) {
+        return -1;
+    }
+    
+    uint32_t hash = hash_term(term);
+    BufferTerm* entry = buffer_slot(buffer->terms, buffer->term_slots, term, hash);
+    if (entry->term == NULL) {
+        char* copy = malloc(strlen(term) + 1);
+        if (copy == NULL) {
+            return -1;
+        }
+        strcpy(copy, term);
+        entry->term = copy;
+        entry->hash = hash;
+        buffer->term_count++;
+    }
+    
+    // Repeated words post once
+    if (entry->count > 0 && entry->docs[entry->count - 1] == doc) {
+        return 0;
+    }
+    if (entry->count == entry->capacity) {
+        uint32_t capacity = entry->capacity > 0 ? entry->capacity * 2 : 4;
+        uint32_t* docs = realloc(entry->docs, capacity * sizeof(uint32_t));
+        if (docs == NULL) {
+            return -1;
+        }
+        entry->docs = docs;
+        entry->capacity = capacity;
+    }
+    if (entry->count == 0) {
+        buffer->used_terms++;
+    }
+    entry->docs[entry->count++] = doc;
+    return 0;
+}
+
+// Add a message, the buffer takes it over (caller holds index mutex).
+// Out of memory part way leaves it partly indexed.
+static int buffer_add(SearchBuffer* buffer, SearchItem* item) {
+    if (buffer->count == buffer->capacity) {
+        uint32_t capacity = buffer->capacity > 0 ? buffer->capacity * 2 : 1024;
+        SearchItem** docs = realloc(buffer->docs, capacity * sizeof(SearchItem*));
+        if (docs == NULL) {
+            return -1;
+        }
+        buffer->docs = docs;
+        buffer->capacity = capacity;
+    }
+    
+    uint32_t doc = buffer->count;
+    buffer->docs[buffer->count++] = item;
+    
+    char term[SEARCH_TERM_LENGTH + 1];
+    const char* cursor = item->text;
+    const char* end = item->text + item->length;
+    while (next_term(&cursor, end, term) > 0) {
+        if (buffer_post(buffer, term, doc) < 0) {
+            break;
+        }
+    }
+    return 0;
+}
+
+// Start an empty buffer after a flush: terms the flushed messages used stay
+// for the next ones, the rest are freed (caller holds index mutex)
+static void buffer_reset(SearchBuffer* buffer) {
+    for (uint32_t i = 0; i < buffer->count; i++) {
+        free(buffer->docs[i]);
+    }
+    buffer->count = 0;
+    
+    // Survivors start empty, unless used again they go at the next flush.
+    // On failure the old table stays as it is.
+    uint32_t slots = buffer->term_slots;
+    while (slots > 1024 && buffer->used_terms * 4 < slots) {
+        slots /= 2;
+    }
+    buffer_rehash(buffer, slots, 1);
+    for (uint32_t i = 0; i < buffer->term_slots; i++) {
+        buffer->terms[i].count = 0;
+    }
+    buffer->used_terms = 0;
+}
+
+// Free the buffer and everything in it (caller holds index mutex)
+static void buffer_clear(SearchBuffer* buffer) {
+    for (uint32_t i = 0; i < buffer->term_slots; i++) {
+        free(buffer->terms[i].term);
+        free(buffer->terms[i].docs);
+    }
+    for (uint32_t i = 0; i < buffer->count; i++) {
+        free(buffer->docs[i]);
+    }
+    free(buffer->terms);
+    free(buffer->docs);
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+// Buffered term with its first bytes as a number, so most comparisons of
+// the flush sort stay out of the term strings
+typedef struct {
+    uint64_t prefix;
+    const BufferTerm* term;
+} SortedTerm;
+
+// Order buffered terms for qsort
+static int compare_sorted_terms(const void* a, const void* b) {
+    const SortedTerm* x = (const SortedTerm*)a;
+    const SortedTerm* y = (const SortedTerm*)b;
+    if (x->prefix != y->prefix) {
+        return x->prefix < y->prefix ? -1 : 1;
+    }
+    return strcmp(x->term->term, y->term->term);
+}
+
+// First 8 bytes of term, big-endian and zero padded, orders like the term
+static uint64_t term_prefix(const char* term) {
+    uint64_t prefix = 0;
+    int i = 0;
+    for (; i < 8 && term[i] != '\0'; i++) {
+        prefix = (prefix << 8) | (unsigned char)term[i];
+    }
+    return prefix << (8 * (8 - i));
+}
+
+// Start a writer on file, NULL = in memory
+static void writer_init(SegmentWriter* writer, FILE* file) {
+    memset(writer, 0, sizeof(*writer));
+    writer->file = file;
+}
+
+// Append bytes, a failure sticks until the end
+static void writer_put(SegmentWriter* writer, const void* bytes, size_t length) {
+    if (writer->failed || length == 0) {
+        return;
+    }
+    
+    if (writer->file != NULL) {
+        if (fwrite(bytes, 1, length, writer->file) != length) {
+            writer->failed = 1;
+            return;
+        }
+    } else {
+        if (writer->size + length > writer->capacity) {
+            size_t capacity = writer->capacity > 0 ? writer->capacity : 4096;
+            while (capacity < writer->size + length) {
+                capacity *= 2;
+            }
+            unsigned char* data = realloc(writer->data, capacity);
+            if (data == NULL) {
+                writer->failed = 1;
+                return;
+            }
+            writer->data = data;
+            writer->capacity = capacity;
+        }
+        memcpy(writer->data + writer->size, bytes, length);
+    }
+    writer->size += length;
+}
+
+// Append a 64-bit integer
+static void writer_put_u64(SegmentWriter* writer, uint64_t value) {
+    unsigned char bytes[8];
+    encode_u64(value, bytes);
+    writer_put(writer, bytes, sizeof(bytes));
+}
+
+// Append a message record
+static void put_doc(SegmentWriter* out, long long timestamp, const char* source,
+                    const void* text, uint32_t length) {
+    unsigned char fixed[DOC_FIXED_SIZE];
+    size_t source_length = strlen(source);
+    
+    encode_u64((uint64_t)timestamp, fixed);
+    fixed[8] = (unsigned char)source_length;
+    writer_put(out, fixed, 9);
+    writer_put(out, source, source_length);
+    encode_u32(length, fixed + 9);
+    writer_put(out, fixed + 9, 4);
+    writer_put(out, text, length);
+}
+
+// Start the dictionary of a segment
+static void dict_init(Dictionary* dict) {
+    memset(dict, 0, sizeof(*dict));
+    writer_init(&dict->entries, NULL);
+    writer_init(&dict->strings, NULL);
+}
+
+// Start the postings of a term
+static void dict_begin(Dictionary* dict, const SegmentWriter* out, const SegmentLayout* layout,
+                       const void* term, uint32_t length) {
+    encode_u32((uint32_t)dict->strings.size, dict->entry);
+    encode_u32(length, dict->entry + 4);
+    encode_u64(out->size - layout->postings, dict->entry + 8);
+    writer_put(&dict->strings, term, length);
+    dict->docs = 0;
+    dict->last = 0;
+}
+
+// Add a message to the current term, IDs must ascend
+static void dict_post(Dictionary* dict, SegmentWriter* out, uint32_t doc) {
+    unsigned char varint[5];
+    if (dict->docs > 0 && doc <= dict->last) {
+        return;
+    }
+    writer_put(out, varint, encode_varint(dict->docs > 0 ? doc - dict->last : doc, varint));
+    dict->docs++;
+    dict->last = doc;
+}
+
+// Finish the current term
+static void dict_end(Dictionary* dict) {
+    encode_u32(dict->docs, dict->entry + 16);
+    writer_put(&dict->entries, dict->entry, TERM_ENTRY_SIZE);
+    dict->count++;
+}
+
+// Write strings and term entries after the postings
+static void dict_finish(Dictionary* dict, SegmentWriter* out, SegmentLayout* layout) {
+    layout->strings = out->size;
+    writer_put(out, dict->strings.data, dict->strings.size);
+    layout->terms = out->size;
+    writer_put(out, dict->entries.data, dict->entries.size);
+    layout->term_count = dict->count;
+    
+    if (dict->entries.failed || dict->strings.failed) {
+        out->failed = 1;
+    }
+    free(dict->entries.data);
+    free(dict->strings.data);
+}
+
+// Write the message offset table
+static void put_doc_table(SegmentWriter* out, SegmentLayout* layout,
+                          const uint64_t* offsets, uint32_t count) {
+    layout->doc_table = out->size;
+    for (uint32_t i = 0; i < count; i++) {
+        writer_put_u64(out, offsets[i]);
+    }
+}
+
+// Header bytes of layout
+static void encode_header(const SegmentLayout* layout, unsigned char* out) {
+    encode_u32(SEGMENT_MAGIC, out);
+    encode_u32(SEGMENT_VERSION, out + 4);
+    encode_u64(layout->sequence, out + 8);
+    encode_u32(layout->doc_count, out + 16);
+    encode_u32(layout->term_count, out + 20);
+    encode_u64(layout->terms, out + 24);
+    encode_u64(layout->strings, out + 32);
+    encode_u64(layout->postings, out + 40);
+    encode_u64(layout->doc_table, out + 48);
+    encode_u64(layout->docs, out + 56);
+    encode_u64(layout->size, out + 64);
+}
+
+// Check the header and locate sections of a mapped or built segment
+static int parse_segment(Segment* segment) {
+    const unsigned char* base = segment->base;
+    uint64_t size = segment->size;
+    
+    if (size < SEGMENT_HEADER_SIZE || decode_u32(base) != SEGMENT_MAGIC ||
+        decode_u32(base + 4) != SEGMENT_VERSION || decode_u64(base + 64) != size) {
+        return -1;
+    }
+    
+    segment->sequence = decode_u64(base + 8);
+    segment->doc_count = decode_u32(base + 16);
+    segment->term_count = decode_u32(base + 20);
+    uint64_t terms = decode_u64(base + 24);
+    uint64_t strings = decode_u64(base + 32);
+    uint64_t postings = decode_u64(base + 40);
+    uint64_t doc_table = decode_u64(base + 48);
+    uint64_t docs = decode_u64(base + 56);
+    
+    if (terms > size || strings > size || postings > size || doc_table > size || docs > size ||
+        (size - terms) / TERM_ENTRY_SIZE < segment->term_count ||
+        (size - doc_table) / DOC_TABLE_ENTRY_SIZE < segment->doc_count) {
+        return -1;
+    }
+    
+    segment->terms = base + terms;
+    segment->strings = base + strings;
+    segment->postings = base + postings;
+    segment->doc_table = base + doc_table;
+    segment->docs = base + docs;
+    return 0;
+}
+
+// Term of entry i, -1 if it points outside the segment
+static int segment_term(const Segment* segment, uint32_t i, const unsigned char** term,
+                        uint32_t* length) {
+    const unsigned char* entry = segment->terms + (size_t)i * TERM_ENTRY_SIZE;
+    const unsigned char* end = segment->base + segment->size;
+    uint32_t offset = decode_u32(entry);
+    
+    *length = decode_u32(entry + 4);
+    if (*length > SEARCH_TERM_LENGTH || offset > (size_t)(end - segment->strings) ||
+        *length > (size_t)(end - segment->strings) - offset) {
+        return -1;
+    }
+    *term = segment->strings + offset;
+    return 0;
+}
+
+// Entry of term by binary search, -1 if absent
+static long find_term(const Segment* segment, const char* term) {
+    uint32_t length = (uint32_t)strlen(term);
+    uint32_t low = 0;
+    uint32_t high = segment->term_count;
+    
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        const unsigned char* candidate;
+        uint32_t candidate_length;
+        if (segment_term(segment, middle, &candidate, &candidate_length) < 0) {
+            return -1;
+        }
+        
+        int order = compare_terms(candidate, candidate_length, (const unsigned char*)term, length);
+        if (order == 0) {
+            return (long)middle;
+        }
+        if (order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return -1;
+}
+
+// Cursor on the postings of term entry i, 0 if they point outside the segment
+static int segment_cursor(const Segment* segment, uint32_t i, PostingCursor* cursor) {
+    const unsigned char* entry = segment->terms + (size_t)i * TERM_ENTRY_SIZE;
+    const unsigned char* end = segment->base + segment->size;
+    uint64_t offset = decode_u64(entry + 8);
+    uint32_t docs = decode_u32(entry + 16);
+    
+    memset(cursor, 0, sizeof(*cursor));
+    if (offset >= (uint64_t)(end - segment->postings)) {
+        return 0;
+    }
+    cursor->next = segment->postings + offset;
+    cursor->end = end;
+    cursor->remaining = docs < segment->doc_count ? docs : segment->doc_count;
+    cursor->limit = segment->doc_count;
+    return cursor->remaining > 0;
+}
+
+// Step to the next doc ID, 0 at the end (or on damaged postings)
+static int cursor_next(PostingCursor* cursor) {
+    uint32_t value;
+    
+    if (cursor->remaining == 0) {
+        return 0;
+    }
+    cursor->remaining--;
+    
+    if (cursor->array != NULL) {
+        cursor->doc = *cursor->array++;
+    } else {
+        cursor->next = decode_varint(cursor->next, cursor->end, &value);
+        if (cursor->next == NULL || (cursor->started && value == 0)) {
+            cursor->remaining = 0;
+            return 0;
+        }
+        cursor->doc = cursor->started ? cursor->doc + value : value;
+    }
+    
+    cursor->started = 1;
+    if (cursor->doc >= cursor->limit) {
+        cursor->remaining = 0;
+        return 0;
+    }
+    return 1;
+}
+
+// Advance to the first doc ID not below doc, 0 if there is none
+static int cursor_seek(PostingCursor* cursor, uint32_t doc) {
+    while (cursor->doc < doc) {
+        if (!cursor_next(cursor)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Doc IDs on every cursor, ascending; the first cursor drives and should be
+// the shortest. Returns the count or -1.
+static long intersect(PostingCursor* cursors, int count, uint32_t** out) {
+    uint32_t* matches = malloc((cursors[0].remaining + 1) * sizeof(uint32_t));
+    long found = 0;
+    int alive = 1;
+    
+    *out = matches;
+    if (matches == NULL) {
+        return -1;
+    }
+    
+    for (int i = 1; i < count && alive; i++) {
+        alive = cursor_next(&cursors[i]);
+    }
+    while (alive && cursor_next(&cursors[0])) {
+        uint32_t doc = cursors[0].doc;
+        int everywhere = 1;
+        for (int i = 1; i < count && alive; i++) {
+            alive = cursor_seek(&cursors[i], doc);
+            everywhere = everywhere && alive && cursors[i].doc == doc;
+        }
+        if (alive && everywhere) {
+            matches[found++] = doc;
+        }
+    }
+    return found;
+}
+
+// Record of message i, NULL if it points outside the segment
+static const unsigned char* segment_doc(const Segment* segment, uint32_t i, size_t* length) {
+    const unsigned char* end = segment->base + segment->size;
+    uint64_t offset = decode_u64(segment->doc_table + (size_t)i * DOC_TABLE_ENTRY_SIZE);
+    
+    if (offset > (uint64_t)(end - segment->docs) ||
+        (size_t)(end - segment->docs) - offset < DOC_FIXED_SIZE) {
+        return NULL;
+    }
+    const unsigned char* record = segment->docs + offset;
+    size_t source_length = record[8];
+    size_t available = (size_t)(end - record);
+    if (available < DOC_FIXED_SIZE + source_length) {
+        return NULL;
+    }
+    
+    uint32_t text_length = decode_u32(record + 9 + source_length);
+    if (available - DOC_FIXED_SIZE - source_length < text_length) {
+        return NULL;
+    }
+    *length = DOC_FIXED_SIZE + source_length + text_length;
+    return record;
+}
+
+// Segment from the built image in the writer, which it takes over
+static Segment* image_segment(SegmentWriter* out) {
+    Segment* segment = calloc(1, sizeof(Segment));
+    if (segment != NULL) {
+        segment->base = out->data;
+        segment->size = out->size;
+        if (parse_segment(segment) == 0) {
+            return segment;
+        }
+        free(segment);
+    }
+    free(out->data);
+    return NULL;
+}
+
+#ifndef _WIN32
+// Map a segment file read-only
+static Segment* map_segment(const char* path) {
+    struct stat info;
+    Segment* segment = NULL;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    
+    if (fstat(fd, &info) == 0 && info.st_size >= SEGMENT_HEADER_SIZE) {
+        void* base = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (base != MAP_FAILED) {
+            segment = calloc(1, sizeof(Segment));
+            if (segment != NULL) {
+                snprintf(segment->path, sizeof(segment->path), "%s", path);
+                segment->base = base;
+                segment->size = (size_t)info.st_size;
+            }
+            if (segment == NULL || parse_segment(segment) < 0) {
+                munmap(base, (size_t)info.st_size);
+                free(segment);
+                segment = NULL;
+            }
+        }
+    }
+    
+    close(fd);
+    return segment;
+}
+#endif
+
+// Unmap or free a segment
+static void free_segment(Segment* segment) {
+    #ifndef _WIN32
+    if (segment->path[0] != '\0') {
+        if (segment->base != NULL) {
+            munmap(segment->base, segment->size);
+        }
+        free(segment);
+        return;
+    }
+    #endif
+    free(segment->base);
+    free(segment);
+}
+
+// Drop a reference, the last one frees (caller holds index mutex)
+static void release_segment(Segment* segment) {
+    if (--segment->refs == 0) {
+        free_segment(segment);
+    }
+}
+
+// Position of segment with path, -1 if not listed (caller holds index mutex)
+static int find_segment(const SearchIndex* index, const char* path) {
+    for (int i = 0; i < index->segment_count; i++) {
+        if (strcmp(index->segments[i]->path, path) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// List segment in sequence order, the list holds a reference
+// (caller holds index mutex)
+static int add_segment(SearchIndex* index, Segment* segment) {
+    if (index->segment_count >= SEARCH_MAX_SEGMENTS) {
+        return -1;
+    }
+    
+    int position = index->segment_count;
+    while (position > 0 && index->segments[position - 1]->sequence > segment->sequence) {
+        index->segments[position] = index->segments[position - 1];
+        position--;
+    }
+    index->segments[position] = segment;
+    index->segment_count++;
+    segment->refs++;
+    
+    if (segment->sequence >= index->next_sequence) {
+        index->next_sequence = segment->sequence + 1;
+    }
+    return 0;
+}
+
+// Unlist the segment at position, the caller takes the list's reference
+// (caller holds index mutex)
+static void remove_segment_at(SearchIndex* index, int position) {
+    index->segment_count--;
+    memmove(index->segments + position, index->segments + position + 1,
+            (index->segment_count - position) * sizeof(Segment*));
+}
+
+// Write a segment with fill: to a temporary file in the index directory,
+// renamed by install_segment, or to an image in memory when there is no
+// directory or the file can't be written
+static Segment* write_segment(SearchIndex* index, uint64_t sequence,
+                              segment_fill_fn fill, void* arg) {
+    unsigned char header[SEGMENT_HEADER_SIZE];
+    SegmentLayout layout;
+    SegmentWriter out;
+    
+    memset(header, 0, sizeof(header));
+    memset(&layout, 0, sizeof(layout));
+    layout.sequence = sequence;
+    
+    #ifndef _WIN32
+    if (index->dir[0] != '\0') {
+        char path[SEARCH_PATH_LENGTH];
+        char temp[SEARCH_PATH_LENGTH + 8];
+        snprintf(path, sizeof(path), SEARCH_SEGMENT_FORMAT, index->dir,
+                 (unsigned long long)sequence, (long)getpid(), index->written++);
+        snprintf(temp, sizeof(temp), "%s.tmp", path);
+        
+        writer_init(&out, fopen(temp, "wb"));
+        if (out.file != NULL) {
+            setvbuf(out.file, NULL, _IOFBF, WRITE_BUFFER);
+            writer_put(&out, header, sizeof(header));
+            int result = fill(&out, arg, &layout);
+            layout.size = out.size;
+            encode_header(&layout, header);
+            if (result < 0 || out.failed || fseek(out.file, 0, SEEK_SET) != 0 ||
+                fwrite(header, 1, sizeof(header), out.file) != sizeof(header)) {
+                result = -1;
+            }
+            if (fclose(out.file) != 0) {
+                result = -1;
+            }
+            
+            Segment* segment = result == 0 ? calloc(1, sizeof(Segment)) : NULL;
+            if (segment != NULL) {
+                snprintf(segment->path, sizeof(segment->path), "%s", path);
+                segment->sequence = sequence;
+                return segment;
+            }
+            remove(temp);
+        }
+    }
+    #endif
+    
+    writer_init(&out, NULL);
+    writer_put(&out, header, sizeof(header));
+    if (fill(&out, arg, &layout) < 0 || out.failed) {
+        free(out.data);
+        return NULL;
+    }
+    layout.size = out.size;
+    encode_header(&layout, out.data);
+    return image_segment(&out);
+}
+
+// Put a written segment into the list, mapping its file under the final
+// name (caller holds index mutex)
+static int install_segment(SearchIndex* index, Segment* segment) {
+    #ifndef _WIN32
+    if (segment->base == NULL) {
+        char temp[SEARCH_PATH_LENGTH + 8];
+        Segment* mapped = NULL;
+        snprintf(temp, sizeof(temp), "%s.tmp", segment->path);
+        if (rename(temp, segment->path) == 0) {
+            mapped = map_segment(segment->path);
+        }
+        if (mapped == NULL) {
+            remove(temp);
+            remove(segment->path);
+            free(segment);
+            return -1;
+        }
+        free(segment);
+        segment = mapped;
+    }
+    #endif
+    
+    if (add_segment(index, segment) < 0) {
+        if (segment->path[0] != '\0') {
+            remove(segment->path);
+        }
+        free_segment(segment);
+        return -1;
+    }
+    return 0;
+}
+
+// Fill a segment from the buffer
+static int fill_from_buffer(SegmentWriter* out, void* arg, SegmentLayout* layout) {
+    SearchBuffer* buffer = (SearchBuffer*)arg;
+    uint64_t* offsets = malloc((buffer->count + 1) * sizeof(uint64_t));
+    SortedTerm* sorted = malloc((buffer->used_terms + 1) * sizeof(SortedTerm));
+    if (offsets == NULL || sorted == NULL) {
+        free(offsets);
+        free(sorted);
+        return -1;
+    }
+    
+    layout->doc_count = buffer->count;
+    layout->docs = out->size;
+    for (uint32_t i = 0; i < buffer->count; i++) {
+        const SearchItem* item = buffer->docs[i];
+        offsets[i] = out->size - layout->docs;
+        put_doc(out, item->timestamp, item->source, item->text, item->length);
+    }
+    put_doc_table(out, layout, offsets, buffer->count);
+    
+    // Dictionary in byte order for binary search and merging
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < buffer->term_slots && count < buffer->used_terms; i++) {
+        if (buffer->terms[i].count > 0) {
+            sorted[count].prefix = term_prefix(buffer->terms[i].term);
+            sorted[count].term = &buffer->terms[i];
+            count++;
+        }
+    }
+    qsort(sorted, count, sizeof(SortedTerm), compare_sorted_terms);
+    
+    Dictionary dict;
+    dict_init(&dict);
+    layout->postings = out->size;
+    for (uint32_t i = 0; i < count; i++) {
+        const BufferTerm* term = sorted[i].term;
+        dict_begin(&dict, out, layout, term->term, (uint32_t)strlen(term->term));
+        for (uint32_t j = 0; j < term->count; j++) {
+            dict_post(&dict, out, term->docs[j]);
+        }
+        dict_end(&dict);
+    }
+    dict_finish(&dict, out, layout);
+    
+    free(offsets);
+    free(sorted);
+    return out->failed ? -1 : 0;
+}
+
+// Fill a segment from merged segments: messages in input order, each term's
+// postings concatenated with the input's doc IDs moved past the ones before
+static int fill_from_merge(SegmentWriter* out, void* arg, SegmentLayout* layout) {
+    MergeInput* merge = (MergeInput*)arg;
+    uint32_t bases[SEARCH_MERGE_FANIN];
+    uint32_t positions[SEARCH_MERGE_FANIN];
+    uint32_t total = 0;
+    
+    for (int k = 0; k < merge->count; k++) {
+        bases[k] = total;
+        positions[k] = 0;
+        total += merge->segments[k]->doc_count;
+    }
+    
+    uint64_t* offsets = malloc((total + 1) * sizeof(uint64_t));
+    if (offsets == NULL) {
+        return -1;
+    }
+    
+    // Records are copied as they are, damaged ones replaced to keep IDs
+    layout->doc_count = total;
+    layout->docs = out->size;
+    for (int k = 0; k < merge->count; k++) {
+        const Segment* segment = merge->segments[k];
+        for (uint32_t i = 0; i < segment->doc_count; i++) {
+            size_t length;
+            const unsigned char* record = segment_doc(segment, i, &length);
+            offsets[bases[k] + i] = out->size - layout->docs;
+            if (record != NULL) {
+                writer_put(out, record, length);
+            } else {
+                put_doc(out, 0, "", "", 0);
+            }
+        }
+    }
+    put_doc_table(out, layout, offsets, total);
+    free(offsets);
+    
+    Dictionary dict;
+    dict_init(&dict);
+    layout->postings = out->size;
+    for (;;) {
+        // Smallest term still ahead in any input
+        const unsigned char* term = NULL;
+        uint32_t length = 0;
+        int damaged = 0;
+        for (int k = 0; k < merge->count && !damaged; k++) {
+            const unsigned char* candidate;
+            uint32_t candidate_length;
+            if (positions[k] >= merge->segments[k]->term_count) {
+                continue;
+            }
+            if (segment_term(merge->segments[k], positions[k], &candidate, &candidate_length) < 0) {
+                positions[k]++;
+                damaged = 1;
+            } else if (term == NULL ||
+                       compare_terms(candidate, candidate_length, term, length) < 0) {
+                term = candidate;
+                length = candidate_length;
+            }
+        }
+        if (damaged) {
+            continue;
+        }
+        if (term == NULL) {
+            break;
+        }
+        
+        dict_begin(&dict, out, layout, term, length);
+        for (int k = 0; k < merge->count; k++) {
+            const unsigned char* candidate;
+            uint32_t candidate_length;
+            PostingCursor cursor;
+            if (positions[k] >= merge->segments[k]->term_count ||
+                segment_term(merge->segments[k], positions[k], &candidate, &candidate_length) < 0 ||
+                compare_terms(candidate, candidate_length, term, length) != 0) {
+                continue;
+            }
+            if (segment_cursor(merge->segments[k], positions[k], &cursor)) {
+                while (cursor_next(&cursor)) {
+                    dict_post(&dict, out, bases[k] + cursor.doc);
+                }
+            }
+            positions[k]++;
+        }
+        dict_end(&dict);
+    }
+    dict_finish(&dict, out, layout);
+    
+    return out->failed ? -1 : 0;
+}
+
+// Size tier: 0 for flushed buffers, one up per SEARCH_MERGE_FANIN merged
+static int segment_tier(const Segment* segment) {
+    uint64_t limit = (uint64_t)SEARCH_FLUSH_DOCS * SEARCH_MERGE_FANIN;
+    int tier = 0;
+    while (segment->doc_count >= limit && tier < MAX_TIER) {
+        limit *= SEARCH_MERGE_FANIN;
+        tier++;
+    }
+    return tier;
+}
+
+// Oldest SEARCH_MERGE_FANIN segments of the lowest full tier, referenced
+// for the merge (caller holds index mutex). Returns how many, 0 = none.
+static int pick_merge(SearchIndex* index, Segment** inputs) {
+    for (int tier = 0; tier <= MAX_TIER; tier++) {
+        int count = 0;
+        for (int i = 0; i < index->segment_count && count < SEARCH_MERGE_FANIN; i++) {
+            if (segment_tier(index->segments[i]) == tier) {
+                inputs[count++] = index->segments[i];
+            }
+        }
+        if (count == SEARCH_MERGE_FANIN) {
+            for (int i = 0; i < count; i++) {
+                inputs[i]->refs++;
+            }
+            return count;
+        }
+    }
+    return 0;
+}
+
+// Merge full tiers. Segments are immutable, so the merge runs outside the
+// index mutex and queries go on; only the swap holds it.
+static void merge_segments(SearchIndex* index) {
+    Segment* inputs[SEARCH_MERGE_FANIN];
+    
+    for (;;) {
+        pthread_mutex_lock(&index->mutex);
+        int count = pick_merge(index, inputs);
+        pthread_mutex_unlock(&index->mutex);
+        if (count == 0) {
+            return;
+        }
+        
+        TRACE_BEGIN("index_merge");
+        MergeInput merge = { inputs, count };
+        Segment* merged = write_segment(index, inputs[count - 1]->sequence, fill_from_merge, &merge);
+        TRACE_END("index_merge");
+        
+        pthread_mutex_lock(&index->mutex);
+        int installed = -1;
+        if (merged != NULL) {
+            // Inputs leave first so the merged segment has room
+            int positions[SEARCH_MERGE_FANIN];
+            for (int i = 0; i < count; i++) {
+                positions[i] = -1;
+                for (int j = 0; j < index->segment_count; j++) {
+                    if (index->segments[j] == inputs[i]) {
+                        positions[i] = j;
+                        remove_segment_at(index, j);
+                        break;
+                    }
+                }
+            }
+            
+            installed = install_segment(index, merged);
+            for (int i = 0; i < count; i++) {
+                if (positions[i] < 0) {
+                    continue;
+                }
+                if (installed == 0) {
+                    if (inputs[i]->path[0] != '\0') {
+                        remove(inputs[i]->path);
+                    }
+                    release_segment(inputs[i]);
+                } else {
+                    inputs[i]->refs--;
+                    add_segment(index, inputs[i]);
+                }
+            }
+        }
+        for (int i = 0; i < count; i++) {
+            release_segment(inputs[i]);
+        }
+        pthread_mutex_unlock(&index->mutex);
+        
+        // Retried after the next flush
+        if (installed < 0) {
+            return;
+        }
+    }
+}
+
+// Write the buffer out as a segment (caller holds index mutex). On failure
+// the buffer keeps growing and the next try waits for another full buffer.
+static int flush_buffer(SearchIndex* index) {
+    if (index->buffer.count == 0) {
+        return 0;
+    }
+    
+    Segment* segment = NULL;
+    if (index->segment_count < SEARCH_MAX_SEGMENTS) {
+        TRACE_BEGIN("index_flush");
+        segment = write_segment(index, index->next_sequence++, fill_from_buffer, &index->buffer);
+        TRACE_END("index_flush");
+    }
+    if (segment == NULL || install_segment(index, segment) < 0) {
+        index->flush_at = index->buffer.count + SEARCH_FLUSH_DOCS;
+        return -1;
+    }
+    
+    buffer_reset(&index->buffer);
+    index->flush_at = SEARCH_FLUSH_DOCS;
+    return 1;
+}
+
+#ifndef _WIN32
+// Follow the directory: map segments another process wrote (a handoff
+// predecessor's last flush) and drop ones merged away (caller holds index mutex)
+static void refresh_segments(SearchIndex* index) {
+    struct stat info;
+    for (int i = 0; i < index->segment_count;) {
+        Segment* segment = index->segments[i];
+        if (segment->path[0] != '\0' && stat(segment->path, &info) != 0 && errno == ENOENT) {
+            remove_segment_at(index, i);
+            release_segment(segment);
+        } else {
+            i++;
+        }
+    }
+    
+    DIR* dir = opendir(index->dir);
+    if (dir == NULL) {
+        return;
+    }
+    
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char* name = entry->d_name;
+        size_t length = strlen(name);
+        if (length < 8 || length > 64 || strncmp(name, "seg_", 4) != 0 ||
+            strcmp(name + length - 4, ".idx") != 0) {
+            continue;
+        }
+        
+        char path[SEARCH_PATH_LENGTH];
+        snprintf(path, sizeof(path), "%s/%.64s", index->dir, name);
+        if (find_segment(index, path) >= 0) {
+            continue;
+        }
+        Segment* segment = map_segment(path);
+        if (segment != NULL && add_segment(index, segment) < 0) {
+            free_segment(segment);
+        }
+    }
+    closedir(dir);
+}
+#endif
+
+// Index thread: move queued messages into the buffer, write full buffers
+// out and merge
+static void* index_thread(void* arg) {
+    SearchIndex* index = (SearchIndex*)arg;
+    
+    TRACE_THREAD("index");
+    
+    pthread_mutex_lock(&index->queue_mutex);
+    for (;;) {
+        while (index->head == NULL && !index->stopping) {
+            pthread_cond_wait(&index->queue_ready, &index->queue_mutex);
+        }
+        if (index->head == NULL) {
+            break;
+        }
+        
+        // Everything queued so far, the queue is free for receivers again
+        SearchItem* item = index->head;
+        index->head = NULL;
+        index->tail = NULL;
+        index->queued = 0;
+        index->busy = 1;
+        pthread_mutex_unlock(&index->queue_mutex);
+        
+        int flushed = 0;
+        while (item != NULL) {
+            // Short holds of the index mutex keep queries quick
+            pthread_mutex_lock(&index->mutex);
+            for (int i = 0; i < INDEX_BATCH && item != NULL; i++) {
+                SearchItem* next = item->next;
+                if (buffer_add(&index->buffer, item) < 0) {
+                    free(item);
+                }
+                if (index->buffer.count >= index->flush_at && flush_buffer(index) > 0) {
+                    flushed = 1;
+                }
+                item = next;
+            }
+            pthread_mutex_unlock(&index->mutex);
+        }
+        if (flushed) {
+            merge_segments(index);
+        }
+        
+        pthread_mutex_lock(&index->queue_mutex);
+        index->busy = 0;
+        pthread_cond_broadcast(&index->queue_idle);
+    }
+    pthread_mutex_unlock(&index->queue_mutex);
+    
+    return NULL;
+}
+
+// Release every segment (caller holds index mutex)
+static void release_segments(SearchIndex* index) {
+    while (index->segment_count > 0) {
+        Segment* segment = index->segments[index->segment_count - 1];
+        index->segment_count--;
+        release_segment(segment);
+    }
+}
+
+// Undo a search_open that failed part way
+static void search_abandon(SearchIndex* index) {
+    pthread_mutex_lock(&index->mutex);
+    release_segments(index);
+    pthread_mutex_unlock(&index->mutex);
+    pthread_cond_destroy(&index->queue_idle);
+    pthread_cond_destroy(&index->queue_ready);
+    pthread_mutex_destroy(&index->queue_mutex);
+    pthread_mutex_destroy(&index->mutex);
+}
+
+// Open the segments in dir and start the index thread
+int search_open(SearchIndex* index, const char* dir) {
+    memset(index, 0, sizeof(*index));
+    pthread_mutex_init(&index->mutex, NULL);
+    pthread_mutex_init(&index->queue_mutex, NULL);
+    pthread_cond_init(&index->queue_ready, NULL);
+    pthread_cond_init(&index->queue_idle, NULL);
+    index->next_sequence = 1;
+    index->flush_at = SEARCH_FLUSH_DOCS;
+    
+    // Without mmap the index stays in memory
+    #ifndef _WIN32
+    if (dir != NULL && *dir != '\0') {
+        snprintf(index->dir, sizeof(index->dir), "%s", dir);
+        if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+            search_abandon(index);
+            return -1;
+        }
+        pthread_mutex_lock(&index->mutex);
+        refresh_segments(index);
+        pthread_mutex_unlock(&index->mutex);
+    }
+    #else
+    (void)dir;
+    #endif
+    
+    if (pthread_create(&index->thread, NULL, index_thread, index) != 0) {
+        search_abandon(index);
+        return -1;
+    }
+    index->started = 1;
+    return 0;
+}
+
+// Index what is queued, write the buffer out and stop
+void search_close(SearchIndex* index) {
+    if (!index->started) {
+        return;
+    }
+    
+    pthread_mutex_lock(&index->queue_mutex);
+    index->stopping = 1;
+    pthread_cond_broadcast(&index->queue_ready);
+    pthread_mutex_unlock(&index->queue_mutex);
+    pthread_join(index->thread, NULL);
+    index->started = 0;
+    
+    pthread_mutex_lock(&index->mutex);
+    flush_buffer(index);
+    buffer_clear(&index->buffer);
+    pthread_mutex_unlock(&index->mutex);
+    search_abandon(index);
+}
+
+// Queue a message for the index thread
+int search_add(SearchIndex* index, long long timestamp, const char* source,
+               const void* text, size_t length) {
+    if (!index->started || length > UINT32_MAX) {
+        return -1;
+    }
+    
+    SearchItem* item = malloc(sizeof(SearchItem) + length + 1);
+    if (item == NULL) {
+        return -1;
+    }
+    item->timestamp = timestamp;
+    snprintf(item->source, sizeof(item->source), "%s", source);
+    item->length = (uint32_t)length;
+    item->next = NULL;
+    memcpy(item->text, text, length);
+    item->text[length] = '\0';
+    
+    // A full queue means indexing fell behind; the message still gets delivered
+    pthread_mutex_lock(&index->queue_mutex);
+    if (index->stopping || index->queued >= SEARCH_QUEUE_LIMIT) {
+        index->dropped++;
+        pthread_mutex_unlock(&index->queue_mutex);
+        free(item);
+        return -1;
+    }
+    if (index->tail != NULL) {
+        index->tail->next = item;
+    } else {
+        index->head = item;
+    }
+    index->tail = item;
+    index->queued++;
+    pthread_cond_signal(&index->queue_ready);
+    pthread_mutex_unlock(&index->queue_mutex);
+    
+    return 0;
+}
+
+// Cursor on term's postings in a source, 0 if the term is not there
+// (caller holds index mutex)
+static int open_cursor(SearchIndex* index, int source, const char* term, PostingCursor* cursor) {
+    if (source < index->segment_count) {
+        long entry = find_term(index->segments[source], term);
+        return entry >= 0 && segment_cursor(index->segments[source], (uint32_t)entry, cursor);
+    }
+    
+    SearchBuffer* buffer = &index->buffer;
+    memset(cursor, 0, sizeof(*cursor));
+    if (buffer->term_slots == 0) {
+        return 0;
+    }
+    BufferTerm* entry = buffer_slot(buffer->terms, buffer->term_slots, term, hash_term(term));
+    if (entry->term == NULL || entry->count == 0) {
+        return 0;
+    }
+    cursor->array = entry->docs;
+    cursor->remaining = entry->count;
+    cursor->limit = buffer->count;
+    return 1;
+}
+
+// Messages of a source containing every term, ascending; returns the count
+// or -1 (caller holds index mutex)
+static long match_source(SearchIndex* index, int source,
+                         char terms[][SEARCH_TERM_LENGTH + 1], int count, uint32_t** out) {
+    PostingCursor cursors[SEARCH_MAX_TERMS];
+    int shortest = 0;
+    
+    *out = NULL;
+    for (int i = 0; i < count; i++) {
+        if (!open_cursor(index, source, terms[i], &cursors[i])) {
+            return 0;
+        }
+        if (cursors[i].remaining < cursors[shortest].remaining) {
+            shortest = i;
+        }
+    }
+    
+    // The rarest term drives, the others are skipped through
+    PostingCursor first = cursors[0];
+    cursors[0] = cursors[shortest];
+    cursors[shortest] = first;
+    return intersect(cursors, count, out);
+}
+
+// Time of a match (caller holds index mutex)
+static long long candidate_time(SearchIndex* index, int source, uint32_t doc) {
+    size_t length;
+    if (source == index->segment_count) {
+        return index->buffer.docs[doc]->timestamp;
+    }
+    const unsigned char* record = segment_doc(index->segments[source], doc, &length);
+    return record != NULL ? (long long)decode_u64(record) : 0;
+}
+
+// Newest first for qsort, later sources and IDs break ties
+static int compare_candidates(const void* a, const void* b) {
+    const Candidate* x = (const Candidate*)a;
+    const Candidate* y = (const Candidate*)b;
+    if (x->timestamp != y->timestamp) {
+        return x->timestamp < y->timestamp ? 1 : -1;
+    }
+    if (x->source != y->source) {
+        return x->source < y->source ? 1 : -1;
+    }
+    return (x->doc < y->doc) - (x->doc > y->doc);
+}
+
+// Copy a match out of the index (caller holds index mutex)
+static int copy_hit(SearchIndex* index, const Candidate* candidate, SearchHit* hit) {
+    const char* source = "";
+    const char* text = "";
+    size_t source_length = 0;
+    uint32_t length = 0;
+    
+    if (candidate->source == index->segment_count) {
+        const SearchItem* item = index->buffer.docs[candidate->doc];
+        source = item->source;
+        source_length = strlen(source);
+        text = item->text;
+        length = item->length;
+    } else {
+        size_t record_length;
+        const unsigned char* record = segment_doc(index->segments[candidate->source],
+                                                  candidate->doc, &record_length);
+        if (record != NULL) {
+            source = (const char*)record + 9;
+            source_length = record[8];
+            text = (const char*)record + DOC_FIXED_SIZE + source_length;
+            length = decode_u32(record + 9 + source_length);
+        }
+    }
+    
+    hit->timestamp = candidate->timestamp;
+    if (source_length >= sizeof(hit->source)) {
+        source_length = sizeof(hit->source) - 1;
+    }
+    memcpy(hit->source, source, source_length);
+    hit->source[source_length] = '\0';
+    hit->text = malloc((size_t)length + 1);
+    if (hit->text == NULL) {
+        return -1;
+    }
+    memcpy(hit->text, text, length);
+    hit->text[length] = '\0';
+    hit->length = length;
+    return 0;
+}
+
+// Messages containing every word of query, newest first
+int search_query(SearchIndex* index, const char* query, int max,
+                 SearchHit** hits, long long* total) {
+    char terms[SEARCH_MAX_TERMS][SEARCH_TERM_LENGTH + 1];
+    int term_count = 0;
+    
+    *hits = NULL;
+    if (total != NULL) {
+        *total = 0;
+    }
+    if (!index->started || query == NULL || max < 0) {
+        return -1;
+    }
+    
+    const char* cursor = query;
+    const char* end = query + strlen(query);
+    char term[SEARCH_TERM_LENGTH + 1];
+    while (term_count < SEARCH_MAX_TERMS && next_term(&cursor, end, term) > 0) {
+        int repeated = 0;
+        for (int i = 0; i < term_count; i++) {
+            repeated = repeated || strcmp(terms[i], term) == 0;
+        }
+        if (!repeated) {
+            strcpy(terms[term_count++], term);
+        }
+    }
+    if (term_count == 0) {
+        return 0;
+    }
+    
+    pthread_mutex_lock(&index->mutex);
+    #ifndef _WIN32
+    if (index->dir[0] != '\0') {
+        refresh_segments(index);
+    }
+    #endif
+    
+    // Newest max of every source, then newest max overall
+    int sources = index->segment_count + 1;
+    Candidate* candidates = malloc(((size_t)max * sources + 1) * sizeof(Candidate));
+    int candidate_count = 0;
+    long long matched = 0;
+    for (int source = 0; candidates != NULL && source < sources; source++) {
+        uint32_t* docs;
+        long found = match_source(index, source, terms, term_count, &docs);
+        if (found > 0) {
+            matched += found;
+            for (long i = found - 1; i >= 0 && i >= found - max; i--) {
+                candidates[candidate_count].timestamp = candidate_time(index, source, docs[i]);
+                candidates[candidate_count].source = source;
+                candidates[candidate_count].doc = docs[i];
+                candidate_count++;
+            }
+        }
+        free(docs);
+    }
+    
+    int count = candidate_count < max ? candidate_count : max;
+    SearchHit* results = candidates != NULL ? calloc((size_t)count + 1, sizeof(SearchHit)) : NULL;
+    if (results != NULL) {
+        qsort(candidates, candidate_count, sizeof(Candidate), compare_candidates);
+        for (int i = 0; i < count; i++) {
+            if (copy_hit(index, &candidates[i], &results[i]) < 0) {
+                count = i;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&index->mutex);
+    
+    free(candidates);
+    if (results == NULL) {
+        return -1;
+    }
+    *hits = results;
+    if (total != NULL) {
+        *total = matched;
+    }
+    return count;
+}
+
+// Free what search_query returned
+void search_free_hits(SearchHit* hits, int count) {
+    for (int i = 0; i < count; i++) {
+        free(hits[i].text);
+    }
+    free(hits);
+}
+
+// Wait until the index thread has taken in everything queued
+void search_sync(SearchIndex* index) {
+    if (!index->started) {
+        return;
+    }
+    pthread_mutex_lock(&index->queue_mutex);
+    while (index->head != NULL || index->busy) {
+        pthread_cond_wait(&index->queue_idle, &index->queue_mutex);
+    }
+    pthread_mutex_unlock(&index->queue_mutex);
+}
+
+// Messages indexed, segments and their bytes, messages dropped
+void search_stats(SearchIndex* index, long long* messages, int* segments,
+                  long long* bytes, long long* dropped) {
+    *messages = 0;
+    *segments = 0;
+    *bytes = 0;
+    *dropped = 0;
+    if (!index->started) {
+        return;
+    }
+    
+    pthread_mutex_lock(&index->queue_mutex);
+    *dropped = index->dropped;
+    pthread_mutex_unlock(&index->queue_mutex);
+    
+    pthread_mutex_lock(&index->mutex);
+    *messages = index->buffer.count;
+    *segments = index->segment_count;
+    for (int i = 0; i < index->segment_count; i++) {
+        *messages += index->segments[i]->doc_count;
+        *bytes += (long long)index->segments[i]->size;
+    }
+    pthread_mutex_unlock(&index->mutex);
+}
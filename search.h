@@ -0,0 +1,132 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "common.h"
+#include <stdint.h>
+#include <pthread.h>
+
+// Full-text index over messages sent and received.
+// The receive path only queues a copy; the index thread adds it to an
+// in-memory buffer. A full buffer is written out as an immutable segment:
+// sorted term dictionary, postings as varint doc ID deltas, then the
+// messages. With search_dir set segments are files mapped read-only, so a
+// restart opens them without reading them; otherwise the images stay in
+// memory. SEARCH_MERGE_FANIN segments of one size tier are merged into the
+// next tier, keeping the number a query has to visit logarithmic.
+
+#define SEARCH_TERM_LENGTH 32        // Longer words are indexed by their prefix
+#define SEARCH_MAX_TERMS 8           // Words of a query, the rest are ignored
+#define SEARCH_SOURCE_LENGTH 48      // "#topic", "ip:port" or "to ip:port"
+#define SEARCH_DIR_LENGTH 128
+#define SEARCH_PATH_LENGTH 256
+#define SEARCH_FLUSH_DOCS 32768       // Buffered messages written out as one segment
+#define SEARCH_MERGE_FANIN 4         // Segments of a size tier merged into one
+#define SEARCH_MAX_SEGMENTS 64
+#define SEARCH_QUEUE_LIMIT 65536     // Messages waiting for the index thread, more are dropped
+#define SEARCH_SEGMENT_FORMAT "%s/seg_%016llx_%ld_%u.idx"  // Directory, sequence, writer's pid, count
+
+// Message waiting in the queue or the buffer
+typedef struct SearchItem {
+    long long timestamp;             // Milliseconds since the epoch
+    char source[SEARCH_SOURCE_LENGTH];
+    uint32_t length;
+    struct SearchItem* next;
+    char text[];
+} SearchItem;
+
+// Buffered term and the buffered messages containing it. Terms outlive a
+// flush while they keep being used, so common words are not reallocated.
+typedef struct {
+    char* term;                      // NULL = free slot
+    uint32_t hash;
+    uint32_t count;                  // 0 = not in the current buffer
+    uint32_t capacity;
+    uint32_t* docs;                  // Ascending buffer positions
+} BufferTerm;
+
+// Messages not yet written to a segment
+typedef struct {
+    SearchItem** docs;
+    uint32_t count;
+    uint32_t capacity;
+    BufferTerm* terms;               // Open addressing, at most half full
+    uint32_t term_slots;
+    uint32_t term_count;             // Slots taken
+    uint32_t used_terms;             // Terms of the current buffer
+} SearchBuffer;
+
+// Immutable segment, mapped file or image in memory
+typedef struct {
+    char path[SEARCH_PATH_LENGTH];   // Empty = in memory
+    unsigned char* base;
+    size_t size;
+    uint64_t sequence;               // Order of creation, merged segments take the newest
+    uint32_t doc_count;
+    uint32_t term_count;
+    const unsigned char* terms;
+    const unsigned char* strings;
+    const unsigned char* postings;
+    const unsigned char* doc_table;
+    const unsigned char* docs;
+    int refs;                        // The list and merges in progress
+} Segment;
+
+// Index of a node
+typedef struct {
+    pthread_mutex_t mutex;           // Buffer and segment list
+    pthread_mutex_t queue_mutex;
+    pthread_cond_t queue_ready;
+    pthread_cond_t queue_idle;
+    SearchItem* head;
+    SearchItem* tail;
+    int queued;
+    int busy;                        // Index thread working on a batch
+    long long dropped;               // Messages lost to a full queue
+    int stopping;
+    int started;
+    pthread_t thread;
+    SearchBuffer buffer;
+    uint32_t flush_at;               // Buffer size that triggers the next flush
+    Segment* segments[SEARCH_MAX_SEGMENTS];  // Ascending sequence
+    int segment_count;
+    uint64_t next_sequence;
+    unsigned int written;            // Segment files this process wrote
+    char dir[SEARCH_DIR_LENGTH];     // Empty = segments stay in memory
+} SearchIndex;
+
+// Message found, copied out of the index
+typedef struct {
+    long long timestamp;
+    char source[SEARCH_SOURCE_LENGTH];
+    char* text;                      // Terminated, length excludes the terminator
+    uint32_t length;
+} SearchHit;
+
+// Index of this node
+extern SearchIndex node_index;
+
+// Open the segments in dir (empty = memory only) and start the index thread
+int search_open(SearchIndex* index, const char* dir);
+
+// Index what is queued, write the buffer out and stop. Safe to call twice.
+void search_close(SearchIndex* index);
+
+// Queue a message for indexing, -1 if dropped
+int search_add(SearchIndex* index, long long timestamp, const char* source,
+               const void* text, size_t length);
+
+// Messages containing every word of query, newest first. Fills up to max
+// hits, sets *total to all matches; returns the hit count or -1.
+// Free with search_free_hits.
+int search_query(SearchIndex* index, const char* query, int max,
+                 SearchHit** hits, long long* total);
+void search_free_hits(SearchHit* hits, int count);
+
+// Wait until everything queued is searchable (benchmarks)
+void search_sync(SearchIndex* index);
+
+// Messages indexed, segments and their bytes, messages dropped
+void search_stats(SearchIndex* index, long long* messages, int* segments,
+                  long long* bytes, long long* dropped);
+
+#endif // SEARCH_H
@@ -1,5 +1,4 @@
 #include "signal.h"
-#include "socket.h"
 #include <time.h>
 
 #ifdef _WIN32
@@ -66,8 +65,12 @@ void setup_signal_handlers(void) {
     signal(SIGINT, signal_handler);
     
     #ifndef _WIN32
-    // Unix/Linux specific signals
-    signal(SIGTERM, signal_handler);
+    // Unix/Linux specific signals; SIGTERM interrupts the blocked command read
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = signal_handler;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGTERM, &action, NULL);
     signal(SIGHUP, signal_handler);
     signal(SIGPIPE, SIG_IGN);  // Ignore broken pipe
     #endif
@@ -134,10 +137,10 @@ void print_banner(void) {
 }
 
 // Print startup information
-void print_startup_info(void) {
+void print_startup_info(const char* ip, int port) {
     printf("%s=== P2P Chat Application Started ===%s\n", COLOR_GREEN, COLOR_RESET);
-    printf("Local IP: %s%s%s\n", COLOR_YELLOW, local_ip, COLOR_RESET);
-    printf("Listening on port: %s%d%s\n", COLOR_YELLOW, listen_port, COLOR_RESET);
+    printf("Local IP: %s%s%s\n", COLOR_YELLOW, ip, COLOR_RESET);
+    printf("Listening on port: %s%d%s\n", COLOR_YELLOW, port, COLOR_RESET);
     printf("Type '%shelp%s' for available commands\n", COLOR_CYAN, COLOR_RESET);
     printf("%s====================================%s\n\n", COLOR_GREEN, COLOR_RESET);
 }
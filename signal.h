@@ -15,7 +15,7 @@ int is_empty_string(const char* str);
 
 // Display and UI functions
 void print_banner(void);
-void print_startup_info(void);
+void print_startup_info(const char* ip, int port);
 void print_prompt(void);
 void clear_screen(void);
 void print_error(const char* message);
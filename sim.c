@@ -0,0 +1,903 @@
+#include "common.h"
+#include "protocol.h"
+#include "topic.h"
+#include "roomlog.h"
+#include "pubsub.h"
+#include "config.h"
+#include <stdint.h>
+#include <getopt.h>
+#include <time.h>
+#ifdef __GLIBC__
+    #include <malloc.h>
+#endif
+
+// In-process network simulator: many logical nodes exchange real protocol
+// frames (HELLO, SUBSCRIBE deltas, sequenced ENTRY with cumulative ACKs,
+// DIGEST anti-entropy) over in-memory pipes driven by a deterministic,
+// seeded discrete-event scheduler. Room logs and anti-entropy run the
+// node's own code (roomlog.c, pubsub.c) through a RoomSync per node.
+
+// Defaults
+#define SIM_DEFAULT_NODES 10000
+#define SIM_DEFAULT_DEGREE 8
+#define SIM_DEFAULT_TOPICS 64
+#define SIM_DEFAULT_SUBSCRIPTIONS 4
+#define SIM_DEFAULT_LATENCY_US 500
+#define SIM_DEFAULT_BANDWIDTH_MBIT 100
+#define SIM_DEFAULT_PUBLISHES 10000
+#define SIM_DEFAULT_CHURN 1000
+#define SIM_DEFAULT_CATCHUP 1000
+#define SIM_DEFAULT_SEED 1
+#define SIM_RETRANSMIT_US 200000     // TCP minimum RTO, charged per lost frame
+#define SIM_PHASE_SPREAD_US 1000000  // Actions of a phase spread over 1s
+
+// Event kinds
+#define SIM_EVENT_CONNECTED 1        // Dialer finished TCP handshake
+#define SIM_EVENT_DELIVER   2        // Bytes arrive at the far end of a pipe
+#define SIM_EVENT_TOGGLE    3        // Node joins or leaves a topic
+#define SIM_EVENT_PUBLISH   4        // Node publishes to a topic
+#define SIM_EVENT_CATCHUP   5        // Node joins a topic with history
+
+// Simulation parameters
+typedef struct {
+    int nodes;
+    int degree;
+    int topics;
+    int subscriptions;
+    long long latency_us;
+    long long jitter_us;
+    double loss;                     // Probability per frame
+    double bandwidth;                // Bytes per second per direction
+    int publishes;
+    int churn;
+    int catchup;
+    uint64_t seed;
+} SimConfig;
+
+// Logical connection: two directed in-memory pipes
+typedef struct {
+    int node[2];                     // node[0] dialed node[1]
+    long long free_at[2];            // Pipe busy until (bandwidth), per direction
+    long long last_arrival[2];       // Keeps delivery in order, like TCP
+    uint64_t tx_seq[2];              // Last sequenced frame sent, per direction
+    uint64_t rx_seq[2];              // Last sequenced frame received, per direction
+} SimConn;
+
+struct Sim;
+
+// Logical node
+typedef struct {
+    struct Sim* sim;
+    int id;
+    TopicIndex topics;
+    RoomLog rooms;
+    RoomSync sync;                   // Anti-entropy over this node's pipes
+    int* conns;
+    int conn_count;
+    int conn_capacity;
+} SimNode;
+
+// Scheduled event
+typedef struct {
+    long long time_us;
+    uint64_t order;                  // Tie-break for determinism
+    int kind;
+    int conn;
+    int dir;                         // 0: node[0] -> node[1]
+    int arg1;
+    int arg2;
+    uint32_t length;
+    unsigned char* data;
+} SimEvent;
+
+// Per-phase counters
+typedef struct {
+    long long frames;
+    long long bytes;
+    long long retransmits;
+    long long last_update_us;        // Last index change or delivery
+} SimStats;
+
+// Simulator state
+typedef struct Sim {
+    SimConfig config;
+    SimNode* nodes;
+    SimConn* conns;
+    int conn_count;
+    SimEvent* heap;
+    int heap_count;
+    int heap_capacity;
+    uint64_t next_order;
+    uint64_t rng;
+    long long now_us;
+    SimStats stats;
+    long long* publish_time;
+    long long* latencies;
+    int latency_count;
+    int latency_capacity;
+    long long misdelivered;
+    long long repaired;              // Entries delivered by anti-entropy
+    uint64_t fingerprint;
+} Sim;
+
+// Pipe endpoint used as write_frame sink
+typedef struct {
+    Sim* sim;
+    int conn;
+    int dir;
+} SimPipe;
+
+// Deterministic PRNG (xorshift64*)
+static uint64_t sim_random(Sim* sim) {
+    sim->rng ^= sim->rng >> 12;
+    sim->rng ^= sim->rng << 25;
+    sim->rng ^= sim->rng >> 27;
+    return sim->rng * 2685821657736338717ULL;
+}
+
+// Uniform integer in [0, bound)
+static int sim_random_below(Sim* sim, int bound) {
+    return (int)(sim_random(sim) % (uint64_t)bound);
+}
+
+// Uniform double in [0, 1)
+static double sim_random_unit(Sim* sim) {
+    return (sim_random(sim) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Heap-allocated bytes, for memory per connection
+static size_t heap_in_use(void) {
+    #ifdef __GLIBC__
+        struct mallinfo2 info = mallinfo2();
+        return info.uordblks + info.hblkhd;
+    #else
+        return 0;
+    #endif
+}
+
+// Wall clock in microseconds
+static long long wall_clock_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Event ordering: time first, then scheduling order
+static int event_before(const SimEvent* a, const SimEvent* b) {
+    return a->time_us < b->time_us ||
+           (a->time_us == b->time_us && a->order < b->order);
+}
+
+// Push event onto min-heap
+static void schedule_event(Sim* sim, SimEvent event) {
+    if (sim->heap_count == sim->heap_capacity) {
+        int capacity = sim->heap_capacity ? sim->heap_capacity * 2 : 1024;
+        SimEvent* grown = realloc(sim->heap, capacity * sizeof(SimEvent));
+        if (grown == NULL) {
+            printf("Out of memory\n");
+            exit(1);
+        }
+        sim->heap = grown;
+        sim->heap_capacity = capacity;
+    }
+    
+    event.order = sim->next_order++;
+    int i = sim->heap_count++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!event_before(&event, &sim->heap[parent])) break;
+        sim->heap[i] = sim->heap[parent];
+        i = parent;
+    }
+    sim->heap[i] = event;
+}
+
+// Pop earliest event from min-heap
+static SimEvent pop_event(Sim* sim) {
+    SimEvent top = sim->heap[0];
+    SimEvent last = sim->heap[--sim->heap_count];
+    
+    int i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= sim->heap_count) break;
+        if (child + 1 < sim->heap_count &&
+            event_before(&sim->heap[child + 1], &sim->heap[child])) {
+            child++;
+        }
+        if (!event_before(&sim->heap[child], &last)) break;
+        sim->heap[i] = sim->heap[child];
+        i = child;
+    }
+    if (sim->heap_count > 0) {
+        sim->heap[i] = last;
+    }
+    
+    return top;
+}
+
+// write_frame sink: model serialization, latency and loss, then schedule delivery
+static int write_to_pipe(void* ctx, const void* data, size_t length) {
+    SimPipe* pipe = ctx;
+    Sim* sim = pipe->sim;
+    SimConn* conn = &sim->conns[pipe->conn];
+    int dir = pipe->dir;
+    
+    long long start = sim->now_us > conn->free_at[dir] ? sim->now_us : conn->free_at[dir];
+    conn->free_at[dir] = start + (long long)(length * 1000000.0 / sim->config.bandwidth);
+    
+    long long arrival = conn->free_at[dir] + sim->config.latency_us;
+    if (sim->config.jitter_us > 0) {
+        arrival += sim_random_below(sim, (int)sim->config.jitter_us + 1);
+    }
+    if (sim->config.loss > 0 && sim_random_unit(sim) < sim->config.loss) {
+        arrival += SIM_RETRANSMIT_US;
+        sim->stats.retransmits++;
+    }
+    
+    // Reliable, ordered stream: a late frame holds back the ones behind it
+    if (arrival < conn->last_arrival[dir]) {
+        arrival = conn->last_arrival[dir];
+    }
+    conn->last_arrival[dir] = arrival;
+    
+    SimEvent event;
+    memset(&event, 0, sizeof(event));
+    event.time_us = arrival;
+    event.kind = SIM_EVENT_DELIVER;
+    event.conn = pipe->conn;
+    event.dir = dir;
+    event.length = (uint32_t)length;
+    event.data = malloc(length);
+    if (event.data == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    memcpy(event.data, data, length);
+    schedule_event(sim, event);
+    
+    sim->stats.frames++;
+    sim->stats.bytes += length;
+    return (int)length;
+}
+
+// Send a frame from one end of a connection
+static void sim_send(Sim* sim, int conn, int from_node, uint8_t type, uint64_t seq,
+                     const void* payload, uint32_t length) {
+    SimPipe pipe = { sim, conn, sim->conns[conn].node[0] == from_node ? 0 : 1 };
+    write_frame(write_to_pipe, &pipe, type, seq, payload, length);
+}
+
+// Send a sequenced frame, numbered per direction like queue_to_connection
+static void sim_send_sequenced(Sim* sim, int conn, int from_node, uint8_t type,
+                               const void* payload, uint32_t length) {
+    int dir = sim->conns[conn].node[0] == from_node ? 0 : 1;
+    sim_send(sim, conn, from_node, type, ++sim->conns[conn].tx_seq[dir], payload, length);
+}
+
+// RoomSync sink: an unsequenced frame with flags, like send_control
+static int sim_send_sync(void* ctx, int conn_id, uint8_t type, uint8_t flags,
+                         const void* payload, uint32_t length) {
+    SimNode* node = ctx;
+    Sim* sim = node->sim;
+    SimPipe pipe = { sim, conn_id, sim->conns[conn_id].node[0] == node->id ? 0 : 1 };
+    return write_stream_frame(write_to_pipe, &pipe, type, flags, 0, payload, length);
+}
+
+// Open anti-entropy with every neighbour in a joined room, like sync_room
+static void sim_sync_room(Sim* sim, int node, const char* topic) {
+    SimNode* sim_node = &sim->nodes[node];
+    int* subscribers = malloc((sim_node->conn_count + 1) * sizeof(int));
+    if (subscribers == NULL) {
+        return;
+    }
+    
+    int count = topic_get_subscribers(&sim_node->topics, topic, subscribers,
+                                      sim_node->conn_count);
+    for (int i = 0; i < count; i++) {
+        room_sync_open(&sim_node->sync, subscribers[i], topic);
+    }
+    free(subscribers);
+}
+
+// Send node's full subscription set over a connection
+static void sim_send_subscriptions(Sim* sim, int node, int conn) {
+    char (*names)[MAX_TOPIC_LENGTH + 1];
+    int count = topic_get_joined(&sim->nodes[node].topics, &names);
+    
+    for (int i = 0; i < count; i++) {
+        sim_send(sim, conn, node, FRAME_SUBSCRIBE, 0, names[i], strlen(names[i]));
+    }
+    free(names);
+}
+
+// Send HELLO from node over a connection
+static void sim_send_hello(Sim* sim, int node, int conn) {
+    unsigned char payload[HELLO_PAYLOAD_SIZE];
+    HelloPayload hello = { (uint64_t)node + 1, 0, 0 };
+    
+    encode_hello(&hello, payload);
+    sim_send(sim, conn, node, FRAME_HELLO, 0, payload, sizeof(payload));
+}
+
+// Record a publish delivery latency
+static void record_latency(Sim* sim, long long latency) {
+    if (sim->latency_count == sim->latency_capacity) {
+        int capacity = sim->latency_capacity ? sim->latency_capacity * 2 : 4096;
+        long long* grown = realloc(sim->latencies, capacity * sizeof(long long));
+        if (grown == NULL) return;
+        sim->latencies = grown;
+        sim->latency_capacity = capacity;
+    }
+    sim->latencies[sim->latency_count++] = latency;
+}
+
+// Handle one frame at the receiving node, mirroring handle_frame
+static void sim_handle_frame(Sim* sim, int node, int conn, int outbound,
+                             const FrameHeader* header, const unsigned char* payload) {
+    SimNode* sim_node = &sim->nodes[node];
+    TopicIndex* topics = &sim_node->topics;
+    char topic[MAX_TOPIC_LENGTH + 1];
+    char message[BUFFER_SIZE];
+    EntryKey key;
+    int publish_id;
+    
+    switch (header->type) {
+        case FRAME_HELLO:
+            // Accepting side answers, then both sides send full subscription sets
+            if (!outbound) {
+                sim_send_hello(sim, node, conn);
+            }
+            topic_remove_connection(topics, conn);
+            sim_send_subscriptions(sim, node, conn);
+            break;
+            
+        case FRAME_SUBSCRIBE:
+        case FRAME_UNSUBSCRIBE:
+            if (header->length == 0 || header->length > MAX_TOPIC_LENGTH) break;
+            memcpy(topic, payload, header->length);
+            topic[header->length] = '\0';
+            if (strlen(topic) != header->length || !is_valid_topic(topic)) break;
+            if (header->type == FRAME_SUBSCRIBE) {
+                topic_add_subscriber(topics, topic, conn);
+                if (topic_is_joined(topics, topic)) {
+                    room_sync_open(&sim_node->sync, conn, topic);
+                }
+            } else {
+                topic_remove_subscriber(topics, topic, conn);
+            }
+            sim->stats.last_update_us = sim->now_us;
+            break;
+            
+        case FRAME_ENTRY:
+            topic[0] = '\0';
+            if (!room_sync_entry(&sim_node->sync, payload, header->length, &key,
+                                 topic, sizeof(topic), message, sizeof(message), NULL)) {
+                // Repairs may race a leave; a live publish never should
+                if (!(header->flags & FRAME_FLAG_SYNC) && topic[0] != '\0' &&
+                    !topic_is_joined(topics, topic)) {
+                    sim->misdelivered++;
+                }
+                break;
+            }
+            if (header->flags & FRAME_FLAG_SYNC) {
+                sim->repaired++;
+            } else if (sscanf(message, "simulated message %d", &publish_id) == 1) {
+                record_latency(sim, sim->now_us - sim->publish_time[publish_id]);
+            }
+            sim->fingerprint = sim->fingerprint * 31 + (uint64_t)sim->now_us;
+            sim->stats.last_update_us = sim->now_us;
+            break;
+            
+        case FRAME_DIGEST:
+            room_sync_digest(&sim_node->sync, conn, payload, header->length);
+            sim->stats.last_update_us = sim->now_us;
+            break;
+            
+        default:
+            break;
+    }
+}
+
+// Deliver pipe bytes: parse with the real frame reader, drop replayed
+// duplicates and acknowledge sequenced frames once per burst, like
+// receive_frames
+static void sim_deliver(Sim* sim, const SimEvent* event) {
+    SimConn* conn = &sim->conns[event->conn];
+    int node = conn->node[1 - event->dir];
+    int outbound = event->dir == 1;  // Receiver is the dialer
+    int unacked = 0;
+    FrameReader reader;
+    FrameHeader header;
+    const unsigned char* payload;
+    
+    frame_reader_init(&reader, event->data, event->length);
+    reader.used = event->length;
+    while (frame_reader_next(&reader, &header, &payload) > 0) {
+        if (header.type == FRAME_ACK) {
+            // Nothing is stored to trim: pipes never lose a frame
+        } else if (header.seq != 0 && header.seq <= conn->rx_seq[event->dir]) {
+            // Duplicate from a replay, already delivered
+        } else {
+            if (header.seq != 0) {
+                conn->rx_seq[event->dir] = header.seq;
+                unacked++;
+            }
+            sim_handle_frame(sim, node, event->conn, outbound, &header, payload);
+        }
+        frame_reader_consume(&reader, &header);
+    }
+    
+    if (unacked > 0) {
+        unsigned char ack[ACK_PAYLOAD_SIZE];
+        encode_u64(conn->rx_seq[event->dir], ack);
+        sim_send(sim, event->conn, node, FRAME_ACK, 0, ack, sizeof(ack));
+    }
+}
+
+// Join or leave a topic and announce the delta to every neighbour
+static void sim_toggle(Sim* sim, int node, int topic_number) {
+    SimNode* sim_node = &sim->nodes[node];
+    char topic[MAX_TOPIC_LENGTH + 1];
+    uint8_t type;
+    
+    snprintf(topic, sizeof(topic), "topic-%d", topic_number);
+    if (topic_is_joined(&sim_node->topics, topic)) {
+        topic_leave(&sim_node->topics, topic);
+        room_drop(&sim_node->rooms, topic);
+        type = FRAME_UNSUBSCRIBE;
+    } else {
+        topic_join(&sim_node->topics, topic);
+        type = FRAME_SUBSCRIBE;
+    }
+    
+    for (int i = 0; i < sim_node->conn_count; i++) {
+        sim_send(sim, sim_node->conns[i], node, type, 0, topic, strlen(topic));
+    }
+    
+    // Catch up from members we are already connected to, like p2p_join
+    if (type == FRAME_SUBSCRIBE) {
+        sim_sync_room(sim, node, topic);
+    }
+}
+
+// Join a topic the node is not in yet, if any, so it catches up on history
+static void sim_catchup(Sim* sim, int node, int topic_number) {
+    char topic[MAX_TOPIC_LENGTH + 1];
+    
+    for (int i = 0; i < sim->config.topics; i++) {
+        int candidate = (topic_number + i) % sim->config.topics;
+        snprintf(topic, sizeof(topic), "topic-%d", candidate);
+        if (!topic_is_joined(&sim->nodes[node].topics, topic)) {
+            sim_toggle(sim, node, candidate);
+            return;
+        }
+    }
+}
+
+// Log and send an ENTRY to subscribed neighbours only, like publish_to_topic
+static void sim_publish(Sim* sim, int node, int topic_number, int publish_id,
+                        long long* fanout) {
+    SimNode* sim_node = &sim->nodes[node];
+    char topic[MAX_TOPIC_LENGTH + 1];
+    char message[MAX_MESSAGE_LENGTH + 1];
+    unsigned char payload[MAX_FRAME_PAYLOAD];
+    int* subscribers = malloc((sim_node->conn_count + 1) * sizeof(int));
+    if (subscribers == NULL) {
+        return;
+    }
+    
+    snprintf(topic, sizeof(topic), "topic-%d", topic_number);
+    snprintf(message, sizeof(message), "simulated message %d", publish_id);
+    
+    // Simulated time keeps the keys, and so the run, reproducible
+    EntryKey key = room_next_key_at(&sim_node->rooms, (uint64_t)node + 1, sim->now_us / 1000);
+    int length = encode_entry(&key, topic, message, payload, sizeof(payload));
+    if (topic_is_joined(&sim_node->topics, topic)) {
+        room_insert(&sim_node->rooms, topic, &key, message, NULL);
+    }
+    int count = topic_get_subscribers(&sim_node->topics, topic, subscribers,
+                                      sim_node->conn_count);
+    
+    sim->publish_time[publish_id] = sim->now_us;
+    for (int i = 0; i < count; i++) {
+        sim_send_sequenced(sim, subscribers[i], node, FRAME_ENTRY, payload, length);
+    }
+    *fanout += count;
+    free(subscribers);
+}
+
+// Run events until the network is quiet
+static long long sim_run(Sim* sim, long long* fanout) {
+    long long events = 0;
+    
+    while (sim->heap_count > 0) {
+        SimEvent event = pop_event(sim);
+        sim->now_us = event.time_us;
+        events++;
+        
+        switch (event.kind) {
+            case SIM_EVENT_CONNECTED:
+                sim_send_hello(sim, sim->conns[event.conn].node[0], event.conn);
+                break;
+            case SIM_EVENT_DELIVER:
+                sim_deliver(sim, &event);
+                free(event.data);
+                break;
+            case SIM_EVENT_TOGGLE:
+                sim_toggle(sim, event.arg1, event.arg2);
+                break;
+            case SIM_EVENT_PUBLISH:
+                sim_publish(sim, event.arg1, event.arg2, event.conn, fanout);
+                break;
+            case SIM_EVENT_CATCHUP:
+                sim_catchup(sim, event.arg1, event.arg2);
+                break;
+        }
+    }
+    
+    return events;
+}
+
+// Attach connection to node
+static void attach_connection(SimNode* node, int conn) {
+    if (node->conn_count == node->conn_capacity) {
+        int capacity = node->conn_capacity ? node->conn_capacity * 2 : 4;
+        int* grown = realloc(node->conns, capacity * sizeof(int));
+        if (grown == NULL) {
+            printf("Out of memory\n");
+            exit(1);
+        }
+        node->conns = grown;
+        node->conn_capacity = capacity;
+    }
+    node->conns[node->conn_count++] = conn;
+}
+
+// Check whether two nodes are already connected
+static int nodes_connected(Sim* sim, int a, int b) {
+    for (int i = 0; i < sim->nodes[a].conn_count; i++) {
+        SimConn* conn = &sim->conns[sim->nodes[a].conns[i]];
+        if (conn->node[0] == b || conn->node[1] == b) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Verify every index entry matches the neighbour's joined set
+static long long verify_indexes(Sim* sim, long long* entries) {
+    long long errors = 0;
+    *entries = 0;
+    
+    for (int n = 0; n < sim->config.nodes; n++) {
+        TopicIndex* index = &sim->nodes[n].topics;
+        for (int b = 0; b < TOPIC_BUCKETS; b++) {
+            for (Topic* topic = index->table[b]; topic != NULL; topic = topic->next) {
+                for (int i = 0; i < topic->subscriber_count; i++) {
+                    SimConn* conn = &sim->conns[topic->subscribers[i]];
+                    int peer = conn->node[0] == n ? conn->node[1] : conn->node[0];
+                    if (!topic_is_joined(&sim->nodes[peer].topics, topic->name)) {
+                        errors++;
+                    }
+                    (*entries)++;
+                }
+            }
+        }
+    }
+    
+    // Every joined topic must be known on every neighbour
+    long long expected = 0;
+    for (int c = 0; c < sim->conn_count; c++) {
+        for (int side = 0; side < 2; side++) {
+            char (*names)[MAX_TOPIC_LENGTH + 1];
+            int count = topic_get_joined(&sim->nodes[sim->conns[c].node[side]].topics,
+                                         &names);
+            expected += count;
+            free(names);
+        }
+    }
+    
+    return errors + (expected > *entries ? expected - *entries : *entries - expected);
+}
+
+// Compare latencies for qsort
+static int compare_latency(const void* a, const void* b) {
+    long long x = *(const long long*)a;
+    long long y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+// Print phase summary and reset counters
+static void report_phase(Sim* sim, const char* name, long long start_us,
+                         long long events, long long wall_us) {
+    long long elapsed_us = sim->stats.last_update_us - start_us;
+    
+    printf("%-12s sim %8.2f ms | wall %8.2f ms | events %9lld | frames %9lld | "
+           "bytes %11lld | retransmits %lld\n", name,
+           (elapsed_us > 0 ? elapsed_us : 0) / 1000.0, wall_us / 1000.0,
+           events, sim->stats.frames, sim->stats.bytes, sim->stats.retransmits);
+    memset(&sim->stats, 0, sizeof(sim->stats));
+}
+
+// Print usage
+static void print_usage(const char* program) {
+    printf("Usage: %s [options]\n", program);
+    printf("  --nodes N          Logical nodes (default %d)\n", SIM_DEFAULT_NODES);
+    printf("  --degree K         Connections dialed per node (default %d)\n",
+           SIM_DEFAULT_DEGREE);
+    printf("  --topics T         Distinct topics (default %d)\n", SIM_DEFAULT_TOPICS);
+    printf("  --subscriptions S  Topics joined per node (default %d)\n",
+           SIM_DEFAULT_SUBSCRIPTIONS);
+    printf("  --latency US       One-way pipe latency in us (default %d)\n",
+           SIM_DEFAULT_LATENCY_US);
+    printf("  --jitter US        Random extra latency in us (default 0)\n");
+    printf("  --loss PERCENT     Frame loss, charged as a retransmit (default 0)\n");
+    printf("  --bandwidth MBIT   Pipe bandwidth per direction (default %d)\n",
+           SIM_DEFAULT_BANDWIDTH_MBIT);
+    printf("  --publishes M      Publishes in fan-out phase (default %d)\n",
+           SIM_DEFAULT_PUBLISHES);
+    printf("  --churn C          Join/leave deltas in churn phase (default %d)\n",
+           SIM_DEFAULT_CHURN);
+    printf("  --catchup J        Joins of rooms with history in catch-up phase (default %d)\n",
+           SIM_DEFAULT_CATCHUP);
+    printf("  --seed S           Scheduler seed (default %d)\n", SIM_DEFAULT_SEED);
+}
+
+// Parse command line into config, returns 0 on success
+static int parse_options(int argc, char* argv[], SimConfig* config) {
+    static struct option options[] = {
+        { "nodes", required_argument, NULL, 'n' },
+        { "degree", required_argument, NULL, 'd' },
+        { "topics", required_argument, NULL, 't' },
+        { "subscriptions", required_argument, NULL, 's' },
+        { "latency", required_argument, NULL, 'l' },
+        { "jitter", required_argument, NULL, 'j' },
+        { "loss", required_argument, NULL, 'o' },
+        { "bandwidth", required_argument, NULL, 'b' },
+        { "publishes", required_argument, NULL, 'p' },
+        { "churn", required_argument, NULL, 'c' },
+        { "catchup", required_argument, NULL, 'u' },
+        { "seed", required_argument, NULL, 'r' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    
+    config->nodes = SIM_DEFAULT_NODES;
+    config->degree = SIM_DEFAULT_DEGREE;
+    config->topics = SIM_DEFAULT_TOPICS;
+    config->subscriptions = SIM_DEFAULT_SUBSCRIPTIONS;
+    config->latency_us = SIM_DEFAULT_LATENCY_US;
+    config->jitter_us = 0;
+    config->loss = 0;
+    config->bandwidth = SIM_DEFAULT_BANDWIDTH_MBIT * 1000000.0 / 8;
+    config->publishes = SIM_DEFAULT_PUBLISHES;
+    config->churn = SIM_DEFAULT_CHURN;
+    config->catchup = SIM_DEFAULT_CATCHUP;
+    config->seed = SIM_DEFAULT_SEED;
+    
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", options, NULL)) != -1) {
+        switch (opt) {
+            case 'n': config->nodes = atoi(optarg); break;
+            case 'd': config->degree = atoi(optarg); break;
+            case 't': config->topics = atoi(optarg); break;
+            case 's': config->subscriptions = atoi(optarg); break;
+            case 'l': config->latency_us = atoll(optarg); break;
+            case 'j': config->jitter_us = atoll(optarg); break;
+            case 'o': config->loss = atof(optarg) / 100.0; break;
+            case 'b': config->bandwidth = atof(optarg) * 1000000.0 / 8; break;
+            case 'p': config->publishes = atoi(optarg); break;
+            case 'c': config->churn = atoi(optarg); break;
+            case 'u': config->catchup = atoi(optarg); break;
+            case 'r': config->seed = strtoull(optarg, NULL, 10); break;
+            default: return -1;
+        }
+    }
+    
+    if (config->nodes < 2 || config->degree < 1 || config->degree >= config->nodes ||
+        config->topics < 1 || config->subscriptions < 0 ||
+        config->subscriptions > config->topics || config->bandwidth <= 0) {
+        printf("Error: Invalid simulation parameters\n");
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    Sim sim;
+    memset(&sim, 0, sizeof(sim));
+    
+    if (parse_options(argc, argv, &sim.config) < 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    SimConfig* config = &sim.config;
+    sim.rng = config->seed * 0x9E3779B97F4A7C15ULL + 1;
+    
+    printf("=== P2P Network Simulation ===\n");
+    printf("Nodes: %d | Degree: %d | Topics: %d | Joined per node: %d\n",
+           config->nodes, config->degree, config->topics, config->subscriptions);
+    printf("Latency: %lld us (+%lld jitter) | Loss: %.2f%% | Bandwidth: %.0f Mbit/s "
+           "| Seed: %llu\n\n", config->latency_us, config->jitter_us,
+           config->loss * 100, config->bandwidth * 8 / 1000000.0,
+           (unsigned long long)config->seed);
+    
+    // Nodes with their initial subscriptions
+    sim.nodes = calloc(config->nodes, sizeof(SimNode));
+    sim.conns = calloc((size_t)config->nodes * config->degree, sizeof(SimConn));
+    sim.publish_time = calloc(config->publishes + 1, sizeof(long long));
+    if (sim.nodes == NULL || sim.conns == NULL || sim.publish_time == NULL) {
+        printf("Out of memory\n");
+        return 1;
+    }
+    
+    for (int n = 0; n < config->nodes; n++) {
+        SimNode* node = &sim.nodes[n];
+        node->sim = &sim;
+        node->id = n;
+        init_topics(&node->topics);
+        init_rooms(&node->rooms, ROOM_LOG_ENTRIES);
+        node->sync.topics = &node->topics;
+        node->sync.rooms = &node->rooms;
+        node->sync.send = sim_send_sync;
+        node->sync.ctx = node;
+        for (int joined = 0; joined < config->subscriptions; ) {
+            char topic[MAX_TOPIC_LENGTH + 1];
+            snprintf(topic, sizeof(topic), "topic-%d", sim_random_below(&sim, config->topics));
+            if (topic_join(&sim.nodes[n].topics, topic) == 0) {
+                joined++;
+            }
+        }
+    }
+    
+    // Phase 1: every node dials random peers, handshake and subscription sync
+    size_t heap_before = heap_in_use();
+    long long wall_start = wall_clock_us();
+    
+    for (int n = 0; n < config->nodes; n++) {
+        for (int k = 0; k < config->degree; k++) {
+            int peer;
+            do {
+                peer = sim_random_below(&sim, config->nodes);
+            } while (peer == n || nodes_connected(&sim, n, peer));
+            
+            int c = sim.conn_count++;
+            sim.conns[c].node[0] = n;
+            sim.conns[c].node[1] = peer;
+            attach_connection(&sim.nodes[n], c);
+            attach_connection(&sim.nodes[peer], c);
+            
+            // SYN / SYN-ACK round trip before the dialer can send
+            SimEvent event;
+            memset(&event, 0, sizeof(event));
+            event.kind = SIM_EVENT_CONNECTED;
+            event.conn = c;
+            event.time_us = sim_random_below(&sim, SIM_PHASE_SPREAD_US) +
+                            2 * config->latency_us;
+            schedule_event(&sim, event);
+        }
+    }
+    
+    long long fanout = 0;
+    long long events = sim_run(&sim, &fanout);
+    long long converged_us = sim.stats.last_update_us;
+    report_phase(&sim, "Mesh build", 0, events, wall_clock_us() - wall_start);
+    
+    long long entries;
+    long long errors = verify_indexes(&sim, &entries);
+    size_t heap_after = heap_in_use();
+    
+    // Phase 2: incremental subscription churn
+    long long phase_start = converged_us;
+    for (int i = 0; i < config->churn; i++) {
+        SimEvent event;
+        memset(&event, 0, sizeof(event));
+        event.kind = SIM_EVENT_TOGGLE;
+        event.time_us = phase_start + sim_random_below(&sim, SIM_PHASE_SPREAD_US);
+        event.arg1 = sim_random_below(&sim, config->nodes);
+        event.arg2 = sim_random_below(&sim, config->topics);
+        schedule_event(&sim, event);
+    }
+    
+    long long full_resync_bytes = 0;
+    long long subscribe_frame = FRAME_HEADER_SIZE + (long long)strlen("topic-00");
+    for (int i = 0; i < config->churn; i++) {
+        // A full resync would resend every joined topic to every neighbour
+        full_resync_bytes += (long long)config->subscriptions * subscribe_frame *
+                             2 * config->degree;
+    }
+    
+    wall_start = wall_clock_us();
+    events = sim_run(&sim, &fanout);
+    long long churn_bytes = sim.stats.bytes;
+    if (sim.stats.last_update_us < phase_start) {
+        sim.stats.last_update_us = phase_start;
+    }
+    long long churn_end = sim.stats.last_update_us;
+    report_phase(&sim, "Churn", phase_start, events, wall_clock_us() - wall_start);
+    phase_start = churn_end;
+    errors += verify_indexes(&sim, &entries);
+    
+    // Phase 3: publishes fan out to subscribed neighbours only
+    for (int i = 0; i < config->publishes; i++) {
+        SimEvent event;
+        memset(&event, 0, sizeof(event));
+        event.kind = SIM_EVENT_PUBLISH;
+        event.time_us = phase_start + sim_random_below(&sim, SIM_PHASE_SPREAD_US);
+        event.arg1 = sim_random_below(&sim, config->nodes);
+        event.arg2 = sim_random_below(&sim, config->topics);
+        event.conn = i;
+        schedule_event(&sim, event);
+    }
+    
+    fanout = 0;
+    wall_start = wall_clock_us();
+    events = sim_run(&sim, &fanout);
+    if (sim.stats.last_update_us < phase_start) {
+        sim.stats.last_update_us = phase_start;
+    }
+    long long fanout_end = sim.stats.last_update_us;
+    report_phase(&sim, "Fan-out", phase_start, events, wall_clock_us() - wall_start);
+    phase_start = fanout_end;
+    
+    // Phase 4: nodes join rooms with history and catch up by anti-entropy
+    for (int i = 0; i < config->catchup; i++) {
+        SimEvent event;
+        memset(&event, 0, sizeof(event));
+        event.kind = SIM_EVENT_CATCHUP;
+        event.time_us = phase_start + sim_random_below(&sim, SIM_PHASE_SPREAD_US);
+        event.arg1 = sim_random_below(&sim, config->nodes);
+        event.arg2 = sim_random_below(&sim, config->topics);
+        schedule_event(&sim, event);
+    }
+    
+    wall_start = wall_clock_us();
+    events = sim_run(&sim, &fanout);
+    long long catchup_bytes = sim.stats.bytes;
+    report_phase(&sim, "Catch-up", phase_start, events, wall_clock_us() - wall_start);
+    errors += verify_indexes(&sim, &entries);
+    
+    // Results
+    printf("\n=== Results ===\n");
+    printf("Connections:            %d\n", sim.conn_count);
+    printf("Mesh convergence:       %.2f ms simulated\n", converged_us / 1000.0);
+    printf("Index entries:          %lld (%lld mismatches)\n", entries, errors);
+    printf("Churn delta bytes:      %lld (full resync would be ~%lld)\n",
+           churn_bytes, full_resync_bytes);
+    printf("Fan-out per publish:    %.2f frames (broadcast would be %.2f)\n",
+           config->publishes ? (double)fanout / config->publishes : 0.0,
+           2.0 * config->degree);
+    printf("Misdelivered publishes: %lld\n", sim.misdelivered);
+    printf("Catch-up repairs:       %lld entries in %lld bytes\n",
+           sim.repaired, catchup_bytes);
+    
+    if (sim.latency_count > 0) {
+        qsort(sim.latencies, sim.latency_count, sizeof(long long), compare_latency);
+        printf("Publish latency:        p50 %lld us | p99 %lld us | max %lld us\n",
+               sim.latencies[sim.latency_count / 2],
+               sim.latencies[(long long)sim.latency_count * 99 / 100],
+               sim.latencies[sim.latency_count - 1]);
+    }
+    
+    if (heap_after > heap_before) {
+        printf("Sim memory/connection:  %.0f bytes (index entries + pipe state)\n",
+               (double)(heap_after - heap_before) / sim.conn_count + sizeof(SimConn));
+    }
+    printf("Fingerprint:            %016llx\n", (unsigned long long)sim.fingerprint);
+    
+    // Cleanup
+    for (int n = 0; n < config->nodes; n++) {
+        free_topics(&sim.nodes[n].topics);
+        free_rooms(&sim.nodes[n].rooms);
+        free(sim.nodes[n].conns);
+    }
+    free(sim.nodes);
+    free(sim.conns);
+    free(sim.heap);
+    free(sim.publish_time);
+    free(sim.latencies);
+    
+    return errors == 0 && sim.misdelivered == 0 ? 0 : 1;
+}
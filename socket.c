@@ -1,19 +1,53 @@
 #include "socket.h"
+#include "config.h"
+#include "timeutil.h"
+#include <stdint.h>
+
+#ifndef _WIN32
+    #include <netinet/tcp.h>
+    #include <poll.h>
+    #include <fcntl.h>
+    #ifdef __linux__
+        #include <sys/eventfd.h>
+    #endif
+#else
+    #define poll WSAPoll
+#endif
+
+// Don't raise SIGPIPE in an embedding process when a peer goes away
+#ifdef MSG_NOSIGNAL
+    #define SEND_FLAGS MSG_NOSIGNAL
+#else
+    #define SEND_FLAGS 0
+#endif
 
 // Global socket variables
 SOCKET listen_socket = INVALID_SOCKET;
 int listen_port = 0;
 char local_ip[INET_ADDRSTRLEN];
 
+// Stop signal for blocked waits: an eventfd, or the read end of a self-pipe.
+// It stays readable once raised, so every waiting thread sees it.
+static int wake_fds[2] = { -1, -1 };
+
+// Cuts short the reconnect thread's wait when there is a peer to dial now
+static int nudge_fds[2] = { -1, -1 };
+
+// Tells the park thread its set of parked sockets changed
+static int park_fds[2] = { -1, -1 };
+
+// Tells the spin thread a connection was added to or dropped from its set
+static int spin_fds[2] = { -1, -1 };
+
 // Initialize socket library (Windows specific)
-void initialize_sockets(void) {
+int initialize_sockets(void) {
     #ifdef _WIN32
     WSADATA wsaData;
     if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
-        printf("WSAStartup failed\n");
-        exit(1);
+        return -1;
     }
     #endif
+    return 0;
 }
 
 // Cleanup socket library (Windows specific)
@@ -23,8 +57,13 @@ void cleanup_sockets(void) {
     #endif
 }
 
-// Get local IP address
+// Get local IP address, the configured one if set
 void get_local_ip(void) {
+    if (node_config.local_ip[0] != '\0') {
+        strcpy(local_ip, node_config.local_ip);
+        return;
+    }
+    
     #ifdef _WIN32
     char hostname[256];
     struct hostent* host;
@@ -81,11 +120,159 @@ int is_valid_port(int port) {
     return port > 0 && port <= 65535;
 }
 
+// Set an integer socket option, returns 0 on success
+static int set_int_option(SOCKET sock, int level, int option, int value) {
+    return setsockopt(sock, level, option, (char*)&value, sizeof(value));
+}
+
+// Apply tuning options from the node configuration.
+// Options the OS rejects are skipped; config show reports what took effect.
+void apply_socket_options(SOCKET sock) {
+    if (node_config.sndbuf > 0) {
+        set_int_option(sock, SOL_SOCKET, SO_SNDBUF, node_config.sndbuf);
+    }
+    if (node_config.rcvbuf > 0) {
+        set_int_option(sock, SOL_SOCKET, SO_RCVBUF, node_config.rcvbuf);
+    }
+    if (node_config.tcp_nodelay) {
+        set_int_option(sock, IPPROTO_TCP, TCP_NODELAY, 1);
+    }
+    
+    if (node_config.keepalive) {
+        set_int_option(sock, SOL_SOCKET, SO_KEEPALIVE, 1);
+        #ifdef TCP_KEEPIDLE
+        if (node_config.keepalive_idle > 0) {
+            set_int_option(sock, IPPROTO_TCP, TCP_KEEPIDLE, node_config.keepalive_idle);
+        }
+        #elif defined(TCP_KEEPALIVE)
+        if (node_config.keepalive_idle > 0) {
+            set_int_option(sock, IPPROTO_TCP, TCP_KEEPALIVE, node_config.keepalive_idle);
+        }
+        #endif
+        #ifdef TCP_KEEPINTVL
+        if (node_config.keepalive_interval > 0) {
+            set_int_option(sock, IPPROTO_TCP, TCP_KEEPINTVL, node_config.keepalive_interval);
+        }
+        #endif
+        #ifdef TCP_KEEPCNT
+        if (node_config.keepalive_count > 0) {
+            set_int_option(sock, IPPROTO_TCP, TCP_KEEPCNT, node_config.keepalive_count);
+        }
+        #endif
+    }
+    
+    #ifdef TCP_USER_TIMEOUT
+    if (node_config.user_timeout > 0) {
+        set_int_option(sock, IPPROTO_TCP, TCP_USER_TIMEOUT, node_config.user_timeout);
+    }
+    #endif
+    #ifdef SO_BUSY_POLL
+    if (node_config.busy_poll > 0) {
+        set_int_option(sock, SOL_SOCKET, SO_BUSY_POLL, node_config.busy_poll);
+    }
+    #endif
+}
+
+// Read back a tuning option as the OS applied it.
+// Returns 0, or -1 if the key is not a socket option on this platform.
+int get_socket_option(SOCKET sock, const char* key, int* value) {
+    int level = SOL_SOCKET;
+    int option;
+    
+    if (strcmp(key, "sndbuf") == 0) {
+        option = SO_SNDBUF;
+    } else if (strcmp(key, "rcvbuf") == 0) {
+        option = SO_RCVBUF;
+    } else if (strcmp(key, "keepalive") == 0) {
+        option = SO_KEEPALIVE;
+    } else if (strcmp(key, "tcp_nodelay") == 0) {
+        level = IPPROTO_TCP;
+        option = TCP_NODELAY;
+    #ifdef TCP_KEEPIDLE
+    } else if (strcmp(key, "keepalive_idle") == 0) {
+        level = IPPROTO_TCP;
+        option = TCP_KEEPIDLE;
+    #endif
+    #ifdef TCP_KEEPINTVL
+    } else if (strcmp(key, "keepalive_interval") == 0) {
+        level = IPPROTO_TCP;
+        option = TCP_KEEPINTVL;
+    #endif
+    #ifdef TCP_KEEPCNT
+    } else if (strcmp(key, "keepalive_count") == 0) {
+        level = IPPROTO_TCP;
+        option = TCP_KEEPCNT;
+    #endif
+    #ifdef TCP_USER_TIMEOUT
+    } else if (strcmp(key, "user_timeout") == 0) {
+        level = IPPROTO_TCP;
+        option = TCP_USER_TIMEOUT;
+    #endif
+    #ifdef SO_BUSY_POLL
+    } else if (strcmp(key, "busy_poll") == 0) {
+        option = SO_BUSY_POLL;
+    #endif
+    } else {
+        return -1;
+    }
+    
+    socklen_t length = sizeof(*value);
+    *value = 0;
+    if (getsockopt(sock, level, option, (char*)value, &length) < 0) {
+        return -1;
+    }
+    if (option == SO_KEEPALIVE || (level == IPPROTO_TCP && option == TCP_NODELAY)) {
+        *value = *value != 0;
+    }
+    return 0;
+}
+
+// Make blocking sends on sock fail after timeout_ms
+void set_send_timeout(SOCKET sock, int timeout_ms) {
+    #ifdef _WIN32
+    DWORD timeout = (DWORD)timeout_ms;
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (char*)&timeout, sizeof(timeout));
+    #else
+    struct timeval timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    #endif
+}
+
+// Send timeout of sock in milliseconds, 0 if sends may block forever
+int get_send_timeout(SOCKET sock) {
+    #ifdef _WIN32
+    DWORD timeout = 0;
+    int length = sizeof(timeout);
+    if (getsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (char*)&timeout, &length) < 0) {
+        return 0;
+    }
+    return (int)timeout;
+    #else
+    struct timeval timeout;
+    socklen_t length = sizeof(timeout);
+    if (getsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, &length) < 0) {
+        return 0;
+    }
+    return (int)(timeout.tv_sec * 1000 + timeout.tv_usec / 1000);
+    #endif
+}
+
+// Cap unsent bytes the kernel accepts ahead of later frames (no-op where unsupported)
+void set_notsent_lowat(SOCKET sock, int bytes) {
+    #ifdef TCP_NOTSENT_LOWAT
+    set_int_option(sock, IPPROTO_TCP, TCP_NOTSENT_LOWAT, bytes);
+    #else
+    (void)sock;
+    (void)bytes;
+    #endif
+}
+
 // Create a new socket
 SOCKET create_socket(void) {
     SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
     if (sock == INVALID_SOCKET) {
-        printf("Failed to create socket\n");
         return INVALID_SOCKET;
     }
     
@@ -93,11 +280,11 @@ SOCKET create_socket(void) {
     int opt = 1;
     if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, 
                    (char*)&opt, sizeof(opt)) < 0) {
-        printf("setsockopt failed\n");
         close(sock);
         return INVALID_SOCKET;
     }
     
+    apply_socket_options(sock);
     return sock;
 }
 
@@ -117,47 +304,287 @@ int setup_listening_socket(int port) {
     
     if (bind(listen_socket, (struct sockaddr*)&server_addr, 
              sizeof(server_addr)) < 0) {
-        printf("Bind failed on port %d\n", port);
         close(listen_socket);
+        listen_socket = INVALID_SOCKET;
         return -1;
     }
     
-    if (listen(listen_socket, BACKLOG) < 0) {
-        printf("Listen failed\n");
+    if (listen(listen_socket, node_config.backlog) < 0) {
         close(listen_socket);
+        listen_socket = INVALID_SOCKET;
         return -1;
     }
     
+    set_listen_nonblocking();
     listen_port = port;
-    printf("Listening on port %d\n", port);
     return 0;
 }
 
-// Accept client connection
-SOCKET accept_client(struct sockaddr_in* client_addr) {
-    socklen_t addr_len = sizeof(*client_addr);
-    return accept(listen_socket, (struct sockaddr*)client_addr, &addr_len);
+// Let accept_client find the listen queue empty instead of blocking, so
+// one wakeup can drain it (Windows keeps a blocking listener)
+void set_listen_nonblocking(void) {
+    #ifndef _WIN32
+    fcntl(listen_socket, F_SETFL, fcntl(listen_socket, F_GETFL, 0) | O_NONBLOCK);
+    #endif
 }
 
-// Connect to a peer
-int connect_to_peer(const char* ip, int port, SOCKET* sock) {
-    *sock = create_socket();
-    if (*sock == INVALID_SOCKET) {
+// UDP socket in multicast group:port, sending there with TTL 1 and
+// looped back to this host. It joins on the interface of interface_ip, or
+// when empty the routed one, falling back to loopback on a host without a
+// route. Non-blocking; fills in target. INVALID_SOCKET on failure.
+SOCKET open_multicast_socket(const char* group, int port, const char* interface_ip,
+                             struct sockaddr_in* target) {
+    struct ip_mreq membership;
+    memset(&membership, 0, sizeof(membership));
+    if (inet_pton(AF_INET, group, &membership.imr_multiaddr) != 1 ||
+        !IN_MULTICAST(ntohl(membership.imr_multiaddr.s_addr))) {
+        return INVALID_SOCKET;
+    }
+    membership.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (interface_ip[0] != '\0' &&
+        inet_pton(AF_INET, interface_ip, &membership.imr_interface) != 1) {
+        return INVALID_SOCKET;
+    }
+    
+    SOCKET sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock == INVALID_SOCKET) {
+        return INVALID_SOCKET;
+    }
+    
+    // Every node on the host binds the same port and gets every announcement
+    set_int_option(sock, SOL_SOCKET, SO_REUSEADDR, 1);
+    #if defined(SO_REUSEPORT) && !defined(__linux__)
+    set_int_option(sock, SOL_SOCKET, SO_REUSEPORT, 1);
+    #endif
+    
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(sock);
+        return INVALID_SOCKET;
+    }
+    
+    int joined = setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+                            (char*)&membership, sizeof(membership)) == 0;
+    if (!joined && interface_ip[0] == '\0') {
+        membership.imr_interface.s_addr = htonl(INADDR_LOOPBACK);
+        joined = setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+                            (char*)&membership, sizeof(membership)) == 0;
+    }
+    if (!joined) {
+        close(sock);
+        return INVALID_SOCKET;
+    }
+    if (membership.imr_interface.s_addr != htonl(INADDR_ANY)) {
+        setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, (char*)&membership.imr_interface,
+                   sizeof(membership.imr_interface));
+    }
+    
+    // Stay on the local segment, and reach nodes on this host too
+    unsigned char ttl = 1;
+    unsigned char loop = 1;
+    setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, (char*)&ttl, sizeof(ttl));
+    setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, (char*)&loop, sizeof(loop));
+    
+    #ifdef _WIN32
+    u_long nonblocking = 1;
+    ioctlsocket(sock, FIONBIO, &nonblocking);
+    #else
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+    #endif
+    
+    memset(target, 0, sizeof(*target));
+    target->sin_family = AF_INET;
+    target->sin_addr = membership.imr_multiaddr;
+    target->sin_port = htons(port);
+    return sock;
+}
+
+// Take the next pending connection: 1 with *sock set, 0 if none is
+// pending, -1 on error. Peer sockets are blocking.
+int accept_client(SOCKET* sock, struct sockaddr_in* client_addr) {
+    for (;;) {
+        socklen_t addr_len = sizeof(*client_addr);
+        #ifdef __linux__
+        // Linux accept4 does not pass on O_NONBLOCK from the listener
+        *sock = accept4(listen_socket, (struct sockaddr*)client_addr, &addr_len, SOCK_CLOEXEC);
+        #else
+        *sock = accept(listen_socket, (struct sockaddr*)client_addr, &addr_len);
+        #endif
+        if (*sock != INVALID_SOCKET) {
+            break;
+        }
+        
+        // A peer that gave up while queued only costs a retry
+        #ifndef _WIN32
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        if (errno != EINTR && errno != ECONNABORTED && errno != EPROTO) {
+            return -1;
+        }
+        #else
+        return -1;
+        #endif
+    }
+    
+    #if !defined(__linux__) && !defined(_WIN32)
+    fcntl(*sock, F_SETFL, fcntl(*sock, F_GETFL, 0) & ~O_NONBLOCK);
+    #endif
+    
+    // Not every platform inherits options from the listening socket
+    apply_socket_options(*sock);
+    return 1;
+}
+
+// Reset a connection instead of closing it gracefully: no FIN handshake
+// and no TIME_WAIT left behind (shedding load)
+void reset_socket(SOCKET sock) {
+    struct linger linger;
+    linger.l_onoff = 1;
+    linger.l_linger = 0;
+    setsockopt(sock, SOL_SOCKET, SO_LINGER, (char*)&linger, sizeof(linger));
+    close(sock);
+}
+
+// Poll fds, treating EINTR as a timeout; the wakeup descriptor is watched
+// too (pfd[count]). Without one, infinite waits are capped at WAKE_POLL_MS.
+static int poll_with_wakeup(struct pollfd* pfd, int count, int timeout_ms) {
+    pfd[count].fd = wake_fds[0];
+    pfd[count].events = POLLIN;
+    for (int i = 0; i <= count; i++) {
+        pfd[i].revents = 0;
+    }
+    
+    if (wake_fds[0] < 0) {
+        count--;
+        if (timeout_ms < 0 || timeout_ms > WAKE_POLL_MS) {
+            timeout_ms = WAKE_POLL_MS;
+        }
+    }
+    
+    int ready = poll(pfd, count + 1, timeout_ms);
+    if (ready < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    return ready;
+}
+
+// Start a non-blocking dial: 1 = connected, 0 = in progress, -1 = failed
+static int start_dial(DialTarget* target) {
+    target->sock = create_socket();
+    if (target->sock == INVALID_SOCKET) {
         return -1;
     }
     
     struct sockaddr_in peer_addr;
     memset(&peer_addr, 0, sizeof(peer_addr));
     peer_addr.sin_family = AF_INET;
-    peer_addr.sin_port = htons(port);
-    inet_pton(AF_INET, ip, &peer_addr.sin_addr);
+    peer_addr.sin_port = htons(target->port);
+    inet_pton(AF_INET, target->ip, &peer_addr.sin_addr);
     
-    if (connect(*sock, (struct sockaddr*)&peer_addr, sizeof(peer_addr)) < 0) {
-        close(*sock);
-        return -1;
+    #ifndef _WIN32
+    fcntl(target->sock, F_SETFL, fcntl(target->sock, F_GETFL, 0) | O_NONBLOCK);
+    #endif
+    
+    if (connect(target->sock, (struct sockaddr*)&peer_addr, sizeof(peer_addr)) == 0) {
+        return 1;
+    }
+    return errno == EINPROGRESS ? 0 : -1;
+}
+
+// Settle a dial: blocking again when connected, closed when not
+static void end_dial(DialTarget* target, int connected, long long start_ms) {
+    if (!connected) {
+        close(target->sock);
+        target->sock = INVALID_SOCKET;
+        return;
     }
+    #ifndef _WIN32
+    fcntl(target->sock, F_SETFL, fcntl(target->sock, F_GETFL, 0) & ~O_NONBLOCK);
+    #endif
+    target->connect_ms = (int)(get_monotonic_ms() - start_ms);
+}
+
+// Dial every target at once, giving up after CONNECT_TIMEOUT_MS or on
+// wakeup. Each target gets its socket (INVALID_SOCKET on failure) and how
+// long the connect took; returns how many connected.
+int connect_peers(DialTarget* targets, int count) {
+    long long start = get_monotonic_ms();
+    int connected = 0;
+    int pending = 0;
     
-    return 0;
+    struct pollfd* pfd = malloc((count + 1) * sizeof(struct pollfd));
+    if (pfd == NULL) {
+        for (int i = 0; i < count; i++) {
+            targets[i].sock = INVALID_SOCKET;
+        }
+        return 0;
+    }
+    
+    for (int i = 0; i < count; i++) {
+        targets[i].connect_ms = -1;
+        pfd[i].fd = -1;
+        pfd[i].events = POLLOUT;
+        int result = start_dial(&targets[i]);
+        if (result == 0) {
+            pfd[i].fd = targets[i].sock;
+            pending++;
+        } else if (targets[i].sock != INVALID_SOCKET) {
+            end_dial(&targets[i], result > 0, start);
+            connected += result > 0;
+        }
+    }
+    
+    // Negative descriptors are skipped by poll, finished dials drop out
+    long long deadline = start + CONNECT_TIMEOUT_MS;
+    while (pending > 0) {
+        int remaining = (int)(deadline - get_monotonic_ms());
+        if (remaining <= 0) {
+            break;
+        }
+        int ready = poll_with_wakeup(pfd, count, remaining);
+        if (ready < 0 || (ready > 0 && pfd[count].revents != 0 && wake_fds[0] >= 0)) {
+            break;
+        }
+        for (int i = 0; i < count && ready > 0; i++) {
+            if (pfd[i].fd < 0 || pfd[i].revents == 0) {
+                continue;
+            }
+            int error = 0;
+            socklen_t length = sizeof(error);
+            int ok = getsockopt(targets[i].sock, SOL_SOCKET, SO_ERROR, (char*)&error, &length) == 0 &&
+                     error == 0;
+            end_dial(&targets[i], ok, start);
+            connected += ok;
+            pfd[i].fd = -1;
+            pending--;
+        }
+    }
+    
+    // Timed out or woken
+    for (int i = 0; i < count; i++) {
+        if (pfd[i].fd >= 0) {
+            end_dial(&targets[i], 0, start);
+        }
+    }
+    
+    free(pfd);
+    return connected;
+}
+
+// Connect to a peer, giving up after CONNECT_TIMEOUT_MS or on wakeup
+int connect_to_peer(const char* ip, int port, SOCKET* sock) {
+    DialTarget target;
+    snprintf(target.ip, sizeof(target.ip), "%s", ip);
+    target.port = port;
+    
+    connect_peers(&target, 1);
+    *sock = target.sock;
+    return target.sock != INVALID_SOCKET ? 0 : -1;
 }
 
 // Send message through socket
@@ -165,6 +592,216 @@ int send_message(SOCKET sock, const char* message) {
     return send(sock, message, strlen(message), 0);
 }
 
+// Send a whole buffer with flags, retrying on partial writes
+static int send_all_flags(SOCKET sock, const void* data, size_t length, int flags) {
+    const char* ptr = (const char*)data;
+    size_t remaining = length;
+    
+    while (remaining > 0) {
+        int sent = send(sock, ptr, remaining, SEND_FLAGS | flags);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        ptr += sent;
+        remaining -= sent;
+    }
+    
+    return (int)length;
+}
+
+// Send a whole buffer, retrying on partial writes
+int send_all(SOCKET sock, const void* data, size_t length) {
+    return send_all_flags(sock, data, length, 0);
+}
+
+// Send a whole buffer that more data will follow shortly
+int send_all_more(SOCKET sock, const void* data, size_t length) {
+    #ifdef MSG_MORE
+    return send_all_flags(sock, data, length, MSG_MORE);
+    #else
+    return send_all_flags(sock, data, length, 0);
+    #endif
+}
+
+// Open an eventfd, or a self-pipe, for signalling between threads
+static int open_signal(int fds[2]) {
+    #ifdef _WIN32
+    (void)fds;
+    return 0;
+    #elif defined(__linux__)
+    fds[0] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    fds[1] = fds[0];
+    return fds[0] < 0 ? -1 : 0;
+    #else
+    if (pipe(fds) < 0) {
+        fds[0] = fds[1] = -1;
+        return -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL, 0) | O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    return 0;
+    #endif
+}
+
+// Close a signal descriptor
+static void close_signal(int fds[2]) {
+    #ifndef _WIN32
+    if (fds[1] != fds[0] && fds[1] >= 0) {
+        close(fds[1]);
+    }
+    if (fds[0] >= 0) {
+        close(fds[0]);
+    }
+    fds[0] = fds[1] = -1;
+    #else
+    (void)fds;
+    #endif
+}
+
+// Make a signal descriptor readable
+static void raise_signal(int fds[2]) {
+    #ifndef _WIN32
+    uint64_t one = 1;
+    if (fds[1] >= 0 && write(fds[1], &one, sizeof(one)) < 0) {
+        // Already raised, the counter or pipe is full
+    }
+    #else
+    (void)fds;
+    #endif
+}
+
+// Make a signal descriptor unreadable again
+static void drain_signal(int fds[2]) {
+    #ifndef _WIN32
+    uint64_t drained;
+    while (fds[0] >= 0 && read(fds[0], &drained, sizeof(drained)) > 0) {
+    }
+    #else
+    (void)fds;
+    #endif
+}
+
+// Create the wakeup and nudge descriptors, returns 0 on success
+int wakeup_open(void) {
+    if (open_signal(wake_fds) < 0) {
+        return -1;
+    }
+    if (open_signal(nudge_fds) < 0) {
+        close_signal(wake_fds);
+        return -1;
+    }
+    if (open_signal(park_fds) < 0) {
+        close_signal(nudge_fds);
+        close_signal(wake_fds);
+        return -1;
+    }
+    if (open_signal(spin_fds) < 0) {
+        close_signal(park_fds);
+        close_signal(nudge_fds);
+        close_signal(wake_fds);
+        return -1;
+    }
+    return 0;
+}
+
+// Close the wakeup descriptor (no thread may be waiting on it)
+void wakeup_close(void) {
+    close_signal(spin_fds);
+    close_signal(park_fds);
+    close_signal(nudge_fds);
+    close_signal(wake_fds);
+}
+
+// Wake every thread blocked in wait_readable(), wait_wakeup() or a connect
+void wakeup_raise(void) {
+    raise_signal(wake_fds);
+}
+
+// Reset after a stop, before threads start again
+void wakeup_clear(void) {
+    drain_signal(wake_fds);
+    drain_signal(nudge_fds);
+    drain_signal(park_fds);
+    drain_signal(spin_fds);
+}
+
+// Cut short the current wait_nudge(), or the next one
+void wakeup_nudge(void) {
+    raise_signal(nudge_fds);
+}
+
+// Make the current or next wait_parked() return
+void wakeup_park(void) {
+    raise_signal(park_fds);
+}
+
+// Make the current or next wait_spinning() return
+void wakeup_spin(void) {
+    raise_signal(spin_fds);
+}
+
+// Wait until sock is readable: 1 = ready, 0 = timed out or woken, -1 = error
+int wait_readable(SOCKET sock, int timeout_ms) {
+    struct pollfd pfd[2];
+    
+    pfd[0].fd = sock;
+    pfd[0].events = POLLIN;
+    
+    int ready = poll_with_wakeup(pfd, 1, timeout_ms);
+    if (ready <= 0) {
+        return ready;
+    }
+    return pfd[0].revents != 0 && pfd[1].revents == 0;
+}
+
+// Sleep up to timeout_ms, returns 1 if woken early
+int wait_wakeup(int timeout_ms) {
+    struct pollfd pfd[1];
+    
+    if (wake_fds[0] < 0) {
+        sleep_ms(timeout_ms);
+        return 0;
+    }
+    return poll_with_wakeup(pfd, 0, timeout_ms) > 0;
+}
+
+// Sleep up to timeout_ms or until nudged, returns 1 if woken or nudged
+int wait_nudge(int timeout_ms) {
+    struct pollfd pfd[2];
+    
+    if (nudge_fds[0] < 0) {
+        return wait_wakeup(timeout_ms);
+    }
+    pfd[0].fd = nudge_fds[0];
+    pfd[0].events = POLLIN;
+    int ready = poll_with_wakeup(pfd, 1, timeout_ms);
+    drain_signal(nudge_fds);
+    return ready > 0;
+}
+
+// Wait up to timeout_ms until one of count sockets is readable, or the
+// park signal or the wakeup is raised; pfd has room for two more entries.
+// Returns the number of ready entries (signals included), -1 on error.
+int wait_parked(struct pollfd* pfd, int count, int timeout_ms) {
+    pfd[count].fd = park_fds[0];
+    pfd[count].events = POLLIN;
+    int ready = poll_with_wakeup(pfd, count + 1, timeout_ms);
+    drain_signal(park_fds);
+    return ready;
+}
+
+// Same as wait_parked() for the spin thread's sockets and signal
+int wait_spinning(struct pollfd* pfd, int count, int timeout_ms) {
+    pfd[count].fd = spin_fds[0];
+    pfd[count].events = POLLIN;
+    int ready = poll_with_wakeup(pfd, count + 1, timeout_ms);
+    drain_signal(spin_fds);
+    return ready;
+}
+
 // Receive message from socket
 int receive_message(SOCKET sock, char* buffer, int buffer_size) {
     return recv(sock, buffer, buffer_size - 1, 0);
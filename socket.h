@@ -3,13 +3,24 @@
 
 #include "common.h"
 
+#define CONNECT_TIMEOUT_MS 5000     // Dial attempts give up after this long
+#define WAKE_POLL_MS 100            // Wait slice where there is no wakeup descriptor
+
+// Peer to dial with connect_peers
+typedef struct {
+    char ip[INET_ADDRSTRLEN];
+    int port;
+    SOCKET sock;                    // Connected socket, INVALID_SOCKET on failure
+    int connect_ms;                 // Time the connect took, -1 on failure
+} DialTarget;
+
 // Global socket variables
 extern SOCKET listen_socket;
 extern int listen_port;
 extern char local_ip[INET_ADDRSTRLEN];
 
 // Socket initialization and cleanup
-void initialize_sockets(void);
+int initialize_sockets(void);
 void cleanup_sockets(void);
 
 // Network utilities
@@ -17,14 +28,53 @@ void get_local_ip(void);
 int is_valid_ip(const char* ip);
 int is_valid_port(int port);
 
+// Socket options
+void apply_socket_options(SOCKET sock);
+int get_socket_option(SOCKET sock, const char* key, int* value);
+void set_send_timeout(SOCKET sock, int timeout_ms);
+int get_send_timeout(SOCKET sock);
+void set_notsent_lowat(SOCKET sock, int bytes);
+
 // Socket operations
 SOCKET create_socket(void);
 int setup_listening_socket(int port);
-SOCKET accept_client(struct sockaddr_in* client_addr);
+void set_listen_nonblocking(void);
+int accept_client(SOCKET* sock, struct sockaddr_in* client_addr);
+void reset_socket(SOCKET sock);
 int connect_to_peer(const char* ip, int port, SOCKET* sock);
+int connect_peers(DialTarget* targets, int count);
+
+// Discovery announcements: non-blocking UDP socket in a multicast group
+SOCKET open_multicast_socket(const char* group, int port, const char* interface_ip,
+                             struct sockaddr_in* target);
 
 // Data transmission
 int send_message(SOCKET sock, const char* message);
+int send_all(SOCKET sock, const void* data, size_t length);
+int send_all_more(SOCKET sock, const void* data, size_t length);
 int receive_message(SOCKET sock, char* buffer, int buffer_size);
+int wait_readable(SOCKET sock, int timeout_ms);
+
+// Wakeup descriptor: raised to stop the node, blocked waits return at once
+int wakeup_open(void);
+void wakeup_close(void);
+void wakeup_raise(void);
+void wakeup_clear(void);
+int wait_wakeup(int timeout_ms);
+
+// Nudge: cuts short one wait_nudge, the wakeup descriptor still ends it too
+void wakeup_nudge(void);
+int wait_nudge(int timeout_ms);
+
+// Park signal: the park thread waits on idle sockets until one is readable
+// or the set changes (pfd holds count + 2 entries)
+struct pollfd;
+void wakeup_park(void);
+int wait_parked(struct pollfd* pfd, int count, int timeout_ms);
+
+// Spin signal: the spin thread blocks on its sockets once they stay quiet,
+// until one is readable or the set changes (pfd holds count + 2 entries)
+void wakeup_spin(void);
+int wait_spinning(struct pollfd* pfd, int count, int timeout_ms);
 
 #endif // SOCKET_H
\ No newline at end of file
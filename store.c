@@ -0,0 +1,223 @@
+#include "store.h"
+
+// Spill record layout: seq(8) type(1) length(4) data
+#define SPILL_RECORD_HEADER 13
+
+// Allocate a memory entry
+static StoreEntry* create_entry(uint64_t seq, uint8_t type,
+                                const void* data, uint32_t length) {
+    StoreEntry* entry = malloc(sizeof(StoreEntry) + length);
+    if (entry == NULL) {
+        return NULL;
+    }
+    
+    entry->seq = seq;
+    entry->type = type;
+    entry->length = length;
+    entry->next = NULL;
+    memcpy(entry->data, data, length);
+    return entry;
+}
+
+// Append entry to memory list
+static void append_entry(StoreQueue* queue, StoreEntry* entry) {
+    if (queue->tail != NULL) {
+        queue->tail->next = entry;
+    } else {
+        queue->head = entry;
+    }
+    queue->tail = entry;
+    queue->memory_count++;
+}
+
+// Read one spill record at offset, returns entry or NULL
+static StoreEntry* read_spill_record(FILE* spill, long offset, long* next_offset) {
+    unsigned char header[SPILL_RECORD_HEADER];
+    uint64_t seq;
+    uint32_t length;
+    
+    if (fseek(spill, offset, SEEK_SET) != 0 ||
+        fread(header, 1, sizeof(header), spill) != sizeof(header)) {
+        return NULL;
+    }
+    
+    memcpy(&seq, header, sizeof(seq));
+    memcpy(&length, header + 9, sizeof(length));
+    
+    StoreEntry* entry = malloc(sizeof(StoreEntry) + length);
+    if (entry == NULL) {
+        return NULL;
+    }
+    
+    if (fread(entry->data, 1, length, spill) != length) {
+        free(entry);
+        return NULL;
+    }
+    
+    entry->seq = seq;
+    entry->type = header[8];
+    entry->length = length;
+    entry->next = NULL;
+    *next_offset = offset + SPILL_RECORD_HEADER + length;
+    return entry;
+}
+
+// Append record to spill file
+static int write_spill_record(StoreQueue* queue, uint64_t seq, uint8_t type,
+                              const void* data, uint32_t length) {
+    unsigned char header[SPILL_RECORD_HEADER];
+    
+    if (queue->spill == NULL) {
+        queue->spill = fopen(queue->spill_path, "w+b");
+        if (queue->spill == NULL) {
+            return -1;
+        }
+        queue->spill_read_offset = 0;
+    }
+    
+    memcpy(header, &seq, sizeof(seq));
+    header[8] = type;
+    memcpy(header + 9, &length, sizeof(length));
+    
+    if (fseek(queue->spill, 0, SEEK_END) != 0 ||
+        fwrite(header, 1, sizeof(header), queue->spill) != sizeof(header) ||
+        fwrite(data, 1, length, queue->spill) != length) {
+        return -1;
+    }
+    
+    queue->spill_count++;
+    return 0;
+}
+
+// Move spilled records back into memory as space frees up
+static void refill_from_spill(StoreQueue* queue) {
+    while (queue->spill_count > 0 && queue->memory_count < STORE_MEMORY_LIMIT) {
+        long next_offset;
+        StoreEntry* entry = read_spill_record(queue->spill, queue->spill_read_offset,
+                                              &next_offset);
+        if (entry == NULL) {
+            return;
+        }
+        
+        append_entry(queue, entry);
+        queue->spill_read_offset = next_offset;
+        queue->spill_count--;
+    }
+    
+    // Spill file fully drained, start over from an empty file
+    if (queue->spill != NULL && queue->spill_count == 0) {
+        fclose(queue->spill);
+        queue->spill = NULL;
+        remove(queue->spill_path);
+        queue->spill_read_offset = 0;
+    }
+}
+
+// Create empty queue spilling to the given file
+StoreQueue* store_create(const char* spill_path) {
+    StoreQueue* queue = calloc(1, sizeof(StoreQueue));
+    if (queue == NULL) {
+        return NULL;
+    }
+    
+    snprintf(queue->spill_path, sizeof(queue->spill_path), "%s", spill_path);
+    return queue;
+}
+
+// Free queue and remove its spill file
+void store_destroy(StoreQueue* queue) {
+    if (queue == NULL) {
+        return;
+    }
+    
+    StoreEntry* entry = queue->head;
+    while (entry != NULL) {
+        StoreEntry* next = entry->next;
+        free(entry);
+        entry = next;
+    }
+    
+    if (queue->spill != NULL) {
+        fclose(queue->spill);
+        remove(queue->spill_path);
+    }
+    
+    free(queue);
+}
+
+// Queue a frame; spills once memory is full or older entries are on disk
+int store_push(StoreQueue* queue, uint64_t seq, uint8_t type,
+               const void* data, uint32_t length) {
+    if (queue->memory_count >= STORE_MEMORY_LIMIT || queue->spill_count > 0) {
+        return write_spill_record(queue, seq, type, data, length);
+    }
+    
+    StoreEntry* entry = create_entry(seq, type, data, length);
+    if (entry == NULL) {
+        return -1;
+    }
+    
+    append_entry(queue, entry);
+    return 0;
+}
+
+// Drop all entries acknowledged by the peer
+void store_ack(StoreQueue* queue, uint64_t seq) {
+    while (queue->head != NULL && queue->head->seq <= seq) {
+        StoreEntry* entry = queue->head;
+        queue->head = entry->next;
+        if (queue->head == NULL) {
+            queue->tail = NULL;
+        }
+        queue->memory_count--;
+        free(entry);
+        
+        if (queue->head == NULL) {
+            refill_from_spill(queue);
+        }
+    }
+    
+    refill_from_spill(queue);
+}
+
+// Visit entries newer than after_seq in order, returns count visited
+int store_replay(StoreQueue* queue, uint64_t after_seq,
+                 store_visit_fn visit, void* ctx) {
+    int visited = 0;
+    
+    for (StoreEntry* entry = queue->head; entry != NULL; entry = entry->next) {
+        if (entry->seq <= after_seq) continue;
+        if (visit(ctx, entry->seq, entry->type, entry->data, entry->length) < 0) {
+            return visited;
+        }
+        visited++;
+    }
+    
+    long offset = queue->spill_read_offset;
+    for (int i = 0; i < queue->spill_count; i++) {
+        long next_offset;
+        StoreEntry* entry = read_spill_record(queue->spill, offset, &next_offset);
+        if (entry == NULL) {
+            break;
+        }
+        
+        int result = 0;
+        if (entry->seq > after_seq) {
+            result = visit(ctx, entry->seq, entry->type, entry->data, entry->length);
+            visited++;
+        }
+        free(entry);
+        
+        if (result < 0) {
+            break;
+        }
+        offset = next_offset;
+    }
+    
+    return visited;
+}
+
+// Number of unacknowledged entries
+int store_count(const StoreQueue* queue) {
+    return queue->memory_count + queue->spill_count;
+}
@@ -0,0 +1,48 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include "common.h"
+#include <stdint.h>
+
+// Store-and-forward limits
+#define STORE_MEMORY_LIMIT 256     // Entries kept in memory before spilling
+#define STORE_SPOOL_DIR "."        // Directory for spill files
+#define STORE_PATH_LENGTH 256
+
+// Queued outbound frame
+typedef struct StoreEntry {
+    uint64_t seq;
+    uint8_t type;
+    uint32_t length;
+    struct StoreEntry* next;
+    unsigned char data[];
+} StoreEntry;
+
+// Unacknowledged outbound frames: oldest in memory, overflow appended to disk
+typedef struct {
+    StoreEntry* head;
+    StoreEntry* tail;
+    int memory_count;
+    FILE* spill;                    // Append-only spill file, opened on demand
+    char spill_path[STORE_PATH_LENGTH];
+    long spill_read_offset;         // First unconsumed record in spill file
+    int spill_count;                // Records not yet moved back to memory
+} StoreQueue;
+
+// Called for each entry during replay, negative return stops replay
+typedef int (*store_visit_fn)(void* ctx, uint64_t seq, uint8_t type,
+                              const unsigned char* data, uint32_t length);
+
+// Queue lifecycle
+StoreQueue* store_create(const char* spill_path);
+void store_destroy(StoreQueue* queue);
+
+// Queue operations
+int store_push(StoreQueue* queue, uint64_t seq, uint8_t type,
+               const void* data, uint32_t length);
+void store_ack(StoreQueue* queue, uint64_t seq);
+int store_replay(StoreQueue* queue, uint64_t after_seq,
+                 store_visit_fn visit, void* ctx);
+int store_count(const StoreQueue* queue);
+
+#endif // STORE_H
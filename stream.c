@@ -0,0 +1,356 @@
+#include "stream.h"
+#include "protocol.h"
+#include "trace.h"
+
+// Find open stream by ID (caller holds set mutex)
+static OutStream* find_stream(StreamSet* set, uint16_t id) {
+    for (OutStream* stream = set->streams; stream != NULL; stream = stream->next) {
+        if (stream->id == id) {
+            return stream;
+        }
+    }
+    return NULL;
+}
+
+// Can stream send its next chunk now
+static int sendable(const OutStream* stream) {
+    return stream->head != NULL && stream->credit >= (long)stream->head->length;
+}
+
+// Pass the turn to the next stream (caller holds set mutex)
+static void next_turn(StreamSet* set) {
+    set->current = set->current->next;
+    set->turn_started = 0;
+}
+
+// Deficit round robin: the stream whose turn it is gets weight * quantum
+// bytes and sends while that covers its next chunk, then the turn passes on.
+// Streams with nothing to send (or no credit) forfeit their deficit.
+static OutStream* pick_stream(StreamSet* set) {
+    for (int visited = 0; visited <= set->count; visited++) {
+        if (set->current == NULL) {
+            set->current = set->streams;
+            set->turn_started = 0;
+        }
+        OutStream* stream = set->current;
+        if (stream == NULL) {
+            return NULL;
+        }
+        
+        if (sendable(stream)) {
+            if (!set->turn_started) {
+                stream->deficit += (long)stream->weight * STREAM_QUANTUM;
+                set->turn_started = 1;
+            }
+            if (stream->deficit >= (long)stream->head->length) {
+                return stream;
+            }
+        } else {
+            stream->deficit = 0;
+        }
+        next_turn(set);
+    }
+    return NULL;
+}
+
+// Unlink and free a finished stream (caller holds set mutex)
+static void remove_stream(StreamSet* set, OutStream* stream) {
+    if (set->current == stream) {
+        next_turn(set);
+    }
+    
+    OutStream** link = &set->streams;
+    while (*link != stream) {
+        link = &(*link)->next;
+    }
+    *link = stream->next;
+    set->count--;
+    
+    while (stream->head != NULL) {
+        StreamChunk* chunk = stream->head;
+        stream->head = chunk->next;
+        free(chunk);
+    }
+    free(stream);
+}
+
+// Sender thread: move chunks of eligible streams onto the connection
+static void* stream_sender_thread(void* arg) {
+    StreamSet* set = (StreamSet*)arg;
+    
+    TRACE_THREAD("stream");
+    
+    pthread_mutex_lock(&set->mutex);
+    while (!set->stopping) {
+        OutStream* stream = pick_stream(set);
+        if (stream == NULL) {
+            pthread_cond_wait(&set->ready, &set->mutex);
+            continue;
+        }
+        
+        StreamChunk* chunk = stream->head;
+        stream->head = chunk->next;
+        if (stream->head == NULL) {
+            stream->tail = NULL;
+        }
+        stream->queued -= chunk->length;
+        stream->credit -= chunk->length;
+        stream->deficit -= chunk->length;
+        uint16_t id = stream->id;
+        if (chunk->flags & FRAME_FLAG_FIN) {
+            remove_stream(set, stream);
+        }
+        set->sending = 1;
+        pthread_cond_broadcast(&set->space);
+        pthread_mutex_unlock(&set->mutex);
+        
+        // A failed send means the link is going; teardown destroys the set
+        TRACE_BEGIN("stream_send");
+        set->send(set->ctx, id, chunk->flags, chunk->data, chunk->length);
+        TRACE_END("stream_send");
+        free(chunk);
+        
+        pthread_mutex_lock(&set->mutex);
+        set->sending = 0;
+        set->chunks_sent++;
+        pthread_cond_broadcast(&set->space);
+    }
+    pthread_mutex_unlock(&set->mutex);
+    
+    return NULL;
+}
+
+// Create empty set and start its sender
+StreamSet* stream_set_create(stream_send_fn send, void* ctx) {
+    StreamSet* set = calloc(1, sizeof(StreamSet));
+    if (set == NULL) {
+        return NULL;
+    }
+    
+    pthread_mutex_init(&set->mutex, NULL);
+    pthread_cond_init(&set->ready, NULL);
+    pthread_cond_init(&set->space, NULL);
+    set->next_id = 1;
+    set->send = send;
+    set->ctx = ctx;
+    
+    if (pthread_create(&set->thread, NULL, stream_sender_thread, set) != 0) {
+        pthread_cond_destroy(&set->space);
+        pthread_cond_destroy(&set->ready);
+        pthread_mutex_destroy(&set->mutex);
+        free(set);
+        return NULL;
+    }
+    return set;
+}
+
+// Stop the sender, wait for writers to leave, free everything
+void stream_set_destroy(StreamSet* set) {
+    if (set == NULL) {
+        return;
+    }
+    
+    pthread_mutex_lock(&set->mutex);
+    set->stopping = 1;
+    pthread_cond_broadcast(&set->ready);
+    pthread_cond_broadcast(&set->space);
+    while (set->users > 0) {
+        pthread_cond_wait(&set->space, &set->mutex);
+    }
+    pthread_mutex_unlock(&set->mutex);
+    
+    pthread_join(set->thread, NULL);
+    
+    while (set->streams != NULL) {
+        remove_stream(set, set->streams);
+    }
+    pthread_cond_destroy(&set->space);
+    pthread_cond_destroy(&set->ready);
+    pthread_mutex_destroy(&set->mutex);
+    free(set);
+}
+
+// Stop taking chunks, wait a while for the one in flight
+int stream_set_stop(StreamSet* set, int timeout_ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000;
+    deadline.tv_nsec %= 1000000000;
+    
+    pthread_mutex_lock(&set->mutex);
+    set->stopping = 1;
+    pthread_cond_broadcast(&set->ready);
+    pthread_cond_broadcast(&set->space);
+    int waited = 0;
+    while (set->sending && waited == 0) {
+        waited = pthread_cond_timedwait(&set->space, &set->mutex, &deadline);
+    }
+    int result = set->sending ? -1 : 0;
+    pthread_mutex_unlock(&set->mutex);
+    return result;
+}
+
+// Register a writer that may block
+void stream_set_hold(StreamSet* set) {
+    pthread_mutex_lock(&set->mutex);
+    set->users++;
+    pthread_mutex_unlock(&set->mutex);
+}
+
+// Writer done with set
+void stream_set_release(StreamSet* set) {
+    pthread_mutex_lock(&set->mutex);
+    set->users--;
+    pthread_cond_broadcast(&set->space);
+    pthread_mutex_unlock(&set->mutex);
+}
+
+// Open a stream with the full initial credit
+int stream_open(StreamSet* set, int weight) {
+    pthread_mutex_lock(&set->mutex);
+    if (set->stopping || set->count >= STREAM_MAX_OPEN) {
+        pthread_mutex_unlock(&set->mutex);
+        return -1;
+    }
+    
+    OutStream* stream = calloc(1, sizeof(OutStream));
+    if (stream == NULL) {
+        pthread_mutex_unlock(&set->mutex);
+        return -1;
+    }
+    
+    // IDs wrap, skipping 0 (control and chat) and streams still open
+    do {
+        stream->id = set->next_id++;
+        if (set->next_id == 0) {
+            set->next_id = 1;
+        }
+    } while (find_stream(set, stream->id) != NULL);
+    
+    if (weight < 1) {
+        weight = 1;
+    } else if (weight > STREAM_MAX_WEIGHT) {
+        weight = STREAM_MAX_WEIGHT;
+    }
+    stream->weight = weight;
+    stream->credit = STREAM_WINDOW;
+    
+    // Appended, so the stream waits for its first turn like the others
+    OutStream** link = &set->streams;
+    while (*link != NULL) {
+        link = &(*link)->next;
+    }
+    *link = stream;
+    set->count++;
+    
+    int id = stream->id;
+    pthread_mutex_unlock(&set->mutex);
+    return id;
+}
+
+// Append a chunk to stream (caller holds set mutex)
+static void append_chunk(OutStream* stream, StreamChunk* chunk) {
+    chunk->next = NULL;
+    if (stream->tail != NULL) {
+        stream->tail->next = chunk;
+    } else {
+        stream->head = chunk;
+    }
+    stream->tail = chunk;
+    stream->queued += chunk->length;
+}
+
+// Queue data on a stream, split into chunks
+int stream_write(StreamSet* set, uint16_t id, const void* data, size_t length,
+                 uint32_t chunk_size) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    int result = 0;
+    
+    if (chunk_size > STREAM_QUANTUM) {
+        chunk_size = STREAM_QUANTUM;
+    }
+    
+    pthread_mutex_lock(&set->mutex);
+    while (length > 0) {
+        // Looked up each time, the stream may have been reset meanwhile
+        OutStream* stream = find_stream(set, id);
+        if (set->stopping) {
+            result = -2;
+            break;
+        }
+        if (stream == NULL || stream->closing) {
+            result = -1;
+            break;
+        }
+        if (stream->queued >= STREAM_QUEUE_LIMIT) {
+            pthread_cond_wait(&set->space, &set->mutex);
+            continue;
+        }
+        
+        uint32_t piece = length < chunk_size ? (uint32_t)length : chunk_size;
+        StreamChunk* chunk = malloc(sizeof(StreamChunk) + piece);
+        if (chunk == NULL) {
+            result = -3;
+            break;
+        }
+        chunk->length = piece;
+        chunk->flags = 0;
+        memcpy(chunk->data, bytes, piece);
+        append_chunk(stream, chunk);
+        pthread_cond_signal(&set->ready);
+        
+        bytes += piece;
+        length -= piece;
+    }
+    pthread_mutex_unlock(&set->mutex);
+    
+    return result;
+}
+
+// Queue the end of a stream
+int stream_close(StreamSet* set, uint16_t id) {
+    pthread_mutex_lock(&set->mutex);
+    OutStream* stream = find_stream(set, id);
+    if (stream == NULL || stream->closing) {
+        pthread_mutex_unlock(&set->mutex);
+        return -1;
+    }
+    
+    StreamChunk* chunk = malloc(sizeof(StreamChunk));
+    if (chunk == NULL) {
+        pthread_mutex_unlock(&set->mutex);
+        return -1;
+    }
+    chunk->length = 0;
+    chunk->flags = FRAME_FLAG_FIN;
+    append_chunk(stream, chunk);
+    stream->closing = 1;
+    pthread_cond_signal(&set->ready);
+    
+    pthread_mutex_unlock(&set->mutex);
+    return 0;
+}
+
+// Drop a stream the peer refused
+void stream_reset(StreamSet* set, uint16_t id) {
+    pthread_mutex_lock(&set->mutex);
+    OutStream* stream = find_stream(set, id);
+    if (stream != NULL) {
+        remove_stream(set, stream);
+        pthread_cond_broadcast(&set->space);
+    }
+    pthread_mutex_unlock(&set->mutex);
+}
+
+// Add credit granted by the peer
+void stream_credit(StreamSet* set, uint16_t id, uint32_t bytes) {
+    pthread_mutex_lock(&set->mutex);
+    OutStream* stream = find_stream(set, id);
+    if (stream != NULL) {
+        stream->credit += bytes;
+        pthread_cond_signal(&set->ready);
+    }
+    pthread_mutex_unlock(&set->mutex);
+}
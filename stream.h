@@ -0,0 +1,97 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "common.h"
+#include <stdint.h>
+#include <pthread.h>
+
+// Outbound bulk streams of one connection.
+// Control and chat frames are written straight into the connection's send
+// batch; bulk data waits in per-stream queues and a sender thread feeds it
+// into the gaps, one chunk at a time. Streams share the link by deficit
+// round robin on their weights, and each may only have as many bytes in
+// flight as its receiver granted in credit.
+
+#define STREAM_MAX_WEIGHT 16
+#define STREAM_QUANTUM 16384            // Bytes per weight unit per round, >= chunk size
+#define STREAM_QUEUE_LIMIT (256 * 1024) // Bytes a stream buffers before writers wait
+#define STREAM_MAX_OPEN 64              // Open outbound streams per connection
+#define STREAM_NOTSENT_LOWAT (64 * 1024) // Unsent kernel bytes allowed ahead of chat
+
+// Queued piece of stream data, sent as one DATA frame
+typedef struct StreamChunk {
+    struct StreamChunk* next;
+    uint32_t length;
+    uint8_t flags;
+    unsigned char data[];
+} StreamChunk;
+
+// Outbound stream
+typedef struct OutStream {
+    uint16_t id;
+    int weight;
+    long deficit;                   // Bytes it may still send this round
+    long credit;                    // Bytes the peer will still accept
+    StreamChunk* head;
+    StreamChunk* tail;
+    size_t queued;
+    int closing;                    // FIN queued, no more writes
+    struct OutStream* next;
+} OutStream;
+
+// Writes one DATA frame for the sender thread, negative on failure
+typedef int (*stream_send_fn)(void* ctx, uint16_t stream, uint8_t flags,
+                              const void* data, uint32_t length);
+
+// Streams of a connection and their sender thread
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t ready;           // Data or credit arrived, or stopping
+    pthread_cond_t space;           // A queue shrank, a user left, or stopping
+    OutStream* streams;
+    OutStream* current;             // Whose turn it is
+    int turn_started;               // current already got this round's quantum
+    int count;
+    uint16_t next_id;
+    int users;                      // Writers inside stream_write
+    int stopping;
+    int sending;                    // A chunk is being written
+    stream_send_fn send;
+    void* ctx;
+    pthread_t thread;
+    long long chunks_sent;
+} StreamSet;
+
+// Set lifecycle: create starts the sender, destroy stops it and drops
+// unsent data (waits for writers to leave)
+StreamSet* stream_set_create(stream_send_fn send, void* ctx);
+void stream_set_destroy(StreamSet* set);
+
+// Stop the sender taking chunks and wait up to timeout_ms for the one being
+// written; returns -1 if it is still in flight (the link is stalled)
+int stream_set_stop(StreamSet* set, int timeout_ms);
+
+// Keep set alive across a blocking stream_write (take while the owner's lock
+// guarantees the set exists)
+void stream_set_hold(StreamSet* set);
+void stream_set_release(StreamSet* set);
+
+// Open a stream (weight 1..STREAM_MAX_WEIGHT), returns its ID or -1
+int stream_open(StreamSet* set, int weight);
+
+// Queue data in chunks of at most chunk_size, waiting while the stream is
+// over STREAM_QUEUE_LIMIT. Returns 0, -1 for an unknown or closing stream,
+// -2 once the set is stopping, -3 out of memory.
+int stream_write(StreamSet* set, uint16_t id, const void* data, size_t length,
+                 uint32_t chunk_size);
+
+// Queue FIN after the stream's data, returns 0 or -1 for an unknown stream
+int stream_close(StreamSet* set, uint16_t id);
+
+// Peer consumed bytes of stream id
+void stream_credit(StreamSet* set, uint16_t id, uint32_t bytes);
+
+// Peer refused stream id: drop its unsent data, writers get -1
+void stream_reset(StreamSet* set, uint16_t id);
+
+#endif // STREAM_H
@@ -0,0 +1,73 @@
+#include "timeutil.h"
+#include <time.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+#endif
+
+// Get monotonic clock in milliseconds
+long long get_monotonic_ms(void) {
+    #ifdef _WIN32
+        return (long long)GetTickCount64();
+    #else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    #endif
+}
+
+// Get monotonic clock in microseconds
+long long get_monotonic_us(void) {
+    #ifdef _WIN32
+        LARGE_INTEGER count, frequency;
+        QueryPerformanceCounter(&count);
+        QueryPerformanceFrequency(&frequency);
+        return count.QuadPart / frequency.QuadPart * 1000000 +
+               count.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart;
+    #else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    #endif
+}
+
+// Get monotonic clock in nanoseconds
+long long get_monotonic_ns(void) {
+    #ifdef _WIN32
+        LARGE_INTEGER count, frequency;
+        QueryPerformanceCounter(&count);
+        QueryPerformanceFrequency(&frequency);
+        return count.QuadPart / frequency.QuadPart * 1000000000 +
+               count.QuadPart % frequency.QuadPart * 1000000000 / frequency.QuadPart;
+    #else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    #endif
+}
+
+// Get wall clock in milliseconds since the Unix epoch
+long long get_wall_ms(void) {
+    #ifdef _WIN32
+        FILETIME ft;
+        GetSystemTimeAsFileTime(&ft);
+        long long ticks = ((long long)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+        return ticks / 10000 - 11644473600000LL;
+    #else
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    #endif
+}
+
+// Sleep for the given number of milliseconds
+void sleep_ms(int milliseconds) {
+    #ifdef _WIN32
+        Sleep(milliseconds);
+    #else
+        struct timespec ts;
+        ts.tv_sec = milliseconds / 1000;
+        ts.tv_nsec = (long)(milliseconds % 1000) * 1000000;
+        nanosleep(&ts, NULL);
+    #endif
+}
@@ -0,0 +1,13 @@
+#ifndef TIMEUTIL_H
+#define TIMEUTIL_H
+
+#include "common.h"
+
+// Time utilities
+long long get_monotonic_ms(void);
+long long get_monotonic_us(void);
+long long get_monotonic_ns(void);
+long long get_wall_ms(void);
+void sleep_ms(int milliseconds);
+
+#endif // TIMEUTIL_H
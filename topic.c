@@ -0,0 +1,294 @@
+#include "topic.h"
+
+// Index of this node
+TopicIndex node_topics;
+
+// FNV-1a hash of topic name
+static unsigned int hash_topic(const char* name) {
+    unsigned int hash = 2166136261u;
+    while (*name) {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+    return hash % TOPIC_BUCKETS;
+}
+
+// Find topic entry (caller holds index mutex)
+static Topic* find_topic(TopicIndex* index, const char* name) {
+    Topic* topic = index->table[hash_topic(name)];
+    while (topic != NULL && strcmp(topic->name, name) != 0) {
+        topic = topic->next;
+    }
+    return topic;
+}
+
+// Find or create topic entry (caller holds index mutex)
+static Topic* get_or_create_topic(TopicIndex* index, const char* name) {
+    Topic* topic = find_topic(index, name);
+    if (topic != NULL) {
+        return topic;
+    }
+    
+    topic = calloc(1, sizeof(Topic));
+    if (topic == NULL) {
+        return NULL;
+    }
+    
+    strcpy(topic->name, name);
+    unsigned int bucket = hash_topic(name);
+    topic->next = index->table[bucket];
+    index->table[bucket] = topic;
+    return topic;
+}
+
+// Free topic entry once nobody uses it (caller holds index mutex)
+static void release_topic_if_unused(TopicIndex* index, Topic* topic) {
+    if (topic->joined || topic->subscriber_count > 0) {
+        return;
+    }
+    
+    Topic** link = &index->table[hash_topic(topic->name)];
+    while (*link != topic) {
+        link = &(*link)->next;
+    }
+    *link = topic->next;
+    
+    free(topic->subscribers);
+    free(topic);
+}
+
+// Remove subscriber by swapping with the last entry (caller holds index mutex)
+static int remove_subscriber(Topic* topic, int conn_id) {
+    for (int i = 0; i < topic->subscriber_count; i++) {
+        if (topic->subscribers[i] == conn_id) {
+            topic->subscribers[i] = topic->subscribers[--topic->subscriber_count];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Initialize topic index
+void init_topics(TopicIndex* index) {
+    memset(index->table, 0, sizeof(index->table));
+    pthread_mutex_init(&index->mutex, NULL);
+}
+
+// Free all topic entries
+void free_topics(TopicIndex* index) {
+    pthread_mutex_lock(&index->mutex);
+    
+    for (int i = 0; i < TOPIC_BUCKETS; i++) {
+        Topic* topic = index->table[i];
+        while (topic != NULL) {
+            Topic* next = topic->next;
+            free(topic->subscribers);
+            free(topic);
+            topic = next;
+        }
+        index->table[i] = NULL;
+    }
+    
+    pthread_mutex_unlock(&index->mutex);
+}
+
+// Check if topic name is valid
+int is_valid_topic(const char* name) {
+    size_t len = strlen(name);
+    if (len == 0 || len > MAX_TOPIC_LENGTH) {
+        return 0;
+    }
+    
+    for (size_t i = 0; i < len; i++) {
+        if (!isgraph((unsigned char)name[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Subscribe local node to topic
+int topic_join(TopicIndex* index, const char* name) {
+    pthread_mutex_lock(&index->mutex);
+    
+    Topic* topic = get_or_create_topic(index, name);
+    if (topic == NULL) {
+        pthread_mutex_unlock(&index->mutex);
+        return -1;
+    }
+    
+    int result = topic->joined ? 1 : 0;
+    topic->joined = 1;
+    
+    pthread_mutex_unlock(&index->mutex);
+    return result;
+}
+
+// Unsubscribe local node from topic
+int topic_leave(TopicIndex* index, const char* name) {
+    pthread_mutex_lock(&index->mutex);
+    
+    Topic* topic = find_topic(index, name);
+    if (topic == NULL || !topic->joined) {
+        pthread_mutex_unlock(&index->mutex);
+        return 1;
+    }
+    
+    topic->joined = 0;
+    release_topic_if_unused(index, topic);
+    
+    pthread_mutex_unlock(&index->mutex);
+    return 0;
+}
+
+// Check if local node is subscribed to topic
+int topic_is_joined(TopicIndex* index, const char* name) {
+    pthread_mutex_lock(&index->mutex);
+    Topic* topic = find_topic(index, name);
+    int joined = topic != NULL && topic->joined;
+    pthread_mutex_unlock(&index->mutex);
+    return joined;
+}
+
+// Record that a peer subscribed to topic
+int topic_add_subscriber(TopicIndex* index, const char* name, int conn_id) {
+    pthread_mutex_lock(&index->mutex);
+    
+    Topic* topic = get_or_create_topic(index, name);
+    if (topic == NULL) {
+        pthread_mutex_unlock(&index->mutex);
+        return -1;
+    }
+    
+    for (int i = 0; i < topic->subscriber_count; i++) {
+        if (topic->subscribers[i] == conn_id) {
+            pthread_mutex_unlock(&index->mutex);
+            return 1;
+        }
+    }
+    
+    if (topic->subscriber_count == topic->subscriber_capacity) {
+        int capacity = topic->subscriber_capacity ? topic->subscriber_capacity * 2 : 4;
+        int* grown = realloc(topic->subscribers, capacity * sizeof(int));
+        if (grown == NULL) {
+            release_topic_if_unused(index, topic);
+            pthread_mutex_unlock(&index->mutex);
+            return -1;
+        }
+        topic->subscribers = grown;
+        topic->subscriber_capacity = capacity;
+    }
+    
+    topic->subscribers[topic->subscriber_count++] = conn_id;
+    
+    pthread_mutex_unlock(&index->mutex);
+    return 0;
+}
+
+// Record that a peer unsubscribed from topic
+void topic_remove_subscriber(TopicIndex* index, const char* name, int conn_id) {
+    pthread_mutex_lock(&index->mutex);
+    
+    Topic* topic = find_topic(index, name);
+    if (topic != NULL && remove_subscriber(topic, conn_id)) {
+        release_topic_if_unused(index, topic);
+    }
+    
+    pthread_mutex_unlock(&index->mutex);
+}
+
+// Drop all subscriptions of a closed connection
+void topic_remove_connection(TopicIndex* index, int conn_id) {
+    pthread_mutex_lock(&index->mutex);
+    
+    for (int i = 0; i < TOPIC_BUCKETS; i++) {
+        Topic* topic = index->table[i];
+        while (topic != NULL) {
+            Topic* next = topic->next;
+            if (remove_subscriber(topic, conn_id)) {
+                release_topic_if_unused(index, topic);
+            }
+            topic = next;
+        }
+    }
+    
+    pthread_mutex_unlock(&index->mutex);
+}
+
+// Copy subscriber IDs of topic, returns count
+int topic_get_subscribers(TopicIndex* index, const char* name, int* conn_ids, int max) {
+    int count = 0;
+    
+    pthread_mutex_lock(&index->mutex);
+    Topic* topic = find_topic(index, name);
+    if (topic != NULL) {
+        count = topic->subscriber_count < max ? topic->subscriber_count : max;
+        memcpy(conn_ids, topic->subscribers, count * sizeof(int));
+    }
+    pthread_mutex_unlock(&index->mutex);
+    
+    return count;
+}
+
+// Copy names of locally joined topics into a new array, returns count
+int topic_get_joined(TopicIndex* index, char (**names)[MAX_TOPIC_LENGTH + 1]) {
+    char (*joined)[MAX_TOPIC_LENGTH + 1] = NULL;
+    int count = 0;
+    int capacity = 0;
+    
+    pthread_mutex_lock(&index->mutex);
+    for (int i = 0; i < TOPIC_BUCKETS; i++) {
+        for (Topic* topic = index->table[i]; topic != NULL; topic = topic->next) {
+            if (!topic->joined) continue;
+            if (count == capacity) {
+                int grown_capacity = capacity ? capacity * 2 : 8;
+                void* grown = realloc(joined, grown_capacity * sizeof(*joined));
+                if (grown == NULL) break;
+                joined = grown;
+                capacity = grown_capacity;
+            }
+            strcpy(joined[count++], topic->name);
+        }
+    }
+    pthread_mutex_unlock(&index->mutex);
+    
+    *names = joined;
+    return count;
+}
+
+// Copy topic snapshot, returns count
+int topic_get_info(TopicIndex* index, P2PTopicInfo* out, int max) {
+    int count = 0;
+    
+    pthread_mutex_lock(&index->mutex);
+    for (int i = 0; i < TOPIC_BUCKETS && count < max; i++) {
+        for (Topic* topic = index->table[i]; topic != NULL && count < max;
+             topic = topic->next) {
+            snprintf(out[count].name, sizeof(out[count].name), "%s", topic->name);
+            out[count].joined = topic->joined;
+            out[count].subscribers = topic->subscriber_count;
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&index->mutex);
+    
+    return count;
+}
+
+// Call visit for every topic under the index mutex, returns -1 if it stopped early
+int topic_visit(TopicIndex* index, topic_visit_fn visit, void* ctx) {
+    int result = 0;
+    
+    pthread_mutex_lock(&index->mutex);
+    for (int i = 0; i < TOPIC_BUCKETS && result == 0; i++) {
+        for (Topic* topic = index->table[i]; topic != NULL; topic = topic->next) {
+            if (visit(ctx, topic) < 0) {
+                result = -1;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&index->mutex);
+    
+    return result;
+}
@@ -0,0 +1,54 @@
+#ifndef TOPIC_H
+#define TOPIC_H
+
+#include "common.h"
+#include "protocol.h"
+#include "p2pchat.h"
+#include <pthread.h>
+
+#define TOPIC_BUCKETS 256
+
+// Topic entry in the subscription index
+typedef struct Topic {
+    char name[MAX_TOPIC_LENGTH + 1];
+    int joined;                 // Local node is subscribed
+    int* subscribers;           // Connection IDs of subscribed peers
+    int subscriber_count;
+    int subscriber_capacity;
+    struct Topic* next;         // Hash bucket chain
+} Topic;
+
+// Subscription index: topic name -> subscribed connection IDs
+typedef struct {
+    Topic* table[TOPIC_BUCKETS];
+    pthread_mutex_t mutex;
+} TopicIndex;
+
+// Called for each topic by topic_visit, negative return stops the walk
+typedef int (*topic_visit_fn)(void* ctx, const Topic* topic);
+
+// Index of this node
+extern TopicIndex node_topics;
+
+// Index management
+void init_topics(TopicIndex* index);
+void free_topics(TopicIndex* index);
+int is_valid_topic(const char* name);
+
+// Local subscriptions (0 = changed, 1 = no change, -1 = error)
+int topic_join(TopicIndex* index, const char* name);
+int topic_leave(TopicIndex* index, const char* name);
+int topic_is_joined(TopicIndex* index, const char* name);
+int topic_get_joined(TopicIndex* index, char (**names)[MAX_TOPIC_LENGTH + 1]);
+
+// Remote subscriptions
+int topic_add_subscriber(TopicIndex* index, const char* name, int conn_id);
+void topic_remove_subscriber(TopicIndex* index, const char* name, int conn_id);
+void topic_remove_connection(TopicIndex* index, int conn_id);
+int topic_get_subscribers(TopicIndex* index, const char* name, int* conn_ids, int max);
+
+// Topic info
+int topic_get_info(TopicIndex* index, P2PTopicInfo* out, int max);
+int topic_visit(TopicIndex* index, topic_visit_fn visit, void* ctx);
+
+#endif // TOPIC_H
@@ -0,0 +1,222 @@
+#include "trace.h"
+
+#ifdef P2P_TRACE
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+// Recorded event
+typedef struct {
+    uint64_t timestamp_ns;
+    const char* name;
+    long long arg;
+    char phase;
+} TraceEvent;
+
+// Single-writer ring buffer owned by one thread
+typedef struct {
+    TraceEvent events[TRACE_BUFFER_EVENTS];
+    uint64_t head;                  // Total events written, published with release
+    int tid;
+    int retired;                    // Owner thread exited, buffer may be reused
+    char thread_name[TRACE_THREAD_NAME_LENGTH];
+} TraceBuffer;
+
+static TraceBuffer* trace_buffers[TRACE_MAX_THREADS];
+static int trace_buffer_count = 0;
+static int trace_next_tid = 1;
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t trace_key;
+static pthread_once_t trace_key_once = PTHREAD_ONCE_INIT;
+static __thread TraceBuffer* thread_buffer = NULL;
+static __thread int thread_buffer_failed = 0;
+
+// Monotonic clock in nanoseconds
+static uint64_t trace_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Thread exit: hand buffer back for reuse, its events stay until then
+static void retire_buffer(void* arg) {
+    TraceBuffer* buffer = arg;
+    __atomic_store_n(&buffer->retired, 1, __ATOMIC_RELEASE);
+}
+
+// Create thread exit key
+static void create_trace_key(void) {
+    pthread_key_create(&trace_key, retire_buffer);
+}
+
+// Get this thread's buffer, registering one on first use
+static TraceBuffer* get_thread_buffer(void) {
+    if (thread_buffer != NULL || thread_buffer_failed) {
+        return thread_buffer;
+    }
+    
+    pthread_once(&trace_key_once, create_trace_key);
+    pthread_mutex_lock(&trace_mutex);
+    
+    TraceBuffer* buffer = NULL;
+    for (int i = 0; i < trace_buffer_count; i++) {
+        if (__atomic_load_n(&trace_buffers[i]->retired, __ATOMIC_ACQUIRE)) {
+            buffer = trace_buffers[i];
+            break;
+        }
+    }
+    
+    if (buffer == NULL && trace_buffer_count < TRACE_MAX_THREADS) {
+        buffer = calloc(1, sizeof(TraceBuffer));
+        if (buffer != NULL) {
+            trace_buffers[trace_buffer_count++] = buffer;
+        }
+    }
+    
+    // A reused ring starts empty on a track of its own, so the dead thread's
+    // events and unclosed spans never show up under the new thread
+    if (buffer != NULL) {
+        buffer->head = 0;
+        buffer->tid = trace_next_tid++;
+        buffer->thread_name[0] = '\0';
+        __atomic_store_n(&buffer->retired, 0, __ATOMIC_RELEASE);
+        pthread_setspecific(trace_key, buffer);
+    } else {
+        thread_buffer_failed = 1;
+    }
+    
+    pthread_mutex_unlock(&trace_mutex);
+    thread_buffer = buffer;
+    return buffer;
+}
+
+// Append event to this thread's ring, lock-free
+void trace_record(const char* name, char phase, long long arg) {
+    TraceBuffer* buffer = get_thread_buffer();
+    if (buffer == NULL) {
+        return;
+    }
+    
+    uint64_t head = buffer->head;
+    TraceEvent* event = &buffer->events[head & (TRACE_BUFFER_EVENTS - 1)];
+    event->timestamp_ns = trace_now_ns();
+    event->name = name;
+    event->arg = arg;
+    event->phase = phase;
+    __atomic_store_n(&buffer->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Name this thread in the trace viewer
+void trace_thread_name(const char* name) {
+    TraceBuffer* buffer = get_thread_buffer();
+    if (buffer != NULL) {
+        snprintf(buffer->thread_name, sizeof(buffer->thread_name), "%s", name);
+    }
+}
+
+// Copy a consistent snapshot of a ring, returns event count
+static int snapshot_buffer(TraceBuffer* buffer, TraceEvent* out) {
+    uint64_t head = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+    uint64_t first = head > TRACE_BUFFER_EVENTS ? head - TRACE_BUFFER_EVENTS : 0;
+    
+    for (uint64_t i = first; i < head; i++) {
+        out[i - first] = buffer->events[i & (TRACE_BUFFER_EVENTS - 1)];
+    }
+    
+    // Drop entries the writer may have overwritten while we copied
+    uint64_t after = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+    uint64_t valid_from = after > TRACE_BUFFER_EVENTS ? after - TRACE_BUFFER_EVENTS : 0;
+    if (valid_from > first) {
+        uint64_t skip = valid_from - first;
+        if (skip >= head - first) {
+            return 0;
+        }
+        memmove(out, out + skip, (head - first - skip) * sizeof(TraceEvent));
+        first = valid_from;
+    }
+    
+    return (int)(head - first);
+}
+
+// Write buffered events as Chrome trace JSON
+int trace_dump(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        return -1;
+    }
+    
+    TraceEvent* events = malloc(TRACE_BUFFER_EVENTS * sizeof(TraceEvent));
+    if (events == NULL) {
+        fclose(file);
+        return -1;
+    }
+    
+    int total = 0;
+    int first_entry = 1;
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    
+    pthread_mutex_lock(&trace_mutex);
+    for (int b = 0; b < trace_buffer_count; b++) {
+        TraceBuffer* buffer = trace_buffers[b];
+        
+        if (buffer->thread_name[0] != '\0') {
+            fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                    "\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                    first_entry ? "" : ",\n", buffer->tid, buffer->thread_name);
+            first_entry = 0;
+        }
+        
+        int count = snapshot_buffer(buffer, events);
+        for (int i = 0; i < count; i++) {
+            fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,"
+                    "\"pid\":1,\"tid\":%d", first_entry ? "" : ",\n",
+                    events[i].name, events[i].phase,
+                    events[i].timestamp_ns / 1000.0, buffer->tid);
+            if (events[i].phase == 'i') {
+                fprintf(file, ",\"s\":\"t\",\"args\":{\"value\":%lld}", events[i].arg);
+            }
+            fprintf(file, "}");
+            first_entry = 0;
+        }
+        total += count;
+    }
+    pthread_mutex_unlock(&trace_mutex);
+    
+    fprintf(file, "\n]}\n");
+    free(events);
+    
+    if (fclose(file) != 0) {
+        return -1;
+    }
+    return total;
+}
+
+// Tracing compiled in
+int trace_enabled(void) {
+    return 1;
+}
+
+#else
+
+// Tracing compiled out: recording is a no-op and dumps are refused
+void trace_record(const char* name, char phase, long long arg) {
+    (void)name;
+    (void)phase;
+    (void)arg;
+}
+
+void trace_thread_name(const char* name) {
+    (void)name;
+}
+
+int trace_dump(const char* path) {
+    (void)path;
+    return -1;
+}
+
+int trace_enabled(void) {
+    return 0;
+}
+
+#endif // P2P_TRACE
@@ -0,0 +1,31 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "common.h"
+
+// Trace points compile to nothing unless built with -DP2P_TRACE (make TRACE=1)
+#ifdef P2P_TRACE
+    #define TRACE_BEGIN(name)        trace_record((name), 'B', 0)
+    #define TRACE_END(name)          trace_record((name), 'E', 0)
+    #define TRACE_INSTANT(name, arg) trace_record((name), 'i', (long long)(arg))
+    #define TRACE_THREAD(name)       trace_thread_name(name)
+#else
+    #define TRACE_BEGIN(name)        ((void)0)
+    #define TRACE_END(name)          ((void)0)
+    #define TRACE_INSTANT(name, arg) ((void)0)
+    #define TRACE_THREAD(name)       ((void)0)
+#endif
+
+#define TRACE_BUFFER_EVENTS 4096    // Per-thread ring size (power of two)
+#define TRACE_MAX_THREADS 256
+#define TRACE_THREAD_NAME_LENGTH 32
+
+// Event recording (name must be a string literal)
+void trace_record(const char* name, char phase, long long arg);
+void trace_thread_name(const char* name);
+
+// Write all buffered events as Chrome/Perfetto JSON, returns event count or -1
+int trace_dump(const char* path);
+int trace_enabled(void);
+
+#endif // TRACE_H
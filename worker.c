@@ -0,0 +1,340 @@
+#include "worker.h"
+#include "trace.h"
+
+// Synchronization lives as long as the process: receivers of a stopped node
+// may still reach the pool and must find it stopped, not destroyed
+WorkerPool frame_pool = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .work = PTHREAD_COND_INITIALIZER,
+    .space = PTHREAD_COND_INITIALIZER,
+    .idle = PTHREAD_COND_INITIALIZER
+};
+
+// Online CPUs, at least 1
+static int cpu_count(void) {
+    #ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    long count = (long)info.dwNumberOfProcessors;
+    #else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    #endif
+    return count > 0 ? (int)count : 1;
+}
+
+// Hash bucket of key
+static Strand** bucket(WorkerPool* pool, int key) {
+    return &pool->strands[(unsigned int)key % WORKER_STRAND_BUCKETS];
+}
+
+// Find strand of key (caller holds pool mutex)
+static Strand* find_strand(WorkerPool* pool, int key) {
+    for (Strand* strand = *bucket(pool, key); strand != NULL; strand = strand->next) {
+        if (strand->key == key) {
+            return strand;
+        }
+    }
+    return NULL;
+}
+
+// Find or create strand of key (caller holds pool mutex)
+static Strand* open_strand(WorkerPool* pool, int key) {
+    Strand* strand = find_strand(pool, key);
+    if (strand != NULL) {
+        return strand;
+    }
+    
+    strand = calloc(1, sizeof(Strand));
+    if (strand == NULL) {
+        return NULL;
+    }
+    strand->key = key;
+    strand->next = *bucket(pool, key);
+    *bucket(pool, key) = strand;
+    return strand;
+}
+
+// Unlink and free an empty, unscheduled strand (caller holds pool mutex)
+static void close_strand(WorkerPool* pool, Strand* strand) {
+    Strand** link = bucket(pool, strand->key);
+    while (*link != strand) {
+        link = &(*link)->next;
+    }
+    *link = strand->next;
+    free(strand);
+}
+
+// Append strand to a worker's ready queue (caller holds pool mutex)
+static void push_ready(WorkerPool* pool, Worker* worker, Strand* strand) {
+    strand->ready_next = NULL;
+    
+    pthread_mutex_lock(&worker->mutex);
+    if (worker->ready_tail != NULL) {
+        worker->ready_tail->ready_next = strand;
+    } else {
+        worker->ready_head = strand;
+    }
+    worker->ready_tail = strand;
+    pthread_mutex_unlock(&worker->mutex);
+    
+    pool->ready++;
+    pthread_cond_signal(&pool->work);
+}
+
+// Take the oldest ready strand of worker, NULL if none
+static Strand* pop_ready(Worker* worker) {
+    pthread_mutex_lock(&worker->mutex);
+    Strand* strand = worker->ready_head;
+    if (strand != NULL) {
+        worker->ready_head = strand->ready_next;
+        if (worker->ready_head == NULL) {
+            worker->ready_tail = NULL;
+        }
+    }
+    pthread_mutex_unlock(&worker->mutex);
+    return strand;
+}
+
+// Own queue first, then steal from the others
+static Strand* find_work(Worker* self) {
+    WorkerPool* pool = self->pool;
+    
+    Strand* strand = pop_ready(self);
+    for (int i = 1; strand == NULL && i < pool->thread_count; i++) {
+        strand = pop_ready(&pool->workers[(self->index + i) % pool->thread_count]);
+    }
+    return strand;
+}
+
+// Run up to WORKER_SLICE items of strand, then requeue it or let it go
+// (caller holds pool mutex, released while handling)
+static void run_strand(Worker* self, Strand* strand) {
+    WorkerPool* pool = self->pool;
+    
+    WorkItem* items = strand->head;
+    WorkItem* last = items;
+    int taken = 1;
+    while (taken < WORKER_SLICE && last->next != NULL) {
+        last = last->next;
+        taken++;
+    }
+    strand->head = last->next;
+    if (strand->head == NULL) {
+        strand->tail = NULL;
+    }
+    last->next = NULL;
+    strand->pending -= taken;
+    pthread_cond_broadcast(&pool->space);
+    pthread_mutex_unlock(&pool->mutex);
+    
+    while (items != NULL) {
+        WorkItem* next = items->next;
+        TRACE_BEGIN("process");
+        pool->handler(items, self->scratch);
+        TRACE_END("process");
+        free(items);
+        items = next;
+    }
+    
+    pthread_mutex_lock(&pool->mutex);
+    pool->outstanding -= taken;
+    if (strand->head != NULL) {
+        // Back of our own queue, so other connections get a turn
+        push_ready(pool, self, strand);
+    } else {
+        strand->scheduled = 0;
+        close_strand(pool, strand);
+        pthread_cond_broadcast(&pool->idle);
+    }
+}
+
+// Worker thread: run ready strands until the pool stops
+static void* worker_thread(void* arg) {
+    Worker* self = (Worker*)arg;
+    WorkerPool* pool = self->pool;
+    
+    TRACE_THREAD("worker");
+    
+    for (;;) {
+        Strand* strand = find_work(self);
+        
+        pthread_mutex_lock(&pool->mutex);
+        if (!pool->running) {
+            pthread_mutex_unlock(&pool->mutex);
+            break;
+        }
+        if (strand == NULL) {
+            // A strand another worker popped is still counted until it locks
+            if (pool->ready == 0) {
+                pthread_cond_wait(&pool->work, &pool->mutex);
+            }
+            pthread_mutex_unlock(&pool->mutex);
+            continue;
+        }
+        
+        pool->ready--;
+        run_strand(self, strand);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+    
+    return NULL;
+}
+
+// Start worker threads, returns 0 on success
+int worker_pool_start(WorkerPool* pool, int threads, int queue_limit,
+                      size_t scratch_size, work_fn handler) {
+    if (threads <= 0) {
+        threads = cpu_count();
+    }
+    if (threads > WORKER_MAX_THREADS) {
+        threads = WORKER_MAX_THREADS;
+    }
+    
+    Worker* workers = calloc(threads, sizeof(Worker));
+    if (workers == NULL) {
+        return -1;
+    }
+    
+    pthread_mutex_lock(&pool->mutex);
+    pool->workers = workers;
+    pool->thread_count = threads;
+    pool->queue_limit = queue_limit > 0 ? queue_limit : 1;
+    pool->handler = handler;
+    pool->ready = 0;
+    pool->outstanding = 0;
+    pool->running = 1;
+    pthread_mutex_unlock(&pool->mutex);
+    
+    // Every queue exists before any worker starts stealing
+    int failed = 0;
+    for (int i = 0; i < threads; i++) {
+        workers[i].pool = pool;
+        workers[i].index = i;
+        pthread_mutex_init(&workers[i].mutex, NULL);
+        workers[i].scratch = malloc(scratch_size);
+        failed |= workers[i].scratch == NULL;
+    }
+    if (failed) {
+        return -1;
+    }
+    
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&workers[i].thread, NULL, worker_thread, &workers[i]) != 0) {
+            return -1;
+        }
+        workers[i].started = 1;
+    }
+    return 0;
+}
+
+// Stop workers after their current slice, then free what is left
+void worker_pool_stop(WorkerPool* pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->running = 0;
+    pthread_cond_broadcast(&pool->work);
+    pthread_cond_broadcast(&pool->space);
+    pthread_cond_broadcast(&pool->idle);
+    pthread_mutex_unlock(&pool->mutex);
+    
+    for (int i = 0; i < pool->thread_count; i++) {
+        if (pool->workers[i].started) {
+            pthread_join(pool->workers[i].thread, NULL);
+        }
+    }
+    
+    pthread_mutex_lock(&pool->mutex);
+    for (int i = 0; i < WORKER_STRAND_BUCKETS; i++) {
+        while (pool->strands[i] != NULL) {
+            Strand* strand = pool->strands[i];
+            pool->strands[i] = strand->next;
+            while (strand->head != NULL) {
+                WorkItem* item = strand->head;
+                strand->head = item->next;
+                free(item);
+            }
+            free(strand);
+        }
+    }
+    for (int i = 0; i < pool->thread_count; i++) {
+        pthread_mutex_destroy(&pool->workers[i].mutex);
+        free(pool->workers[i].scratch);
+    }
+    free(pool->workers);
+    pool->workers = NULL;
+    pool->thread_count = 0;
+    pool->ready = 0;
+    pool->outstanding = 0;
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+// Queue a copy of a frame for key, waiting for room
+int worker_submit(WorkerPool* pool, int key, const char* ip, int port,
+                  const FrameHeader* header, const void* data) {
+    uint32_t length = header->length;
+    WorkItem* item = malloc(sizeof(WorkItem) + length);
+    if (item == NULL) {
+        return -1;
+    }
+    item->next = NULL;
+    item->key = key;
+    strcpy(item->ip, ip);
+    item->port = port;
+    item->header = *header;
+    if (length > 0) {
+        memcpy(item->data, data, length);
+    }
+    
+    pthread_mutex_lock(&pool->mutex);
+    
+    // Looked up again after each wait, a drained strand is freed
+    Strand* strand = NULL;
+    while (pool->running) {
+        strand = open_strand(pool, key);
+        if (strand == NULL || strand->pending < pool->queue_limit) {
+            break;
+        }
+        pthread_cond_wait(&pool->space, &pool->mutex);
+    }
+    
+    if (!pool->running || strand == NULL) {
+        pthread_mutex_unlock(&pool->mutex);
+        free(item);
+        return -1;
+    }
+    
+    if (strand->tail != NULL) {
+        strand->tail->next = item;
+    } else {
+        strand->head = item;
+    }
+    strand->tail = item;
+    strand->pending++;
+    pool->outstanding++;
+    
+    // Same worker for a key while it has no backlog, others steal under load
+    if (!strand->scheduled) {
+        strand->scheduled = 1;
+        push_ready(pool, &pool->workers[(unsigned int)key % pool->thread_count], strand);
+    }
+    
+    pthread_mutex_unlock(&pool->mutex);
+    return 0;
+}
+
+// Wait until key has no items queued or running
+void worker_wait_key(WorkerPool* pool, int key) {
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->running && find_strand(pool, key) != NULL) {
+        pthread_cond_wait(&pool->idle, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+// Wait until every submitted item has been handled
+void worker_pool_drain(WorkerPool* pool) {
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->running && pool->outstanding > 0) {
+        pthread_cond_wait(&pool->idle, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
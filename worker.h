@@ -0,0 +1,93 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include "common.h"
+#include "protocol.h"
+#include <stdint.h>
+#include <pthread.h>
+
+// Frame processing pool.
+// Receivers hand decoded frames to worker threads so processing runs off the
+// I/O threads. Frames of one connection form a strand that at most one worker
+// runs at a time, which keeps them in order; ready strands sit in per-worker
+// queues and idle workers steal from busy ones.
+
+#define WORKER_MAX_THREADS 64
+#define WORKER_STRAND_BUCKETS 256
+#define WORKER_SLICE 32             // Items run before a strand yields its worker
+
+// Received frame waiting for a worker
+typedef struct WorkItem {
+    struct WorkItem* next;
+    int key;                        // Connection ID
+    char ip[INET_ADDRSTRLEN];
+    int port;
+    FrameHeader header;             // length is the size of data
+    unsigned char data[];
+} WorkItem;
+
+// Pending items of one connection
+typedef struct Strand {
+    int key;
+    WorkItem* head;
+    WorkItem* tail;
+    int pending;                    // Items not yet taken by a worker
+    int scheduled;                  // Queued on a worker or running
+    struct Strand* next;            // Hash bucket chain
+    struct Strand* ready_next;      // Worker queue link
+} Strand;
+
+// Called on a worker thread for each item; scratch is private to the worker
+typedef void (*work_fn)(const WorkItem* item, void* scratch);
+
+struct WorkerPool;
+
+// Worker thread and its queue of ready strands
+typedef struct {
+    struct WorkerPool* pool;
+    int index;
+    pthread_t thread;
+    int started;
+    pthread_mutex_t mutex;          // Guards the ready queue
+    Strand* ready_head;
+    Strand* ready_tail;
+    void* scratch;
+} Worker;
+
+// Pool of workers (synchronization is static, see worker.c)
+typedef struct WorkerPool {
+    pthread_mutex_t mutex;          // Strands, items and counters
+    pthread_cond_t work;            // A strand became ready
+    pthread_cond_t space;           // Items taken from a strand
+    pthread_cond_t idle;            // A strand or the whole pool ran dry
+    int running;
+    Worker* workers;
+    int thread_count;
+    int queue_limit;                // Items a strand holds before submit waits
+    work_fn handler;
+    Strand* strands[WORKER_STRAND_BUCKETS];
+    int ready;                      // Strands waiting in worker queues
+    int outstanding;                // Items submitted and not yet handled
+} WorkerPool;
+
+// Pool delivering received frames of this node
+extern WorkerPool frame_pool;
+
+// Start threads workers (0 = one per CPU), returns 0 on success
+int worker_pool_start(WorkerPool* pool, int threads, int queue_limit,
+                      size_t scratch_size, work_fn handler);
+
+// Drop unprocessed items and join the workers
+void worker_pool_stop(WorkerPool* pool);
+
+// Queue a copy of a frame behind earlier ones with the same key.
+// Waits while the key has queue_limit items pending; -1 once stopped.
+int worker_submit(WorkerPool* pool, int key, const char* ip, int port,
+                  const FrameHeader* header, const void* data);
+
+// Wait until every item of key (or of the pool) has been handled.
+// Must not be called from a worker.
+void worker_wait_key(WorkerPool* pool, int key);
+void worker_pool_drain(WorkerPool* pool);
+
+#endif // WORKER_H